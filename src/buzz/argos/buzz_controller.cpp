@@ -429,7 +429,11 @@ CBuzzController::CBuzzController() :
    m_pcBattery(NULL),
    m_tBuzzVM(NULL),
    m_tBuzzDbgInfo(NULL),
-   m_pcRNG(NULL) {}
+   m_pcRNG(NULL),
+   m_unCompressThreshold(0),
+   m_ptBuzzFrag(NULL),
+   m_unFragTimeout(20),
+   m_unFragMaxBytes(65536) {}
 
 /****************************************/
 /****************************************/
@@ -462,6 +466,11 @@ void CBuzzController::Init(TConfigurationNode& t_node) {
       /* Get the script name */
       std::string strDbgFName;
       GetNodeAttributeOrDefault(t_node, "debug_file", strDbgFName, strDbgFName);
+      /* Get the minimum size of the messages to compress (0 = never) */
+      GetNodeAttributeOrDefault(t_node, "compress_threshold", m_unCompressThreshold, m_unCompressThreshold);
+      /* Get the fragmentation parameters */
+      GetNodeAttributeOrDefault(t_node, "fragment_timeout", m_unFragTimeout, m_unFragTimeout);
+      GetNodeAttributeOrDefault(t_node, "fragment_max_bytes", m_unFragMaxBytes, m_unFragMaxBytes);
       /* Initialize the rest */
       bool bIDSuccess = false;
       m_unRobotId = 0;
@@ -488,6 +497,8 @@ void CBuzzController::Init(TConfigurationNode& t_node) {
          SetBytecode(strBCFName, strDbgFName);
       else {
          m_tBuzzVM = buzzvm_new(m_unRobotId);
+         m_tBuzzVM->outmsgs->compress = m_unCompressThreshold;
+         ResetFragmentation();
          UpdateSensors();
       }
       /* Set initial robot message (id and then all zeros) */
@@ -578,6 +589,19 @@ void CBuzzController::Destroy() {
       buzzvm_destroy(&m_tBuzzVM);
       if(m_tBuzzDbgInfo) buzzdebug_destroy(&m_tBuzzDbgInfo);
    }
+   /* Get rid of the fragmentation layer */
+   if(m_ptBuzzFrag) buzzfrag_destroy(&m_ptBuzzFrag);
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzController::ResetFragmentation() {
+   if(m_ptBuzzFrag) buzzfrag_destroy(&m_ptBuzzFrag);
+   /* A frame must fit the data buffer along with the robot id and its size */
+   m_ptBuzzFrag = buzzfrag_new(m_pcRABA->GetSize() - 2 * sizeof(UInt16),
+                               m_unFragTimeout,
+                               m_unFragMaxBytes);
 }
 
 /****************************************/
@@ -588,6 +612,8 @@ void CBuzzController::SetBytecode(const std::string& str_bc_fname,
    /* Reset the BuzzVM */
    if(m_tBuzzVM) buzzvm_destroy(&m_tBuzzVM);
    m_tBuzzVM = buzzvm_new(m_unRobotId);
+   m_tBuzzVM->outmsgs->compress = m_unCompressThreshold;
+   ResetFragmentation();
    /* Get rid of debug info */
    if(m_tBuzzDbgInfo) buzzdebug_destroy(&m_tBuzzDbgInfo);
    m_tBuzzDbgInfo = buzzdebug_new();
@@ -756,20 +782,23 @@ buzzvm_state CBuzzController::RegisterFunctions() {
 /****************************************/
 
 void CBuzzController::ProcessInMsgs() {
-   /* Reset neighbor information */
-   buzzneighbors_reset(m_tBuzzVM);
+   /* Drop incomplete messages that timed out */
+   buzzfrag_update(m_ptBuzzFrag);
    /* Go through RAB messages and add them to the FIFO */
    const CCI_RangeAndBearingSensor::TReadings& tPackets = m_pcRABS->GetReadings();
+   m_vecNeighborIds.resize(tPackets.size());
+   m_vecNeighborDistance.resize(tPackets.size());
+   m_vecNeighborAzimuth.resize(tPackets.size());
+   m_vecNeighborElevation.resize(tPackets.size());
    for(size_t i = 0; i < tPackets.size(); ++i) {
       /* Copy packet into temporary buffer */
       CByteArray cData = tPackets[i].Data;
-      /* Get robot id and update neighbor information */
+      /* Get robot id and neighbor information */
       UInt16 unRobotId = cData.PopFront<UInt16>();
-      buzzneighbors_add(m_tBuzzVM,
-                        unRobotId,
-                        tPackets[i].Range,
-                        tPackets[i].HorizontalBearing.GetValue(),
-                        tPackets[i].VerticalBearing.GetValue());
+      m_vecNeighborIds[i] = unRobotId;
+      m_vecNeighborDistance[i] = tPackets[i].Range;
+      m_vecNeighborAzimuth[i] = tPackets[i].HorizontalBearing.GetValue();
+      m_vecNeighborElevation[i] = tPackets[i].VerticalBearing.GetValue();
       /* Go through the messages until there's nothing else to read */
       UInt16 unMsgSize;
       do {
@@ -777,15 +806,23 @@ void CBuzzController::ProcessInMsgs() {
          unMsgSize = cData.PopFront<UInt16>();
          /* Append message to the Buzz input message queue */
          if(unMsgSize > 0 && cData.Size() >= unMsgSize) {
-            buzzinmsg_queue_append(m_tBuzzVM,
-                                   unRobotId,
-                                   buzzmsg_payload_frombuffer(cData.ToCArray(), unMsgSize));
+            buzzfrag_in(m_ptBuzzFrag,
+                        m_tBuzzVM,
+                        unRobotId,
+                        buzzmsg_payload_frombuffer(cData.ToCArray(), unMsgSize));
             /* Get rid of the data read */
             for(size_t i = 0; i < unMsgSize; ++i) cData.PopFront<UInt8>();
          }
       }
       while(cData.Size() > sizeof(UInt16) && unMsgSize > 0);
    }
+   /* Replace the neighbor information */
+   buzzneighbors_set_all(m_tBuzzVM,
+                         tPackets.size(),
+                         m_vecNeighborIds.data(),
+                         m_vecNeighborDistance.data(),
+                         m_vecNeighborAzimuth.data(),
+                         m_vecNeighborElevation.data());
    /* Process messages */
    buzzvm_process_inmsgs(m_tBuzzVM);
 }
@@ -799,37 +836,23 @@ void CBuzzController::ProcessOutMsgs() {
    /* Send robot id */
    CByteArray cData;
    cData << m_tBuzzVM->robot;
-   /* Send messages from FIFO */
+   /* Send messages from FIFO, splitting the oversize ones into fragments */
    do {
-      /* Are there more messages? */
-      if(buzzoutmsg_queue_isempty(m_tBuzzVM)) break;
-      /* Get first message */
-      buzzmsg_payload_t m = buzzoutmsg_queue_first(m_tBuzzVM);
-      /* Make sure the message is smaller than the data buffer
-       * Without this check, large messages would clog the queue forever
-       */
+      /* Get next frame */
+      buzzmsg_payload_t m = buzzfrag_out_first(m_ptBuzzFrag, m_tBuzzVM);
+      if(!m) break;
+      /* Make sure the next frame fits the data buffer */
       size_t unMsgSize = buzzmsg_payload_size(m) + sizeof(UInt16);
-      if(unMsgSize < m_pcRABA->GetSize() - sizeof(UInt16)) {
-         /* Make sure the next message fits the data buffer */
-         if(cData.Size() + unMsgSize > m_pcRABA->GetSize()) {
-            buzzmsg_payload_destroy(&m);
-            break;
-         }
-         /* Add message length to data buffer */
-         cData << static_cast<UInt16>(buzzmsg_payload_size(m));
-         /* Add payload to data buffer */
-         cData.AddBuffer(reinterpret_cast<UInt8*>(m->data), buzzmsg_payload_size(m));
+      if(cData.Size() + unMsgSize > m_pcRABA->GetSize()) {
+         buzzmsg_payload_destroy(&m);
+         break;
       }
-      else {
-         RLOGERR << "Discarded oversize message ("
-                 << unMsgSize
-                 << " bytes). Max size is "
-                 << m_pcRABA->GetSize() - sizeof(UInt16)
-                 << " bytes."
-                 << std::endl;
-      }
-      /* Get rid of message */
-      buzzoutmsg_queue_next(m_tBuzzVM);
+      /* Add frame length to data buffer */
+      cData << static_cast<UInt16>(buzzmsg_payload_size(m));
+      /* Add payload to data buffer */
+      cData.AddBuffer(reinterpret_cast<UInt8*>(m->data), buzzmsg_payload_size(m));
+      /* Get rid of frame */
+      buzzfrag_out_next(m_ptBuzzFrag, m_tBuzzVM);
       buzzmsg_payload_destroy(&m);
    } while(1);
    /* Pad the rest of the data with zeroes */
@@ -856,7 +879,11 @@ void CBuzzController::ProcessOutMsgs() {
    /* Set debug.msgqueue.vstig */
    TablePut(tMsgQueue,
             "vstig",
-            static_cast<SInt32>(buzzdarray_size(m_tBuzzVM->outmsgs->queues[BUZZMSG_VSTIG_PUT])) + static_cast<SInt32>(buzzdarray_size(m_tBuzzVM->outmsgs->queues[BUZZMSG_VSTIG_QUERY])));
+            static_cast<SInt32>(buzzoutmsg_queue_vstig_size(m_tBuzzVM)));
+   /* Set debug.msgqueue.fragments */
+   TablePut(tMsgQueue,
+            "fragments",
+            static_cast<SInt32>(buzzfrag_out_size(m_ptBuzzFrag)));
    /* Set debug.msgqueue.swarm */
    TablePut(tMsgQueue,
             "swarm",
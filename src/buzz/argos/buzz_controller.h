@@ -13,8 +13,10 @@
 #include <argos3/core/utility/math/rng.h>
 #include <buzz/buzzvm.h>
 #include <buzz/buzzdebug.h>
+#include <buzz/buzzfrag.h>
 #include <string>
 #include <list>
+#include <vector>
 
 using namespace argos;
 
@@ -207,6 +209,7 @@ protected:
    virtual void ProcessOutMsgs();
 
    virtual void UpdateSensors();
+   void ResetFragmentation();
 
 protected:
 
@@ -235,6 +238,19 @@ protected:
    SDebug m_sDebug;
    /* The random number generator */
    CRandom::CRNG* m_pcRNG;
+   /* Minimum size of the messages to compress (0 = never) */
+   UInt32 m_unCompressThreshold;
+   /* Fragmentation layer between the message queues and the radio */
+   buzzfrag_t m_ptBuzzFrag;
+   /* Steps after which an incomplete message is dropped */
+   UInt32 m_unFragTimeout;
+   /* Maximum bytes buffered per sender for incomplete messages */
+   UInt32 m_unFragMaxBytes;
+   /* Neighbor data gathered at each step, passed to the VM at once */
+   std::vector<UInt16> m_vecNeighborIds;
+   std::vector<float> m_vecNeighborDistance;
+   std::vector<float> m_vecNeighborAzimuth;
+   std::vector<float> m_vecNeighborElevation;
 
 public:
    
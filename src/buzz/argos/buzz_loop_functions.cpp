@@ -223,7 +223,18 @@ void BuzzTableCloseNested(buzzvm_t t_vm) {
 /****************************************/
 /****************************************/
 
+CBuzzLoopFunctions::~CBuzzLoopFunctions() {
+   delete m_pcThreadPool;
+}
+
+/****************************************/
+/****************************************/
+
 void CBuzzLoopFunctions::Init(TConfigurationNode& t_tree) {
+   UInt32 unThreads = 0;
+   GetNodeAttributeOrDefault(t_tree, "threads", unThreads, unThreads);
+   delete m_pcThreadPool;
+   m_pcThreadPool = new CBuzzThreadPool(unThreads);
    BuzzRegisterVMs();
 }
 
@@ -263,6 +274,22 @@ void CBuzzLoopFunctions::BuzzForeachVM(
 /****************************************/
 /****************************************/
 
+void CBuzzLoopFunctions::BuzzForeachVMParallel(
+   std::function<void(const std::string& str_robot_id,
+                      buzzvm_t)> c_function) {
+   /* Subclasses might not call Init() */
+   if(!m_pcThreadPool) m_pcThreadPool = new CBuzzThreadPool;
+   m_pcThreadPool->ParallelFor(
+      m_vecBuzzVMs.size(),
+      [this, &c_function](size_t un_idx) {
+         c_function(m_vecBuzzVMs[un_idx].first,
+                    m_vecBuzzVMs[un_idx].second->GetBuzzVM());
+      });
+}
+
+/****************************************/
+/****************************************/
+
 void CBuzzLoopFunctions::BuzzRegisterVMs() {
    /* Start with an empty VM map to handle removals since the last call */
    /* Additions are handled implicitly in the for loop that follows */
@@ -281,6 +308,7 @@ void CBuzzLoopFunctions::BuzzRegisterVMs() {
          m_mapBuzzVMs[pcControllable->GetRootEntity().GetId()] = pcBuzzController;
       }
    }
+   m_vecBuzzVMs.assign(m_mapBuzzVMs.begin(), m_mapBuzzVMs.end());
 }
 
 /****************************************/
@@ -3,9 +3,11 @@
 
 #include <argos3/core/simulator/loop_functions.h>
 #include <buzz/buzzvm.h>
+#include "buzz_thread_pool.h"
 
 #include <functional>
 #include <map>
+#include <vector>
 
 using namespace argos;
 
@@ -270,10 +272,16 @@ class CBuzzLoopFunctions : public CLoopFunctions {
 
 public:
 
-   CBuzzLoopFunctions() {}
+   CBuzzLoopFunctions() :
+      m_pcThreadPool(NULL) {}
 
-   virtual ~CBuzzLoopFunctions() {}
+   virtual ~CBuzzLoopFunctions();
 
+   /**
+    * Initializes the loop functions.
+    * The optional attribute 'threads' sets the number of threads used by
+    * BuzzForeachVMParallel() (default: 0, one per hardware thread).
+    */
    virtual void Init(TConfigurationNode& t_tree);
 
 public:
@@ -306,6 +314,20 @@ public:
     */
    void BuzzForeachVM(COperation& c_operation);
 
+   /**
+    * Loops through all the VMs and executes the given function in parallel.
+    *
+    * The function is called from several threads at once, each time with a
+    * different VM. It can do anything with the VM it receives, but it must
+    * not touch the other VMs, and it must protect any other shared state
+    * (e.g., with a std::mutex, or by writing each result to a slot reserved
+    * to its robot). The calls are done when this method returns.
+    *
+    * If the function throws an exception, the first exception is rethrown
+    * once all the calls are done.
+    */
+   void BuzzForeachVMParallel(std::function<void(const std::string&, buzzvm_t)> c_function);
+
    /**
     * Registers the BuzzVMs, so the BuzzForeachVM methods can do their work.
     * @see BuzzForeachVM
@@ -320,6 +342,12 @@ public:
 protected:
 
    std::map<std::string, CBuzzController*> m_mapBuzzVMs;
+
+   /* The contents of m_mapBuzzVMs, indexed for the thread pool */
+   std::vector<std::pair<std::string, CBuzzController*> > m_vecBuzzVMs;
+
+   /* The thread pool used by BuzzForeachVMParallel() */
+   CBuzzThreadPool* m_pcThreadPool;
 };
 
 /****************************************/
@@ -0,0 +1,151 @@
+#include "buzz_thread_pool.h"
+#include <algorithm>
+
+/****************************************/
+/****************************************/
+
+/* Number of chunks dealt to each worker, to leave room for stealing */
+static const size_t CHUNKS_PER_WORKER = 8;
+
+/****************************************/
+/****************************************/
+
+CBuzzThreadPool::CBuzzThreadPool(size_t un_threads) :
+   m_pcTask(NULL),
+   m_unJob(0),
+   m_unBusy(0),
+   m_bQuit(false) {
+   if(un_threads == 0) un_threads = std::thread::hardware_concurrency();
+   if(un_threads == 0) un_threads = 1;
+   for(size_t i = 0; i < un_threads; ++i)
+      m_vecQueues.push_back(new SQueue);
+   for(size_t i = 1; i < un_threads; ++i)
+      m_vecThreads.push_back(std::thread(&CBuzzThreadPool::Worker, this, i));
+}
+
+/****************************************/
+/****************************************/
+
+CBuzzThreadPool::~CBuzzThreadPool() {
+   {
+      std::lock_guard<std::mutex> cLock(m_cMutex);
+      m_bQuit = true;
+   }
+   m_cWakeUp.notify_all();
+   for(size_t i = 0; i < m_vecThreads.size(); ++i)
+      m_vecThreads[i].join();
+   for(size_t i = 0; i < m_vecQueues.size(); ++i)
+      delete m_vecQueues[i];
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzThreadPool::ParallelFor(size_t un_count,
+                                  const std::function<void(size_t)>& c_task) {
+   if(un_count == 0) return;
+   /* Not worth waking up the other threads */
+   if(m_vecQueues.size() == 1 || un_count == 1) {
+      for(size_t i = 0; i < un_count; ++i) c_task(i);
+      return;
+   }
+   /* Deal the chunks to the workers */
+   size_t unChunks = m_vecQueues.size() * CHUNKS_PER_WORKER;
+   size_t unChunkSize = (un_count + unChunks - 1) / unChunks;
+   size_t unWorker = 0;
+   for(size_t i = 0; i < un_count; i += unChunkSize) {
+      std::lock_guard<std::mutex> cLock(m_vecQueues[unWorker]->Mutex);
+      m_vecQueues[unWorker]->Ranges.push_back(
+         TRange(i, std::min(i + unChunkSize, un_count)));
+      unWorker = (unWorker + 1) % m_vecQueues.size();
+   }
+   /* Start the job */
+   {
+      std::lock_guard<std::mutex> cLock(m_cMutex);
+      m_pcTask = &c_task;
+      m_pcException = NULL;
+      m_unBusy = m_vecThreads.size();
+      ++m_unJob;
+   }
+   m_cWakeUp.notify_all();
+   /* Take part in the work */
+   Work(0);
+   /* Wait for the other workers to finish */
+   std::unique_lock<std::mutex> cLock(m_cMutex);
+   m_cDone.wait(cLock, [this] { return m_unBusy == 0; });
+   m_pcTask = NULL;
+   if(m_pcException) std::rethrow_exception(m_pcException);
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzThreadPool::Worker(size_t un_id) {
+   size_t unLastJob = 0;
+   while(true) {
+      /* Wait for a new job */
+      {
+         std::unique_lock<std::mutex> cLock(m_cMutex);
+         m_cWakeUp.wait(cLock, [this, unLastJob] { return m_bQuit || m_unJob != unLastJob; });
+         if(m_bQuit) return;
+         unLastJob = m_unJob;
+      }
+      /* Do the job */
+      Work(un_id);
+      /* Tell the calling thread we're done */
+      {
+         std::lock_guard<std::mutex> cLock(m_cMutex);
+         --m_unBusy;
+      }
+      m_cDone.notify_one();
+   }
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzThreadPool::Work(size_t un_id) {
+   TRange tRange;
+   while(NextRange(un_id, tRange)) {
+      for(size_t i = tRange.first; i < tRange.second; ++i) {
+         try {
+            (*m_pcTask)(i);
+         }
+         catch(...) {
+            std::lock_guard<std::mutex> cLock(m_cMutex);
+            if(!m_pcException) m_pcException = std::current_exception();
+         }
+      }
+   }
+}
+
+/****************************************/
+/****************************************/
+
+bool CBuzzThreadPool::NextRange(size_t un_id,
+                                TRange& t_range) {
+   /* Try with the worker's own queue first */
+   {
+      SQueue& sQueue = *m_vecQueues[un_id];
+      std::lock_guard<std::mutex> cLock(sQueue.Mutex);
+      if(!sQueue.Ranges.empty()) {
+         t_range = sQueue.Ranges.front();
+         sQueue.Ranges.pop_front();
+         return true;
+      }
+   }
+   /* Steal from the other queues */
+   for(size_t i = 1; i < m_vecQueues.size(); ++i) {
+      SQueue& sQueue = *m_vecQueues[(un_id + i) % m_vecQueues.size()];
+      std::lock_guard<std::mutex> cLock(sQueue.Mutex);
+      if(!sQueue.Ranges.empty()) {
+         t_range = sQueue.Ranges.back();
+         sQueue.Ranges.pop_back();
+         return true;
+      }
+   }
+   return false;
+}
+
+/****************************************/
+/****************************************/
@@ -0,0 +1,111 @@
+#ifndef BUZZ_THREAD_POOL_H
+#define BUZZ_THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/****************************************/
+/****************************************/
+
+/**
+ * A work-stealing thread pool to run independent tasks in parallel.
+ *
+ * ParallelFor() splits a range of indices into chunks and deals them to
+ * the workers. Each worker takes chunks from the front of its own queue,
+ * and when the queue is empty it steals chunks from the back of the
+ * queues of the other workers. This keeps all the workers busy when the
+ * tasks take uneven time, such as Buzz VMs running different branches of
+ * a script.
+ *
+ * The calling thread takes part in the work, so a pool with N threads
+ * starts N-1 background threads.
+ */
+class CBuzzThreadPool {
+
+public:
+
+   /**
+    * Class constructor.
+    * @param un_threads The number of threads (0 = one per hardware thread).
+    */
+   CBuzzThreadPool(size_t un_threads = 0);
+
+   /**
+    * Class destructor.
+    * Waits for the background threads to terminate.
+    */
+   ~CBuzzThreadPool();
+
+   /**
+    * Executes c_task(i) for each i in [0,un_count), in parallel.
+    * Returns when all the tasks are done. If a task throws an exception,
+    * the first exception is rethrown once all the tasks are done.
+    * This method must not be called from within a task.
+    * @param un_count The number of tasks.
+    * @param c_task The task.
+    */
+   void ParallelFor(size_t un_count,
+                    const std::function<void(size_t)>& c_task);
+
+   /**
+    * Returns the number of threads, including the calling thread.
+    */
+   inline size_t GetNumThreads() const {
+      return m_vecQueues.size();
+   }
+
+private:
+
+   /** A range of task indices, as [begin,end) */
+   typedef std::pair<size_t, size_t> TRange;
+
+   /** The queue of a worker */
+   struct SQueue {
+      std::mutex Mutex;
+      std::deque<TRange> Ranges;
+   };
+
+   /** Main loop of a background thread */
+   void Worker(size_t un_id);
+
+   /** Executes chunks until none is left; returns when all the queues are empty */
+   void Work(size_t un_id);
+
+   /** Gets the next chunk for the given worker, possibly stealing it */
+   bool NextRange(size_t un_id,
+                  TRange& t_range);
+
+private:
+
+   /** The background threads */
+   std::vector<std::thread> m_vecThreads;
+   /** One queue per worker; worker 0 is the calling thread */
+   std::vector<SQueue*> m_vecQueues;
+   /** Protects the fields below */
+   std::mutex m_cMutex;
+   /** Signals a new job or termination to the background threads */
+   std::condition_variable m_cWakeUp;
+   /** Signals the end of a job to the calling thread */
+   std::condition_variable m_cDone;
+   /** The current task */
+   const std::function<void(size_t)>* m_pcTask;
+   /** Incremented at every new job */
+   size_t m_unJob;
+   /** Number of background threads still working on the current job */
+   size_t m_unBusy;
+   /** Set to terminate the background threads */
+   bool m_bQuit;
+   /** The first exception thrown by the current job */
+   std::exception_ptr m_pcException;
+};
+
+/****************************************/
+/****************************************/
+
+#endif
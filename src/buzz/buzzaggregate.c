@@ -0,0 +1,470 @@
+#include "buzzaggregate.h"
+#include "buzzvm.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/****************************************/
+/****************************************/
+
+#define function_register(FNAME, FPOINTER)                      \
+   buzzvm_dup(vm);                                              \
+   buzzvm_pushs(vm, buzzvm_string_register(vm, (FNAME), 1));    \
+   buzzvm_pushcc(vm, buzzvm_function_register(vm, (FPOINTER))); \
+   buzzvm_tput(vm);
+
+#define id_get()                                          \
+   buzzvm_lload(vm, 0);                                   \
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "id", 1)); \
+   buzzvm_tget(vm);                                       \
+   uint16_t id = buzzvm_stack_at(vm, 1)->i.value;
+
+/*
+ * Names of the operations, as given to aggregate.create().
+ */
+static const char* AGGREGATE_OPS[BUZZAGGREGATE_OP_COUNT] = {
+   "avg", "sum", "count", "min", "max"
+};
+
+/*
+ * Whether an operation uses push-sum, and how many extrema it keeps.
+ */
+#define aggregate_pushsum(op) ((op) == BUZZAGGREGATE_AVG || (op) == BUZZAGGREGATE_SUM)
+#define aggregate_nextrema(op)                                          \
+   ((op) == BUZZAGGREGATE_SUM || (op) == BUZZAGGREGATE_COUNT ? BUZZAGGREGATE_SLOTS : \
+    (op) == BUZZAGGREGATE_MIN || (op) == BUZZAGGREGATE_MAX ? 1 : 0)
+
+/*
+ * Size of the message of an operation.
+ */
+#define aggregate_msgsize(op) \
+   (4 + (aggregate_pushsum(op) ? 10 : 0) + aggregate_nextrema(op) * 5)
+
+/****************************************/
+/****************************************/
+
+static void aggregate_destroy(const void* key, void* data, void* params) {
+   buzzaggregate_t a = *(buzzaggregate_t*)data;
+   free(a->extrema);
+   free(a->own);
+   buzzdict_destroy(&a->peers);
+   free(a);
+   free((void*)key);
+   free(data);
+}
+
+/*
+ * Makes a new aggregate.
+ * The random values used to count the robots depend on the robot and the
+ * aggregate ids, so they are the same every time the aggregate is made.
+ */
+static buzzaggregate_t aggregate_new(uint8_t op, uint16_t robot, uint16_t id) {
+   buzzaggregate_t a = (buzzaggregate_t)calloc(1, sizeof(struct buzzaggregate_s));
+   a->op = op;
+   uint32_t i, n = aggregate_nextrema(op);
+   a->extrema = (struct buzzaggregate_extremum_s*)malloc((n ? n : 1) * sizeof(struct buzzaggregate_extremum_s));
+   for(i = 0; i < n; ++i) {
+      a->extrema[i].value = INFINITY;
+      a->extrema[i].age = 0;
+      a->extrema[i].own = 1;
+   }
+   if(op == BUZZAGGREGATE_SUM || op == BUZZAGGREGATE_COUNT) {
+      /* Exponentially distributed values, from a xorshift generator */
+      a->own = (float*)malloc(BUZZAGGREGATE_SLOTS * sizeof(float));
+      uint32_t x = ((uint32_t)robot << 16 | id) * 2654435761u + 1;
+      for(i = 0; i < BUZZAGGREGATE_SLOTS; ++i) {
+         x ^= x << 13;
+         x ^= x >> 17;
+         x ^= x << 5;
+         a->own[i] = -logf(((x >> 8) + 1) / 16777216.0f);
+      }
+   }
+   a->peers = buzzdict_new(10,
+                           sizeof(uint16_t),
+                           sizeof(uint16_t),
+                           buzzdict_uint16keyhash,
+                           buzzdict_uint16keycmp,
+                           NULL);
+   return a;
+}
+
+/****************************************/
+/****************************************/
+
+buzzaggregates_t buzzaggregates_new() {
+   buzzaggregates_t as = (buzzaggregates_t)malloc(sizeof(struct buzzaggregates_s));
+   as->table = buzzdict_new(10,
+                            sizeof(uint16_t),
+                            sizeof(buzzaggregate_t),
+                            buzzdict_uint16keyhash,
+                            buzzdict_uint16keycmp,
+                            aggregate_destroy);
+   as->order = buzzdarray_new(10, sizeof(uint16_t), NULL);
+   as->next = 0;
+   as->budget = BUZZAGGREGATE_BUDGET;
+   as->tokens = 0;
+   as->sent = 0;
+   return as;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzaggregates_destroy(buzzaggregates_t* as) {
+   buzzdict_destroy(&(*as)->table);
+   buzzdarray_destroy(&(*as)->order);
+   free(*as);
+   *as = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzaggregate_budget(buzzvm_t vm,
+                          uint32_t bytes) {
+   vm->aggregates->budget = bytes;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Makes the value of this robot the extremum.
+ */
+static void aggregate_extremum_reset(buzzaggregate_extremum_t e, float value) {
+   e->value = value;
+   e->age = 0;
+   e->own = 1;
+}
+
+/*
+ * Merges an extremum sent by a neighbor.
+ */
+static void aggregate_extremum_merge(buzzaggregate_extremum_t e, float value, uint8_t age) {
+   if(age >= BUZZAGGREGATE_MAXAGE || isinf(value)) return;
+   /* Take smaller values, and fresher news of the same value */
+   if(value < e->value ||
+      (value == e->value && !e->own && age + 1 < e->age)) {
+      e->value = value;
+      e->age = age + 1;
+      e->own = 0;
+   }
+}
+
+/*
+ * Sets the values of this robot in the extrema, INFINITY to withdraw.
+ */
+static void aggregate_extrema_set(buzzaggregate_t a, float value) {
+   uint32_t i, n = aggregate_nextrema(a->op);
+   for(i = 0; i < n; ++i) {
+      float v = value;
+      if(a->own && !isinf(value)) v = a->own[i];
+      if(a->extrema[i].own || v <= a->extrema[i].value)
+         aggregate_extremum_reset(a->extrema + i, v);
+   }
+}
+
+/****************************************/
+/****************************************/
+
+struct aggregate_age_s {
+   buzzdarray_t gone;
+};
+
+static void aggregate_peer_age(const void* key, void* data, void* params) {
+   uint16_t* age = (uint16_t*)data;
+   if(++(*age) > BUZZAGGREGATE_MAXAGE)
+      buzzdarray_push(((struct aggregate_age_s*)params)->gone, (void*)key);
+}
+
+/*
+ * Ages the extrema and the peers of an aggregate.
+ */
+static void aggregate_age(buzzaggregate_t a) {
+   uint32_t i, n = aggregate_nextrema(a->op);
+   for(i = 0; i < n; ++i) {
+      buzzaggregate_extremum_t e = a->extrema + i;
+      if(e->own) continue;
+      if(e->age < UINT8_MAX) ++e->age;
+      if(e->age > BUZZAGGREGATE_MAXAGE) {
+         /* The robot with the value is gone or changed its value */
+         float v = INFINITY;
+         if(a->contributing)
+            v = a->own ? a->own[i] : (a->op == BUZZAGGREGATE_MAX ? -a->value : a->value);
+         aggregate_extremum_reset(e, v);
+      }
+   }
+   struct aggregate_age_s p;
+   p.gone = buzzdarray_new(1, sizeof(uint16_t), NULL);
+   buzzdict_foreach(a->peers, aggregate_peer_age, &p);
+   for(i = 0; i < buzzdarray_size(p.gone); ++i)
+      buzzdict_remove(a->peers, &buzzdarray_get(p.gone, i, uint16_t));
+   buzzdarray_destroy(&p.gone);
+}
+
+/****************************************/
+/****************************************/
+
+struct aggregate_pick_s {
+   uint16_t n;
+   uint16_t robot;
+};
+
+static void aggregate_peer_pick(const void* key, void* data, void* params) {
+   struct aggregate_pick_s* p = (struct aggregate_pick_s*)params;
+   if(p->n-- == 0) p->robot = *(uint16_t*)key;
+}
+
+/*
+ * Makes the message of an aggregate. Half of the push-sum mass goes to
+ * one of the peers, in turn.
+ */
+static buzzmsg_payload_t aggregate_serialize(buzzvm_t vm,
+                                             uint16_t id,
+                                             buzzaggregate_t a) {
+   buzzmsg_payload_t m = buzzmsg_payload_new(aggregate_msgsize(a->op));
+   buzzmsg_serialize_u8(m, BUZZMSG_AGGREGATE);
+   buzzmsg_serialize_u16(m, id);
+   buzzmsg_serialize_u8(m, a->op);
+   if(aggregate_pushsum(a->op)) {
+      /* No peer yet: announce this robot, with no mass */
+      struct aggregate_pick_s p = { 0, vm->robot };
+      float s = 0, w = 0;
+      if(!buzzdict_isempty(a->peers)) {
+         p.n = a->cursor++ % buzzdict_size(a->peers);
+         buzzdict_foreach(a->peers, aggregate_peer_pick, &p);
+         a->s /= 2;
+         a->w /= 2;
+         s = a->s;
+         w = a->w;
+      }
+      buzzmsg_serialize_u16(m, p.robot);
+      buzzmsg_serialize_float(m, s);
+      buzzmsg_serialize_float(m, w);
+   }
+   uint32_t i, n = aggregate_nextrema(a->op);
+   for(i = 0; i < n; ++i) {
+      buzzmsg_serialize_float(m, a->extrema[i].value);
+      buzzmsg_serialize_u8(m, a->extrema[i].age);
+   }
+   return m;
+}
+
+void buzzaggregate_update(buzzvm_t vm) {
+   buzzaggregates_t as = vm->aggregates;
+   uint32_t n = buzzdarray_size(as->order);
+   if(n == 0) return;
+   /* Age the values and the peers */
+   uint32_t i;
+   for(i = 0; i < n; ++i) {
+      uint16_t id = buzzdarray_get(as->order, i, uint16_t);
+      aggregate_age(*buzzdict_get(as->table, &id, buzzaggregate_t));
+   }
+   /* Refill the budget, keeping enough for the largest message */
+   as->tokens += as->budget;
+   if(as->tokens > as->budget + aggregate_msgsize(BUZZAGGREGATE_SUM))
+      as->tokens = as->budget + aggregate_msgsize(BUZZAGGREGATE_SUM);
+   /* The aggregates take turns, each sends at most once */
+   for(i = 0; i < n; ++i) {
+      uint16_t id = buzzdarray_get(as->order, as->next % n, uint16_t);
+      buzzaggregate_t a = *buzzdict_get(as->table, &id, buzzaggregate_t);
+      /* Wait for the last message to go, or the push-sum mass in it
+       * would be counted twice */
+      if(!buzzoutmsg_queue_aggregate_pending(vm, id)) {
+         if(as->tokens < aggregate_msgsize(a->op)) break;
+         as->tokens -= aggregate_msgsize(a->op);
+         buzzoutmsg_queue_append_aggregate(vm, aggregate_serialize(vm, id, a));
+         ++as->sent;
+      }
+      as->next = (as->next + 1) % n;
+   }
+}
+
+/****************************************/
+/****************************************/
+
+int buzzaggregate_receive(buzzvm_t vm,
+                          uint16_t rid,
+                          buzzmsg_payload_t msg) {
+   /* Deserialize the id and the operation */
+   uint16_t id;
+   uint8_t op;
+   int64_t pos = buzzmsg_deserialize_u16(&id, msg, 1);
+   if(pos >= 0) pos = buzzmsg_deserialize_u8(&op, msg, pos);
+   if(pos < 0) return -1;
+   /* Look for the aggregate */
+   const buzzaggregate_t* pa = buzzdict_get(vm->aggregates->table, &id, buzzaggregate_t);
+   if(!pa || (*pa)->op != op) return 0;
+   buzzaggregate_t a = *pa;
+   /* The sender takes part */
+   uint16_t age = 0;
+   buzzdict_set(a->peers, &rid, &age);
+   /* Take the push-sum mass sent to this robot */
+   if(aggregate_pushsum(op)) {
+      uint16_t target;
+      float s, w;
+      pos = buzzmsg_deserialize_u16(&target, msg, pos);
+      if(pos >= 0) pos = buzzmsg_deserialize_float(&s, msg, pos);
+      if(pos >= 0) pos = buzzmsg_deserialize_float(&w, msg, pos);
+      if(pos < 0) return -1;
+      if(target == vm->robot) {
+         a->s += s;
+         a->w += w;
+      }
+   }
+   /* Merge the extrema */
+   uint32_t i, n = aggregate_nextrema(op);
+   for(i = 0; i < n; ++i) {
+      float v;
+      uint8_t va;
+      pos = buzzmsg_deserialize_float(&v, msg, pos);
+      if(pos >= 0) pos = buzzmsg_deserialize_u8(&va, msg, pos);
+      if(pos < 0) return -1;
+      aggregate_extremum_merge(a->extrema + i, v, va);
+   }
+   return 0;
+}
+
+/****************************************/
+/****************************************/
+
+int buzzaggregate_value(buzzaggregate_t a,
+                        float* value) {
+   float avg = 0, count = 0;
+   if(aggregate_pushsum(a->op)) {
+      if(a->w <= 0) return 0;
+      avg = a->s / a->w;
+   }
+   if(a->op == BUZZAGGREGATE_SUM || a->op == BUZZAGGREGATE_COUNT) {
+      /* The smallest of N exponential values is exponential with rate N */
+      uint32_t i;
+      float t = 0;
+      for(i = 0; i < BUZZAGGREGATE_SLOTS; ++i) {
+         if(isinf(a->extrema[i].value)) return 0;
+         t += a->extrema[i].value;
+      }
+      count = (BUZZAGGREGATE_SLOTS - 1) / t;
+   }
+   switch(a->op) {
+      case BUZZAGGREGATE_AVG:   *value = avg;         return 1;
+      case BUZZAGGREGATE_SUM:   *value = avg * count; return 1;
+      case BUZZAGGREGATE_COUNT: *value = count;       return 1;
+      case BUZZAGGREGATE_MIN:
+         if(isinf(a->extrema[0].value)) return 0;
+         *value = a->extrema[0].value;
+         return 1;
+      case BUZZAGGREGATE_MAX:
+         if(isinf(a->extrema[0].value)) return 0;
+         *value = -a->extrema[0].value;
+         return 1;
+   }
+   return 0;
+}
+
+/****************************************/
+/****************************************/
+
+int buzzaggregate_register(buzzvm_t vm) {
+   /* Add 'aggregate' table */
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "aggregate", 1));
+   buzzvm_pusht(vm);
+   function_register("create", buzzaggregate_create);
+   buzzvm_gstore(vm);
+   return vm->state;
+}
+
+/****************************************/
+/****************************************/
+
+int buzzaggregate_create(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 2);
+   /* Get the id and the operation */
+   buzzvm_lload(vm, 1);
+   buzzvm_lload(vm, 2);
+   buzzvm_type_assert(vm, 2, BUZZTYPE_INT);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_STRING);
+   uint16_t id = buzzvm_stack_at(vm, 2)->i.value;
+   const char* name = buzzvm_stack_at(vm, 1)->s.value.str;
+   buzzvm_pop(vm);
+   buzzvm_pop(vm);
+   uint8_t op = 0;
+   while(op < BUZZAGGREGATE_OP_COUNT && strcmp(name, AGGREGATE_OPS[op]) != 0) ++op;
+   if(op == BUZZAGGREGATE_OP_COUNT) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_TYPE,
+                      "aggregate.create(): unknown operation '%s'",
+                      name);
+      return vm->state;
+   }
+   /* Keep the aggregate with the same id and operation, replace any other */
+   const buzzaggregate_t* pa = buzzdict_get(vm->aggregates->table, &id, buzzaggregate_t);
+   if(!pa || (*pa)->op != op) {
+      if(!pa) buzzdarray_push(vm->aggregates->order, &id);
+      buzzaggregate_t a = aggregate_new(op, vm->robot, id);
+      buzzdict_set(vm->aggregates->table, &id, &a);
+   }
+   /* Create a table */
+   buzzvm_pusht(vm);
+   buzzvm_dup(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "id", 1));
+   buzzvm_pushi(vm, id);
+   buzzvm_tput(vm);
+   function_register("contribute", buzzaggregate_contribute);
+   function_register("value",      buzzaggregate_get);
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzaggregate_contribute(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 1);
+   /* Get the value */
+   buzzvm_lload(vm, 1);
+   buzzobj_t o = buzzvm_stack_at(vm, 1);
+   if(o->o.type != BUZZTYPE_NIL) buzzvm_type_assert_number(vm, 1);
+   buzzvm_pop(vm);
+   /* Get the aggregate */
+   id_get();
+   const buzzaggregate_t* pa = buzzdict_get(vm->aggregates->table, &id, buzzaggregate_t);
+   if(!pa) return buzzvm_ret0(vm);
+   buzzaggregate_t a = *pa;
+   if(o->o.type == BUZZTYPE_NIL) {
+      /* Withdraw the contribution */
+      if(!a->contributing) return buzzvm_ret0(vm);
+      a->contributing = 0;
+      a->s -= a->value;
+      a->w -= 1;
+      aggregate_extrema_set(a, INFINITY);
+      return buzzvm_ret0(vm);
+   }
+   float v = o->o.type == BUZZTYPE_INT ? o->i.value : o->f.value;
+   /* The push-sum mass follows the changes of the contribution */
+   if(a->contributing) {
+      a->s += v - a->value;
+   }
+   else {
+      a->s += v;
+      a->w += 1;
+   }
+   a->value = v;
+   a->contributing = 1;
+   aggregate_extrema_set(a, a->op == BUZZAGGREGATE_MAX ? -v : v);
+   return buzzvm_ret0(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzaggregate_get(buzzvm_t vm) {
+   id_get();
+   const buzzaggregate_t* pa = buzzdict_get(vm->aggregates->table, &id, buzzaggregate_t);
+   float v;
+   if(pa && buzzaggregate_value(*pa, &v)) buzzvm_pushf(vm, v);
+   else buzzvm_pushnil(vm);
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
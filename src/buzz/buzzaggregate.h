@@ -0,0 +1,187 @@
+#ifndef BUZZAGGREGATE_H
+#define BUZZAGGREGATE_H
+
+#include <buzz/buzzdict.h>
+#include <buzz/buzzmsg.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /*
+    * Forward declaration of the Buzz VM state.
+    */
+   struct buzzvm_s;
+
+   /*
+    * Aggregation operations.
+    */
+   typedef enum {
+      BUZZAGGREGATE_AVG = 0, // Mean of the contributions, by push-sum
+      BUZZAGGREGATE_SUM,     // Sum of the contributions, as mean times count
+      BUZZAGGREGATE_COUNT,   // Number of contributors, by extrema propagation
+      BUZZAGGREGATE_MIN,     // Smallest contribution
+      BUZZAGGREGATE_MAX,     // Largest contribution
+      BUZZAGGREGATE_OP_COUNT // How many operations have been defined
+   } buzzaggregate_op_e;
+
+   /*
+    * The smallest value seen by a robot, propagated until it gets too old.
+    */
+   struct buzzaggregate_extremum_s {
+      /* The value, INFINITY if none */
+      float value;
+      /* Steps since the robot that has the value sent it */
+      uint8_t age;
+      /* 1 if the value is the one of this robot */
+      uint8_t own;
+   };
+   typedef struct buzzaggregate_extremum_s* buzzaggregate_extremum_t;
+
+   /*
+    * An aggregate.
+    */
+   struct buzzaggregate_s {
+      /* The operation */
+      uint8_t op;
+      /* The contribution of this robot, if contributing */
+      float value;
+      uint8_t contributing;
+      /* Push-sum mass: value and weight */
+      float s;
+      float w;
+      /* Extrema: one for min/max, BUZZAGGREGATE_SLOTS for count and sum.
+       * The values of max are negated. */
+      struct buzzaggregate_extremum_s* extrema;
+      /* The random values of this robot for count and sum */
+      float* own;
+      /* The robots that take part, as robot id (uint16_t) -> steps since
+       * heard (uint16_t) */
+      buzzdict_t peers;
+      /* The next peer to send push-sum mass to */
+      uint16_t cursor;
+   };
+   typedef struct buzzaggregate_s* buzzaggregate_t;
+
+   /*
+    * The aggregates of a VM.
+    */
+   struct buzzaggregates_s {
+      /* Aggregate id (uint16_t) -> buzzaggregate_t */
+      buzzdict_t table;
+      /* The aggregate ids, in the order they take turns to send */
+      buzzdarray_t order;
+      /* The next aggregate to send */
+      uint32_t next;
+      /* Bytes the aggregates may send per step */
+      uint32_t budget;
+      /* Bytes left to send */
+      uint32_t tokens;
+      /* Messages sent so far */
+      uint32_t sent;
+   };
+   typedef struct buzzaggregates_s* buzzaggregates_t;
+
+   /*
+    * Creates the aggregates of a VM.
+    * @return The aggregates.
+    */
+   extern buzzaggregates_t buzzaggregates_new();
+
+   /*
+    * Destroys the aggregates of a VM.
+    * @param a The aggregates.
+    */
+   extern void buzzaggregates_destroy(buzzaggregates_t* a);
+
+   /*
+    * Sets the bandwidth the aggregates may use.
+    * The aggregates take turns to send, each at most once per step, as
+    * long as the budget allows it.
+    * @param vm The Buzz VM data.
+    * @param bytes The bytes the aggregates may send per step.
+    */
+   extern void buzzaggregate_budget(struct buzzvm_s* vm,
+                                    uint32_t bytes);
+
+   /*
+    * Ages the aggregates and queues the messages the budget allows.
+    * Called by buzzvm_process_outmsgs().
+    * @param vm The Buzz VM data.
+    */
+   extern void buzzaggregate_update(struct buzzvm_s* vm);
+
+   /*
+    * Merges an aggregate message sent by a neighbor.
+    * Called by buzzvm_process_inmsgs().
+    * @param vm The Buzz VM data.
+    * @param rid The id of the robot that sent the message.
+    * @param msg The message.
+    * @return 0 on success, -1 if the message is malformed.
+    */
+   extern int buzzaggregate_receive(struct buzzvm_s* vm,
+                                    uint16_t rid,
+                                    buzzmsg_payload_t msg);
+
+   /*
+    * Computes the current estimate of an aggregate.
+    * @param a The aggregate.
+    * @param value Set to the estimate, if any.
+    * @return 1 if there is an estimate, 0 otherwise.
+    */
+   extern int buzzaggregate_value(buzzaggregate_t a,
+                                  float* value);
+
+   /*
+    * Registers the 'aggregate' table.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzaggregate_register(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to create a new aggregate.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzaggregate_create(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to set the contribution of this robot, or to
+    * withdraw it with nil.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzaggregate_contribute(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to push the current estimate of an aggregate, or nil
+    * if there is none yet.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzaggregate_get(struct buzzvm_s* vm);
+
+#ifdef __cplusplus
+}
+#endif
+
+/*
+ * Random values per robot to estimate a count. The error is about
+ * 1/sqrt(BUZZAGGREGATE_SLOTS - 2).
+ */
+#define BUZZAGGREGATE_SLOTS 16
+
+/*
+ * Steps after which a value or a peer that was not heard again is
+ * forgotten.
+ */
+#define BUZZAGGREGATE_MAXAGE 100
+
+/*
+ * Default bytes the aggregates may send per step.
+ */
+#define BUZZAGGREGATE_BUDGET 64
+
+#endif
@@ -91,12 +91,16 @@
 /****************************************/
 /****************************************/
 
-void strkeydstryf(const void* key, void* data, void* params) {
+static void strkeydstryf(const void* key, void* data, void* params) {
    free(*(char**)key);
+   free((void*)key);
+   free(data);
 }
 
-void strdatadstryf(const void* key, void* data, void* params) {
+static void strdatadstryf(const void* key, void* data, void* params) {
    free(*(char**)data);
+   free((void*)key);
+   free(data);
 }
 
 /****************************************/
@@ -143,6 +147,27 @@ int buzz_asm(const char* fname,
              uint8_t** buf,
              uint32_t* size,
              buzzdebug_t* dbg) {
+   /* Open file */
+   FILE* fd = fopen(fname, "r");
+   if(!fd) {
+      perror(fname);
+      return 1;
+   }
+   /* Compile its content */
+   int retval = buzz_asm_stream(fd, fname, buf, size, dbg);
+   /* Close file */
+   fclose(fd);
+   return retval;
+}
+
+/****************************************/
+/****************************************/
+
+int buzz_asm_stream(FILE* fd,
+                    const char* fname,
+                    uint8_t** buf,
+                    uint32_t* size,
+                    buzzdebug_t* dbg) {
    /* Make new label position dictionary */
    buzzdict_t labpos = buzzdict_new(100,
                                     sizeof(char*),
@@ -159,12 +184,6 @@ int buzz_asm(const char* fname,
                                      strdatadstryf);
    /* Make new debug data structure */
    *dbg = buzzdebug_new();
-   /* Open file */
-   FILE* fd = fopen(fname, "r");
-   if(!fd) {
-      perror(fname);
-      return 1;
-   }
    /* Create initial bytecode buffer */
    *buf = malloc(256);
    size_t bcode_max_size = 256;
@@ -308,8 +327,6 @@ int buzz_asm(const char* fname,
       fprintf(stderr, "ERROR: %s:%zu unknown instruction \"%s\"\n", fname, lineno, instr);
       return 2;
    }
-   /* Close file */
-   fclose(fd);
    /*
     * Perform second pass: label substitution
     */
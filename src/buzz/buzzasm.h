@@ -3,6 +3,7 @@
 
 #include <buzz/buzzvm.h>
 #include <buzz/buzzdebug.h>
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -21,6 +22,22 @@ extern "C" {
                        uint32_t* size,
                        buzzdebug_t* dbg);
 
+   /*
+    * Compiles assembly code read from a stream into bytecode.
+    * The stream is read until its end, but it is not closed.
+    * @param fd The stream where the code is located.
+    * @param fname The name of the stream, used in error messages.
+    * @param buf The buffer in which the bytecode will be stored. Created internally.
+    * @param size The size of the bytecode buffer.
+    * @param dbg The debug data structure to fill into. Created internally.
+    * @return 0 if no error occurred, 2 for compilation error.
+    */
+   extern int buzz_asm_stream(FILE* fd,
+                              const char* fname,
+                              uint8_t** buf,
+                              uint32_t* size,
+                              buzzdebug_t* dbg);
+
    /*
     * Decompiles bytecode into an assembly file.
     * @param buf The buffer in which the bytecode is stored.
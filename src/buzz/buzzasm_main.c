@@ -1,6 +1,8 @@
 #include "buzzasm.h"
+#include "buzzopt.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -8,8 +10,14 @@
 
 int main(int argc, char** argv) {
    /* Parse command line */
+   int optimize = 1;
+   if(argc == 5 && strcmp(argv[1], "-O0") == 0) {
+      optimize = 0;
+      ++argv;
+      --argc;
+   }
    if(argc != 4) {
-      fprintf(stderr, "Usage:\n\t%s <asmfile.basm> <bytecodefile.bo> <debugfile.bdbg>\n\n", argv[0]);
+      fprintf(stderr, "Usage:\n\t%s [-O0] <asmfile.basm> <bytecodefile.bo> <debugfile.bdbg>\n\n", argv[0]);
       return 0;
    }
    /* Open output file */
@@ -24,6 +32,10 @@ int main(int argc, char** argv) {
    if(buzz_asm(argv[1], &bcode_buf, &bcode_size, &dbg) != 0) {
       return 1;
    }
+   /* Optimize bytecode */
+   if(optimize && buzz_optimize(bcode_buf, &bcode_size, &dbg) != 0) {
+      return 1;
+   }
    /* Write to file */
    ssize_t written;
    size_t tot = 0;
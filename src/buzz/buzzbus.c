@@ -0,0 +1,351 @@
+#include "buzzbus.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/****************************************/
+/****************************************/
+
+/*
+ * A transport connected to the bus.
+ */
+struct buzzbus_endpoint_s {
+   /* The bus */
+   buzzbus_t bus;
+   /* Position and orientation in the global frame */
+   float x, y, z, yaw;
+   /* Packets to receive at this step */
+   buzzdarray_t inbox;
+   /* Next packet to receive */
+   uint32_t inboxpos;
+   /* Packets to receive at the next step */
+   buzzdarray_t next;
+   /* Bytes to receive at the next step */
+   uint32_t nextbytes;
+};
+typedef struct buzzbus_endpoint_s* buzzbus_endpoint_t;
+
+/*
+ * A cell of the spatial index.
+ * The cell side is equal to the communication range.
+ */
+struct buzzbus_cell_s {
+   int32_t x, y;
+};
+
+/****************************************/
+/****************************************/
+
+static void buzzbus_packet_destroy(uint32_t pos, void* data, void* params) {
+   buzzmsg_payload_destroy((buzzmsg_payload_t*)data);
+}
+
+static uint32_t buzzbus_cell_hash(const void* key) {
+   const struct buzzbus_cell_s* c = (const struct buzzbus_cell_s*)key;
+   return ((uint32_t)c->x * 73856093u) ^ ((uint32_t)c->y * 19349663u);
+}
+
+static int buzzbus_cell_cmp(const void* a, const void* b) {
+   const struct buzzbus_cell_s* ca = (const struct buzzbus_cell_s*)a;
+   const struct buzzbus_cell_s* cb = (const struct buzzbus_cell_s*)b;
+   if(ca->x < cb->x) return -1;
+   if(ca->x > cb->x) return  1;
+   if(ca->y < cb->y) return -1;
+   if(ca->y > cb->y) return  1;
+   return 0;
+}
+
+static void buzzbus_cell_destroy(const void* key, void* data, void* params) {
+   free((void*)key);
+   buzzdarray_destroy((buzzdarray_t*)data);
+   free(data);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Returns a random number in [0,1) (xorshift64*).
+ */
+static float buzzbus_rand(buzzbus_t bus) {
+   bus->rngstate ^= bus->rngstate >> 12;
+   bus->rngstate ^= bus->rngstate << 25;
+   bus->rngstate ^= bus->rngstate >> 27;
+   return ((bus->rngstate * 2685821657736338717ull) >> 40) / 16777216.0f;
+}
+
+/****************************************/
+/****************************************/
+
+buzzbus_t buzzbus_new(float range) {
+   if(!(range >= 0.0f)) return NULL;
+   buzzbus_t bus = (buzzbus_t)calloc(1, sizeof(struct buzzbus_s));
+   bus->endpoints = buzzdarray_new(10, sizeof(buzztransport_t), NULL);
+   bus->byid = buzzdict_new(10,
+                            sizeof(uint16_t),
+                            sizeof(buzztransport_t),
+                            buzzdict_uint16keyhash,
+                            buzzdict_uint16keycmp,
+                            NULL);
+   bus->range = range;
+   buzzbus_seed(bus, 1);
+   return bus;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzbus_destroy(buzzbus_t* bus) {
+   if((*bus)->grid) buzzdict_destroy(&(*bus)->grid);
+   buzzdarray_destroy(&(*bus)->endpoints);
+   buzzdict_destroy(&(*bus)->byid);
+   free(*bus);
+   *bus = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Returns the cell index of a coordinate.
+ * The index is clamped, so that it and its neighbors fit an int32_t
+ * even for a tiny range or a far position. The clamped cells are
+ * larger, which costs time but not correctness.
+ */
+static int32_t buzzbus_cell_index(float v, float range) {
+   float c = floorf(v / range);
+   if(!(c > -1e9f)) return -1000000000;
+   if(c > 1e9f) return 1000000000;
+   return (int32_t)c;
+}
+
+/*
+ * Returns the cell that contains the given endpoint.
+ */
+static struct buzzbus_cell_s buzzbus_cell(buzzbus_endpoint_t e) {
+   struct buzzbus_cell_s c = {
+      .x = buzzbus_cell_index(e->x, e->bus->range),
+      .y = buzzbus_cell_index(e->y, e->bus->range)
+   };
+   return c;
+}
+
+/*
+ * Builds the spatial index.
+ */
+static void buzzbus_grid_build(buzzbus_t bus) {
+   bus->grid = buzzdict_new(buzzdarray_size(bus->endpoints) / 4 + 1,
+                            sizeof(struct buzzbus_cell_s),
+                            sizeof(buzzdarray_t),
+                            buzzbus_cell_hash,
+                            buzzbus_cell_cmp,
+                            buzzbus_cell_destroy);
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(bus->endpoints); ++i) {
+      buzztransport_t t = buzzdarray_get(bus->endpoints, i, buzztransport_t);
+      struct buzzbus_cell_s c = buzzbus_cell((buzzbus_endpoint_t)t->data);
+      buzzdarray_t* cell = (buzzdarray_t*)buzzdict_rawget(bus->grid, &c);
+      if(!cell) {
+         buzzdarray_t ts = buzzdarray_new(4, sizeof(buzztransport_t), NULL);
+         buzzdict_set(bus->grid, &c, &ts);
+         cell = (buzzdarray_t*)buzzdict_rawget(bus->grid, &c);
+      }
+      buzzdarray_push(*cell, &t);
+   }
+}
+
+/*
+ * Forgets about the spatial index, so it gets rebuilt at the next send.
+ */
+static void buzzbus_grid_invalidate(buzzbus_t bus) {
+   if(bus->grid) buzzdict_destroy(&bus->grid);
+}
+
+/****************************************/
+/****************************************/
+
+static void buzzbus_deliver(buzztransport_t src,
+                            buzztransport_t dst,
+                            const uint8_t* buf,
+                            uint32_t size) {
+   if(dst == src) return;
+   buzzbus_endpoint_t s = (buzzbus_endpoint_t)src->data;
+   buzzbus_endpoint_t d = (buzzbus_endpoint_t)dst->data;
+   buzzbus_t bus = s->bus;
+   /* Check communication range */
+   if(bus->range > 0.0f) {
+      float dx = d->x - s->x;
+      float dy = d->y - s->y;
+      float dz = d->z - s->z;
+      if(dx * dx + dy * dy + dz * dz > bus->range * bus->range)
+         return;
+   }
+   /* Simulate packet loss and limited bandwidth */
+   if(size > dst->mtu ||
+      (bus->loss > 0.0f && buzzbus_rand(bus) < bus->loss) ||
+      (bus->bandwidth > 0 && d->nextbytes + size > bus->bandwidth)) {
+      ++bus->dropped;
+      return;
+   }
+   buzzmsg_payload_t p = buzzmsg_payload_frombuffer(buf, size);
+   buzzdarray_push(d->next, &p);
+   d->nextbytes += size;
+   ++bus->delivered;
+}
+
+static int buzzbus_send(buzztransport_t t,
+                        const uint8_t* buf,
+                        uint32_t size) {
+   buzzbus_endpoint_t e = (buzzbus_endpoint_t)t->data;
+   buzzbus_t bus = e->bus;
+   uint32_t i;
+   if(bus->range > 0.0f) {
+      /* Only the cells around the sender can be in range */
+      if(!bus->grid) buzzbus_grid_build(bus);
+      struct buzzbus_cell_s c0 = buzzbus_cell(e), c;
+      for(c.x = c0.x - 1; c.x <= c0.x + 1; ++c.x) {
+         for(c.y = c0.y - 1; c.y <= c0.y + 1; ++c.y) {
+            const buzzdarray_t* cell = buzzdict_get(bus->grid, &c, buzzdarray_t);
+            if(!cell) continue;
+            for(i = 0; i < buzzdarray_size(*cell); ++i)
+               buzzbus_deliver(t, buzzdarray_get(*cell, i, buzztransport_t), buf, size);
+         }
+      }
+   }
+   else {
+      for(i = 0; i < buzzdarray_size(bus->endpoints); ++i)
+         buzzbus_deliver(t, buzzdarray_get(bus->endpoints, i, buzztransport_t), buf, size);
+   }
+   return 0;
+}
+
+/****************************************/
+/****************************************/
+
+static int64_t buzzbus_recv(buzztransport_t t,
+                            uint8_t* buf,
+                            uint32_t cap) {
+   buzzbus_endpoint_t e = (buzzbus_endpoint_t)t->data;
+   if(e->inboxpos >= buzzdarray_size(e->inbox)) return 0;
+   buzzmsg_payload_t p = buzzdarray_get(e->inbox, e->inboxpos, buzzmsg_payload_t);
+   ++e->inboxpos;
+   uint32_t size = buzzmsg_payload_size(p);
+   if(size > cap) size = cap;
+   memcpy(buf, p->data, size);
+   return size;
+}
+
+/****************************************/
+/****************************************/
+
+static int buzzbus_poll(buzztransport_t t,
+                        int timeout) {
+   /* Packets only arrive at buzzbus_tick(), so waiting is pointless */
+   buzzbus_endpoint_t e = (buzzbus_endpoint_t)t->data;
+   return e->inboxpos < buzzdarray_size(e->inbox);
+}
+
+/****************************************/
+/****************************************/
+
+static void buzzbus_destroy_endpoint(buzztransport_t t) {
+   buzzbus_endpoint_t e = (buzzbus_endpoint_t)t->data;
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(e->bus->endpoints); ++i)
+      if(buzzdarray_get(e->bus->endpoints, i, buzztransport_t) == t) {
+         buzzdarray_remove(e->bus->endpoints, i);
+         break;
+      }
+   buzzdict_remove(e->bus->byid, &t->robot);
+   buzzbus_grid_invalidate(e->bus);
+   buzzdarray_destroy(&e->inbox);
+   buzzdarray_destroy(&e->next);
+   free(e);
+}
+
+/****************************************/
+/****************************************/
+
+static int buzzbus_neighbor(buzztransport_t t,
+                            uint16_t rid,
+                            float* distance,
+                            float* azimuth,
+                            float* elevation,
+                            void* params) {
+   buzzbus_endpoint_t e = (buzzbus_endpoint_t)t->data;
+   const buzztransport_t* other = buzzdict_get(e->bus->byid, &rid, buzztransport_t);
+   /* The sender might have left the bus in the meantime */
+   if(!other) return 0;
+   buzzbus_endpoint_t o = (buzzbus_endpoint_t)(*other)->data;
+   /* Express the position of the sender in the local frame */
+   float dx = o->x - e->x;
+   float dy = o->y - e->y;
+   float dz = o->z - e->z;
+   float dxy = sqrtf(dx * dx + dy * dy);
+   *distance = sqrtf(dxy * dxy + dz * dz);
+   *azimuth = atan2f(dy, dx) - e->yaw;
+   while(*azimuth > M_PI) *azimuth -= 2.0f * M_PI;
+   while(*azimuth <= -M_PI) *azimuth += 2.0f * M_PI;
+   *elevation = atan2f(dz, dxy);
+   return 1;
+}
+
+/****************************************/
+/****************************************/
+
+buzztransport_t buzzbus_transport_new(buzzbus_t bus,
+                                      uint16_t robot,
+                                      uint32_t mtu) {
+   if(buzzdict_exists(bus->byid, &robot)) return NULL;
+   buzztransport_t t = buzztransport_new(robot, mtu);
+   buzzbus_endpoint_t e = (buzzbus_endpoint_t)calloc(1, sizeof(struct buzzbus_endpoint_s));
+   e->bus = bus;
+   e->inbox = buzzdarray_new(10, sizeof(buzzmsg_payload_t), buzzbus_packet_destroy);
+   e->next = buzzdarray_new(10, sizeof(buzzmsg_payload_t), buzzbus_packet_destroy);
+   t->data = e;
+   t->send = buzzbus_send;
+   t->recv = buzzbus_recv;
+   t->poll = buzzbus_poll;
+   t->destroy = buzzbus_destroy_endpoint;
+   buzztransport_set_neighbor(t, buzzbus_neighbor, NULL);
+   buzzdarray_push(bus->endpoints, &t);
+   buzzdict_set(bus->byid, &robot, &t);
+   buzzbus_grid_invalidate(bus);
+   return t;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzbus_set_position(buzztransport_t t,
+                          float x,
+                          float y,
+                          float z,
+                          float yaw) {
+   buzzbus_endpoint_t e = (buzzbus_endpoint_t)t->data;
+   e->x = x;
+   e->y = y;
+   e->z = z;
+   e->yaw = yaw;
+   buzzbus_grid_invalidate(e->bus);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzbus_tick(buzzbus_t bus) {
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(bus->endpoints); ++i) {
+      buzztransport_t t = buzzdarray_get(bus->endpoints, i, buzztransport_t);
+      buzzbus_endpoint_t e = (buzzbus_endpoint_t)t->data;
+      buzzdarray_t tmp = e->inbox;
+      buzzdarray_clear(tmp, 10);
+      e->inbox = e->next;
+      e->inboxpos = 0;
+      e->next = tmp;
+      e->nextbytes = 0;
+   }
+}
+
+/****************************************/
+/****************************************/
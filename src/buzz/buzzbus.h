@@ -0,0 +1,103 @@
+#ifndef BUZZBUS_H
+#define BUZZBUS_H
+
+#include <buzz/buzztransport.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /*
+    * An in-process message bus.
+    *
+    * The bus connects transports that live in the same process. Every
+    * transport has a position in a global frame. A packet reaches all the
+    * transports within communication range of the sender. Packets sent
+    * during a step are delivered when buzzbus_tick() is called.
+    *
+    * The radio model can be tuned through the public fields: each packet
+    * is lost with probability 'loss', and a transport receives at most
+    * 'bandwidth' bytes per step.
+    */
+   struct buzzbus_s {
+      /* The transports connected to the bus */
+      buzzdarray_t endpoints;
+      /* The transports connected to the bus, as robot id -> buzztransport_t */
+      buzzdict_t byid;
+      /* Spatial index of the transports, rebuilt when they move */
+      buzzdict_t grid;
+      /* The communication range (0 = unlimited) */
+      float range;
+      /* Probability to lose a packet (0 = no loss) */
+      float loss;
+      /* Maximum number of bytes received per step (0 = unlimited) */
+      uint32_t bandwidth;
+      /* State of the random number generator used for packet loss */
+      uint64_t rngstate;
+      /* Number of packets delivered so far */
+      uint64_t delivered;
+      /* Number of packets dropped so far */
+      uint64_t dropped;
+   };
+   typedef struct buzzbus_s* buzzbus_t;
+
+   /*
+    * Creates a new bus.
+    * @param range The communication range (0 = unlimited).
+    * @return A new bus, or NULL if the range is negative or not a number.
+    */
+   extern buzzbus_t buzzbus_new(float range);
+
+   /*
+    * Destroys a bus.
+    * All the transports connected to the bus must be destroyed first.
+    * @param bus The bus.
+    */
+   extern void buzzbus_destroy(buzzbus_t* bus);
+
+   /*
+    * Creates a new transport connected to the bus.
+    * The transport is placed at the origin of the global frame.
+    * Destroy it with buzztransport_destroy().
+    * @param bus The bus.
+    * @param robot The robot id.
+    * @param mtu The maximum size of a packet.
+    * @return A new transport, or NULL if the robot id is taken.
+    */
+   extern buzztransport_t buzzbus_transport_new(buzzbus_t bus,
+                                                uint16_t robot,
+                                                uint32_t mtu);
+
+   /*
+    * Sets the position of a transport in the global frame.
+    * @param t The transport.
+    * @param x The x coordinate.
+    * @param y The y coordinate.
+    * @param z The z coordinate.
+    * @param yaw The orientation (in rad) on the XY plane.
+    */
+   extern void buzzbus_set_position(buzztransport_t t,
+                                    float x,
+                                    float y,
+                                    float z,
+                                    float yaw);
+
+   /*
+    * Delivers the packets sent since the last call.
+    * The packets that were not received since the last call are lost.
+    * @param bus The bus.
+    */
+   extern void buzzbus_tick(buzzbus_t bus);
+
+#ifdef __cplusplus
+}
+#endif
+
+/*
+ * Seeds the random number generator used for packet loss.
+ * @param bus The bus.
+ * @param seed The seed.
+ */
+#define buzzbus_seed(bus, seed) (bus)->rngstate = (seed) ? (seed) : 1
+
+#endif
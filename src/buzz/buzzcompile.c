@@ -0,0 +1,52 @@
+#include "buzzcompile.h"
+#include "buzzparser.h"
+#include "buzzasm.h"
+#include "buzzopt.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/****************************************/
+/****************************************/
+
+int buzz_compile(const char* src,
+                 const char* fname,
+                 int optimize,
+                 buzzparser_cache_t cache,
+                 uint8_t** buf,
+                 uint32_t* size,
+                 buzzdebug_t* dbg) {
+   /* The assembler code is written into a memory buffer */
+   char* asmbuf = NULL;
+   size_t asmsize = 0;
+   FILE* asmstream = open_memstream(&asmbuf, &asmsize);
+   if(!asmstream) {
+      perror(fname);
+      return 1;
+   }
+   /* Parse the script; destroying the parser closes the stream */
+   buzzparser_t par = buzzparser_new_fromstring(fname, src, asmstream);
+   par->cache = cache;
+   int ok = buzzparser_parse(par);
+   buzzparser_destroy(&par);
+   if(!ok) {
+      free(asmbuf);
+      return 2;
+   }
+   /* Assemble the code */
+   FILE* fd = fmemopen(asmbuf, asmsize, "r");
+   if(!fd) {
+      perror(fname);
+      free(asmbuf);
+      return 1;
+   }
+   int retval = buzz_asm_stream(fd, fname, buf, size, dbg);
+   fclose(fd);
+   free(asmbuf);
+   /* Optimize the bytecode */
+   if(retval == 0 && optimize)
+      retval = buzz_optimize(*buf, size, dbg);
+   return retval;
+}
+
+/****************************************/
+/****************************************/
@@ -0,0 +1,43 @@
+#ifndef BUZZCOMPILE_H
+#define BUZZCOMPILE_H
+
+#include <buzz/buzzvm.h>
+#include <buzz/buzzdebug.h>
+#include <buzz/buzzparser.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /*
+    * Compiles a script into bytecode, in memory.
+    * This does what bzzc does, without temporary files or other
+    * processes: the script is parsed, its assembler code is kept in
+    * memory and assembled, and the result is optimized.
+    * The included files are looked up on disk as bzzparse does, first
+    * with the given path and then in BUZZ_INCLUDE_PATH.
+    * Errors are printed on stderr.
+    * With a cache, the files included in the global scope are parsed
+    * once and reused by the following compilations, until they change.
+    * @param src The script source code.
+    * @param fname The name of the script, used in the debug information and in error messages.
+    * @param optimize 1 to optimize the bytecode, 0 to leave it as assembled.
+    * @param cache The cache of included files, or NULL.
+    * @param buf The buffer in which the bytecode will be stored. Created internally.
+    * @param size The size of the bytecode buffer.
+    * @param dbg The debug data structure to fill into. Created internally.
+    * @return 0 if no error occurred, 1 for I/O error, 2 for compilation error.
+    */
+   extern int buzz_compile(const char* src,
+                           const char* fname,
+                           int optimize,
+                           buzzparser_cache_t cache,
+                           uint8_t** buf,
+                           uint32_t* size,
+                           buzzdebug_t* dbg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
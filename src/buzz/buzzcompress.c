@@ -0,0 +1,213 @@
+#include "buzzcompress.h"
+#include <stdlib.h>
+#include <string.h>
+
+/****************************************/
+/****************************************/
+
+/* Shortest back-reference worth encoding */
+#define MINMATCH 4
+
+/* Largest back-reference distance */
+#define MAXOFFSET 65535
+
+/* Size of the match finder hash table (log2) */
+#define HASHLOG 12
+
+/*
+ * Makes sure there are at least N bytes left in the output buffer
+ */
+#define dst_reserve(N) if(op + (N) > dstcap) return -1;
+
+/*
+ * Writes a length that did not fit in its token nibble
+ */
+#define dst_write_length(LEN)                   \
+   {                                            \
+      uint32_t l = (LEN);                       \
+      while(l >= 255) {                         \
+         dst_reserve(1);                        \
+         dst[op++] = 255;                       \
+         l -= 255;                              \
+      }                                         \
+      dst_reserve(1);                           \
+      dst[op++] = l;                            \
+   }
+
+/*
+ * Reads a length that did not fit in its token nibble
+ */
+#define src_read_length(LEN)                    \
+   {                                            \
+      uint8_t b;                                \
+      do {                                      \
+         if(ip >= srcsize) return -1;           \
+         b = src[ip++];                         \
+         (LEN) += b;                            \
+      } while(b == 255);                        \
+   }
+
+static uint32_t hash4(const uint8_t* p) {
+   uint32_t v;
+   memcpy(&v, p, sizeof(uint32_t));
+   return (v * 2654435761U) >> (32 - HASHLOG);
+}
+
+/****************************************/
+/****************************************/
+
+uint32_t buzzcompress_bound(uint32_t size) {
+   return size + size / 255 + 16;
+}
+
+/****************************************/
+/****************************************/
+
+int64_t buzzcompress_encode(const uint8_t* src,
+                            uint32_t srcsize,
+                            uint8_t* dst,
+                            uint32_t dstcap) {
+   /* Positions of the last occurrence of each 4-byte sequence */
+   int64_t table[1 << HASHLOG];
+   uint32_t i;
+   for(i = 0; i < (1 << HASHLOG); ++i) table[i] = -1;
+   /* Input cursor, start of the pending literals, output cursor */
+   uint32_t ip = 0, anchor = 0, op = 0;
+   /* Look for back-references */
+   while(ip + MINMATCH <= srcsize) {
+      uint32_t h = hash4(src + ip);
+      int64_t ref = table[h];
+      table[h] = ip;
+      if(ref < 0 ||
+         ip - ref > MAXOFFSET ||
+         memcmp(src + ref, src + ip, MINMATCH) != 0) {
+         ++ip;
+         continue;
+      }
+      /* Match found, extend it as far as possible */
+      uint32_t mlen = MINMATCH;
+      while(ip + mlen < srcsize && src[ref + mlen] == src[ip + mlen]) ++mlen;
+      /* Write the token */
+      uint32_t llen = ip - anchor;
+      dst_reserve(1);
+      dst[op++] =
+         ((llen >= 15 ? 15 : llen) << 4) |
+         (mlen - MINMATCH >= 15 ? 15 : mlen - MINMATCH);
+      /* Write the literals */
+      if(llen >= 15) dst_write_length(llen - 15);
+      dst_reserve(llen);
+      memcpy(dst + op, src + anchor, llen);
+      op += llen;
+      /* Write the back-reference */
+      dst_reserve(2);
+      dst[op++] = (ip - ref) & 0xFF;
+      dst[op++] = (ip - ref) >> 8;
+      if(mlen - MINMATCH >= 15) dst_write_length(mlen - MINMATCH - 15);
+      /* Skip the matched data */
+      ip += mlen;
+      anchor = ip;
+   }
+   /* Write the trailing literals; a literal-only sequence ends the stream */
+   uint32_t llen = srcsize - anchor;
+   dst_reserve(1);
+   dst[op++] = (llen >= 15 ? 15 : llen) << 4;
+   if(llen >= 15) dst_write_length(llen - 15);
+   dst_reserve(llen);
+   memcpy(dst + op, src + anchor, llen);
+   op += llen;
+   return op;
+}
+
+/****************************************/
+/****************************************/
+
+int64_t buzzcompress_decode(const uint8_t* src,
+                            uint32_t srcsize,
+                            uint8_t* dst,
+                            uint32_t dstsize) {
+   uint32_t ip = 0, op = 0;
+   while(ip < srcsize) {
+      /* Read the token */
+      uint8_t token = src[ip++];
+      /* Copy the literals */
+      uint32_t llen = token >> 4;
+      if(llen == 15) src_read_length(llen);
+      if(ip + llen > srcsize || op + llen > dstsize) return -1;
+      memcpy(dst + op, src + ip, llen);
+      ip += llen;
+      op += llen;
+      /* The last sequence has no back-reference */
+      if(ip == srcsize) break;
+      /* Read the back-reference */
+      if(ip + 2 > srcsize) return -1;
+      uint32_t off = src[ip] | (src[ip+1] << 8);
+      ip += 2;
+      if(off == 0 || off > op) return -1;
+      uint32_t mlen = token & 0x0F;
+      if(mlen == 15) src_read_length(mlen);
+      mlen += MINMATCH;
+      if(op + mlen > dstsize) return -1;
+      /* Byte-by-byte copy, since source and destination can overlap */
+      uint32_t i;
+      for(i = 0; i < mlen; ++i, ++op) dst[op] = dst[op - off];
+   }
+   return op;
+}
+
+/****************************************/
+/****************************************/
+
+buzzmsg_payload_t buzzcompress_payload_encode(buzzmsg_payload_t msg) {
+   /* Nothing to compress besides the type byte? */
+   if(buzzmsg_payload_size(msg) < 2) return NULL;
+   /* Compress the body */
+   const uint8_t* body = (const uint8_t*)msg->data + 1;
+   uint32_t bodysize = buzzmsg_payload_size(msg) - 1;
+   uint32_t cap = buzzcompress_bound(bodysize);
+   uint8_t* buf = (uint8_t*)malloc(cap);
+   int64_t csize = buzzcompress_encode(body, bodysize, buf, cap);
+   /* Is it worth it? The header costs 4 bytes */
+   if(csize < 0 || csize + sizeof(uint32_t) >= bodysize) {
+      free(buf);
+      return NULL;
+   }
+   /* Make the compressed message */
+   buzzmsg_payload_t m = buzzmsg_payload_new(csize + 1 + sizeof(uint32_t));
+   buzzmsg_serialize_u8(m, buzzmsg_payload_get(msg, 0) | BUZZMSG_FLAG_COMPRESSED);
+   buzzmsg_serialize_u32(m, bodysize);
+   int64_t i;
+   for(i = 0; i < csize; ++i)
+      buzzmsg_serialize_u8(m, buf[i]);
+   free(buf);
+   return m;
+}
+
+/****************************************/
+/****************************************/
+
+buzzmsg_payload_t buzzcompress_payload_decode(buzzmsg_payload_t msg) {
+   /* Read the header */
+   uint8_t type;
+   uint32_t bodysize;
+   int64_t pos = buzzmsg_deserialize_u8(&type, msg, 0);
+   if(pos < 0) return NULL;
+   pos = buzzmsg_deserialize_u32(&bodysize, msg, pos);
+   if(pos < 0) return NULL;
+   /* Reject sizes the compressed data cannot possibly expand to */
+   uint32_t csize = buzzmsg_payload_size(msg) - pos;
+   if(bodysize > (uint64_t)csize * 255 + 16) return NULL;
+   /* Decompress the body right after the type byte */
+   uint8_t* buf = (uint8_t*)malloc(bodysize + 1);
+   buf[0] = type & ~BUZZMSG_FLAG_COMPRESSED;
+   if(buzzcompress_decode((const uint8_t*)msg->data + pos, csize,
+                          buf + 1, bodysize) != bodysize) {
+      free(buf);
+      return NULL;
+   }
+   buzzmsg_payload_t m = buzzmsg_payload_frombuffer(buf, bodysize + 1);
+   free(buf);
+   return m;
+}
+
+/****************************************/
+/****************************************/
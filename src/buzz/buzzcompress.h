@@ -0,0 +1,76 @@
+#ifndef BUZZCOMPRESS_H
+#define BUZZCOMPRESS_H
+
+#include <buzz/buzzmsg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /*
+    * Returns the worst-case size of the compressed form of a buffer.
+    * @param size The size of the uncompressed data.
+    * @return The maximum size of the compressed data.
+    */
+   extern uint32_t buzzcompress_bound(uint32_t size);
+
+   /*
+    * Compresses a buffer.
+    * The coder is a byte-oriented LZ77 variant in the style of LZ4:
+    * the output is a sequence of (literal run, back-reference) pairs
+    * with a 64 KiB window.
+    * @param src The data to compress.
+    * @param srcsize The size of the data to compress.
+    * @param dst The output buffer.
+    * @param dstcap The capacity of the output buffer.
+    * @return The size of the compressed data, or -1 if dstcap was not enough.
+    * @see buzzcompress_bound
+    */
+   extern int64_t buzzcompress_encode(const uint8_t* src,
+                                      uint32_t srcsize,
+                                      uint8_t* dst,
+                                      uint32_t dstcap);
+
+   /*
+    * Decompresses a buffer.
+    * @param src The compressed data.
+    * @param srcsize The size of the compressed data.
+    * @param dst The output buffer.
+    * @param dstsize The expected size of the decompressed data.
+    * @return The size of the decompressed data, or -1 if the data is malformed.
+    */
+   extern int64_t buzzcompress_decode(const uint8_t* src,
+                                      uint32_t srcsize,
+                                      uint8_t* dst,
+                                      uint32_t dstsize);
+
+   /*
+    * Compresses a serialized message.
+    * The type byte is kept in clear and marked with BUZZMSG_FLAG_COMPRESSED.
+    * It is followed by the original size of the body (uint32_t) and by the
+    * compressed body.
+    * @param msg The message to compress.
+    * @return A new compressed message, or NULL if compression does not shrink the message.
+    */
+   extern buzzmsg_payload_t buzzcompress_payload_encode(buzzmsg_payload_t msg);
+
+   /*
+    * Decompresses a serialized message.
+    * The returned message has BUZZMSG_FLAG_COMPRESSED cleared.
+    * @param msg The message to decompress.
+    * @return A new decompressed message, or NULL if the message is malformed.
+    */
+   extern buzzmsg_payload_t buzzcompress_payload_decode(buzzmsg_payload_t msg);
+
+#ifdef __cplusplus
+}
+#endif
+
+/*
+ * Returns <tt>true</tt> if the message is compressed.
+ * @param msg The message payload.
+ * @return <tt>true</tt> if the message is compressed.
+ */
+#define buzzcompress_payload_iscompressed(msg) (buzzmsg_payload_size(msg) > 0 && (buzzmsg_payload_get(msg, 0) & BUZZMSG_FLAG_COMPRESSED))
+
+#endif
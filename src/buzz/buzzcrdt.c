@@ -0,0 +1,851 @@
+#include "buzzcrdt.h"
+#include "buzzvm.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/****************************************/
+/****************************************/
+
+#define function_register(FNAME)                                        \
+   buzzvm_dup(vm);                                                      \
+   buzzvm_pushs(vm, buzzvm_string_register(vm, #FNAME, 1));             \
+   buzzvm_pushcc(vm, buzzvm_function_register(vm, buzzcrdt_ ## FNAME)); \
+   buzzvm_tput(vm);
+
+/*
+ * Bit masks of the types that support a method.
+ */
+#define TYPE_COUNTER ((1 << BUZZCRDT_GCOUNTER) | (1 << BUZZCRDT_PNCOUNTER))
+#define TYPE_MAP     (1 << BUZZCRDT_LWWMAP)
+#define TYPE_SET     (1 << BUZZCRDT_ORSET)
+#define TYPE_REG     (1 << BUZZCRDT_MAXREG)
+
+/****************************************/
+/****************************************/
+
+int buzzcrdt_register(struct buzzvm_s* vm) {
+   /* Push the 'stigmergy' table */
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "stigmergy", 1));
+   buzzvm_gload(vm);
+   /* Add the constructors */
+   function_register(gcounter);
+   function_register(counter);
+   function_register(lwwmap);
+   function_register(set);
+   function_register(maxreg);
+   buzzvm_pop(vm);
+   return vm->state;
+}
+
+/****************************************/
+/****************************************/
+
+uint32_t buzzcrdt_key_hash(const void* key) {
+   return buzzobj_hash(*(buzzobj_t*)key);
+}
+
+int buzzcrdt_key_cmp(const void* a, const void* b) {
+   return buzzobj_cmp(*(buzzobj_t*)a, *(buzzobj_t*)b);
+}
+
+void buzzcrdt_member_destroy(const void* key, void* data, void* params) {
+   free((void*)key);
+   buzzdarray_destroy(&((struct buzzcrdt_member_s*)data)->tags);
+   free(data);
+}
+
+/****************************************/
+/****************************************/
+
+buzzcrdt_t buzzcrdt_new(uint8_t type) {
+   buzzcrdt_t c = (buzzcrdt_t)calloc(1, sizeof(struct buzzcrdt_s));
+   c->type = type;
+   switch(type) {
+      case BUZZCRDT_GCOUNTER:
+      case BUZZCRDT_PNCOUNTER:
+         c->data = buzzdict_new(10,
+                                sizeof(uint16_t),
+                                sizeof(struct buzzcrdt_count_s),
+                                buzzdict_uint16keyhash,
+                                buzzdict_uint16keycmp,
+                                NULL);
+         break;
+      case BUZZCRDT_LWWMAP:
+         c->data = buzzdict_new(10,
+                                sizeof(buzzobj_t),
+                                sizeof(struct buzzcrdt_entry_s),
+                                buzzcrdt_key_hash,
+                                buzzcrdt_key_cmp,
+                                NULL);
+         break;
+      case BUZZCRDT_ORSET:
+         c->data = buzzdict_new(10,
+                                sizeof(buzzobj_t),
+                                sizeof(struct buzzcrdt_member_s),
+                                buzzcrdt_key_hash,
+                                buzzcrdt_key_cmp,
+                                buzzcrdt_member_destroy);
+         break;
+      default:
+         /* The max-register only uses c->reg */
+         c->data = NULL;
+         break;
+   }
+   c->synctimer = BUZZCRDT_SYNC_PERIOD;
+   return c;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzcrdt_destroy(buzzcrdt_t* c) {
+   if((*c)->data) buzzdict_destroy(&((*c)->data));
+   free(*c);
+   *c = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Marks a part of the state to be sent at the next flush.
+ */
+static void buzzcrdt_touch(buzzcrdt_t c, uint8_t* dirty) {
+   if(*dirty) return;
+   *dirty = 1;
+   ++c->dirty;
+}
+
+/*
+ * Returns the contribution of a robot to a counter, creating it if necessary.
+ */
+static struct buzzcrdt_count_s* buzzcrdt_count_get(buzzcrdt_t c,
+                                                   uint16_t robot) {
+   struct buzzcrdt_count_s* x = (struct buzzcrdt_count_s*)buzzdict_rawget(c->data, &robot);
+   if(x) return x;
+   struct buzzcrdt_count_s z = { .inc = 0, .dec = 0, .dirty = 0 };
+   buzzdict_set(c->data, &robot, &z);
+   return (struct buzzcrdt_count_s*)buzzdict_rawget(c->data, &robot);
+}
+
+/*
+ * Returns the entry of a map, creating an empty one if necessary.
+ */
+static struct buzzcrdt_entry_s* buzzcrdt_entry_get(buzzcrdt_t c,
+                                                   buzzobj_t key) {
+   struct buzzcrdt_entry_s* x = (struct buzzcrdt_entry_s*)buzzdict_rawget(c->data, &key);
+   if(x) return x;
+   struct buzzcrdt_entry_s z;
+   memset(&z, 0, sizeof(z));
+   buzzdict_set(c->data, &key, &z);
+   return (struct buzzcrdt_entry_s*)buzzdict_rawget(c->data, &key);
+}
+
+/*
+ * Returns a set member, creating one without tags if necessary.
+ */
+static struct buzzcrdt_member_s* buzzcrdt_member_get(buzzcrdt_t c,
+                                                     buzzobj_t x) {
+   struct buzzcrdt_member_s* m = (struct buzzcrdt_member_s*)buzzdict_rawget(c->data, &x);
+   if(m) return m;
+   struct buzzcrdt_member_s z = {
+      .tags = buzzdarray_new(1, sizeof(struct buzzcrdt_tag_s), NULL),
+      .dirty = 0
+   };
+   buzzdict_set(c->data, &x, &z);
+   return (struct buzzcrdt_member_s*)buzzdict_rawget(c->data, &x);
+}
+
+/*
+ * Returns <tt>true</tt> if a set member has a tag that was not removed.
+ */
+static int buzzcrdt_member_islive(const struct buzzcrdt_member_s* m) {
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(m->tags); ++i)
+      if(!buzzdarray_get(m->tags, i, struct buzzcrdt_tag_s).removed)
+         return 1;
+   return 0;
+}
+
+/*
+ * Adds a tag to a set member, or marks the existing tag as removed.
+ * Returns 1 if the member changed, 0 otherwise.
+ */
+static int buzzcrdt_member_merge(struct buzzcrdt_member_s* m,
+                                 const struct buzzcrdt_tag_s* t) {
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(m->tags); ++i) {
+      struct buzzcrdt_tag_s* l =
+         (struct buzzcrdt_tag_s*)&buzzdarray_get(m->tags, i, struct buzzcrdt_tag_s);
+      if(l->robot == t->robot && l->seq == t->seq) {
+         if(!t->removed || l->removed) return 0;
+         l->removed = 1;
+         return 1;
+      }
+   }
+   buzzdarray_push(m->tags, t);
+   return 1;
+}
+
+/*
+ * Returns <tt>true</tt> if a map entry a wins over b.
+ * The most recent write wins; on a tie, the highest robot id wins.
+ */
+static int buzzcrdt_entry_wins(const struct buzzvstig_elem_s* a,
+                               const struct buzzvstig_elem_s* b) {
+   if(buzzvstig_ts_newer(a->timestamp, b->timestamp)) return 1;
+   return a->timestamp == b->timestamp && a->robot > b->robot;
+}
+
+/*
+ * Returns <tt>true</tt> if an object can be used as a map key or set member.
+ */
+static int buzzcrdt_iskey(const buzzobj_t o) {
+   return
+      o->o.type == BUZZTYPE_INT ||
+      o->o.type == BUZZTYPE_FLOAT ||
+      o->o.type == BUZZTYPE_STRING;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzcrdt_count_entry(const void* key, void* data, void* params) {
+   const struct buzzcrdt_count_s* x = (const struct buzzcrdt_count_s*)data;
+   *(int32_t*)params += x->inc - x->dec;
+}
+
+int32_t buzzcrdt_count(const buzzcrdt_t c) {
+   int32_t n = 0;
+   buzzdict_foreach(c->data, buzzcrdt_count_entry, &n);
+   return n;
+}
+
+/****************************************/
+/****************************************/
+
+int buzzcrdt_contains(const buzzcrdt_t c,
+                      const buzzobj_t x) {
+   const struct buzzcrdt_member_s* m = buzzdict_get(c->data, &x, struct buzzcrdt_member_s);
+   return m && buzzcrdt_member_islive(m);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzcrdt_size_entry(const void* key, void* data, void* params) {
+   buzzcrdt_t c = (buzzcrdt_t)((void**)params)[0];
+   uint32_t* n = (uint32_t*)((void**)params)[1];
+   if(c->type == BUZZCRDT_LWWMAP)
+      *n += ((struct buzzcrdt_entry_s*)data)->elem.data->o.type != BUZZTYPE_NIL;
+   else
+      *n += buzzcrdt_member_islive((struct buzzcrdt_member_s*)data);
+}
+
+uint32_t buzzcrdt_length(const buzzcrdt_t c) {
+   uint32_t n = 0;
+   void* params[2] = { c, &n };
+   buzzdict_foreach(c->data, buzzcrdt_size_entry, params);
+   return n;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * A part of the state to send.
+ */
+struct buzzcrdt_part_s {
+   const void* key;
+   void* data;
+};
+
+void buzzcrdt_touch_entry(const void* key, void* data, void* params) {
+   buzzcrdt_t c = (buzzcrdt_t)params;
+   switch(c->type) {
+      case BUZZCRDT_GCOUNTER:
+      case BUZZCRDT_PNCOUNTER:
+         buzzcrdt_touch(c, &((struct buzzcrdt_count_s*)data)->dirty);
+         break;
+      case BUZZCRDT_LWWMAP:
+         buzzcrdt_touch(c, &((struct buzzcrdt_entry_s*)data)->dirty);
+         break;
+      case BUZZCRDT_ORSET:
+         buzzcrdt_touch(c, &((struct buzzcrdt_member_s*)data)->dirty);
+         break;
+   }
+}
+
+void buzzcrdt_collect_entry(const void* key, void* data, void* params) {
+   uint8_t dirty;
+   switch(((buzzcrdt_t)((void**)params)[0])->type) {
+      case BUZZCRDT_GCOUNTER:
+      case BUZZCRDT_PNCOUNTER:
+         dirty = ((struct buzzcrdt_count_s*)data)->dirty;
+         break;
+      case BUZZCRDT_LWWMAP:
+         dirty = ((struct buzzcrdt_entry_s*)data)->dirty;
+         break;
+      default:
+         dirty = ((struct buzzcrdt_member_s*)data)->dirty;
+         break;
+   }
+   if(!dirty) return;
+   struct buzzcrdt_part_s p = { .key = key, .data = data };
+   buzzdarray_push((buzzdarray_t)((void**)params)[1], &p);
+}
+
+/*
+ * Serializes a part of the state.
+ */
+static void buzzcrdt_part_serialize(buzzmsg_payload_t buf,
+                                    const buzzcrdt_t c,
+                                    const struct buzzcrdt_part_s* p,
+                                    int wide) {
+   switch(c->type) {
+      case BUZZCRDT_GCOUNTER:
+      case BUZZCRDT_PNCOUNTER: {
+         struct buzzcrdt_count_s* x = (struct buzzcrdt_count_s*)p->data;
+         buzzmsg_serialize_u16(buf, *(uint16_t*)p->key);
+         buzzmsg_serialize_u32(buf, x->inc);
+         if(c->type == BUZZCRDT_PNCOUNTER)
+            buzzmsg_serialize_u32(buf, x->dec);
+         x->dirty = 0;
+         break;
+      }
+      case BUZZCRDT_LWWMAP: {
+         struct buzzcrdt_entry_s* x = (struct buzzcrdt_entry_s*)p->data;
+         buzzvstig_elem_serialize(buf, *(buzzobj_t*)p->key, &x->elem, wide);
+         x->dirty = 0;
+         break;
+      }
+      case BUZZCRDT_ORSET: {
+         struct buzzcrdt_member_s* x = (struct buzzcrdt_member_s*)p->data;
+         buzzobj_serialize(buf, *(buzzobj_t*)p->key);
+         buzzmsg_serialize_u16(buf, buzzdarray_size(x->tags));
+         uint32_t i;
+         for(i = 0; i < buzzdarray_size(x->tags); ++i) {
+            const struct buzzcrdt_tag_s* t = &buzzdarray_get(x->tags, i, struct buzzcrdt_tag_s);
+            buzzmsg_serialize_u16(buf, t->robot);
+            buzzmsg_serialize_u32(buf, t->seq);
+            buzzmsg_serialize_u8(buf, t->removed);
+         }
+         x->dirty = 0;
+         break;
+      }
+      case BUZZCRDT_MAXREG: {
+         struct buzzcrdt_entry_s* x = (struct buzzcrdt_entry_s*)p->data;
+         buzzobj_serialize(buf, x->elem.data);
+         x->dirty = 0;
+         break;
+      }
+   }
+}
+
+void buzzcrdt_flush(buzzvm_t vm,
+                    uint16_t id,
+                    buzzcrdt_t c) {
+   /* Time to send the whole state? */
+   if(c->synctimer > 0)
+      --c->synctimer;
+   if(c->synctimer == 0) {
+      c->synctimer = BUZZCRDT_SYNC_PERIOD;
+      if(c->type == BUZZCRDT_MAXREG) {
+         if(c->reg.elem.data) buzzcrdt_touch(c, &c->reg.dirty);
+      }
+      else {
+         buzzdict_foreach(c->data, buzzcrdt_touch_entry, c);
+      }
+   }
+   if(c->dirty == 0) return;
+   /* Collect the parts to send */
+   buzzdarray_t parts = buzzdarray_new(c->dirty, sizeof(struct buzzcrdt_part_s), NULL);
+   if(c->type == BUZZCRDT_MAXREG) {
+      struct buzzcrdt_part_s p = { .key = NULL, .data = &c->reg };
+      buzzdarray_push(parts, &p);
+   }
+   else {
+      void* params[2] = { c, parts };
+      buzzdict_foreach(c->data, buzzcrdt_collect_entry, params);
+   }
+   /* Make the messages */
+   uint32_t i, j;
+   for(i = 0; i < buzzdarray_size(parts); i += BUZZCRDT_DELTA_MAX) {
+      uint32_t n = buzzdarray_size(parts) - i;
+      if(n > BUZZCRDT_DELTA_MAX) n = BUZZCRDT_DELTA_MAX;
+      /* The map entries use 64-bit timestamps if one needs them */
+      int wide = 0;
+      if(c->type == BUZZCRDT_LWWMAP)
+         for(j = i; j < i + n && !wide; ++j)
+            wide = buzzvstig_elem_iswide(
+               &((struct buzzcrdt_entry_s*)buzzdarray_get(parts, j, struct buzzcrdt_part_s).data)->elem);
+      buzzmsg_payload_t m = buzzmsg_payload_new(16 * n);
+      buzzmsg_serialize_u8(m, BUZZMSG_CRDT_DELTA | (wide ? BUZZMSG_FLAG_WIDE : 0));
+      buzzmsg_serialize_u16(m, id);
+      buzzmsg_serialize_u8(m, c->type);
+      buzzmsg_serialize_u16(m, n);
+      for(j = i; j < i + n; ++j)
+         buzzcrdt_part_serialize(m, c, &buzzdarray_get(parts, j, struct buzzcrdt_part_s), wide);
+      buzzoutmsg_queue_append_crdt(vm, m);
+   }
+   buzzdarray_destroy(&parts);
+   c->dirty = 0;
+}
+
+/****************************************/
+/****************************************/
+
+int64_t buzzcrdt_merge(buzzvm_t vm,
+                       buzzcrdt_t c,
+                       buzzmsg_payload_t buf,
+                       uint32_t pos,
+                       int wide) {
+   int64_t p = pos;
+   uint16_t count, i;
+   p = buzzmsg_deserialize_u16(&count, buf, p);
+   if(p < 0) return -1;
+   for(i = 0; i < count; ++i) {
+      switch(c->type) {
+         case BUZZCRDT_GCOUNTER:
+         case BUZZCRDT_PNCOUNTER: {
+            uint16_t robot;
+            uint32_t inc, dec = 0;
+            p = buzzmsg_deserialize_u16(&robot, buf, p);
+            if(p < 0) return -1;
+            p = buzzmsg_deserialize_u32(&inc, buf, p);
+            if(p < 0) return -1;
+            if(c->type == BUZZCRDT_PNCOUNTER) {
+               p = buzzmsg_deserialize_u32(&dec, buf, p);
+               if(p < 0) return -1;
+            }
+            /* Each contribution only grows */
+            struct buzzcrdt_count_s* x = buzzcrdt_count_get(c, robot);
+            if(inc > x->inc || dec > x->dec) {
+               if(inc > x->inc) x->inc = inc;
+               if(dec > x->dec) x->dec = dec;
+               buzzcrdt_touch(c, &x->dirty);
+            }
+            break;
+         }
+         case BUZZCRDT_LWWMAP: {
+            buzzobj_t k;
+            struct buzzvstig_elem_s e;
+            buzzvstig_elem_t pe = &e;
+            memset(&e, 0, sizeof(e));
+            p = buzzvstig_elem_deserialize(&k, &pe, buf, p, wide, vm);
+            if(p < 0) return -1;
+            if(!buzzcrdt_iskey(k)) break;
+            const struct buzzcrdt_entry_s* l = buzzdict_get(c->data, &k, struct buzzcrdt_entry_s);
+            if(l && !wide) e.timestamp = buzzvstig_ts_extend(l->elem.timestamp, e.timestamp);
+            buzzvstig_clock_update(vm, e.timestamp);
+            if(!l || buzzcrdt_entry_wins(&e, &l->elem)) {
+               struct buzzcrdt_entry_s* x = buzzcrdt_entry_get(c, k);
+               x->elem = e;
+               buzzcrdt_touch(c, &x->dirty);
+            }
+            break;
+         }
+         case BUZZCRDT_ORSET: {
+            buzzobj_t o;
+            uint16_t ntags, j;
+            p = buzzobj_deserialize(&o, buf, p, vm);
+            if(p < 0) return -1;
+            p = buzzmsg_deserialize_u16(&ntags, buf, p);
+            if(p < 0) return -1;
+            struct buzzcrdt_member_s* x = buzzcrdt_iskey(o) ? buzzcrdt_member_get(c, o) : NULL;
+            int changed = 0;
+            for(j = 0; j < ntags; ++j) {
+               struct buzzcrdt_tag_s t;
+               p = buzzmsg_deserialize_u16(&t.robot, buf, p);
+               if(p < 0) return -1;
+               p = buzzmsg_deserialize_u32(&t.seq, buf, p);
+               if(p < 0) return -1;
+               p = buzzmsg_deserialize_u8(&t.removed, buf, p);
+               if(p < 0) return -1;
+               if(!x) continue;
+               /* A restarted robot must not reuse its old tags */
+               if(t.robot == vm->robot && t.seq > c->seq) c->seq = t.seq;
+               changed |= buzzcrdt_member_merge(x, &t);
+            }
+            if(changed) buzzcrdt_touch(c, &x->dirty);
+            break;
+         }
+         case BUZZCRDT_MAXREG: {
+            buzzobj_t o;
+            p = buzzobj_deserialize(&o, buf, p, vm);
+            if(p < 0) return -1;
+            if(o->o.type != BUZZTYPE_INT && o->o.type != BUZZTYPE_FLOAT) break;
+            if(!c->reg.elem.data || buzzobj_cmp(o, c->reg.elem.data) > 0) {
+               c->reg.elem.data = o;
+               buzzcrdt_touch(c, &c->reg.dirty);
+            }
+            break;
+         }
+      }
+   }
+   return p;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzcrdt_mark_entry(const void* key, void* data, void* params) {
+   buzzvm_t vm = (buzzvm_t)((void**)params)[0];
+   buzzcrdt_t c = (buzzcrdt_t)((void**)params)[1];
+   buzzheap_obj_mark(*(buzzobj_t*)key, vm);
+   if(c->type == BUZZCRDT_LWWMAP)
+      buzzheap_obj_mark(((struct buzzcrdt_entry_s*)data)->elem.data, vm);
+}
+
+void buzzcrdt_mark(const void* key, void* data, void* params) {
+   buzzcrdt_t c = *(buzzcrdt_t*)data;
+   if(c->type == BUZZCRDT_LWWMAP || c->type == BUZZCRDT_ORSET) {
+      void* p[2] = { params, c };
+      buzzdict_foreach(c->data, buzzcrdt_mark_entry, p);
+   }
+   else if(c->type == BUZZCRDT_MAXREG && c->reg.elem.data) {
+      buzzheap_obj_mark(c->reg.elem.data, (buzzvm_t)params);
+   }
+}
+
+void buzzcrdt_gc(buzzvm_t vm) {
+   buzzdict_foreach(vm->crdts, buzzcrdt_mark, vm);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Creates a shared structure and the table to access it.
+ */
+static int buzzcrdt_create(buzzvm_t vm, uint8_t type) {
+   buzzvm_lnum_assert(vm, 1);
+   /* Get the id */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
+   uint16_t id = buzzvm_stack_at(vm, 1)->i.value;
+   buzzvm_pop(vm);
+   /* Replace the structure with the same id, if any */
+   if(buzzdict_exists(vm->crdts, &id))
+      buzzdict_remove(vm->crdts, &id);
+   buzzcrdt_t c = buzzcrdt_new(type);
+   buzzdict_set(vm->crdts, &id, &c);
+   /* Create a table */
+   buzzvm_pusht(vm);
+   buzzvm_dup(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "id", 1));
+   buzzvm_pushi(vm, id);
+   buzzvm_tput(vm);
+   /* Add the methods */
+   switch(type) {
+      case BUZZCRDT_GCOUNTER:
+         function_register(increment);
+         function_register(value);
+         break;
+      case BUZZCRDT_PNCOUNTER:
+         function_register(increment);
+         function_register(decrement);
+         function_register(value);
+         break;
+      case BUZZCRDT_LWWMAP:
+         function_register(put);
+         function_register(get);
+         function_register(size);
+         function_register(foreach);
+         break;
+      case BUZZCRDT_ORSET:
+         function_register(add);
+         function_register(remove);
+         function_register(has);
+         function_register(size);
+         function_register(foreach);
+         break;
+      case BUZZCRDT_MAXREG:
+         function_register(put);
+         function_register(get);
+         break;
+   }
+   /* Return the table */
+   return buzzvm_ret1(vm);
+}
+
+int buzzcrdt_gcounter(buzzvm_t vm) {
+   return buzzcrdt_create(vm, BUZZCRDT_GCOUNTER);
+}
+
+int buzzcrdt_counter(buzzvm_t vm) {
+   return buzzcrdt_create(vm, BUZZCRDT_PNCOUNTER);
+}
+
+int buzzcrdt_lwwmap(buzzvm_t vm) {
+   return buzzcrdt_create(vm, BUZZCRDT_LWWMAP);
+}
+
+int buzzcrdt_set(buzzvm_t vm) {
+   return buzzcrdt_create(vm, BUZZCRDT_ORSET);
+}
+
+int buzzcrdt_maxreg(buzzvm_t vm) {
+   return buzzcrdt_create(vm, BUZZCRDT_MAXREG);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Returns the shared structure of the table a method was called on, or
+ * NULL if it was replaced by a structure of a type not in the given mask.
+ */
+static buzzcrdt_t buzzcrdt_self(buzzvm_t vm, int types) {
+   buzzvm_lload(vm, 0);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "id", 1));
+   buzzvm_tget(vm);
+   uint16_t id = buzzvm_stack_at(vm, 1)->i.value;
+   buzzvm_pop(vm);
+   const buzzcrdt_t* c = buzzdict_get(vm->crdts, &id, buzzcrdt_t);
+   if(!c || !((1 << (*c)->type) & types)) return NULL;
+   return *c;
+}
+
+/*
+ * Adds to the local contribution of a counter.
+ */
+static int buzzcrdt_change(buzzvm_t vm, int dec) {
+   /* Expected parameters: optionally, the amount */
+   if(buzzvm_lnum(vm) > 1) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_LNUM,
+                      "expected 0 or 1 parameters, got %" PRId64,
+                      buzzvm_lnum(vm));
+      return vm->state;
+   }
+   uint32_t n = 1;
+   if(buzzvm_lnum(vm) == 1) {
+      buzzvm_lload(vm, 1);
+      buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
+      int32_t v = buzzvm_stack_at(vm, 1)->i.value;
+      buzzvm_pop(vm);
+      if(v < 0) {
+         buzzvm_seterror(vm,
+                         BUZZVM_ERROR_TYPE,
+                         "%s(): expected a non-negative amount, got %d",
+                         dec ? "decrement" : "increment",
+                         v);
+         return vm->state;
+      }
+      n = v;
+   }
+   buzzcrdt_t c = buzzcrdt_self(vm, TYPE_COUNTER);
+   if(c && n > 0) {
+      struct buzzcrdt_count_s* x = buzzcrdt_count_get(c, vm->robot);
+      if(dec) x->dec += n;
+      else x->inc += n;
+      buzzcrdt_touch(c, &x->dirty);
+   }
+   return buzzvm_ret0(vm);
+}
+
+int buzzcrdt_increment(buzzvm_t vm) {
+   return buzzcrdt_change(vm, 0);
+}
+
+int buzzcrdt_decrement(buzzvm_t vm) {
+   return buzzcrdt_change(vm, 1);
+}
+
+int buzzcrdt_value(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 0);
+   buzzcrdt_t c = buzzcrdt_self(vm, TYPE_COUNTER);
+   buzzvm_pushi(vm, c ? buzzcrdt_count(c) : 0);
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzcrdt_put(buzzvm_t vm) {
+   buzzcrdt_t c = buzzcrdt_self(vm, TYPE_MAP | TYPE_REG);
+   if(c && c->type == BUZZCRDT_MAXREG) {
+      /* Max-register: keep the value if it is the largest */
+      buzzvm_lnum_assert(vm, 1);
+      buzzvm_lload(vm, 1);
+      buzzvm_type_assert_number(vm, 1);
+      buzzobj_t v = buzzvm_stack_at(vm, 1);
+      if(!c->reg.elem.data || buzzobj_cmp(v, c->reg.elem.data) > 0) {
+         c->reg.elem.data = v;
+         buzzcrdt_touch(c, &c->reg.dirty);
+      }
+      return buzzvm_ret0(vm);
+   }
+   buzzvm_lnum_assert(vm, 2);
+   if(!c) return buzzvm_ret0(vm);
+   /* Map: write the entry, nil deletes it */
+   buzzvm_lload(vm, 1);
+   buzzobj_t k = buzzvm_stack_at(vm, 1);
+   if(!buzzcrdt_iskey(k)) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_TYPE,
+                      "expected int, float or string, got %s",
+                      buzztype_desc[k->o.type]);
+      return vm->state;
+   }
+   buzzvm_lload(vm, 2);
+   buzzobj_t v = buzzvm_stack_at(vm, 1);
+   const struct buzzcrdt_entry_s* l = buzzdict_get(c->data, &k, struct buzzcrdt_entry_s);
+   if(!l && v->o.type == BUZZTYPE_NIL) return buzzvm_ret0(vm);
+   struct buzzcrdt_entry_s* x = buzzcrdt_entry_get(c, k);
+   x->elem.data = v;
+   x->elem.timestamp = buzzvstig_clock_tick(vm, x->elem.timestamp);
+   x->elem.robot = vm->robot;
+   buzzcrdt_touch(c, &x->dirty);
+   return buzzvm_ret0(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzcrdt_get(buzzvm_t vm) {
+   buzzcrdt_t c = buzzcrdt_self(vm, TYPE_MAP | TYPE_REG);
+   if(c && c->type == BUZZCRDT_MAXREG) {
+      buzzvm_lnum_assert(vm, 0);
+      if(c->reg.elem.data) buzzvm_push(vm, c->reg.elem.data);
+      else buzzvm_pushnil(vm);
+      return buzzvm_ret1(vm);
+   }
+   buzzvm_lnum_assert(vm, 1);
+   buzzvm_lload(vm, 1);
+   buzzobj_t k = buzzvm_stack_at(vm, 1);
+   const struct buzzcrdt_entry_s* x = c ? buzzdict_get(c->data, &k, struct buzzcrdt_entry_s) : NULL;
+   if(x) buzzvm_push(vm, x->elem.data);
+   else buzzvm_pushnil(vm);
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzcrdt_size(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 0);
+   buzzcrdt_t c = buzzcrdt_self(vm, TYPE_MAP | TYPE_SET);
+   buzzvm_pushi(vm, c ? buzzcrdt_length(c) : 0);
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzcrdt_add(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 1);
+   buzzvm_lload(vm, 1);
+   buzzobj_t o = buzzvm_stack_at(vm, 1);
+   if(!buzzcrdt_iskey(o)) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_TYPE,
+                      "expected int, float or string, got %s",
+                      buzztype_desc[o->o.type]);
+      return vm->state;
+   }
+   buzzcrdt_t c = buzzcrdt_self(vm, TYPE_SET);
+   if(!c) return buzzvm_ret0(vm);
+   struct buzzcrdt_member_s* x = buzzcrdt_member_get(c, o);
+   /* Every add gets a new tag, so that it wins over concurrent removes;
+    * the previous add of this robot is replaced */
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(x->tags); ++i) {
+      struct buzzcrdt_tag_s* t =
+         (struct buzzcrdt_tag_s*)&buzzdarray_get(x->tags, i, struct buzzcrdt_tag_s);
+      if(t->robot == vm->robot) t->removed = 1;
+   }
+   struct buzzcrdt_tag_s t = { .robot = vm->robot, .seq = ++c->seq, .removed = 0 };
+   buzzdarray_push(x->tags, &t);
+   buzzcrdt_touch(c, &x->dirty);
+   return buzzvm_ret0(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzcrdt_remove(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 1);
+   buzzvm_lload(vm, 1);
+   buzzobj_t o = buzzvm_stack_at(vm, 1);
+   buzzcrdt_t c = buzzcrdt_self(vm, TYPE_SET);
+   struct buzzcrdt_member_s* x =
+      c ? (struct buzzcrdt_member_s*)buzzdict_rawget(c->data, &o) : NULL;
+   if(!x) return buzzvm_ret0(vm);
+   /* Remove the tags this robot has seen */
+   int changed = 0;
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(x->tags); ++i) {
+      struct buzzcrdt_tag_s* t =
+         (struct buzzcrdt_tag_s*)&buzzdarray_get(x->tags, i, struct buzzcrdt_tag_s);
+      if(!t->removed) {
+         t->removed = 1;
+         changed = 1;
+      }
+   }
+   if(changed) buzzcrdt_touch(c, &x->dirty);
+   return buzzvm_ret0(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzcrdt_has(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 1);
+   buzzvm_lload(vm, 1);
+   buzzobj_t o = buzzvm_stack_at(vm, 1);
+   buzzcrdt_t c = buzzcrdt_self(vm, TYPE_SET);
+   buzzvm_pushi(vm, c && buzzcrdt_contains(c, o));
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+struct buzzcrdt_foreach_params {
+   buzzvm_t vm;
+   buzzcrdt_t c;
+   buzzobj_t fun;
+};
+
+void buzzcrdt_foreach_entry(const void* key, void* data, void* params) {
+   struct buzzcrdt_foreach_params* p = (struct buzzcrdt_foreach_params*)params;
+   if(p->vm->state != BUZZVM_STATE_READY) return;
+   if(p->c->type == BUZZCRDT_LWWMAP) {
+      /* Map: push closure and params (key, value, robot) */
+      const struct buzzcrdt_entry_s* x = (const struct buzzcrdt_entry_s*)data;
+      if(x->elem.data->o.type == BUZZTYPE_NIL) return;
+      buzzvm_push(p->vm, p->fun);
+      buzzvm_push(p->vm, *(buzzobj_t*)key);
+      buzzvm_push(p->vm, x->elem.data);
+      buzzvm_pushi(p->vm, x->elem.robot);
+      p->vm->state = buzzvm_closure_call(p->vm, 3);
+   }
+   else {
+      /* Set: push closure and member */
+      if(!buzzcrdt_member_islive((const struct buzzcrdt_member_s*)data)) return;
+      buzzvm_push(p->vm, p->fun);
+      buzzvm_push(p->vm, *(buzzobj_t*)key);
+      p->vm->state = buzzvm_closure_call(p->vm, 1);
+   }
+   /* Get rid of the return value */
+   if(p->vm->state == BUZZVM_STATE_READY) buzzvm_pop(p->vm);
+}
+
+int buzzcrdt_foreach(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 1);
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
+   buzzobj_t f = buzzvm_stack_at(vm, 1);
+   buzzcrdt_t c = buzzcrdt_self(vm, TYPE_MAP | TYPE_SET);
+   if(c) {
+      struct buzzcrdt_foreach_params p = { .vm = vm, .c = c, .fun = f };
+      buzzdict_foreach(c->data, buzzcrdt_foreach_entry, &p);
+   }
+   return buzzvm_ret0(vm);
+}
+
+/****************************************/
+/****************************************/
@@ -0,0 +1,303 @@
+#ifndef BUZZCRDT_H
+#define BUZZCRDT_H
+
+#include <buzz/buzztype.h>
+#include <buzz/buzzdict.h>
+#include <buzz/buzzmsg.h>
+#include <buzz/buzzvstig.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /*
+    * Types of shared structures.
+    */
+   typedef enum {
+      BUZZCRDT_GCOUNTER = 0, // Counter that can only be incremented
+      BUZZCRDT_PNCOUNTER,    // Counter that can be incremented and decremented
+      BUZZCRDT_LWWMAP,       // Map where the last write of an entry wins
+      BUZZCRDT_ORSET,        // Set where a concurrent add wins over a remove
+      BUZZCRDT_MAXREG,       // Register that keeps the largest value written
+      BUZZCRDT_TYPE_COUNT    // How many types have been defined
+   } buzzcrdt_type_e;
+
+   /*
+    * The contribution of a robot to a counter.
+    */
+   struct buzzcrdt_count_s {
+      /* The total of the increments */
+      uint32_t inc;
+      /* The total of the decrements */
+      uint32_t dec;
+      /* Whether the contribution must be sent to the neighbors */
+      uint8_t dirty;
+   };
+
+   /*
+    * An entry in a map, or the value of a register.
+    */
+   struct buzzcrdt_entry_s {
+      /* The value (nil for a deleted entry), timestamp and writer */
+      struct buzzvstig_elem_s elem;
+      /* Whether the entry must be sent to the neighbors */
+      uint8_t dirty;
+   };
+
+   /*
+    * A tag of a set member.
+    * Each add creates a unique tag; a remove marks the observed tags.
+    */
+   struct buzzcrdt_tag_s {
+      /* The robot that added the member */
+      uint16_t robot;
+      /* The sequence number of the add on that robot */
+      uint32_t seq;
+      /* Whether the tag was removed */
+      uint8_t removed;
+   };
+
+   /*
+    * A set member.
+    */
+   struct buzzcrdt_member_s {
+      /* The tags, as a list of struct buzzcrdt_tag_s */
+      buzzdarray_t tags;
+      /* Whether the member must be sent to the neighbors */
+      uint8_t dirty;
+   };
+
+   /*
+    * A shared structure.
+    */
+   struct buzzcrdt_s {
+      /* The type */
+      uint8_t type;
+      /* The state:
+       * - counters: robot id (uint16_t) -> struct buzzcrdt_count_s
+       * - maps:     key (buzzobj_t) -> struct buzzcrdt_entry_s
+       * - sets:     member (buzzobj_t) -> struct buzzcrdt_member_s
+       * - max-registers: NULL */
+      buzzdict_t data;
+      /* The value of a register */
+      struct buzzcrdt_entry_s reg;
+      /* Sequence number of the last local add to a set */
+      uint32_t seq;
+      /* Number of parts of the state that must be sent to the neighbors */
+      uint32_t dirty;
+      /* Steps left before the whole state is sent again */
+      uint16_t synctimer;
+   };
+   typedef struct buzzcrdt_s* buzzcrdt_t;
+
+   /*
+    * Forward declaration of the Buzz VM.
+    */
+   struct buzzvm_s;
+
+   /*
+    * Registers the shared structure constructors in the 'stigmergy' table.
+    * Must be called after buzzvstig_register().
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzcrdt_register(struct buzzvm_s* vm);
+
+   /*
+    * Creates a new shared structure.
+    * @param type The type of the structure.
+    * @return The new shared structure.
+    * @see buzzcrdt_type_e
+    */
+   extern buzzcrdt_t buzzcrdt_new(uint8_t type);
+
+   /*
+    * Destroys a shared structure.
+    * @param c The shared structure.
+    */
+   extern void buzzcrdt_destroy(buzzcrdt_t* c);
+
+   /*
+    * Returns the value of a counter.
+    * @param c The shared structure.
+    * @return The sum of the increments minus the sum of the decrements.
+    */
+   extern int32_t buzzcrdt_count(const buzzcrdt_t c);
+
+   /*
+    * Returns <tt>true</tt> if a set contains a member.
+    * @param c The shared structure.
+    * @param x The member.
+    * @return <tt>true</tt> if the set contains the member.
+    */
+   extern int buzzcrdt_contains(const buzzcrdt_t c,
+                                const buzzobj_t x);
+
+   /*
+    * Returns the number of members of a set, or of live entries of a map.
+    * @param c The shared structure.
+    * @return The number of members or entries.
+    */
+   extern uint32_t buzzcrdt_length(const buzzcrdt_t c);
+
+   /*
+    * Queues the parts of the state that changed since the last call.
+    * The changes are sent as BUZZMSG_CRDT_DELTA messages of at most
+    * BUZZCRDT_DELTA_MAX parts each. Every BUZZCRDT_SYNC_PERIOD calls, the
+    * whole state is sent, so that lost messages and late robots are repaired.
+    * Called at every step by buzzvm_process_outmsgs().
+    * @param vm The Buzz VM state.
+    * @param id The id of the shared structure.
+    * @param c The shared structure.
+    */
+   extern void buzzcrdt_flush(struct buzzvm_s* vm,
+                              uint16_t id,
+                              buzzcrdt_t c);
+
+   /*
+    * Merges a delta received from a neighbor.
+    * The parts that change the local state are sent on at the next flush.
+    * The buffer is read starting at the number of parts, right after the
+    * id and the type of the structure.
+    * @param vm The Buzz VM state.
+    * @param c The shared structure.
+    * @param buf The message.
+    * @param pos The position at which the delta starts.
+    * @param wide 1 if the timestamps are 64-bit wide, 0 if they are 16-bit wide.
+    * @return The new position in the buffer, of -1 in case of error.
+    */
+   extern int64_t buzzcrdt_merge(struct buzzvm_s* vm,
+                                 buzzcrdt_t c,
+                                 buzzmsg_payload_t buf,
+                                 uint32_t pos,
+                                 int wide);
+
+   /*
+    * Marks the objects held by the shared structures.
+    * You should never call this function. It is called by
+    * buzzheap_gc() when necessary.
+    * @param vm The Buzz VM state.
+    */
+   extern void buzzcrdt_gc(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to create a new grow-only counter.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzcrdt_gcounter(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to create a new counter.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzcrdt_counter(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to create a new last-writer-wins map.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzcrdt_lwwmap(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to create a new observed-remove set.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzcrdt_set(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to create a new max-register.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzcrdt_maxreg(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to increment a counter by 1 or by the given amount.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzcrdt_increment(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to decrement a counter by 1 or by the given amount.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzcrdt_decrement(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to get the value of a counter.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzcrdt_value(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to write an entry of a map, or a value in a max-register.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzcrdt_put(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to read an entry of a map, or the value of a max-register.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzcrdt_get(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to get the number of entries of a map or members of a set.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzcrdt_size(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to loop through the entries of a map or the members of a set.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzcrdt_foreach(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to add a member to a set.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzcrdt_add(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to remove a member from a set.
+    * Only the adds this robot has seen are removed: a concurrent add wins.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzcrdt_remove(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to check whether a set contains a member.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzcrdt_has(struct buzzvm_s* vm);
+
+#ifdef __cplusplus
+}
+#endif
+
+/*
+ * Maximum number of parts in a delta message.
+ */
+#define BUZZCRDT_DELTA_MAX 32
+
+/*
+ * Number of control steps between two broadcasts of the whole state.
+ */
+#define BUZZCRDT_SYNC_PERIOD 50
+
+#endif
@@ -250,7 +250,46 @@ const int32_t* buzzdebug_info_get_fromscript(buzzdebug_t dbg,
 /****************************************/
 /****************************************/
 
-int offset_compare(const void* a, const void* b) {
+struct buzzdebug_merge_s {
+   buzzdebug_t dbg;
+   int32_t shift;
+};
+
+static void buzzdebug_merge_entry(const void* key, void* data, void* params) {
+   struct buzzdebug_merge_s* m = (struct buzzdebug_merge_s*)params;
+   buzzdebug_entry_t e = *(buzzdebug_entry_t*)data;
+   buzzdebug_info_set(m->dbg, *(int32_t*)key + m->shift, e->line, e->col, e->fname);
+}
+
+int buzzdebug_merge_module(buzzdebug_t dbg,
+                           buzzdebug_t mdbg,
+                           buzzvm_t vm,
+                           const uint8_t* bcode,
+                           uint32_t bcode_size) {
+   /* Skip the string table of the module */
+   uint16_t count;
+   uint32_t start = sizeof(uint16_t);
+   if(bcode_size < start) return 0;
+   memcpy(&count, bcode, sizeof(uint16_t));
+   for(; count > 0; --count) {
+      while(start < bcode_size && bcode[start] != 0) ++start;
+      if(start >= bcode_size) return 0;
+      ++start;
+   }
+   /* The code of the module is at the end of the code of the VM */
+   if(bcode_size - start > vm->bcode_size) return 0;
+   struct buzzdebug_merge_s m = {
+      .dbg = dbg,
+      .shift = (int32_t)(vm->bcode_size - (bcode_size - start)) - (int32_t)start
+   };
+   buzzdict_foreach(mdbg->off2script, buzzdebug_merge_entry, &m);
+   return 1;
+}
+
+/****************************************/
+/****************************************/
+
+static int offset_compare(const void* a, const void* b) {
    int32_t x = *(int32_t*)a;
    int32_t y = *(int32_t*)b;
    if(x < y) return -1;
@@ -522,3 +561,68 @@ void buzzdebug_backtrace(buzzvm_t vm,
 
 /****************************************/
 /****************************************/
+
+void buzzdebug_print_args(buzzvm_t vm,
+                          FILE* stream) {
+   for(int i = 1; i < buzzdarray_size(vm->lsyms->syms); ++i) {
+      buzzvm_lload(vm, i);
+      buzzobj_t o = buzzvm_stack_at(vm, 1);
+      buzzvm_pop(vm);
+      switch(o->o.type) {
+         case BUZZTYPE_NIL:
+            fprintf(stream, "[nil]");
+            break;
+         case BUZZTYPE_INT:
+            fprintf(stream, "%d", o->i.value);
+            break;
+         case BUZZTYPE_FLOAT:
+            fprintf(stream, "%f", o->f.value);
+            break;
+         case BUZZTYPE_TABLE:
+            fprintf(stream, "[table with %d elems]", (buzzdict_size(o->t.value)));
+            break;
+         case BUZZTYPE_CLOSURE:
+            if(o->c.value.isnative)
+               fprintf(stream, "[n-closure @%d]", o->c.value.ref);
+            else
+               fprintf(stream, "[c-closure @%d]", o->c.value.ref);
+            break;
+         case BUZZTYPE_STRING:
+            fprintf(stream, "%s", o->s.value.str);
+            break;
+         case BUZZTYPE_USERDATA:
+            fprintf(stream, "[userdata @%p]", o->u.value);
+            break;
+         default:
+            break;
+      }
+   }
+   fprintf(stream, "\n");
+}
+
+/****************************************/
+/****************************************/
+
+void buzzdebug_print_error(buzzvm_t vm,
+                           buzzdebug_t dbg,
+                           const char* bcfname,
+                           FILE* stream) {
+   const buzzdebug_entry_t* e = buzzdebug_info_get_fromoffset(dbg, &vm->oldpc);
+   if(e != NULL) {
+      fprintf(stream, "%s: execution terminated abnormally at %s:%" PRIu64 ":%" PRIu64 " : %s\n",
+              bcfname,
+              (*e)->fname,
+              (*e)->line,
+              (*e)->col,
+              vm->errormsg ? vm->errormsg : buzzvm_error_desc[vm->error]);
+   }
+   else {
+      fprintf(stream, "%s: execution terminated abnormally at bytecode offset %d: %s\n",
+              bcfname,
+              vm->oldpc,
+              vm->errormsg ? vm->errormsg : buzzvm_error_desc[vm->error]);
+   }
+}
+
+/****************************************/
+/****************************************/
@@ -111,6 +111,23 @@ extern "C" {
                                                        uint64_t col,
                                                        const char* fname);
    
+   /*
+    * Adds the debug data of a module to that of the VM it was loaded into.
+    * Call this function after buzzvm_load_module() returned 0, before
+    * loading anything else.
+    * @param dbg The debug data structure of the VM.
+    * @param mdbg The debug data structure of the module.
+    * @param vm The VM data.
+    * @param bcode The module bytecode.
+    * @param bcode_size The size (in bytes) of the module bytecode.
+    * @return 1 if no error, 0 otherwise.
+    */
+   extern int buzzdebug_merge_module(buzzdebug_t dbg,
+                                     buzzdebug_t mdbg,
+                                     buzzvm_t vm,
+                                     const uint8_t* bcode,
+                                     uint32_t bcode_size);
+
    /*
     * Sets a breakpoint at the given offset.
     * @param dbg The debug data structure.
@@ -196,6 +213,27 @@ extern "C" {
                                    buzzdebug_t dbg,
                                    FILE* stream);
 
+   /**
+    * Prints the arguments of the current closure call on one line.
+    * This is what the log() function of bzzrun and bzzswarm does.
+    * @param vm The VM data.
+    * @param stream The output stream.
+    */
+   extern void buzzdebug_print_args(buzzvm_t vm,
+                                    FILE* stream);
+
+   /**
+    * Prints where and why the execution of a VM terminated abnormally.
+    * @param vm The VM data.
+    * @param dbg The debug data structure.
+    * @param bcfname The name of the bytecode file.
+    * @param stream The output stream.
+    */
+   extern void buzzdebug_print_error(buzzvm_t vm,
+                                     buzzdebug_t dbg,
+                                     const char* bcfname,
+                                     FILE* stream);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,332 @@
+#include "buzzfrag.h"
+#include "buzzvm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/****************************************/
+/****************************************/
+
+/*
+ * An incomplete message
+ */
+struct buzzfrag_msg_s {
+   /* Epoch of the sender */
+   uint16_t epoch;
+   /* Sequence number */
+   uint16_t seq;
+   /* Number of fragments */
+   uint8_t count;
+   /* Number of fragments received so far (count once delivered) */
+   uint8_t received;
+   /* Number of bytes buffered so far */
+   uint32_t bytes;
+   /* Step at which the last new fragment was received */
+   uint32_t tick;
+   /* Fragments received so far (NULL for missing ones, NULL once delivered) */
+   buzzmsg_payload_t* parts;
+};
+typedef struct buzzfrag_msg_s* buzzfrag_msg_t;
+
+/****************************************/
+/****************************************/
+
+static void buzzfrag_payload_destroy(uint32_t pos, void* data, void* params) {
+   buzzmsg_payload_destroy((buzzmsg_payload_t*)data);
+}
+
+static void buzzfrag_msg_destroy(uint32_t pos, void* data, void* params) {
+   buzzfrag_msg_t m = *(buzzfrag_msg_t*)data;
+   uint32_t i;
+   if(m->parts) {
+      for(i = 0; i < m->count; ++i)
+         if(m->parts[i]) buzzmsg_payload_destroy(&m->parts[i]);
+      free(m->parts);
+   }
+   free(m);
+}
+
+static void buzzfrag_sender_destroy(const void* key, void* data, void* params) {
+   free((void*)key);
+   buzzdarray_destroy((buzzdarray_t*)data);
+   free(data);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Returns a new epoch. The layers created by a process get different
+ * epochs, and so do the processes started at different times.
+ */
+static uint16_t buzzfrag_epoch() {
+   static uint16_t count = 0;
+   return (uint16_t)(time(NULL) * 7919) + count++;
+}
+
+buzzfrag_t buzzfrag_new(uint32_t mtu,
+                        uint32_t timeout,
+                        uint32_t maxbytes) {
+   buzzfrag_t f = (buzzfrag_t)malloc(sizeof(struct buzzfrag_s));
+   /* A frame must have room for the header and some data */
+   f->mtu = mtu > BUZZFRAG_HEADER_SIZE ? mtu : BUZZFRAG_HEADER_SIZE + 1;
+   f->timeout = timeout;
+   f->maxbytes = maxbytes;
+   f->tick = 0;
+   f->epoch = buzzfrag_epoch();
+   f->seq = 0;
+   f->out = buzzdarray_new(1, sizeof(buzzmsg_payload_t), buzzfrag_payload_destroy);
+   f->in = buzzdict_new(10,
+                        sizeof(uint16_t),
+                        sizeof(buzzdarray_t),
+                        buzzdict_uint16keyhash,
+                        buzzdict_uint16keycmp,
+                        buzzfrag_sender_destroy);
+   return f;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzfrag_destroy(buzzfrag_t* f) {
+   buzzdarray_destroy(&(*f)->out);
+   buzzdict_destroy(&(*f)->in);
+   free(*f);
+   *f = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+buzzmsg_payload_t buzzfrag_out_first(buzzfrag_t f,
+                                     buzzvm_t vm) {
+   /* Pending fragments go first */
+   if(!buzzdarray_isempty(f->out))
+      return buzzdarray_clone(buzzdarray_get(f->out, 0, buzzmsg_payload_t));
+   /* Anything in the VM queue? */
+   if(buzzoutmsg_queue_isempty(vm)) return NULL;
+   buzzmsg_payload_t m = buzzoutmsg_queue_first(vm);
+   /* Small messages are sent as they are */
+   if(buzzmsg_payload_size(m) <= f->mtu) return m;
+   /* The message must be fragmented */
+   uint32_t size = buzzmsg_payload_size(m);
+   uint32_t chunk = f->mtu - BUZZFRAG_HEADER_SIZE;
+   uint32_t count = (size + chunk - 1) / chunk;
+   if(count > 255) {
+      fprintf(stderr, "[WARNING] [ROBOT %u] Discarded oversize message (%u bytes, max is %u)\n", vm->robot, size, 255 * chunk);
+      buzzmsg_payload_destroy(&m);
+      buzzoutmsg_queue_next(vm);
+      return buzzfrag_out_first(f, vm);
+   }
+   uint32_t i, j;
+   for(i = 0; i < count; ++i) {
+      buzzmsg_payload_t p = buzzmsg_payload_new(f->mtu);
+      buzzmsg_serialize_u8(p, BUZZMSG_FLAG_FRAGMENT);
+      buzzmsg_serialize_u16(p, f->epoch);
+      buzzmsg_serialize_u16(p, f->seq);
+      buzzmsg_serialize_u8(p, i);
+      buzzmsg_serialize_u8(p, count);
+      for(j = i * chunk; j < size && j < (i + 1) * chunk; ++j)
+         buzzmsg_serialize_u8(p, buzzmsg_payload_get(m, j));
+      buzzdarray_push(f->out, &p);
+   }
+   ++f->seq;
+   /* The message is now owned by the fragment queue */
+   buzzmsg_payload_destroy(&m);
+   buzzoutmsg_queue_next(vm);
+   return buzzdarray_clone(buzzdarray_get(f->out, 0, buzzmsg_payload_t));
+}
+
+/****************************************/
+/****************************************/
+
+void buzzfrag_out_next(buzzfrag_t f,
+                       buzzvm_t vm) {
+   if(!buzzdarray_isempty(f->out))
+      buzzdarray_remove(f->out, 0);
+   else
+      buzzoutmsg_queue_next(vm);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Drops the least recently updated messages of a sender until the
+ * incomplete ones fit the memory budget of the sender, and at most
+ * BUZZFRAG_DELIVERED_MAX delivered ones are left.
+ */
+static void buzzfrag_enforce_budget(buzzfrag_t f,
+                                    buzzdarray_t msgs) {
+   uint32_t total = 0, delivered = 0;
+   int64_t i;
+   for(i = 0; i < buzzdarray_size(msgs); ++i) {
+      buzzfrag_msg_t m = buzzdarray_get(msgs, i, buzzfrag_msg_t);
+      total += m->bytes;
+      delivered += (m->parts == NULL);
+   }
+   while(total > f->maxbytes || delivered > BUZZFRAG_DELIVERED_MAX) {
+      /* Look for the oldest message of the kind in excess */
+      int isdelivered = delivered > BUZZFRAG_DELIVERED_MAX;
+      int64_t oldest = -1;
+      for(i = 0; i < buzzdarray_size(msgs); ++i) {
+         buzzfrag_msg_t m = buzzdarray_get(msgs, i, buzzfrag_msg_t);
+         if((m->parts == NULL) == isdelivered &&
+            (oldest < 0 || m->tick < buzzdarray_get(msgs, oldest, buzzfrag_msg_t)->tick))
+            oldest = i;
+      }
+      buzzfrag_msg_t m = buzzdarray_get(msgs, oldest, buzzfrag_msg_t);
+      total -= m->bytes;
+      delivered -= isdelivered;
+      buzzdarray_remove(msgs, oldest);
+   }
+}
+
+void buzzfrag_in(buzzfrag_t f,
+                 buzzvm_t vm,
+                 uint16_t rid,
+                 buzzmsg_payload_t frame) {
+   /* Ignore empty frames */
+   if(buzzmsg_payload_size(frame) == 0) {
+      buzzmsg_payload_destroy(&frame);
+      return;
+   }
+   /* Regular messages go straight to the VM */
+   if(buzzmsg_payload_get(frame, 0) != BUZZMSG_FLAG_FRAGMENT) {
+      buzzinmsg_queue_append(vm, rid, frame);
+      return;
+   }
+   /* Parse the fragment header */
+   uint16_t epoch, seq;
+   uint8_t idx, count;
+   int64_t pos = buzzmsg_deserialize_u16(&epoch, frame, 1);
+   if(pos > 0) pos = buzzmsg_deserialize_u16(&seq, frame, pos);
+   if(pos > 0) pos = buzzmsg_deserialize_u8(&idx, frame, pos);
+   if(pos > 0) pos = buzzmsg_deserialize_u8(&count, frame, pos);
+   if(pos < 0 || count == 0 || idx >= count) {
+      fprintf(stderr, "[WARNING] [ROBOT %u] Malformed fragment received from robot %u\n", vm->robot, rid);
+      buzzmsg_payload_destroy(&frame);
+      return;
+   }
+   /* Get the incomplete messages of the sender */
+   buzzdarray_t* pmsgs = (buzzdarray_t*)buzzdict_rawget(f->in, &rid);
+   if(!pmsgs) {
+      buzzdarray_t msgs = buzzdarray_new(1, sizeof(buzzfrag_msg_t), buzzfrag_msg_destroy);
+      buzzdict_set(f->in, &rid, &msgs);
+      pmsgs = (buzzdarray_t*)buzzdict_rawget(f->in, &rid);
+   }
+   buzzdarray_t msgs = *pmsgs;
+   /* A new epoch means that the sender restarted, forget the old messages */
+   if(!buzzdarray_isempty(msgs) &&
+      buzzdarray_get(msgs, 0, buzzfrag_msg_t)->epoch != epoch)
+      buzzdarray_clear(msgs, 1);
+   /* Look for the message this fragment belongs to */
+   buzzfrag_msg_t m = NULL;
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(msgs); ++i) {
+      m = buzzdarray_get(msgs, i, buzzfrag_msg_t);
+      if(m->seq == seq) break;
+   }
+   if(i < buzzdarray_size(msgs) && m->count != count) {
+      /* Sequence number reused for a different message, start over */
+      buzzdarray_remove(msgs, i);
+      i = buzzdarray_size(msgs);
+   }
+   if(i == buzzdarray_size(msgs)) {
+      /* First fragment of a new message */
+      m = (buzzfrag_msg_t)malloc(sizeof(struct buzzfrag_msg_s));
+      m->epoch = epoch;
+      m->seq = seq;
+      m->count = count;
+      m->received = 0;
+      m->bytes = 0;
+      m->parts = (buzzmsg_payload_t*)calloc(count, sizeof(buzzmsg_payload_t));
+      m->tick = f->tick;
+      buzzdarray_push(msgs, &m);
+   }
+   /* Ignore duplicates, including those of already delivered messages */
+   if(!m->parts || m->parts[idx]) {
+      buzzmsg_payload_destroy(&frame);
+      return;
+   }
+   /* Store the fragment */
+   m->tick = f->tick;
+   m->parts[idx] = frame;
+   m->bytes += buzzmsg_payload_size(frame);
+   ++m->received;
+   if(m->received < m->count) {
+      /* Keep the memory used by this sender bounded */
+      buzzfrag_enforce_budget(f, msgs);
+      if(buzzdarray_isempty(msgs)) buzzdict_remove(f->in, &rid);
+      return;
+   }
+   /* The message is complete, put it back together */
+   buzzmsg_payload_t p = buzzmsg_payload_new(m->bytes);
+   uint32_t j, k;
+   for(j = 0; j < m->count; ++j) {
+      for(k = BUZZFRAG_HEADER_SIZE; k < buzzmsg_payload_size(m->parts[j]); ++k)
+         buzzmsg_serialize_u8(p, buzzmsg_payload_get(m->parts[j], k));
+      buzzmsg_payload_destroy(&m->parts[j]);
+   }
+   /* Keep an empty record until timeout to filter late duplicates */
+   free(m->parts);
+   m->parts = NULL;
+   m->bytes = 0;
+   buzzfrag_enforce_budget(f, msgs);
+   /* Deliver the message */
+   buzzinmsg_queue_append(vm, rid, p);
+}
+
+/****************************************/
+/****************************************/
+
+struct buzzfrag_update_s {
+   buzzfrag_t f;
+   buzzdarray_t empty;
+};
+
+static void buzzfrag_update_sender(const void* key, void* data, void* params) {
+   struct buzzfrag_update_s* u = (struct buzzfrag_update_s*)params;
+   buzzdarray_t msgs = *(buzzdarray_t*)data;
+   int64_t i;
+   for(i = buzzdarray_size(msgs) - 1; i >= 0; --i)
+      if(u->f->tick - buzzdarray_get(msgs, i, buzzfrag_msg_t)->tick > u->f->timeout)
+         buzzdarray_remove(msgs, i);
+   if(buzzdarray_isempty(msgs))
+      buzzdarray_push(u->empty, (uint16_t*)key);
+}
+
+void buzzfrag_update(buzzfrag_t f) {
+   ++f->tick;
+   /* Drop timed out messages */
+   struct buzzfrag_update_s u = {
+      .f = f,
+      .empty = buzzdarray_new(1, sizeof(uint16_t), NULL)
+   };
+   buzzdict_foreach(f->in, buzzfrag_update_sender, &u);
+   /* Forget about the senders with nothing pending */
+   int64_t i;
+   for(i = 0; i < buzzdarray_size(u.empty); ++i)
+      buzzdict_remove(f->in, &buzzdarray_get(u.empty, i, uint16_t));
+   buzzdarray_destroy(&u.empty);
+}
+
+/****************************************/
+/****************************************/
+
+static void buzzfrag_count_bytes(const void* key, void* data, void* params) {
+   buzzdarray_t msgs = *(buzzdarray_t*)data;
+   int64_t i;
+   for(i = 0; i < buzzdarray_size(msgs); ++i)
+      *(uint32_t*)params += buzzdarray_get(msgs, i, buzzfrag_msg_t)->bytes;
+}
+
+uint32_t buzzfrag_in_size(buzzfrag_t f) {
+   uint32_t bytes = 0;
+   buzzdict_foreach(f->in, buzzfrag_count_bytes, &bytes);
+   return bytes;
+}
+
+/****************************************/
+/****************************************/
@@ -0,0 +1,146 @@
+#ifndef BUZZFRAG_H
+#define BUZZFRAG_H
+
+#include <buzz/buzzmsg.h>
+#include <buzz/buzzdict.h>
+
+struct buzzvm_s;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /*
+    * Fragmentation and reassembly layer.
+    *
+    * This layer sits between the VM message queues and the radio. Outgoing
+    * messages larger than the link MTU are split into fragments that are
+    * sent over several frames, possibly across several control steps.
+    * Incoming fragments are buffered per sender and the complete message
+    * is appended to the VM input queue once all the fragments are there.
+    *
+    * A fragment is serialized as follows:
+    *
+    *    [u8 BUZZMSG_FLAG_FRAGMENT][u16 epoch][u16 seq][u8 index][u8 count][data]
+    *
+    * where epoch identifies the fragmentation layer of the sender, seq
+    * identifies the message for that layer, count is the number of
+    * fragments of the message and index is the position of this fragment.
+    * A sender that restarts gets a new epoch, so its new messages are not
+    * mistaken for the old ones.
+    */
+   struct buzzfrag_s {
+      /* Maximum size of a frame */
+      uint32_t mtu;
+      /* Number of steps after which an incomplete message is dropped */
+      uint32_t timeout;
+      /* Maximum number of bytes buffered for a single sender */
+      uint32_t maxbytes;
+      /* Current step */
+      uint32_t tick;
+      /* Epoch of this layer */
+      uint16_t epoch;
+      /* Sequence number of the next fragmented message */
+      uint16_t seq;
+      /* Fragments waiting to be sent */
+      buzzdarray_t out;
+      /* Incomplete messages, indexed by robot id */
+      buzzdict_t in;
+   };
+   typedef struct buzzfrag_s* buzzfrag_t;
+
+   /*
+    * Creates a new fragmentation layer.
+    * @param mtu The maximum size of a frame, header included.
+    * @param timeout The number of steps after which an incomplete message is dropped.
+    * @param maxbytes The maximum number of bytes buffered for a single sender.
+    * @return A new fragmentation layer.
+    */
+   extern buzzfrag_t buzzfrag_new(uint32_t mtu,
+                                  uint32_t timeout,
+                                  uint32_t maxbytes);
+
+   /*
+    * Destroys a fragmentation layer.
+    * @param f The fragmentation layer.
+    */
+   extern void buzzfrag_destroy(buzzfrag_t* f);
+
+   /*
+    * Returns the next frame to send.
+    * Frames come first from the pending fragments, then from the VM output
+    * queue. A VM message larger than the MTU is split into fragments and
+    * removed from the VM output queue.
+    * You are in charge of freeing the returned payload.
+    * @param f The fragmentation layer.
+    * @param vm The Buzz VM.
+    * @return The next frame to send, or NULL if there is nothing to send.
+    * @see buzzfrag_out_next
+    */
+   extern buzzmsg_payload_t buzzfrag_out_first(buzzfrag_t f,
+                                               struct buzzvm_s* vm);
+
+   /*
+    * Removes the frame returned by buzzfrag_out_first().
+    * @param f The fragmentation layer.
+    * @param vm The Buzz VM.
+    * @see buzzfrag_out_first
+    */
+   extern void buzzfrag_out_next(buzzfrag_t f,
+                                 struct buzzvm_s* vm);
+
+   /*
+    * Processes a received frame.
+    * Regular messages are appended to the VM input queue right away.
+    * Fragments are buffered until the message is complete.
+    * The ownership of the frame is assumed by this function.
+    * @param f The fragmentation layer.
+    * @param vm The Buzz VM.
+    * @param rid The id of the robot that sent the frame.
+    * @param frame The frame.
+    */
+   extern void buzzfrag_in(buzzfrag_t f,
+                           struct buzzvm_s* vm,
+                           uint16_t rid,
+                           buzzmsg_payload_t frame);
+
+   /*
+    * Advances the clock of the fragmentation layer.
+    * Incomplete messages older than the timeout are dropped.
+    * Call this function once per control step.
+    * @param f The fragmentation layer.
+    */
+   extern void buzzfrag_update(buzzfrag_t f);
+
+   /*
+    * Returns the number of bytes buffered for incomplete messages.
+    * The messages already delivered, kept to filter late duplicates, only
+    * cost a small record each, of which at most BUZZFRAG_DELIVERED_MAX are
+    * kept per sender.
+    * @param f The fragmentation layer.
+    * @return The number of bytes buffered for incomplete messages.
+    */
+   extern uint32_t buzzfrag_in_size(buzzfrag_t f);
+
+#ifdef __cplusplus
+}
+#endif
+
+/*
+ * Size of the fragment header.
+ */
+#define BUZZFRAG_HEADER_SIZE 7
+
+/*
+ * Maximum number of delivered messages remembered per sender.
+ */
+#define BUZZFRAG_DELIVERED_MAX 32
+
+/*
+ * Returns the number of fragments waiting to be sent.
+ * @param f The fragmentation layer.
+ * @return The number of fragments waiting to be sent.
+ */
+#define buzzfrag_out_size(f) buzzdarray_size((f)->out)
+
+#endif
@@ -175,6 +175,10 @@ void buzzheap_vstigobj_mark(const void* key, void* data, void* params) {
    buzzheap_obj_mark((*(buzzvstig_elem_t*)data)->data, params);
 }
 
+static void buzzheap_vstigkey_mark(const void* key, void* data, void* params) {
+   buzzheap_obj_mark(*(buzzobj_t*)key, params);
+}
+
 void buzzheap_vstig_mark(const void* key, void* data, void* params) {
    buzzvstig_t vstig = *(buzzvstig_t*)data;
    if(vstig->onconflict)
@@ -184,6 +188,9 @@ void buzzheap_vstig_mark(const void* key, void* data, void* params) {
    buzzvstig_foreach_elem(vstig,
                           buzzheap_vstigobj_mark,
                           params);
+   buzzdict_foreach(vstig->expired,
+                    buzzheap_vstigkey_mark,
+                    params);
 }
 
 void buzzheap_listener_mark(const void* key, void* data, void* params) {
@@ -211,10 +218,16 @@ void buzzheap_gc(struct buzzvm_s* vm) {
    buzzdarray_foreach(vm->lsymts, buzzheap_lsyms_mark, vm);
    /* Go through all the objects in the virtual stigmergy and mark them */
    buzzdict_foreach(vm->vstigs, buzzheap_vstig_mark, vm);
+   /* Go through all the objects in the shared structures and mark them */
+   buzzcrdt_gc(vm);
    /* Go through all the objects in the listeners and mark them */
    buzzdict_foreach(vm->listeners, buzzheap_listener_mark, vm);
    /* Go through all the objects in the out message queue and mark them */
    buzzoutmsg_gc(vm);
+   /* Go through all the objects in the neighbor data and mark them */
+   buzzneighbors_gc(vm);
+   /* Go through all the objects in the routing state and mark them */
+   buzzroute_gc(vm);
    /* Go through all the objects in the object list and delete the unmarked ones */
    int64_t i = buzzdarray_size(h->objs) - 1;
    while(i >= 0) {
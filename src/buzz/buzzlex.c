@@ -95,6 +95,31 @@ buzzlex_file_t buzzlex_file_new(const char* fname) {
    x->cur_line = 1;
    x->cur_col = 0;
    x->cur_c = 0;
+   x->fresh = 1;
+   x->statend = 0;
+   return x;
+}
+
+buzzlex_file_t buzzlex_file_new_fromstring(const char* fname,
+                                           const char* src) {
+   /* Create memory structure */
+   buzzlex_file_t x = (buzzlex_file_t)malloc(sizeof(struct buzzlex_file_s));
+   /* Copy the source, making sure it ends with a newline */
+   x->buf_size = strlen(src);
+   x->buf = (char*)malloc(x->buf_size + 2);
+   memcpy(x->buf, src, x->buf_size);
+   x->buf[x->buf_size] = '\n';
+   x->buf[x->buf_size+1] = '\0';
+   x->buf_size += 1;
+   /* Store the file name, as an absolute path if the file exists */
+   x->fname = realpath(fname, NULL);
+   if(!x->fname) x->fname = strdup(fname);
+   /* Initialize line and column counters */
+   x->cur_line = 1;
+   x->cur_col = 0;
+   x->cur_c = 0;
+   x->fresh = 0;
+   x->statend = 0;
    return x;
 }
 
@@ -208,17 +233,58 @@ static buzztok_t buzzlex_newtok(buzztok_type_e type,
 /****************************************/
 /****************************************/
 
-buzzlex_t buzzlex_new(const char* fname) {
+static buzzlex_t buzzlex_init(buzzlex_file_t f) {
    /* The lexer corresponds to a stack of file information */
-   buzzlex_t x = buzzdarray_new(10,
-                                sizeof(struct buzzlex_file_s*),
-                                buzzlex_file_destroy);
+   buzzlex_t x = (buzzlex_t)malloc(sizeof(struct buzzlex_s));
+   x->files = buzzdarray_new(10,
+                             sizeof(struct buzzlex_file_s*),
+                             NULL);
+   x->closed = buzzdarray_new(10,
+                              sizeof(struct buzzlex_file_s*),
+                              buzzlex_file_destroy);
+   /* The script is the bottom of the stack */
+   f->fresh = 0;
+   buzzdarray_push(x->files, &f);
+   /* Return the lexer state */
+   return x;
+}
+
+buzzlex_t buzzlex_new(const char* fname) {
    /* Read file */
    buzzlex_file_t f = buzzlex_file_new(fname);
    if(!f) return NULL;
-   buzzdarray_push(x, &f);
-   /* Return the lexer state */
-   return x;
+   return buzzlex_init(f);
+}
+
+/****************************************/
+/****************************************/
+
+buzzlex_t buzzlex_new_fromstring(const char* fname,
+                                 const char* src) {
+   /* The script is already in memory */
+   return buzzlex_init(buzzlex_file_new_fromstring(fname, src));
+}
+
+/****************************************/
+/****************************************/
+
+void buzzlex_destroy(buzzlex_t* lex) {
+   buzzdarray_foreach((*lex)->files, buzzlex_file_destroy, NULL);
+   buzzdarray_destroy(&(*lex)->files);
+   buzzdarray_destroy(&(*lex)->closed);
+   free(*lex);
+   *lex = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+static void buzzlex_popfile(buzzlex_t lex) {
+   buzzlex_file_t f = buzzlex_getfile(lex);
+   buzzdarray_pop(lex->files);
+   /* Keep the included files, they are the dependencies of the script */
+   if(buzzdarray_isempty(lex->files)) buzzlex_file_destroy(0, &f, NULL);
+   else buzzdarray_push(lex->closed, &f);
 }
 
 /****************************************/
@@ -260,7 +326,7 @@ buzzlex_t buzzlex_new(const char* fname) {
                             tokstart,            \
                             lexf->fname);
 
-buzztok_t buzzlex_nexttok(buzzlex_t lex) {
+static buzztok_t buzzlex_readtok(buzzlex_t lex) {
    buzzlex_file_t lexf = buzzlex_getfile(lex);
    do {
       /* Look for a non-space character */
@@ -273,8 +339,8 @@ buzztok_t buzzlex_nexttok(buzzlex_t lex) {
          /* End of stream? */
          if(lexf->cur_c >= lexf->buf_size) {
             /* Done with current file, go back to previous */
-            buzzdarray_pop(lex);
-            if(buzzdarray_isempty(lex))
+            buzzlex_popfile(lex);
+            if(buzzlex_done(lex))
                /* No file to go back to, done parsing */
                return eoftok;
             lexf = buzzlex_getfile(lex);
@@ -294,8 +360,8 @@ buzztok_t buzzlex_nexttok(buzzlex_t lex) {
          /* End of stream? */
          if(lexf->cur_c >= lexf->buf_size) {
             /* Done with current file, go back to previous */
-            buzzdarray_pop(lex);
-            if(buzzdarray_isempty(lex))
+            buzzlex_popfile(lex);
+            if(buzzlex_done(lex))
                /* No file to go back to, done parsing */
                return eoftok;
             lexf = buzzlex_getfile(lex);
@@ -365,12 +431,12 @@ buzztok_t buzzlex_nexttok(buzzlex_t lex) {
          }
          free(fname);
          /* Make sure the file hasn't been already included */
-         if(buzzdarray_find(lex, buzzlex_file_cmp, &f) < buzzdarray_size(lex)) {
+         if(buzzdarray_find(lex->files, buzzlex_file_cmp, &f) < buzzdarray_size(lex->files)) {
             buzzlex_file_destroy(0, &f, NULL);
          }
          else {
             /* Push file structure */
-            buzzdarray_push(lex, &f);
+            buzzdarray_push(lex->files, &f);
             lexf = buzzlex_getfile(lex);
          }
       }
@@ -604,6 +670,48 @@ buzztok_t buzzlex_nexttok(buzzlex_t lex) {
 /****************************************/
 /****************************************/
 
+buzztok_t buzzlex_nexttok(buzzlex_t lex) {
+   /* The included files stop being new when their first token other
+      than a statement end has been processed */
+   if(!buzzlex_done(lex) && !buzzlex_getfile(lex)->statend) {
+      int64_t i = buzzdarray_size(lex->files) - 1;
+      while(i >= 0 && buzzdarray_get(lex->files, i, buzzlex_file_t)->fresh) {
+         buzzdarray_get(lex->files, i, buzzlex_file_t)->fresh = 0;
+         --i;
+      }
+   }
+   /* Read the token */
+   buzztok_t tok = buzzlex_readtok(lex);
+   if(!buzzlex_done(lex))
+      buzzlex_getfile(lex)->statend = (tok->type == BUZZTOK_STATEND);
+   return tok;
+}
+
+/****************************************/
+/****************************************/
+
+buzzlex_file_t buzzlex_newfile(buzzlex_t lex) {
+   /* The new files are at the top of the stack */
+   int64_t i = buzzdarray_size(lex->files) - 1;
+   while(i >= 0 && buzzdarray_get(lex->files, i, buzzlex_file_t)->fresh) --i;
+   if(i == (int64_t)buzzdarray_size(lex->files) - 1) return NULL;
+   return buzzdarray_get(lex->files, i + 1, buzzlex_file_t);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzlex_closefile(buzzlex_t lex,
+                       buzzlex_file_t f) {
+   /* Close the files it included, then the file itself */
+   while(!buzzlex_done(lex) && buzzlex_getfile(lex) != f)
+      buzzlex_popfile(lex);
+   if(!buzzlex_done(lex)) buzzlex_popfile(lex);
+}
+
+/****************************************/
+/****************************************/
+
 buzztok_t buzzlex_clonetok(buzztok_t tok) {
    return buzzlex_newtok(tok->type,
                          tok->value ? strdup(tok->value) : NULL,
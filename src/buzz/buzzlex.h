@@ -81,14 +81,23 @@ extern "C" {
       char* buf;
       /* The name of the file */
       char* fname;
+      /* 1 if the file was included and none of its tokens has been processed yet */
+      int fresh;
+      /* 1 if the last token read from the file was a statement end */
+      int statend;
    };
    typedef struct buzzlex_file_s* buzzlex_file_t;
 
    /*
     * State of a lexer.
-    * It is simply a stack of buzzlex_file_t.
     */
-   typedef buzzdarray_t buzzlex_t;
+   struct buzzlex_s {
+      /* The stack of files being read */
+      buzzdarray_t files;
+      /* The included files that have been read to the end or closed */
+      buzzdarray_t closed;
+   };
+   typedef struct buzzlex_s* buzzlex_t;
 
    /*
     * Creates a new lexer.
@@ -97,23 +106,33 @@ extern "C" {
     */
    extern buzzlex_t buzzlex_new(const char* fname);
 
+   /*
+    * Creates a new lexer for a script held in memory.
+    * The included files are still looked up on disk.
+    * @param fname The name of the script, used in the tokens.
+    * @param src The script source code.
+    * @return The lexer state.
+    */
+   extern buzzlex_t buzzlex_new_fromstring(const char* fname,
+                                           const char* src);
+
    /*
     * Destroys the lexer.
     * @param lex The lexer state.
     */
-#define buzzlex_destroy(lex) buzzdarray_destroy(lex)
+   extern void buzzlex_destroy(buzzlex_t* lex);
 
    /*
     * Returns the current file being processed.
     * @param lex The lexer state.
     */
-#define buzzlex_getfile(lex) buzzdarray_last((lex), buzzlex_file_t)
+#define buzzlex_getfile(lex) buzzdarray_last((lex)->files, buzzlex_file_t)
 
    /*
     * Returns 1 if the lexer has no file left to tokenize, 0 otherwise.
     * @param lex The lexer state.
     */
-#define buzzlex_done(lex) buzzdarray_isempty(lex)
+#define buzzlex_done(lex) buzzdarray_isempty((lex)->files)
    
    /*
     * Processes the next token.
@@ -122,6 +141,24 @@ extern "C" {
     */
    extern buzztok_t buzzlex_nexttok(buzzlex_t lex);
 
+   /*
+    * Returns the file whose inclusion starts with the last token.
+    * This is the outermost file included while reading the last token,
+    * if no token other than statement ends has been read from it before.
+    * @param lex The lexer state.
+    * @return The file or NULL if the last token does not start an included file.
+    */
+   extern buzzlex_file_t buzzlex_newfile(buzzlex_t lex);
+
+   /*
+    * Stops reading an included file and the files it included.
+    * The next token is read from the file that included it.
+    * @param lex The lexer state.
+    * @param f The file, as returned by buzzlex_newfile().
+    */
+   extern void buzzlex_closefile(buzzlex_t lex,
+                                 buzzlex_file_t f);
+
    /*
     * Clones the given token.
     * @param tok The token to clone.
@@ -9,7 +9,12 @@ extern "C" {
 
    /*
     * Buzz message type.
-    * The types are ordered by decreasing priority
+    * The types are ordered by decreasing priority, except for
+    * BUZZMSG_VSTIG_DIGEST, which is sent right before BUZZMSG_VSTIG_PUT,
+    * BUZZMSG_VSTIG_PUTMANY, which is sent in place of BUZZMSG_VSTIG_PUT,
+    * BUZZMSG_VSTIG_BUCKET, BUZZMSG_CRDT_DELTA, BUZZMSG_ROUTE_VECTOR and
+    * BUZZMSG_AGGREGATE, which are sent right after BUZZMSG_VSTIG_QUERY, and
+    * BUZZMSG_ROUTE_DATA, which is sent right after BUZZMSG_BROADCAST
     */
    typedef enum {
       BUZZMSG_BROADCAST = 0, // Neighbor broadcast
@@ -18,6 +23,14 @@ extern "C" {
       BUZZMSG_VSTIG_QUERY,   // Virtual stigmergy QUERY
       BUZZMSG_SWARM_JOIN,    // Swarm joining
       BUZZMSG_SWARM_LEAVE,   // Swarm leaving
+      BUZZMSG_VSTIG_DIGEST,  // Virtual stigmergy digest (anti-entropy)
+      BUZZMSG_VSTIG_BUCKET,  // Virtual stigmergy digest bucket (anti-entropy)
+      BUZZMSG_CRDT_DELTA,    // Shared structure changes
+      BUZZMSG_SWARM_DIGEST,  // Swarm membership heartbeat
+      BUZZMSG_ROUTE_DATA,    // Routed message
+      BUZZMSG_ROUTE_VECTOR,  // Routing distance vector
+      BUZZMSG_AGGREGATE,     // Swarm-wide aggregate state
+      BUZZMSG_VSTIG_PUTMANY, // Virtual stigmergy PUT of several entries
       BUZZMSG_TYPE_COUNT     // How many Buzz message types have been defined
    } buzzmsg_payload_type_e;
 
@@ -145,6 +158,37 @@ extern "C" {
 }
 #endif
 
+/*
+ * Flag set in the type byte of a message whose body is compressed.
+ * @see buzzcompress_payload_encode
+ */
+#define BUZZMSG_FLAG_COMPRESSED 0x80
+
+/*
+ * Type byte of a fragment of a larger message.
+ * @see buzzfrag_out_first
+ */
+#define BUZZMSG_FLAG_FRAGMENT 0x40
+
+/*
+ * Type byte flag of a virtual stigmergy message whose entries have 64-bit
+ * timestamps. Without the flag, the timestamps are 16-bit wide.
+ * @see buzzvstig_elem_serialize
+ */
+#define BUZZMSG_FLAG_WIDE 0x20
+
+/*
+ * Mask to extract the message type from the type byte.
+ */
+#define BUZZMSG_TYPE_MASK 0x1F
+
+/*
+ * Returns the type of a serialized message, without flags.
+ * @param msg The message payload.
+ * @return The message type.
+ */
+#define buzzmsg_payload_type(msg) (buzzmsg_payload_get(msg, 0) & BUZZMSG_TYPE_MASK)
+
 /*
  * Create a new message payload.
  * @param cap The initial capacity of the message payload. Must be >0.
@@ -2,6 +2,8 @@
 #include "buzzvm.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
 
 /****************************************/
 /****************************************/
@@ -38,12 +40,79 @@ static int make_table(buzzvm_t vm, buzzobj_t* t) {
    function_register(*t, "map",     buzzneighbors_map);
    function_register(*t, "reduce",  buzzneighbors_reduce);
    function_register(*t, "count",   buzzneighbors_count);
+   function_register(*t, "sumvec",   buzzneighbors_sumvec);
+   function_register(*t, "centroid", buzzneighbors_centroid);
+   function_register(*t, "within",   buzzneighbors_within);
+   function_register(*t, "nearest",  buzzneighbors_nearest);
    return vm->state;
 }
 
 /****************************************/
 /****************************************/
 
+static void neighbors_latest_destroy(const void* key, void* data, void* params) {
+   buzzneighbors_latest_t l = *(buzzneighbors_latest_t*)data;
+   buzzdict_destroy(&l->steps);
+   free(l);
+   free((void*)key);
+   free(data);
+}
+
+buzzneighbors_t buzzneighbors_data_new() {
+   buzzneighbors_t n = (buzzneighbors_t)malloc(sizeof(struct buzzneighbors_s));
+   n->size      = 0;
+   n->capacity  = BUZZNEIGHBORS_INIT_CAPACITY;
+   n->ids       = (uint16_t*)malloc(n->capacity * sizeof(uint16_t));
+   n->distance  = (float*)malloc(n->capacity * sizeof(float));
+   n->azimuth   = (float*)malloc(n->capacity * sizeof(float));
+   n->elevation = (float*)malloc(n->capacity * sizeof(float));
+   n->x         = (float*)malloc(n->capacity * sizeof(float));
+   n->y         = (float*)malloc(n->capacity * sizeof(float));
+   n->cartesian = 1;
+   n->keys      = (buzzobj_t*)malloc(n->capacity * sizeof(buzzobj_t));
+   n->entries   = (buzzobj_t*)malloc(n->capacity * sizeof(buzzobj_t));
+   n->fields    = buzzdarray_new(1, sizeof(buzzneighbors_field_t), NULL);
+   n->nslots    = 2 * n->capacity;
+   n->slots     = (uint32_t*)calloc(n->nslots, sizeof(uint32_t));
+   n->table     = NULL;
+   n->latest    = buzzdict_new(10,
+                               sizeof(uint16_t),
+                               sizeof(buzzneighbors_latest_t),
+                               buzzdict_uint16keyhash,
+                               buzzdict_uint16keycmp,
+                               neighbors_latest_destroy);
+   n->step      = 0;
+   return n;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzneighbors_data_destroy(buzzneighbors_t* n) {
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size((*n)->fields); ++i) {
+      buzzneighbors_field_t f = buzzdarray_get((*n)->fields, i, buzzneighbors_field_t);
+      free(f->values);
+      free(f);
+   }
+   buzzdarray_destroy(&(*n)->fields);
+   buzzdict_destroy(&(*n)->latest);
+   free((*n)->ids);
+   free((*n)->distance);
+   free((*n)->azimuth);
+   free((*n)->elevation);
+   free((*n)->x);
+   free((*n)->y);
+   free((*n)->keys);
+   free((*n)->entries);
+   free((*n)->slots);
+   free(*n);
+   *n = NULL;
+}
+
+/****************************************/
+/****************************************/
+
 int buzzneighbors_new(buzzvm_t vm) {
    if(vm->state != BUZZVM_STATE_READY) return vm->state;
    /* Make new table */
@@ -54,6 +123,10 @@ int buzzneighbors_new(buzzvm_t vm) {
    function_register(t, "broadcast", buzzneighbors_broadcast);
    function_register(t, "listen",    buzzneighbors_listen);
    function_register(t, "ignore",    buzzneighbors_ignore);
+   function_register(t, "latest",    buzzneighbors_latest);
+   function_register(t, "age",       buzzneighbors_age);
+   /* The data of this table is in vm->neighbors */
+   vm->neighbors->table = t;
    /* Register table as global symbol */
    buzzvm_pushs(vm, buzzvm_string_register(vm, "neighbors", 1));
    buzzvm_push(vm, t);
@@ -66,68 +139,265 @@ int buzzneighbors_new(buzzvm_t vm) {
 
 int buzzneighbors_reset(buzzvm_t vm) {
    if(vm->state != BUZZVM_STATE_READY) return vm->state;
-   /* Get "neighbors" table */
-   buzzvm_pushs(vm, buzzvm_string_register(vm, "neighbors", 1));
-   buzzvm_gload(vm);
-   buzzvm_type_assert(vm, 1, BUZZTYPE_TABLE);
-   /* Make a new POSES table */
-   buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-   buzzvm_pusht(vm);
-   buzzvm_tput(vm);
+   buzzneighbors_t n = vm->neighbors;
+   n->size = 0;
+   n->cartesian = 1;
+   memset(n->slots, 0, n->nslots * sizeof(uint32_t));
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(n->fields); ++i)
+      buzzdarray_get(n->fields, i, buzzneighbors_field_t)->set = 0;
    return vm->state;
 }
 
 /****************************************/
 /****************************************/
 
+/*
+ * Returns the slot of a robot id: the slot that holds it, or the empty
+ * slot where it goes.
+ */
+static uint32_t neighbors_slot(buzzneighbors_t n, uint16_t robot) {
+   uint32_t h = (robot * 2654435761u) & (n->nslots - 1);
+   while(n->slots[h] && n->ids[n->slots[h] - 1] != robot)
+      h = (h + 1) & (n->nslots - 1);
+   return h;
+}
+
+/*
+ * Returns the position of a robot in the arrays, or -1 if not found.
+ */
+static int64_t neighbors_find(buzzneighbors_t n, uint16_t robot) {
+   uint32_t h = neighbors_slot(n, robot);
+   return (int64_t)n->slots[h] - 1;
+}
+
+/*
+ * Doubles the capacity of the arrays.
+ */
+static void neighbors_grow(buzzneighbors_t n) {
+   n->capacity *= 2;
+   n->ids       = (uint16_t*)realloc(n->ids,       n->capacity * sizeof(uint16_t));
+   n->distance  = (float*)realloc(n->distance,     n->capacity * sizeof(float));
+   n->azimuth   = (float*)realloc(n->azimuth,      n->capacity * sizeof(float));
+   n->elevation = (float*)realloc(n->elevation,    n->capacity * sizeof(float));
+   n->x         = (float*)realloc(n->x,            n->capacity * sizeof(float));
+   n->y         = (float*)realloc(n->y,            n->capacity * sizeof(float));
+   n->keys      = (buzzobj_t*)realloc(n->keys,     n->capacity * sizeof(buzzobj_t));
+   n->entries   = (buzzobj_t*)realloc(n->entries,  n->capacity * sizeof(buzzobj_t));
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(n->fields); ++i) {
+      buzzneighbors_field_t f = buzzdarray_get(n->fields, i, buzzneighbors_field_t);
+      f->values = (float*)realloc(f->values, n->capacity * sizeof(float));
+   }
+   /* Keep the hash table at most half full */
+   free(n->slots);
+   n->nslots = 2 * n->capacity;
+   n->slots = (uint32_t*)calloc(n->nslots, sizeof(uint32_t));
+   for(i = 0; i < n->size; ++i)
+      n->slots[neighbors_slot(n, n->ids[i])] = i + 1;
+}
+
 int buzzneighbors_add(buzzvm_t vm,
                       uint16_t robot,
                       float distance,
                       float azimuth,
                       float elevation) {
    if(vm->state != BUZZVM_STATE_READY) return vm->state;
-   /* Get "neighbors" table */
-   buzzvm_pushs(vm, buzzvm_string_register(vm, "neighbors", 1));
-   buzzvm_gload(vm);
-   buzzvm_type_assert(vm, 1, BUZZTYPE_TABLE);
-   buzzobj_t nbr = buzzvm_stack_at(vm, 1);
-   /* Get POSES field */
+   buzzneighbors_t n = vm->neighbors;
+   /* A robot already added is updated */
+   uint32_t h = neighbors_slot(n, robot);
+   uint32_t i;
+   if(n->slots[h]) {
+      i = n->slots[h] - 1;
+   }
+   else {
+      if(n->size == n->capacity) {
+         neighbors_grow(n);
+         h = neighbors_slot(n, robot);
+      }
+      i = n->size++;
+      n->slots[h] = i + 1;
+      n->ids[i] = robot;
+      n->keys[i] = NULL;
+      /* The custom fields already set have no value for a new neighbor */
+      uint32_t j;
+      for(j = 0; j < buzzdarray_size(n->fields); ++j)
+         buzzdarray_get(n->fields, j, buzzneighbors_field_t)->values[i] = NAN;
+   }
+   n->distance[i] = distance;
+   n->azimuth[i] = azimuth;
+   n->elevation[i] = elevation;
+   n->entries[i] = NULL;
+   n->cartesian = 0;
+   return vm->state;
+}
+
+/****************************************/
+/****************************************/
+
+int buzzneighbors_set_all(buzzvm_t vm,
+                          uint32_t n,
+                          const uint16_t* ids,
+                          const float* distance,
+                          const float* azimuth,
+                          const float* elevation) {
+   buzzneighbors_reset(vm);
+   uint32_t i;
+   for(i = 0; i < n; ++i)
+      buzzneighbors_add(vm, ids[i], distance[i], azimuth[i], elevation[i]);
+   return vm->state;
+}
+
+/****************************************/
+/****************************************/
+
+int buzzneighbors_set_field(buzzvm_t vm,
+                            const char* name,
+                            const float* values) {
+   if(vm->state != BUZZVM_STATE_READY) return vm->state;
+   buzzneighbors_t n = vm->neighbors;
+   uint16_t sid = buzzvm_string_register(vm, name, 1);
+   /* Look for the field, or make it */
+   buzzneighbors_field_t f = NULL;
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(n->fields) && !f; ++i)
+      if(buzzdarray_get(n->fields, i, buzzneighbors_field_t)->name == sid)
+         f = buzzdarray_get(n->fields, i, buzzneighbors_field_t);
+   if(!f) {
+      f = (buzzneighbors_field_t)malloc(sizeof(struct buzzneighbors_field_s));
+      f->name = sid;
+      f->values = (float*)malloc(n->capacity * sizeof(float));
+      buzzdarray_push(n->fields, &f);
+   }
+   f->set = 1;
+   memcpy(f->values, values, n->size * sizeof(float));
+   /* The tables made so far lack the field */
+   memset(n->entries, 0, n->size * sizeof(buzzobj_t));
+   return vm->state;
+}
+
+/****************************************/
+/****************************************/
+
+int buzzneighbors_distance(buzzvm_t vm,
+                           uint16_t robot,
+                           float* distance) {
+   int64_t i = neighbors_find(vm->neighbors, robot);
+   if(i < 0) return 0;
+   *distance = vm->neighbors->distance[i];
+   return 1;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Puts a float field in a table.
+ */
+static void neighbors_put(buzzvm_t vm, buzzobj_t t, uint16_t name, float value) {
+   buzzvm_push(vm, t);
+   buzzvm_pushs(vm, name);
+   buzzvm_pushf(vm, value);
+   buzzvm_tput(vm);
+}
+
+/*
+ * Returns the table of a neighbor, making it if necessary.
+ */
+static buzzobj_t neighbors_entry(buzzvm_t vm, uint32_t i) {
+   buzzneighbors_t n = vm->neighbors;
+   if(!n->entries[i]) {
+      buzzobj_t e = buzzheap_newobj(vm, BUZZTYPE_TABLE);
+      neighbors_put(vm, e, buzzvm_string_register(vm, "distance", 1), n->distance[i]);
+      neighbors_put(vm, e, buzzvm_string_register(vm, "azimuth", 1), n->azimuth[i]);
+      neighbors_put(vm, e, buzzvm_string_register(vm, "elevation", 1), n->elevation[i]);
+      uint32_t j;
+      for(j = 0; j < buzzdarray_size(n->fields); ++j) {
+         buzzneighbors_field_t f = buzzdarray_get(n->fields, j, buzzneighbors_field_t);
+         if(f->set && !isnan(f->values[i])) neighbors_put(vm, e, f->name, f->values[i]);
+      }
+      n->entries[i] = e;
+   }
+   return n->entries[i];
+}
+
+/*
+ * Returns the robot id object of a neighbor, making it if necessary.
+ */
+static buzzobj_t neighbors_key(buzzvm_t vm, uint32_t i) {
+   buzzneighbors_t n = vm->neighbors;
+   if(!n->keys[i]) {
+      n->keys[i] = buzzheap_newobj(vm, BUZZTYPE_INT);
+      n->keys[i]->i.value = n->ids[i];
+   }
+   return n->keys[i];
+}
+
+/*
+ * Returns 1 if a neighbor table has data, 0 otherwise.
+ * The global table always has data; the others have it in the POSES field.
+ */
+static int neighbors_hasdata(buzzvm_t vm, buzzobj_t self) {
+   if(self == vm->neighbors->table) return 1;
+   buzzvm_push(vm, self);
    buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
    buzzvm_tget(vm);
-   if(buzzvm_stack_at(vm, 1)->o.type == BUZZTYPE_NIL) {
-      /* Empty data, create a new table */
-      buzzvm_pop(vm);
-      buzzvm_push(vm, nbr);
+   int r = buzzvm_stack_at(vm, 1)->o.type == BUZZTYPE_TABLE;
+   buzzvm_pop(vm);
+   return r;
+}
+
+/*
+ * Calls a function for each neighbor in a table, as buzzdict_foreach()
+ * does on the POSES field. The tables of the neighbors in the global
+ * table are made as needed.
+ */
+static void neighbors_foreach(buzzvm_t vm,
+                              buzzobj_t self,
+                              buzzdict_elem_funp fun,
+                              void* params) {
+   if(self == vm->neighbors->table) {
+      /* The closures called by fun cannot change the neighbor data */
+      uint32_t i;
+      for(i = 0; i < vm->neighbors->size; ++i) {
+         buzzobj_t k = neighbors_key(vm, i);
+         buzzobj_t e = neighbors_entry(vm, i);
+         fun(&k, &e, params);
+      }
+   }
+   else {
+      buzzvm_push(vm, self);
       buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-      buzzvm_pusht(vm);
+      buzzvm_tget(vm);
       buzzobj_t data = buzzvm_stack_at(vm, 1);
-      buzzvm_tput(vm);
-      buzzvm_push(vm, data);
-   }
-   /* When we get here, the POSES table is on top of the stack */
-   /* Push robot id */
-   buzzvm_pushi(vm, robot);
-   /* Create entry table */
-   buzzobj_t entry = buzzheap_newobj(vm, BUZZTYPE_TABLE);
-   /* Insert distance */
-   buzzvm_push(vm, entry);
-   buzzvm_pushs(vm, buzzvm_string_register(vm, "distance", 1));
-   buzzvm_pushf(vm, distance);
-   buzzvm_tput(vm);
-   /* Insert azimuth */
-   buzzvm_push(vm, entry);
-   buzzvm_pushs(vm, buzzvm_string_register(vm, "azimuth", 1));
-   buzzvm_pushf(vm, azimuth);
-   buzzvm_tput(vm);
-   /* Insert elevation */
-   buzzvm_push(vm, entry);
-   buzzvm_pushs(vm, buzzvm_string_register(vm, "elevation", 1));
-   buzzvm_pushf(vm, elevation);
-   buzzvm_tput(vm);
-   /* Save entry into data table */
-   buzzvm_push(vm, entry);
-   buzzvm_tput(vm);
-   return vm->state;
+      buzzvm_pop(vm);
+      if(data->o.type == BUZZTYPE_TABLE)
+         buzzdict_foreach(data->t.value, fun, params);
+   }
+}
+
+/****************************************/
+/****************************************/
+
+static void neighbors_mark(buzzvm_t vm, buzzobj_t o) {
+   if(o) buzzheap_obj_mark(o, vm);
+}
+
+static void neighbors_latest_mark(const void* key, void* data, void* params) {
+   buzzvm_t vm = (buzzvm_t)params;
+   buzzstrman_gc_mark(vm->strings, *(uint16_t*)key);
+   buzzheap_obj_mark((*(buzzneighbors_latest_t*)data)->values, vm);
+}
+
+void buzzneighbors_gc(buzzvm_t vm) {
+   buzzneighbors_t n = vm->neighbors;
+   neighbors_mark(vm, n->table);
+   buzzdict_foreach(n->latest, neighbors_latest_mark, vm);
+   uint32_t i;
+   for(i = 0; i < n->size; ++i) {
+      neighbors_mark(vm, n->keys[i]);
+      neighbors_mark(vm, n->entries[i]);
+   }
 }
 
 /****************************************/
@@ -179,12 +449,159 @@ int buzzneighbors_ignore(buzzvm_t vm) {
    buzzdict_remove(
       vm->listeners,
       &(buzzvm_stack_at(vm, 1)->s.value.sid));
+   /* Stop following the topic */
+   buzzdict_remove(
+      vm->neighbors->latest,
+      &(buzzvm_stack_at(vm, 1)->s.value.sid));
    return buzzvm_ret0(vm);
 }
 
 /****************************************/
 /****************************************/
 
+int buzzneighbors_latest(buzzvm_t vm) {
+   if(buzzvm_lnum(vm) != 2) buzzvm_lnum_assert(vm, 1);
+   /* Get topic argument */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_STRING);
+   uint16_t topic = buzzvm_stack_at(vm, 1)->s.value.sid;
+   /* Get the maximum age, if given */
+   int32_t maxage = -1;
+   if(buzzvm_lnum(vm) == 2) {
+      buzzvm_lload(vm, 2);
+      buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
+      maxage = buzzvm_stack_at(vm, 1)->i.value;
+   }
+   /* Look for the topic, or start following it */
+   const buzzneighbors_latest_t* pl =
+      buzzdict_get(vm->neighbors->latest, &topic, buzzneighbors_latest_t);
+   buzzneighbors_latest_t l;
+   if(pl) {
+      l = *pl;
+   }
+   else {
+      l = (buzzneighbors_latest_t)malloc(sizeof(struct buzzneighbors_latest_s));
+      l->values = buzzheap_newobj(vm, BUZZTYPE_TABLE);
+      l->steps = buzzdict_new(10,
+                              sizeof(uint16_t),
+                              sizeof(uint32_t),
+                              buzzdict_uint16keyhash,
+                              buzzdict_uint16keycmp,
+                              NULL);
+      l->maxage = BUZZNEIGHBORS_LATEST_MAXAGE;
+      buzzdict_set(vm->neighbors->latest, &topic, &l);
+   }
+   if(maxage >= 0) l->maxage = maxage;
+   buzzvm_push(vm, l->values);
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzneighbors_age(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 2);
+   /* Get topic argument */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_STRING);
+   uint16_t topic = buzzvm_stack_at(vm, 1)->s.value.sid;
+   /* Get robot argument */
+   buzzvm_lload(vm, 2);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
+   int32_t robot = buzzvm_stack_at(vm, 1)->i.value;
+   /* Look for the value */
+   const buzzneighbors_latest_t* pl =
+      buzzdict_get(vm->neighbors->latest, &topic, buzzneighbors_latest_t);
+   const uint32_t* s = NULL;
+   if(pl && robot >= 0 && robot <= UINT16_MAX) {
+      uint16_t r = robot;
+      s = buzzdict_get((*pl)->steps, &r, uint32_t);
+   }
+   if(s) buzzvm_pushi(vm, vm->neighbors->step - *s);
+   else buzzvm_pushnil(vm);
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzneighbors_latest_put(buzzvm_t vm,
+                             uint16_t topic,
+                             uint16_t robot,
+                             buzzobj_t value) {
+   const buzzneighbors_latest_t* pl =
+      buzzdict_get(vm->neighbors->latest, &topic, buzzneighbors_latest_t);
+   if(!pl) return 0;
+   buzzneighbors_latest_t l = *pl;
+   /* The messages of a step are processed newest first: keep the first value */
+   const uint32_t* s = buzzdict_get(l->steps, &robot, uint32_t);
+   if(s && *s == vm->neighbors->step) return 1;
+   /* Store the value, nil removes it */
+   union buzzobj_u k;
+   k.o.type = BUZZTYPE_INT;
+   k.i.value = robot;
+   buzzobj_t kp = &k;
+   if(value->o.type == BUZZTYPE_NIL) {
+      buzzdict_remove(l->values->t.value, &kp);
+      buzzdict_remove(l->steps, &robot);
+   }
+   else {
+      kp = buzzheap_newobj(vm, BUZZTYPE_INT);
+      kp->i.value = robot;
+      buzzdict_set(l->values->t.value, &kp, &value);
+      buzzdict_set(l->steps, &robot, &vm->neighbors->step);
+   }
+   return 1;
+}
+
+/****************************************/
+/****************************************/
+
+struct neighbors_expire_s {
+   uint32_t step;
+   uint32_t maxage;
+   buzzdarray_t old;
+};
+
+static void neighbors_expire_robot(const void* key, void* data, void* params) {
+   struct neighbors_expire_s* e = (struct neighbors_expire_s*)params;
+   if(e->step - *(uint32_t*)data > e->maxage)
+      buzzdarray_push(e->old, (uint16_t*)key);
+}
+
+static void neighbors_expire_topic(const void* key, void* data, void* params) {
+   struct neighbors_expire_s* e = (struct neighbors_expire_s*)params;
+   buzzneighbors_latest_t l = *(buzzneighbors_latest_t*)data;
+   e->maxage = l->maxage;
+   buzzdarray_clear(e->old, 10);
+   buzzdict_foreach(l->steps, neighbors_expire_robot, e);
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(e->old); ++i) {
+      uint16_t r = buzzdarray_get(e->old, i, uint16_t);
+      union buzzobj_u k;
+      k.o.type = BUZZTYPE_INT;
+      k.i.value = r;
+      buzzobj_t kp = &k;
+      buzzdict_remove(l->values->t.value, &kp);
+      buzzdict_remove(l->steps, &r);
+   }
+}
+
+void buzzneighbors_latest_update(buzzvm_t vm) {
+   buzzneighbors_t n = vm->neighbors;
+   ++n->step;
+   if(buzzdict_isempty(n->latest)) return;
+   struct neighbors_expire_s e = {
+      .step = n->step,
+      .old = buzzdarray_new(10, sizeof(uint16_t), NULL)
+   };
+   buzzdict_foreach(n->latest, neighbors_expire_topic, &e);
+   buzzdarray_destroy(&e.old);
+}
+
+/****************************************/
+/****************************************/
+
 void neighbor_filter_kin(const void* key, void* data, void* params) {
    buzzobj_t rid = *(buzzobj_t*)key;
    struct neighbor_filter_s* fdata = (struct neighbor_filter_s*)params;
@@ -222,21 +639,18 @@ int buzzneighbors_kin(buzzvm_t vm) {
    /* Get the self table */
    buzzvm_lload(vm, 0);
    buzzvm_type_assert(vm, 1, BUZZTYPE_TABLE);
-   /* Get the data table */
-   buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-   buzzvm_tget(vm);
-   buzzobj_t data = buzzvm_stack_at(vm, 1);
+   buzzobj_t self = buzzvm_stack_at(vm, 1);
    /* Create a new table as return value */
    buzzobj_t t;
    vm->state = make_table(vm, &t);
    if(vm->state != BUZZVM_STATE_READY) return vm->state;
    /* If data is available, filter it */
-   if(data->o.type == BUZZTYPE_TABLE) {
+   if(neighbors_hasdata(vm, self)) {
       /* Create a new data table */
       buzzobj_t kindata = buzzheap_newobj(vm, BUZZTYPE_TABLE);
       /* Filter the neighbors in data and add them to kindata */
       struct neighbor_filter_s fdata = { .vm = vm, .swarm_id = swarmid, .result = kindata->t.value };
-      buzzdict_foreach(data->t.value, neighbor_filter_kin, &fdata);
+      neighbors_foreach(vm, self, neighbor_filter_kin, &fdata);
       /* Add kindata as the POSES field in t */
       buzzvm_push(vm, t);
       buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
@@ -290,17 +704,14 @@ int buzzneighbors_nonkin(buzzvm_t vm) {
    if(swarmid >= 0) {
       /* Get the self table */
       buzzvm_lload(vm, 0);
-      /* Get the data table */
-      buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-      buzzvm_tget(vm);
-      buzzobj_t data = buzzvm_stack_at(vm, 1);
+      buzzobj_t self = buzzvm_stack_at(vm, 1);
       /* If data is available, filter it */
-      if(data->o.type == BUZZTYPE_TABLE) {
+      if(neighbors_hasdata(vm, self)) {
          /* Create a new data table */
          buzzobj_t nonkindata = buzzheap_newobj(vm, BUZZTYPE_TABLE);
          /* Filter the neighbors in data and add them to nonkindata */
          struct neighbor_filter_s fdata = { .vm = vm, .swarm_id = swarmid, .result = nonkindata->t.value };
-         buzzdict_foreach(data->t.value, neighbor_filter_nonkin, &fdata);
+         neighbors_foreach(vm, self, neighbor_filter_nonkin, &fdata);
          /* Add nonkindata as the POSES field in t */
          buzzvm_push(vm, t);
          buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
@@ -320,6 +731,16 @@ int buzzneighbors_get(struct buzzvm_s* vm) {
    buzzvm_lnum_assert(vm, 1);
    /* Get self table */
    buzzvm_lload(vm, 0);
+   if(buzzvm_stack_at(vm, 1) == vm->neighbors->table) {
+      /* Make the table of the neighbor, if known */
+      buzzvm_lload(vm, 1);
+      buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
+      int32_t r = buzzvm_stack_at(vm, 1)->i.value;
+      int64_t i = (r >= 0 && r <= UINT16_MAX) ? neighbors_find(vm->neighbors, r) : -1;
+      if(i >= 0) buzzvm_push(vm, neighbors_entry(vm, i));
+      else buzzvm_pushnil(vm);
+      return buzzvm_ret1(vm);
+   }
    /* Get data field */
    buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
    buzzvm_tget(vm);
@@ -361,11 +782,8 @@ int buzzneighbors_foreach(struct buzzvm_s* vm) {
    buzzvm_lnum_assert(vm, 1);
    /* Get self table */
    buzzvm_lload(vm, 0);
-   /* Get data field */
-   buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-   buzzvm_tget(vm);
-   buzzobj_t data = buzzvm_stack_at(vm, 1);
-   if(buzzvm_stack_at(vm, 1)->o.type == BUZZTYPE_TABLE) {
+   buzzobj_t self = buzzvm_stack_at(vm, 1);
+   if(neighbors_hasdata(vm, self)) {
       /* Get closure */
       buzzvm_lload(vm, 1);
       buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
@@ -375,9 +793,7 @@ int buzzneighbors_foreach(struct buzzvm_s* vm) {
          .vm = vm,
          .closure = closure
       };
-      buzzdict_foreach(data->t.value,
-                       neighbor_for_each,
-                       &edata);
+      neighbors_foreach(vm, self, neighbor_for_each, &edata);
    }
    return buzzvm_ret0(vm);
 }
@@ -424,17 +840,14 @@ int buzzneighbors_map(buzzvm_t vm) {
    /* Get the self table */
    buzzvm_lload(vm, 0);
    buzzvm_type_assert(vm, 1, BUZZTYPE_TABLE);
-   /* Get the data table */
-   buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-   buzzvm_tget(vm);
-   buzzobj_t data = buzzvm_stack_at(vm, 1);
+   buzzobj_t self = buzzvm_stack_at(vm, 1);
    /* Create a new table as return value and put it on the stack */
    buzzobj_t t;
    vm->state = make_table(vm, &t);
    if(vm->state != BUZZVM_STATE_READY) return vm->state;
    buzzvm_push(vm, t);
    /* If data is available, go through it */
-   if(data->o.type == BUZZTYPE_TABLE) {
+   if(neighbors_hasdata(vm, self)) {
       /* Get closure */
       buzzvm_lload(vm, 1);
       buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
@@ -452,7 +865,7 @@ int buzzneighbors_map(buzzvm_t vm) {
          .closure = closure,
          .result = mapdata->t.value
       };
-      buzzdict_foreach(data->t.value, neighbor_map_each, &fdata);
+      neighbors_foreach(vm, self, neighbor_map_each, &fdata);
    }
    /* Return the table */
    buzzvm_push(vm, t);
@@ -498,14 +911,11 @@ int buzzneighbors_reduce(struct buzzvm_s* vm) {
    buzzvm_lnum_assert(vm, 2);
    /* Get self table */
    buzzvm_lload(vm, 0);
-   /* Get data field */
-   buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-   buzzvm_tget(vm);
-   buzzobj_t data = buzzvm_stack_at(vm, 1);
+   buzzobj_t self = buzzvm_stack_at(vm, 1);
    /* Get accumulator */
    buzzvm_lload(vm, 2);
    buzzobj_t accum = buzzvm_stack_at(vm, 1);
-   if(data->o.type == BUZZTYPE_TABLE) {
+   if(neighbors_hasdata(vm, self)) {
       /* Get closure */
       buzzvm_lload(vm, 1);
       buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
@@ -517,9 +927,7 @@ int buzzneighbors_reduce(struct buzzvm_s* vm) {
          .vm = vm,
          .closure = closure
       };
-      buzzdict_foreach(data->t.value,
-                       neighbor_reduce,
-                       &edata);
+      neighbors_foreach(vm, self, neighbor_reduce, &edata);
       /* The final value of the accumulator is on the stack */
    }
    /* Return value */
@@ -572,17 +980,14 @@ int buzzneighbors_filter(struct buzzvm_s* vm) {
    /* Get the self table */
    buzzvm_lload(vm, 0);
    buzzvm_type_assert(vm, 1, BUZZTYPE_TABLE);
-   /* Get the data table */
-   buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-   buzzvm_tget(vm);
-   buzzobj_t data = buzzvm_stack_at(vm, 1);
+   buzzobj_t self = buzzvm_stack_at(vm, 1);
    /* Create a new table as return value and put it on the stack */
    buzzobj_t t;
    vm->state = make_table(vm, &t);
    if(vm->state != BUZZVM_STATE_READY) return vm->state;
    buzzvm_push(vm, t);
    /* If data is available, go through it */
-   if(data->o.type == BUZZTYPE_TABLE) {
+   if(neighbors_hasdata(vm, self)) {
       /* Get closure */
       buzzvm_lload(vm, 1);
       buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
@@ -600,7 +1005,7 @@ int buzzneighbors_filter(struct buzzvm_s* vm) {
          .closure = closure,
          .result = mapdata->t.value
       };
-      buzzdict_foreach(data->t.value, neighbor_filter_each, &fdata);
+      neighbors_foreach(vm, self, neighbor_filter_each, &fdata);
    }
    /* Return the table */
    buzzvm_push(vm, t);
@@ -614,6 +1019,10 @@ int buzzneighbors_count(struct buzzvm_s* vm) {
    buzzvm_lnum_assert(vm, 0);
    /* Get self table */
    buzzvm_lload(vm, 0);
+   if(buzzvm_stack_at(vm, 1) == vm->neighbors->table) {
+      buzzvm_pushi(vm, vm->neighbors->size);
+      return buzzvm_ret1(vm);
+   }
    /* Get data field */
    buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
    buzzvm_tget(vm);
@@ -627,3 +1036,268 @@ int buzzneighbors_count(struct buzzvm_s* vm) {
 
 /****************************************/
 /****************************************/
+
+/*
+ * The positions of the neighbors in a table, as arrays.
+ * For the global table, the arrays are those of vm->neighbors and
+ * keys/values are NULL. For the other tables, they are copies of the
+ * data in the POSES field.
+ */
+struct neighbors_view_s {
+   uint32_t size;
+   float* x;
+   float* y;
+   float* d;
+   buzzobj_t* keys;
+   buzzobj_t* values;
+};
+
+/*
+ * Gets a number from a table field.
+ * Returns 1 if the field is a number, 0 otherwise.
+ */
+static int neighbors_getnum(buzzvm_t vm, buzzobj_t t, const char* name, float* v) {
+   buzzvm_push(vm, t);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, name, 1));
+   buzzvm_tget(vm);
+   buzzobj_t o = buzzvm_stack_at(vm, 1);
+   buzzvm_pop(vm);
+   if(o->o.type == BUZZTYPE_FLOAT) *v = o->f.value;
+   else if(o->o.type == BUZZTYPE_INT) *v = o->i.value;
+   else return 0;
+   return 1;
+}
+
+struct neighbors_gather_s {
+   buzzvm_t vm;
+   struct neighbors_view_s* view;
+};
+
+static void neighbors_gather(const void* key, void* data, void* params) {
+   struct neighbors_gather_s* g = (struct neighbors_gather_s*)params;
+   struct neighbors_view_s* v = g->view;
+   buzzobj_t o = *(buzzobj_t*)data;
+   if(o->o.type != BUZZTYPE_TABLE) return;
+   float x, y, a;
+   uint32_t i = v->size;
+   if(neighbors_getnum(g->vm, o, "x", &x) &&
+      neighbors_getnum(g->vm, o, "y", &y)) {
+      /* A vector, as made by neighbors.map() */
+      v->x[i] = x;
+      v->y[i] = y;
+      v->d[i] = sqrtf(x * x + y * y);
+   }
+   else if(neighbors_getnum(g->vm, o, "distance", &v->d[i]) &&
+           neighbors_getnum(g->vm, o, "azimuth", &a)) {
+      v->x[i] = v->d[i] * cosf(a);
+      v->y[i] = v->d[i] * sinf(a);
+   }
+   else return;
+   v->keys[i] = *(buzzobj_t*)key;
+   v->values[i] = o;
+   ++v->size;
+}
+
+/*
+ * Fills a view on the neighbors in a table.
+ */
+static void neighbors_view(buzzvm_t vm,
+                           buzzobj_t self,
+                           struct neighbors_view_s* v) {
+   if(self == vm->neighbors->table) {
+      buzzneighbors_t n = vm->neighbors;
+      if(!n->cartesian) {
+         uint32_t i;
+         for(i = 0; i < n->size; ++i) {
+            n->x[i] = n->distance[i] * cosf(n->azimuth[i]);
+            n->y[i] = n->distance[i] * sinf(n->azimuth[i]);
+         }
+         n->cartesian = 1;
+      }
+      v->size = n->size;
+      v->x = n->x;
+      v->y = n->y;
+      v->d = n->distance;
+      v->keys = NULL;
+      v->values = NULL;
+      return;
+   }
+   v->size = 0;
+   v->x = v->y = v->d = NULL;
+   v->keys = v->values = NULL;
+   buzzvm_push(vm, self);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
+   buzzvm_tget(vm);
+   buzzobj_t data = buzzvm_stack_at(vm, 1);
+   buzzvm_pop(vm);
+   if(data->o.type != BUZZTYPE_TABLE) return;
+   uint32_t sz = buzzdict_size(data->t.value);
+   v->x = (float*)malloc((sz + 1) * sizeof(float));
+   v->y = (float*)malloc((sz + 1) * sizeof(float));
+   v->d = (float*)malloc((sz + 1) * sizeof(float));
+   v->keys = (buzzobj_t*)malloc((sz + 1) * sizeof(buzzobj_t));
+   v->values = (buzzobj_t*)malloc((sz + 1) * sizeof(buzzobj_t));
+   struct neighbors_gather_s g = { .vm = vm, .view = v };
+   buzzdict_foreach(data->t.value, neighbors_gather, &g);
+}
+
+static void neighbors_view_destroy(struct neighbors_view_s* v) {
+   if(!v->keys) return;
+   free(v->x);
+   free(v->y);
+   free(v->d);
+   free(v->keys);
+   free(v->values);
+}
+
+/*
+ * Pushes a neighbor structure with some of the neighbors of a view.
+ */
+static int neighbors_select(buzzvm_t vm,
+                            struct neighbors_view_s* v,
+                            const uint32_t* idx,
+                            uint32_t num) {
+   buzzobj_t t;
+   vm->state = make_table(vm, &t);
+   if(vm->state != BUZZVM_STATE_READY) return vm->state;
+   buzzobj_t data = buzzheap_newobj(vm, BUZZTYPE_TABLE);
+   uint32_t i;
+   for(i = 0; i < num; ++i) {
+      buzzobj_t k = v->keys ? v->keys[idx[i]] : neighbors_key(vm, idx[i]);
+      buzzobj_t e = v->values ? v->values[idx[i]] : neighbors_entry(vm, idx[i]);
+      buzzdict_set(data->t.value, &k, &e);
+   }
+   buzzvm_push(vm, t);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
+   buzzvm_push(vm, data);
+   buzzvm_tput(vm);
+   buzzvm_push(vm, t);
+   return vm->state;
+}
+
+/*
+ * Pushes a vector table.
+ */
+static void neighbors_pushvec(buzzvm_t vm, float x, float y) {
+   buzzobj_t t = buzzheap_newobj(vm, BUZZTYPE_TABLE);
+   neighbors_put(vm, t, buzzvm_string_register(vm, "x", 1), x);
+   neighbors_put(vm, t, buzzvm_string_register(vm, "y", 1), y);
+   buzzvm_push(vm, t);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzneighbors_sumvec(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 0);
+   buzzvm_lload(vm, 0);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_TABLE);
+   struct neighbors_view_s v;
+   neighbors_view(vm, buzzvm_stack_at(vm, 1), &v);
+   /* Plain loops over the arrays, which the compiler can vectorize */
+   float x = 0, y = 0;
+   uint32_t i;
+   for(i = 0; i < v.size; ++i) x += v.x[i];
+   for(i = 0; i < v.size; ++i) y += v.y[i];
+   neighbors_view_destroy(&v);
+   neighbors_pushvec(vm, x, y);
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzneighbors_centroid(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 0);
+   buzzvm_lload(vm, 0);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_TABLE);
+   struct neighbors_view_s v;
+   neighbors_view(vm, buzzvm_stack_at(vm, 1), &v);
+   if(v.size == 0) {
+      buzzvm_pushnil(vm);
+   }
+   else {
+      float x = 0, y = 0;
+      uint32_t i;
+      for(i = 0; i < v.size; ++i) x += v.x[i];
+      for(i = 0; i < v.size; ++i) y += v.y[i];
+      neighbors_pushvec(vm, x / v.size, y / v.size);
+   }
+   neighbors_view_destroy(&v);
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzneighbors_within(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 1);
+   /* Get the distance */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert_number(vm, 1);
+   float r = buzzvm_stack_at(vm, 1)->o.type == BUZZTYPE_INT ?
+      buzzvm_stack_at(vm, 1)->i.value :
+      buzzvm_stack_at(vm, 1)->f.value;
+   /* Get the self table */
+   buzzvm_lload(vm, 0);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_TABLE);
+   struct neighbors_view_s v;
+   neighbors_view(vm, buzzvm_stack_at(vm, 1), &v);
+   /* Pick the neighbors close enough */
+   uint32_t* idx = (uint32_t*)malloc((v.size + 1) * sizeof(uint32_t));
+   uint32_t i, num = 0;
+   for(i = 0; i < v.size; ++i)
+      if(v.d[i] <= r) idx[num++] = i;
+   neighbors_select(vm, &v, idx, num);
+   free(idx);
+   neighbors_view_destroy(&v);
+   if(vm->state != BUZZVM_STATE_READY) return vm->state;
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+struct neighbors_dist_s {
+   float d;
+   uint32_t i;
+};
+
+static int neighbors_dist_cmp(const void* a, const void* b) {
+   const struct neighbors_dist_s* x = (const struct neighbors_dist_s*)a;
+   const struct neighbors_dist_s* y = (const struct neighbors_dist_s*)b;
+   if(x->d < y->d) return -1;
+   if(x->d > y->d) return  1;
+   return (x->i > y->i) - (x->i < y->i);
+}
+
+int buzzneighbors_nearest(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 1);
+   /* Get the number of neighbors to keep */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
+   int32_t k = buzzvm_stack_at(vm, 1)->i.value;
+   /* Get the self table */
+   buzzvm_lload(vm, 0);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_TABLE);
+   struct neighbors_view_s v;
+   neighbors_view(vm, buzzvm_stack_at(vm, 1), &v);
+   /* Sort the neighbors by distance */
+   struct neighbors_dist_s* s =
+      (struct neighbors_dist_s*)malloc((v.size + 1) * sizeof(struct neighbors_dist_s));
+   uint32_t i;
+   for(i = 0; i < v.size; ++i) {
+      s[i].d = v.d[i];
+      s[i].i = i;
+   }
+   qsort(s, v.size, sizeof(struct neighbors_dist_s), neighbors_dist_cmp);
+   uint32_t num = k < 0 ? 0 : (uint32_t)k < v.size ? (uint32_t)k : v.size;
+   uint32_t* idx = (uint32_t*)malloc((num + 1) * sizeof(uint32_t));
+   for(i = 0; i < num; ++i) idx[i] = s[i].i;
+   neighbors_select(vm, &v, idx, num);
+   free(idx);
+   free(s);
+   neighbors_view_destroy(&v);
+   if(vm->state != BUZZVM_STATE_READY) return vm->state;
+   return buzzvm_ret1(vm);
+}
@@ -2,6 +2,7 @@
 #define BUZZNEIGHBORS_H
 
 #include <buzz/buzzdict.h>
+#include <buzz/buzztype.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -13,6 +14,86 @@ extern "C" {
     */
    struct buzzvm_s;
 
+   /*
+    * A custom neighbor field, set by the host.
+    */
+   struct buzzneighbors_field_s {
+      /* The string id of the field name */
+      uint16_t name;
+      /* 1 if the field was set since the last reset */
+      uint8_t set;
+      /* One value per neighbor */
+      float* values;
+   };
+   typedef struct buzzneighbors_field_s* buzzneighbors_field_t;
+
+   /*
+    * The last value received on a topic from each neighbor.
+    * @see buzzneighbors_latest()
+    */
+   struct buzzneighbors_latest_s {
+      /* Robot id -> value, as a Buzz table */
+      buzzobj_t values;
+      /* Robot id (uint16_t) -> step the value was received (uint32_t) */
+      buzzdict_t steps;
+      /* Steps after which a value is removed */
+      uint32_t maxage;
+   };
+   typedef struct buzzneighbors_latest_s* buzzneighbors_latest_t;
+
+   /*
+    * The neighbor data, as a structure of arrays.
+    * The host fills it at every step. The Buzz table of a neighbor is
+    * made only when the script gets it, and is kept until the next
+    * reset.
+    */
+   struct buzzneighbors_s {
+      /* The number of neighbors */
+      uint32_t size;
+      /* The capacity of the arrays */
+      uint32_t capacity;
+      /* The robot ids */
+      uint16_t* ids;
+      /* The positions of the robots */
+      float* distance;
+      float* azimuth;
+      float* elevation;
+      /* The positions on the XY plane, computed when needed */
+      float* x;
+      float* y;
+      /* 1 if x and y are up to date */
+      uint8_t cartesian;
+      /* The custom fields */
+      buzzdarray_t fields;
+      /* Hash table of the positions in the arrays (position + 1, 0 = empty) */
+      uint32_t* slots;
+      /* The number of slots, a power of two */
+      uint32_t nslots;
+      /* The robot id objects, or NULL if not made yet */
+      buzzobj_t* keys;
+      /* The neighbor tables, or NULL if not made yet */
+      buzzobj_t* entries;
+      /* The global 'neighbors' table */
+      buzzobj_t table;
+      /* Topic string id (uint16_t) -> buzzneighbors_latest_t */
+      buzzdict_t latest;
+      /* Steps since the VM was created */
+      uint32_t step;
+   };
+   typedef struct buzzneighbors_s* buzzneighbors_t;
+
+   /*
+    * Creates the neighbor data of a VM.
+    * @return The neighbor data.
+    */
+   extern buzzneighbors_t buzzneighbors_data_new();
+
+   /*
+    * Destroys the neighbor data of a VM.
+    * @param n The neighbor data.
+    */
+   extern void buzzneighbors_data_destroy(buzzneighbors_t* n);
+
    /*
     * Creates the neighbor structure.
     * Add new neighbor data with buzzneighbor_add().
@@ -46,6 +127,80 @@ extern "C" {
                                 float distance,
                                 float azimuth,
                                 float elevation);
+
+   /*
+    * Replaces the neighbor data.
+    * This is the same as buzzneighbors_reset() followed by a call to
+    * buzzneighbors_add() for each neighbor.
+    * @param vm The Buzz VM data.
+    * @param n The number of neighbors.
+    * @param ids The ids of the robots.
+    * @param distance The distances to the robots.
+    * @param azimuth The angles (in rad) on the XY plane.
+    * @param elevation The angles (in rad) between the XY plane and the robots.
+    * @return The updated VM state.
+    */
+   extern int buzzneighbors_set_all(struct buzzvm_s* vm,
+                                    uint32_t n,
+                                    const uint16_t* ids,
+                                    const float* distance,
+                                    const float* azimuth,
+                                    const float* elevation);
+
+   /*
+    * Sets a custom field for all the neighbors.
+    * The values are in the order in which the neighbors were added. The
+    * field is part of the neighbor tables until the next reset. The
+    * neighbors added after the call, and those whose value is NaN, have
+    * no such field.
+    * @param vm The Buzz VM data.
+    * @param name The field name.
+    * @param values One value per neighbor.
+    * @return The updated VM state.
+    */
+   extern int buzzneighbors_set_field(struct buzzvm_s* vm,
+                                      const char* name,
+                                      const float* values);
+
+   /*
+    * Looks up the distance to a neighbor.
+    * @param vm The Buzz VM data.
+    * @param robot The id of the robot.
+    * @param distance Set to the distance, if the robot is a neighbor.
+    * @return 1 if the robot is a neighbor, 0 otherwise.
+    */
+   extern int buzzneighbors_distance(struct buzzvm_s* vm,
+                                     uint16_t robot,
+                                     float* distance);
+
+   /*
+    * Stores a value received on a topic, if the topic is followed with
+    * neighbors.latest().
+    * Called by buzzvm_process_inmsgs().
+    * @param vm The Buzz VM data.
+    * @param topic The string id of the topic.
+    * @param robot The id of the robot that sent the value.
+    * @param value The value.
+    * @return 1 if the topic is followed, 0 otherwise.
+    */
+   extern int buzzneighbors_latest_put(struct buzzvm_s* vm,
+                                       uint16_t topic,
+                                       uint16_t robot,
+                                       buzzobj_t value);
+
+   /*
+    * Starts a new step and removes the values that are too old.
+    * Called by buzzvm_process_inmsgs().
+    * @param vm The Buzz VM data.
+    */
+   extern void buzzneighbors_latest_update(struct buzzvm_s* vm);
+
+   /*
+    * Marks the neighbor objects in use.
+    * Called by buzzheap_gc().
+    * @param vm The Buzz VM data.
+    */
+   extern void buzzneighbors_gc(struct buzzvm_s* vm);
    
    /*
     * Broadcasts a value across the neighbors.
@@ -68,6 +223,22 @@ extern "C" {
     */
    extern int buzzneighbors_ignore(struct buzzvm_s* vm);
 
+   /*
+    * Pushes a table with the last value received on a topic from each
+    * neighbor. The table is kept up to date without calling any closure.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzneighbors_latest(struct buzzvm_s* vm);
+
+   /*
+    * Pushes the steps since the last value on a topic was received from a
+    * neighbor, or nil if there is no such value.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzneighbors_age(struct buzzvm_s* vm);
+
    /*
     * Pushes a table of robots belonging to the same swarm as the current robot.
     * @param vm The Buzz VM data.
@@ -124,8 +295,49 @@ extern "C" {
     */
    extern int buzzneighbors_count(struct buzzvm_s* vm);
 
+   /*
+    * Pushes the sum of the position vectors of the neighbors.
+    * In a table made by neighbors.map(), the values with an x and a y
+    * field are summed instead.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzneighbors_sumvec(struct buzzvm_s* vm);
+
+   /*
+    * Pushes the mean position of the neighbors, or nil if there are none.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzneighbors_centroid(struct buzzvm_s* vm);
+
+   /*
+    * Pushes a neighbor structure with the neighbors within a distance.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzneighbors_within(struct buzzvm_s* vm);
+
+   /*
+    * Pushes a neighbor structure with the k closest neighbors.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzneighbors_nearest(struct buzzvm_s* vm);
+
 #ifdef __cplusplus
 }
 #endif
 
+/*
+ * Number of neighbors the neighbor data holds before growing.
+ */
+#define BUZZNEIGHBORS_INIT_CAPACITY 16
+
+/*
+ * Default number of steps after which the values of neighbors.latest()
+ * are removed.
+ */
+#define BUZZNEIGHBORS_LATEST_MAXAGE 10
+
 #endif
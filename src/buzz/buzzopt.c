@@ -0,0 +1,681 @@
+#include "buzzopt.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <inttypes.h>
+
+/****************************************/
+/****************************************/
+
+/*
+ * An instruction, as seen by the optimizer
+ */
+struct buzzopt_instr_s {
+   /* The opcode */
+   uint8_t op;
+   /* The argument, if any */
+   union {
+      int32_t i;
+      float f;
+   } arg;
+   /* For jumps and closures, the index of the target instruction, -1 otherwise */
+   int64_t target;
+   /* How many jumps and closures target this instruction */
+   uint32_t refs;
+   /* The debug information, NULL if none */
+   buzzdebug_entry_t dbg;
+   /* 1 if the instruction was dropped */
+   uint8_t removed;
+   /* 1 if the instruction can be reached, used by dead code elimination */
+   uint8_t reached;
+   /* The offset in the optimized bytecode */
+   uint32_t off;
+};
+
+/*
+ * The code being optimized
+ */
+struct buzzopt_s {
+   struct buzzopt_instr_s* code;
+   int64_t count;
+};
+typedef struct buzzopt_s* buzzopt_t;
+
+/*
+ * A constant pushed by pushnil, pushi or pushf
+ */
+struct buzzopt_const_s {
+   /* BUZZTYPE_NIL, BUZZTYPE_INT or BUZZTYPE_FLOAT */
+   int type;
+   int32_t i;
+   float f;
+};
+typedef struct buzzopt_const_s* buzzopt_const_t;
+
+/*
+ * Returns 1 if the opcode has an argument
+ */
+#define has_arg(OP) ((OP) >= BUZZVM_INSTR_PUSHF)
+
+/*
+ * Returns 1 if the argument of the opcode is a code offset
+ */
+#define has_target(OP) ((OP) == BUZZVM_INSTR_PUSHCN || (OP) == BUZZVM_INSTR_PUSHL || (OP) >= BUZZVM_INSTR_JUMP)
+
+/*
+ * Returns 1 if the opcode is a jump
+ */
+#define is_jump(OP) ((OP) >= BUZZVM_INSTR_JUMP)
+
+/*
+ * Returns 1 if the execution never goes past the opcode
+ */
+#define is_terminal(OP) ((OP) == BUZZVM_INSTR_DONE || (OP) == BUZZVM_INSTR_RET0 || (OP) == BUZZVM_INSTR_RET1 || (OP) == BUZZVM_INSTR_JUMP)
+
+/*
+ * Returns 1 if the constant is a number
+ */
+#define const_isnum(C) ((C)->type == BUZZTYPE_INT || (C)->type == BUZZTYPE_FLOAT)
+
+/*
+ * Returns the constant as a float, as the VM does for mixed operands
+ */
+#define const_tofloat(C) ((C)->type == BUZZTYPE_INT ? (float)(C)->i : (C)->f)
+
+/*
+ * Returns 1 if the constant is true for jumpz, jumpnz and the logic operations
+ */
+#define const_istrue(C) (!((C)->type == BUZZTYPE_NIL || ((C)->type == BUZZTYPE_INT && (C)->i == 0)))
+
+/****************************************/
+/****************************************/
+
+static int buzzopt_const_get(const struct buzzopt_instr_s* x,
+                             buzzopt_const_t c) {
+   c->i = 0;
+   c->f = 0;
+   switch(x->op) {
+      case BUZZVM_INSTR_PUSHNIL:
+         c->type = BUZZTYPE_NIL;
+         return 1;
+      case BUZZVM_INSTR_PUSHI:
+         c->type = BUZZTYPE_INT;
+         c->i = x->arg.i;
+         return 1;
+      case BUZZVM_INSTR_PUSHF:
+         c->type = BUZZTYPE_FLOAT;
+         c->f = x->arg.f;
+         return 1;
+      default:
+         return 0;
+   }
+}
+
+static void buzzopt_const_set(struct buzzopt_instr_s* x,
+                              buzzopt_const_t c) {
+   if(c->type == BUZZTYPE_NIL) {
+      x->op = BUZZVM_INSTR_PUSHNIL;
+   }
+   else if(c->type == BUZZTYPE_INT) {
+      x->op = BUZZVM_INSTR_PUSHI;
+      x->arg.i = c->i;
+   }
+   else {
+      x->op = BUZZVM_INSTR_PUSHF;
+      x->arg.f = c->f;
+   }
+}
+
+/*
+ * Compares two constants like buzzobj_cmp()
+ */
+static int buzzopt_const_cmp(buzzopt_const_t a,
+                             buzzopt_const_t b) {
+   if(a->type == BUZZTYPE_NIL && b->type == BUZZTYPE_NIL) return 0;
+   if(a->type == BUZZTYPE_NIL) return -1;
+   if(b->type == BUZZTYPE_NIL) return 1;
+   if(a->type == BUZZTYPE_INT && b->type == BUZZTYPE_INT) {
+      if(a->i < b->i) return -1;
+      if(a->i > b->i) return 1;
+      return 0;
+   }
+   float x = const_tofloat(a);
+   float y = const_tofloat(b);
+   if(x < y) return -1;
+   if(x > y) return 1;
+   return 0;
+}
+
+/*
+ * Computes 'a op b' like the VM does.
+ * Returns 1 if the result was computed, 0 if the operation is left to
+ * the VM (type error, division by zero, overflow).
+ */
+static int buzzopt_fold_binary(uint8_t op,
+                               buzzopt_const_t a,
+                               buzzopt_const_t b,
+                               buzzopt_const_t r) {
+   switch(op) {
+      case BUZZVM_INSTR_ADD:
+      case BUZZVM_INSTR_SUB:
+      case BUZZVM_INSTR_MUL:
+      case BUZZVM_INSTR_DIV: {
+         if(!const_isnum(a) || !const_isnum(b)) return 0;
+         if(a->type == BUZZTYPE_INT && b->type == BUZZTYPE_INT) {
+            int64_t x = a->i, y = b->i, z;
+            if(op == BUZZVM_INSTR_ADD)      z = x + y;
+            else if(op == BUZZVM_INSTR_SUB) z = x - y;
+            else if(op == BUZZVM_INSTR_MUL) z = x * y;
+            else if(y == 0)                 return 0;
+            else                            z = x / y;
+            if(z < INT32_MIN || z > INT32_MAX) return 0;
+            r->type = BUZZTYPE_INT;
+            r->i = z;
+            return 1;
+         }
+         float x = const_tofloat(a);
+         float y = const_tofloat(b);
+         r->type = BUZZTYPE_FLOAT;
+         if(op == BUZZVM_INSTR_ADD)      r->f = x + y;
+         else if(op == BUZZVM_INSTR_SUB) r->f = x - y;
+         else if(op == BUZZVM_INSTR_MUL) r->f = x * y;
+         else                            r->f = x / y;
+         return 1;
+      }
+      case BUZZVM_INSTR_MOD: {
+         /* Mixed int and float operands are left to the VM */
+         if(a->type == BUZZTYPE_INT && b->type == BUZZTYPE_INT) {
+            if(b->i == 0) return 0;
+            r->type = BUZZTYPE_INT;
+            r->i = (b->i == -1) ? 0 : a->i % b->i;
+            if(r->i < 0) r->i += b->i;
+            return 1;
+         }
+         if(a->type == BUZZTYPE_FLOAT && b->type == BUZZTYPE_FLOAT) {
+            r->type = BUZZTYPE_FLOAT;
+            r->f = fmodf(a->f, b->f);
+            if(r->f < 0.) r->f += b->f;
+            return 1;
+         }
+         return 0;
+      }
+      case BUZZVM_INSTR_POW: {
+         if(!const_isnum(a) || !const_isnum(b)) return 0;
+         r->type = BUZZTYPE_FLOAT;
+         r->f = powf(const_tofloat(a), const_tofloat(b));
+         return 1;
+      }
+      case BUZZVM_INSTR_LAND:
+      case BUZZVM_INSTR_LOR: {
+         r->type = BUZZTYPE_INT;
+         r->i = (op == BUZZVM_INSTR_LAND) ?
+            (const_istrue(a) && const_istrue(b)) :
+            (const_istrue(a) || const_istrue(b));
+         return 1;
+      }
+      case BUZZVM_INSTR_BAND:
+      case BUZZVM_INSTR_BOR:
+      case BUZZVM_INSTR_LSHIFT:
+      case BUZZVM_INSTR_RSHIFT: {
+         if(a->type != BUZZTYPE_INT || b->type != BUZZTYPE_INT) return 0;
+         r->type = BUZZTYPE_INT;
+         if(op == BUZZVM_INSTR_BAND)     r->i = a->i & b->i;
+         else if(op == BUZZVM_INSTR_BOR) r->i = a->i | b->i;
+         else if(b->i < 0 || b->i > 31)  return 0;
+         else if(op == BUZZVM_INSTR_LSHIFT) r->i = (int32_t)((uint32_t)a->i << b->i);
+         else                            r->i = a->i >> b->i;
+         return 1;
+      }
+      case BUZZVM_INSTR_EQ:
+      case BUZZVM_INSTR_NEQ:
+      case BUZZVM_INSTR_GT:
+      case BUZZVM_INSTR_GTE:
+      case BUZZVM_INSTR_LT:
+      case BUZZVM_INSTR_LTE: {
+         int cmp = buzzopt_const_cmp(a, b);
+         r->type = BUZZTYPE_INT;
+         switch(op) {
+            case BUZZVM_INSTR_EQ:  r->i = (cmp == 0); break;
+            case BUZZVM_INSTR_NEQ: r->i = (cmp != 0); break;
+            case BUZZVM_INSTR_GT:  r->i = (cmp > 0);  break;
+            case BUZZVM_INSTR_GTE: r->i = (cmp >= 0); break;
+            case BUZZVM_INSTR_LT:  r->i = (cmp < 0);  break;
+            default:               r->i = (cmp <= 0); break;
+         }
+         return 1;
+      }
+      default:
+         return 0;
+   }
+}
+
+/*
+ * Computes 'op a' like the VM does.
+ * Returns 1 if the result was computed, 0 if the operation is left to
+ * the VM.
+ */
+static int buzzopt_fold_unary(uint8_t op,
+                              buzzopt_const_t a,
+                              buzzopt_const_t r) {
+   switch(op) {
+      case BUZZVM_INSTR_UNM: {
+         if(a->type == BUZZTYPE_INT && a->i != INT32_MIN) {
+            r->type = BUZZTYPE_INT;
+            r->i = -a->i;
+            return 1;
+         }
+         if(a->type == BUZZTYPE_FLOAT) {
+            r->type = BUZZTYPE_FLOAT;
+            r->f = -a->f;
+            return 1;
+         }
+         return 0;
+      }
+      case BUZZVM_INSTR_LNOT: {
+         r->type = BUZZTYPE_INT;
+         r->i = !const_istrue(a);
+         return 1;
+      }
+      case BUZZVM_INSTR_BNOT: {
+         if(a->type != BUZZTYPE_INT) return 0;
+         r->type = BUZZTYPE_INT;
+         r->i = ~a->i;
+         return 1;
+      }
+      default:
+         return 0;
+   }
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Returns the index of the first instruction after i that was not
+ * dropped, or -1 if there is none
+ */
+static int64_t buzzopt_next(buzzopt_t o,
+                            int64_t i) {
+   for(++i; i < o->count; ++i)
+      if(!o->code[i].removed) return i;
+   return -1;
+}
+
+/*
+ * Returns the index of the last instruction before i that was not
+ * dropped, or -1 if there is none
+ */
+static int64_t buzzopt_prev(buzzopt_t o,
+                            int64_t i) {
+   for(--i; i >= 0; --i)
+      if(!o->code[i].removed) return i;
+   return -1;
+}
+
+/*
+ * Returns 1 if instruction i always leaves a number on the stack, that
+ * is, it pushes a number or it is an arithmetic operation
+ */
+static int buzzopt_isnumber(buzzopt_t o,
+                            int64_t i) {
+   if(i < 0) return 0;
+   switch(o->code[i].op) {
+      case BUZZVM_INSTR_PUSHI:
+      case BUZZVM_INSTR_PUSHF:
+      case BUZZVM_INSTR_ADD:
+      case BUZZVM_INSTR_SUB:
+      case BUZZVM_INSTR_MUL:
+      case BUZZVM_INSTR_DIV:
+         return 1;
+      default:
+         return 0;
+   }
+}
+
+/*
+ * Makes instruction i target instruction t, -1 for none
+ */
+static void buzzopt_retarget(buzzopt_t o,
+                             int64_t i,
+                             int64_t t) {
+   if(o->code[i].target >= 0) --o->code[o->code[i].target].refs;
+   o->code[i].target = t;
+   if(t >= 0) ++o->code[t].refs;
+}
+
+/*
+ * Drops an instruction. The jumps and closures that targeted it go to
+ * the next instruction, which must exist. If movedbg is 1, the next
+ * instruction also takes the debug information, unless it has some.
+ */
+static void buzzopt_drop(buzzopt_t o,
+                         int64_t i,
+                         int movedbg) {
+   struct buzzopt_instr_s* x = o->code + i;
+   int64_t n = buzzopt_next(o, i);
+   buzzopt_retarget(o, i, -1);
+   x->removed = 1;
+   if(x->refs > 0) {
+      int64_t j;
+      for(j = 0; j < o->count; ++j)
+         if(o->code[j].target == i) o->code[j].target = n;
+      o->code[n].refs += x->refs;
+      x->refs = 0;
+   }
+   if(movedbg && x->dbg && !o->code[n].dbg)
+      o->code[n].dbg = x->dbg;
+   x->dbg = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Applies the peephole rules once over the code.
+ * Returns 1 if something changed, 0 otherwise.
+ * The rules combine instruction i with the following ones only if
+ * nothing jumps to the latter, as they would see a different stack.
+ */
+static int buzzopt_peephole(buzzopt_t o) {
+   int changed = 0;
+   int64_t i, j, k, n;
+   struct buzzopt_const_s a, b, r;
+   for(i = buzzopt_next(o, -1); i >= 0; i = buzzopt_next(o, i)) {
+      struct buzzopt_instr_s* x = o->code + i;
+      j = buzzopt_next(o, i);
+      struct buzzopt_instr_s* y = (j >= 0 && o->code[j].refs == 0) ? o->code + j : NULL;
+      k = y ? buzzopt_next(o, j) : -1;
+      if(buzzopt_const_get(x, &a) && y) {
+         /* Constant folding: 'a; b; op' -> 'a op b' */
+         if(k >= 0 && o->code[k].refs == 0 &&
+            buzzopt_const_get(y, &b) &&
+            buzzopt_fold_binary(o->code[k].op, &a, &b, &r)) {
+            buzzopt_const_set(x, &r);
+            buzzopt_drop(o, k, 0);
+            buzzopt_drop(o, j, 0);
+            changed = 1;
+            continue;
+         }
+         /* Constant folding: 'a; op' -> 'op a' */
+         if(buzzopt_fold_unary(y->op, &a, &r)) {
+            buzzopt_const_set(x, &r);
+            buzzopt_drop(o, j, 0);
+            changed = 1;
+            continue;
+         }
+         /* Branch folding: 'a; jumpz L' -> 'jump L' or nothing */
+         if(y->op == BUZZVM_INSTR_JUMPZ || y->op == BUZZVM_INSTR_JUMPNZ) {
+            int taken = (y->op == BUZZVM_INSTR_JUMPZ) ? !const_istrue(&a) : const_istrue(&a);
+            if(taken) {
+               x->op = BUZZVM_INSTR_JUMP;
+               buzzopt_retarget(o, i, y->target);
+               buzzopt_drop(o, j, 0);
+               changed = 1;
+               continue;
+            }
+            if(k >= 0) {
+               buzzopt_drop(o, j, 0);
+               buzzopt_drop(o, i, 1);
+               changed = 1;
+               continue;
+            }
+         }
+         /* Identities: 'x; 0; add' -> 'x' and the like, only if x is a
+            number, or the type error the operation raises would be lost */
+         if(x->op == BUZZVM_INSTR_PUSHI && k >= 0 &&
+            x->refs == 0 && buzzopt_isnumber(o, buzzopt_prev(o, i)) &&
+            ((x->arg.i == 0 && (y->op == BUZZVM_INSTR_ADD || y->op == BUZZVM_INSTR_SUB)) ||
+             (x->arg.i == 1 && (y->op == BUZZVM_INSTR_MUL || y->op == BUZZVM_INSTR_DIV)))) {
+            buzzopt_drop(o, j, 0);
+            buzzopt_drop(o, i, 1);
+            changed = 1;
+            continue;
+         }
+      }
+      /* Redundant push: 'dup; pop', 'pushi 1; pop', ... -> nothing */
+      if(y && k >= 0 && y->op == BUZZVM_INSTR_POP &&
+         (x->op == BUZZVM_INSTR_DUP ||
+          x->op == BUZZVM_INSTR_PUSHNIL ||
+          x->op == BUZZVM_INSTR_PUSHI ||
+          x->op == BUZZVM_INSTR_PUSHF ||
+          x->op == BUZZVM_INSTR_PUSHCN ||
+          x->op == BUZZVM_INSTR_PUSHL)) {
+         buzzopt_drop(o, j, 0);
+         buzzopt_drop(o, i, 1);
+         changed = 1;
+         continue;
+      }
+      /* 'lnot; jumpz L' -> 'jumpnz L', and vice versa */
+      if(y && x->op == BUZZVM_INSTR_LNOT &&
+         (y->op == BUZZVM_INSTR_JUMPZ || y->op == BUZZVM_INSTR_JUMPNZ)) {
+         x->op = (y->op == BUZZVM_INSTR_JUMPZ) ? BUZZVM_INSTR_JUMPNZ : BUZZVM_INSTR_JUMPZ;
+         buzzopt_retarget(o, i, y->target);
+         buzzopt_drop(o, j, 0);
+         changed = 1;
+         continue;
+      }
+      /* 'lstore n; lload n' -> 'dup; lstore n' */
+      if(y && x->op == BUZZVM_INSTR_LSTORE &&
+         y->op == BUZZVM_INSTR_LLOAD && x->arg.i == y->arg.i) {
+         x->op = BUZZVM_INSTR_DUP;
+         y->op = BUZZVM_INSTR_LSTORE;
+         changed = 1;
+         continue;
+      }
+      /* 'lremove 0' -> nothing */
+      if(x->op == BUZZVM_INSTR_LREMOVE && x->arg.i == 0 && j >= 0) {
+         buzzopt_drop(o, i, 1);
+         changed = 1;
+         continue;
+      }
+      if(is_jump(x->op)) {
+         /* Jump threading: a jump to a jump goes to the final target */
+         k = x->target;
+         for(n = 0; n < o->count && o->code[k].op == BUZZVM_INSTR_JUMP; ++n)
+            k = o->code[k].target;
+         /* A chain that loops forever is left alone */
+         if(n < o->count && k != x->target) {
+            buzzopt_retarget(o, i, k);
+            changed = 1;
+         }
+         /* A jump to the next instruction is not needed */
+         if(x->target == j) {
+            if(x->op == BUZZVM_INSTR_JUMP) {
+               buzzopt_drop(o, i, 1);
+            }
+            else {
+               x->op = BUZZVM_INSTR_POP;
+               buzzopt_retarget(o, i, -1);
+            }
+            changed = 1;
+            continue;
+         }
+         /* A jump to ret0, ret1 or done is that instruction */
+         if(x->op == BUZZVM_INSTR_JUMP &&
+            (o->code[x->target].op == BUZZVM_INSTR_DONE ||
+             o->code[x->target].op == BUZZVM_INSTR_RET0 ||
+             o->code[x->target].op == BUZZVM_INSTR_RET1)) {
+            x->op = o->code[x->target].op;
+            buzzopt_retarget(o, i, -1);
+            changed = 1;
+            continue;
+         }
+      }
+   }
+   return changed;
+}
+
+/*
+ * Drops the instructions that cannot be reached from the start of the
+ * code or from a closure.
+ * Returns 1 if something changed, 0 otherwise.
+ */
+static int buzzopt_deadcode(buzzopt_t o) {
+   int changed = 0;
+   int64_t i, j;
+   int64_t* todo = (int64_t*)malloc(o->count * sizeof(int64_t));
+   int64_t ntodo = 0;
+   for(i = 0; i < o->count; ++i) o->code[i].reached = 0;
+   /* Visit the code from its start */
+   i = buzzopt_next(o, -1);
+   if(i >= 0) {
+      o->code[i].reached = 1;
+      todo[ntodo++] = i;
+   }
+   while(ntodo > 0) {
+      i = todo[--ntodo];
+      j = o->code[i].target;
+      if(j >= 0 && !o->code[j].reached) {
+         o->code[j].reached = 1;
+         todo[ntodo++] = j;
+      }
+      if(!is_terminal(o->code[i].op)) {
+         j = buzzopt_next(o, i);
+         if(j >= 0 && !o->code[j].reached) {
+            o->code[j].reached = 1;
+            todo[ntodo++] = j;
+         }
+      }
+   }
+   free(todo);
+   /* Drop the rest */
+   for(i = 0; i < o->count; ++i) {
+      if(!o->code[i].removed && !o->code[i].reached) {
+         o->code[i].removed = 1;
+         o->code[i].target = -1;
+         o->code[i].dbg = NULL;
+         changed = 1;
+      }
+   }
+   /* Only the reachable code targets instructions now */
+   if(changed) {
+      for(i = 0; i < o->count; ++i) o->code[i].refs = 0;
+      for(i = 0; i < o->count; ++i)
+         if(o->code[i].target >= 0) ++o->code[o->code[i].target].refs;
+   }
+   return changed;
+}
+
+/****************************************/
+/****************************************/
+
+int buzz_optimize(uint8_t* buf,
+                  uint32_t* size,
+                  buzzdebug_t* dbg) {
+   /*
+    * Skip the strings
+    */
+   uint16_t count;
+   if(*size < sizeof(uint16_t)) {
+      fprintf(stderr, "ERROR: bytecode too short\n");
+      return 2;
+   }
+   memcpy(&count, buf, sizeof(uint16_t));
+   uint32_t start = sizeof(uint16_t);
+   long int c = 0;
+   for(; (c < count) && (start < *size); ++c) {
+      while(start < *size && buf[start] != 0) ++start;
+      ++start;
+   }
+   if(c < count || start > *size) {
+      fprintf(stderr, "ERROR: scanning string went up to end of bytecode (%ld still to parse)\n", (count - c));
+      return 2;
+   }
+   /*
+    * Decode the instructions
+    */
+   struct buzzopt_s o = {
+      .code = (struct buzzopt_instr_s*)malloc((*size - start + 1) * sizeof(struct buzzopt_instr_s)),
+      .count = 0
+   };
+   buzzdebug_t olddbg = *dbg;
+   /* Offset -> instruction index */
+   int64_t* idx = (int64_t*)malloc((*size + 1) * sizeof(int64_t));
+   uint32_t off;
+   int64_t i;
+   for(off = 0; off <= *size; ++off) idx[off] = -1;
+   for(off = start; off < *size;) {
+      struct buzzopt_instr_s* x = o.code + o.count;
+      x->op = buf[off];
+      if(x->op >= BUZZVM_INSTR_COUNT) {
+         fprintf(stderr, "ERROR: unknown opcode %u at %u\n", x->op, off);
+         free(o.code);
+         free(idx);
+         return 2;
+      }
+      x->arg.i = 0;
+      if(has_arg(x->op)) {
+         if(off + sizeof(int32_t) >= *size) {
+            fprintf(stderr, "ERROR: not enough bytes in bytecode for argument of %s at %" PRIu32 "\n", buzzvm_instr_desc[x->op], off);
+            free(o.code);
+            free(idx);
+            return 2;
+         }
+         memcpy(&x->arg, buf + off + 1, sizeof(int32_t));
+      }
+      x->target = -1;
+      x->refs = 0;
+      x->removed = 0;
+      x->reached = 0;
+      x->dbg = buzzdebug_info_exists_offset(olddbg, &off) ?
+         *buzzdebug_info_get_fromoffset(olddbg, &off) :
+         NULL;
+      idx[off] = o.count;
+      ++o.count;
+      off += has_arg(x->op) ? 1 + sizeof(int32_t) : 1;
+   }
+   /* Resolve the code offsets */
+   for(i = 0; i < o.count; ++i) {
+      struct buzzopt_instr_s* x = o.code + i;
+      if(has_target(x->op)) {
+         if(x->arg.i < 0 || x->arg.i >= *size || idx[x->arg.i] < 0) {
+            fprintf(stderr, "ERROR: the argument %d of %s is not the offset of an instruction\n", x->arg.i, buzzvm_instr_desc[x->op]);
+            free(o.code);
+            free(idx);
+            return 2;
+         }
+         buzzopt_retarget(&o, i, idx[x->arg.i]);
+      }
+   }
+   free(idx);
+   /*
+    * Optimize until nothing changes
+    */
+   int changed = 1;
+   while(changed) {
+      changed = 0;
+      while(buzzopt_peephole(&o)) changed = 1;
+      if(buzzopt_deadcode(&o)) changed = 1;
+   }
+   /*
+    * Write the optimized code
+    */
+   /* Calculate the new offsets */
+   off = start;
+   for(i = 0; i < o.count; ++i) {
+      if(o.code[i].removed) continue;
+      o.code[i].off = off;
+      off += has_arg(o.code[i].op) ? 1 + sizeof(int32_t) : 1;
+   }
+   *size = off;
+   /* Write the instructions; they can only move backwards */
+   buzzdebug_t newdbg = buzzdebug_new();
+   for(i = 0; i < o.count; ++i) {
+      struct buzzopt_instr_s* x = o.code + i;
+      if(x->removed) continue;
+      buf[x->off] = x->op;
+      if(x->target >= 0) x->arg.i = o.code[x->target].off;
+      if(has_arg(x->op)) memcpy(buf + x->off + 1, &x->arg, sizeof(int32_t));
+      if(x->dbg) buzzdebug_info_set(newdbg, x->off, x->dbg->line, x->dbg->col, x->dbg->fname);
+   }
+   /* Replace the debug information */
+   buzzdebug_destroy(dbg);
+   *dbg = newdbg;
+   free(o.code);
+   return 0;
+}
+
+/****************************************/
+/****************************************/
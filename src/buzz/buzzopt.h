@@ -0,0 +1,45 @@
+#ifndef BUZZOPT_H
+#define BUZZOPT_H
+
+#include <buzz/buzzvm.h>
+#include <buzz/buzzdebug.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /*
+    * Optimizes assembled bytecode.
+    * The passes are repeated until nothing changes:
+    * - constant folding of arithmetic, logic, bitwise and comparison
+    *   operations whose operands are nil, int or float constants;
+    * - removal of the identities x+0, x-0, x*1 and x/1;
+    * - branch folding on constant conditions;
+    * - jump threading: jumps to jumps go straight to the final target,
+    *   jumps to the next instruction are dropped, and jumps to ret0,
+    *   ret1 or done are replaced by that instruction;
+    * - peephole rewriting: dup/pop and push/pop pairs are dropped,
+    *   'lnot; jumpz' becomes 'jumpnz' (and vice versa), 'lstore n;
+    *   lload n' becomes 'dup; lstore n', 'lremove 0' is dropped;
+    * - dead code elimination: the instructions that cannot be reached
+    *   from the start of the code or from a closure are dropped.
+    * The arguments of jump, jumpz, jumpnz, pushcn and pushl are taken
+    * as code offsets and relocated. Reachable 'nop' instructions are
+    * kept, as the first marks the end of the function definitions for
+    * buzzvm_set_bcode().
+    * The identities assume that the other operand is a number: the type
+    * error that, say, a table plus 0 would raise is not raised anymore.
+    * @param buf The bytecode buffer, rewritten in place.
+    * @param size The size of the bytecode buffer, updated.
+    * @param dbg The debug data structure, replaced by one with the new offsets.
+    * @return 0 if no error occurred, 2 for malformed bytecode.
+    */
+   extern int buzz_optimize(uint8_t* buf,
+                            uint32_t* size,
+                            buzzdebug_t* dbg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,11 +1,11 @@
 #include "buzzvm.h"
 #include "buzzheap.h"
+#include "buzzcompress.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <arpa/inet.h>
 #include <math.h>
-#include <string.h>
 
 /****************************************/
 /****************************************/
@@ -21,11 +21,13 @@ struct buzzoutmsg_broadcast_s {
 
 /*
  * Swarm message data
+ * For DIGEST messages, ids contains the robots whose list is requested.
  */
 struct buzzoutmsg_swarm_s {
    int type;
    uint16_t* ids;
    uint16_t size;
+   uint32_t hash;
 };
 
 /*
@@ -36,6 +38,33 @@ struct buzzoutmsg_vstig_s {
    uint16_t id;
    buzzobj_t key;
    buzzvstig_elem_t data;
+   /* Whether the message can be packed with the next ones */
+   uint8_t batch;
+   /* The neighbors in the queue */
+   union buzzoutmsg_u* prev;
+   union buzzoutmsg_u* next;
+};
+
+/*
+ * Virtual stigmergy digest message data
+ * For DIGEST messages, data contains the buckets.
+ * For BUCKET messages, data contains the entry descriptions.
+ */
+struct buzzoutmsg_digest_s {
+   int type;
+   uint16_t id;
+   uint16_t nbuckets;
+   uint16_t bucket;
+   uint32_t* data;
+   uint16_t size;
+};
+
+/*
+ * Pre-serialized message data (shared structure deltas, routing, aggregates)
+ */
+struct buzzoutmsg_crdt_s {
+   int type;
+   buzzmsg_payload_t payload;
 };
 
 /*
@@ -46,6 +75,8 @@ union buzzoutmsg_u {
    struct buzzoutmsg_broadcast_s bc;
    struct buzzoutmsg_swarm_s     sw;
    struct buzzoutmsg_vstig_s     vs;
+   struct buzzoutmsg_digest_s    dg;
+   struct buzzoutmsg_crdt_s      cr;
 };
 typedef union buzzoutmsg_u* buzzoutmsg_t;
 
@@ -68,12 +99,24 @@ void buzzoutmsg_destroy(uint32_t pos, void* data, void* params) {
       case BUZZMSG_SWARM_JOIN:
       case BUZZMSG_SWARM_LEAVE:
       case BUZZMSG_SWARM_LIST:
-         if(m->sw.size > 0) free(m->sw.ids);
+      case BUZZMSG_SWARM_DIGEST:
+         /* A list can be emptied by leave messages, free it anyway */
+         free(m->sw.ids);
          break;
       case BUZZMSG_VSTIG_PUT:
       case BUZZMSG_VSTIG_QUERY:
          free(m->vs.data);
          break;
+      case BUZZMSG_VSTIG_DIGEST:
+      case BUZZMSG_VSTIG_BUCKET:
+         free(m->dg.data);
+         break;
+      case BUZZMSG_CRDT_DELTA:
+      case BUZZMSG_ROUTE_DATA:
+      case BUZZMSG_ROUTE_VECTOR:
+      case BUZZMSG_AGGREGATE:
+         buzzmsg_payload_destroy(&m->cr.payload);
+         break;
    }
    free(m);
 }
@@ -84,10 +127,59 @@ void buzzoutmsg_vstig_destroy(const void* key, void* data, void* params) {
    free(data);
 }
 
-int buzzoutmsg_vstig_cmp(const void* a, const void* b) {
-   if((uintptr_t)(*(buzzoutmsg_t*)a) < (uintptr_t)(*(buzzoutmsg_t*)b)) return -1;
-   if((uintptr_t)(*(buzzoutmsg_t*)a) > (uintptr_t)(*(buzzoutmsg_t*)b)) return  1;
-   return 0;
+/*
+ * Returns the queue of the given vstig message type.
+ */
+static struct buzzoutmsg_vstigq_s* buzzoutmsg_vstigq(buzzvm_t vm, int type) {
+   return type == BUZZMSG_VSTIG_PUT ? &vm->outmsgs->puts : &vm->outmsgs->queries;
+}
+
+/*
+ * Appends a message at the end of a vstig queue.
+ */
+static void buzzoutmsg_vstigq_push(struct buzzoutmsg_vstigq_s* q, buzzoutmsg_t m) {
+   m->vs.prev = q->last;
+   m->vs.next = NULL;
+   if(q->last) q->last->vs.next = m;
+   else q->first = m;
+   q->last = m;
+   ++q->size;
+}
+
+/*
+ * Removes a message from a vstig queue, without destroying it.
+ */
+static void buzzoutmsg_vstigq_unlink(struct buzzoutmsg_vstigq_s* q, buzzoutmsg_t m) {
+   if(m->vs.prev) m->vs.prev->vs.next = m->vs.next;
+   else q->first = m->vs.next;
+   if(m->vs.next) m->vs.next->vs.prev = m->vs.prev;
+   else q->last = m->vs.prev;
+   --q->size;
+}
+
+/*
+ * Removes a message from its vstig queue and from the vstig dictionary, and
+ * destroys it.
+ */
+static void buzzoutmsg_vstig_remove(buzzvm_t vm, buzzoutmsg_t m) {
+   buzzoutmsg_vstigq_unlink(buzzoutmsg_vstigq(vm, m->vs.type), m);
+   buzzdict_remove(
+      *buzzdict_get(vm->outmsgs->vstig, &m->vs.id, buzzdict_t),
+      &m->vs.key);
+   buzzoutmsg_destroy(0, &m, NULL);
+}
+
+/*
+ * Destroys all the messages in a vstig queue.
+ */
+static void buzzoutmsg_vstigq_clear(struct buzzoutmsg_vstigq_s* q) {
+   while(q->first) {
+      buzzoutmsg_t m = q->first;
+      q->first = m->vs.next;
+      buzzoutmsg_destroy(0, &m, NULL);
+   }
+   q->last = NULL;
+   q->size = 0;
 }
 
 /****************************************/
@@ -99,14 +191,27 @@ buzzoutmsg_queue_t buzzoutmsg_queue_new() {
    q->queues[BUZZMSG_SWARM_LIST]  = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
    q->queues[BUZZMSG_SWARM_JOIN]  = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
    q->queues[BUZZMSG_SWARM_LEAVE] = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
-   q->queues[BUZZMSG_VSTIG_PUT]   = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
-   q->queues[BUZZMSG_VSTIG_QUERY] = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
+   q->queues[BUZZMSG_VSTIG_PUT]   = NULL;
+   q->queues[BUZZMSG_VSTIG_QUERY] = NULL;
+   q->queues[BUZZMSG_VSTIG_PUTMANY] = NULL;
+   q->puts.first = q->puts.last = NULL;
+   q->puts.size = 0;
+   q->queries.first = q->queries.last = NULL;
+   q->queries.size = 0;
+   q->queues[BUZZMSG_VSTIG_DIGEST] = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
+   q->queues[BUZZMSG_VSTIG_BUCKET] = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
+   q->queues[BUZZMSG_CRDT_DELTA]   = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
+   q->queues[BUZZMSG_SWARM_DIGEST] = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
+   q->queues[BUZZMSG_ROUTE_DATA]   = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
+   q->queues[BUZZMSG_ROUTE_VECTOR] = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
+   q->queues[BUZZMSG_AGGREGATE]    = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
    q->vstig = buzzdict_new(10,
                            sizeof(uint16_t),
                            sizeof(buzzdict_t),
                            buzzdict_uint16keyhash,
                            buzzdict_uint16keycmp,
                            buzzoutmsg_vstig_destroy);
+   q->compress = 0;
    return q;
 }
 
@@ -118,8 +223,15 @@ void buzzoutmsg_queue_destroy(buzzoutmsg_queue_t* msgq) {
    buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_SWARM_LIST]));
    buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_SWARM_JOIN]));
    buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_SWARM_LEAVE]));
-   buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_VSTIG_PUT]));
-   buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_VSTIG_QUERY]));
+   buzzoutmsg_vstigq_clear(&(*msgq)->puts);
+   buzzoutmsg_vstigq_clear(&(*msgq)->queries);
+   buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_VSTIG_DIGEST]));
+   buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_VSTIG_BUCKET]));
+   buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_CRDT_DELTA]));
+   buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_SWARM_DIGEST]));
+   buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_ROUTE_DATA]));
+   buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_ROUTE_VECTOR]));
+   buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_AGGREGATE]));
    buzzdict_destroy(&((*msgq)->vstig));
    free(*msgq);
 }
@@ -133,8 +245,14 @@ uint32_t buzzoutmsg_queue_size(buzzvm_t vm) {
       buzzdarray_size(vm->outmsgs->queues[BUZZMSG_SWARM_LIST]) +
       buzzdarray_size(vm->outmsgs->queues[BUZZMSG_SWARM_JOIN]) +
       buzzdarray_size(vm->outmsgs->queues[BUZZMSG_SWARM_LEAVE]) +
-      buzzdarray_size(vm->outmsgs->queues[BUZZMSG_VSTIG_PUT]) +
-      buzzdarray_size(vm->outmsgs->queues[BUZZMSG_VSTIG_QUERY]);
+      buzzoutmsg_queue_vstig_size(vm) +
+      buzzdarray_size(vm->outmsgs->queues[BUZZMSG_VSTIG_DIGEST]) +
+      buzzdarray_size(vm->outmsgs->queues[BUZZMSG_VSTIG_BUCKET]) +
+      buzzdarray_size(vm->outmsgs->queues[BUZZMSG_CRDT_DELTA]) +
+      buzzdarray_size(vm->outmsgs->queues[BUZZMSG_SWARM_DIGEST]) +
+      buzzdarray_size(vm->outmsgs->queues[BUZZMSG_ROUTE_DATA]) +
+      buzzdarray_size(vm->outmsgs->queues[BUZZMSG_ROUTE_VECTOR]) +
+      buzzdarray_size(vm->outmsgs->queues[BUZZMSG_AGGREGATE]);
 }
 
 /****************************************/
@@ -155,32 +273,8 @@ void buzzoutmsg_queue_append_broadcast(buzzvm_t vm,
 /****************************************/
 /****************************************/
 
-struct dict_to_array_s {
-   size_t count; /* Current element count */
-   size_t size;  /* Current data buffer size */
-   uint16_t* data; /* Data buffer */
-};
-
-void dict_to_array(const void* key, void* data, void* params) {
-   /* (*key)   is a uint16_t, the swarm id
-    * (*data)  is a uint8_t, the membership (1 -> in, 0 -> out)
-    * (params) is a (struct dict_to_array_s*)
-    */
-   struct dict_to_array_s* p = (struct dict_to_array_s*)params;
-   if(*(uint8_t*)data) {
-      /* Grow buffer if necessary */
-      if(p->count >= p->size) {
-         p->size *= 2;
-         p->data = realloc(p->data, p->size * sizeof(uint16_t));
-      }
-      /* Append swarm id */
-      p->data[p->count] = *(uint16_t*)key;
-      ++p->count;
-   }
-}
-
 void buzzoutmsg_queue_append_swarm_list(buzzvm_t vm,
-                                        const buzzdict_t ids) {
+                                        const buzzdarray_t ids) {
    /* Invariants:
     * - Only one list message can be queued at any time;
     * - If a list message is already queued, join/leave messages are not
@@ -189,20 +283,12 @@ void buzzoutmsg_queue_append_swarm_list(buzzvm_t vm,
    buzzdarray_clear(vm->outmsgs->queues[BUZZMSG_SWARM_LIST], 1);
    buzzdarray_clear(vm->outmsgs->queues[BUZZMSG_SWARM_JOIN], 1);
    buzzdarray_clear(vm->outmsgs->queues[BUZZMSG_SWARM_LEAVE], 1);
-   /* Make an array of current swarm id dictionary */
-   struct dict_to_array_s da = {
-      .count = 0,
-      .size = 1,
-      .data = (uint16_t*)malloc(sizeof(uint16_t))
-   };
-   buzzdict_foreach(ids, dict_to_array, &da);
    /* Make a new LIST message */
    buzzoutmsg_t m = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
    m->sw.type = BUZZMSG_SWARM_LIST;
-   m->sw.size = da.count;
+   m->sw.size = buzzdarray_size(ids);
    m->sw.ids = (uint16_t*)malloc(m->sw.size * sizeof(uint16_t));
-   memcpy(m->sw.ids, da.data, m->sw.size * sizeof(uint16_t));
-   free(da.data);
+   memcpy(m->sw.ids, ids->data, m->sw.size * sizeof(uint16_t));
    /* Queue the new LIST message */
    buzzdarray_push(vm->outmsgs->queues[BUZZMSG_SWARM_LIST], &m);
 }
@@ -210,6 +296,28 @@ void buzzoutmsg_queue_append_swarm_list(buzzvm_t vm,
 /****************************************/
 /****************************************/
 
+void buzzoutmsg_queue_append_swarm_digest(buzzvm_t vm,
+                                          uint32_t hash,
+                                          const buzzdarray_t stale) {
+   /* Only the latest digest is useful */
+   buzzdarray_clear(vm->outmsgs->queues[BUZZMSG_SWARM_DIGEST], 1);
+   /* Make a new DIGEST message */
+   buzzoutmsg_t m = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
+   m->sw.type = BUZZMSG_SWARM_DIGEST;
+   m->sw.hash = hash;
+   m->sw.size = buzzdarray_size(stale);
+   m->sw.ids = NULL;
+   if(m->sw.size > 0) {
+      m->sw.ids = (uint16_t*)malloc(m->sw.size * sizeof(uint16_t));
+      memcpy(m->sw.ids, stale->data, m->sw.size * sizeof(uint16_t));
+   }
+   /* Queue the new DIGEST message */
+   buzzdarray_push(vm->outmsgs->queues[BUZZMSG_SWARM_DIGEST], &m);
+}
+
+/****************************************/
+/****************************************/
+
 static void append_to_swarm_queue(buzzdarray_t q, uint16_t id, int type) {
    /* Is the queue empty? */
    if(buzzdarray_isempty(q)) {
@@ -308,13 +416,14 @@ void buzzoutmsg_queue_append_swarm_joinleave(buzzvm_t vm,
 /****************************************/
 /****************************************/
 
-void buzzoutmsg_queue_append_vstig(buzzvm_t vm,
-                                   int type,
-                                   uint16_t id,
-                                   const buzzobj_t key,
-                                   const buzzvstig_elem_t data) {
+static void buzzoutmsg_vstig_append(buzzvm_t vm,
+                                    int type,
+                                    uint16_t id,
+                                    const buzzobj_t key,
+                                    const buzzvstig_elem_t data,
+                                    uint8_t batch) {
    /* Look for a duplicate message in the dictionary */
-   const struct buzzoutmsg_vstig_s** e = NULL;
+   buzzoutmsg_t* e = NULL;
    /* Virtual stigmergy to actually use */
    buzzdict_t vs = NULL;
    /* Look for the virtual stigmergy */
@@ -322,26 +431,34 @@ void buzzoutmsg_queue_append_vstig(buzzvm_t vm,
    if(tvs) {
       /* Virtual stigmergy found, look for the key */
       vs = *tvs;
-      e = buzzdict_get(vs, &key, struct buzzoutmsg_vstig_s*);
+      e = (buzzoutmsg_t*)buzzdict_rawget(vs, &key);
    }
    else {
       /* Virtual stigmergy not found, create it */
       vs = buzzdict_new(10,
                         sizeof(buzzobj_t),
-                        sizeof(struct buzzoutmsg_vstig_s*),
+                        sizeof(buzzoutmsg_t),
                         buzzoutmsg_obj_hash,
                         buzzoutmsg_obj_cmp,
                         NULL);
       buzzdict_set(vm->outmsgs->vstig, &id, &vs);
    }
-   /* Do we have a more recent duplicate? */
-   int etype = -1, eidx = -1; /* No message to remove from the queue */
+   /* Do we have a duplicate? */
    if(e) {
+      buzzoutmsg_t d = *e;
       /* Yes; if the duplicate is newer than the passed message, nothing to do */
-      if((*e)->data->timestamp >= data->timestamp) return;
-      /* The duplicate is older, store data to remove it later */
-      etype = (*e)->type;
-      eidx = buzzdarray_find(vm->outmsgs->queues[etype], buzzoutmsg_vstig_cmp, e);
+      if(!buzzvstig_ts_newer(data->timestamp, d->vs.data->timestamp)) return;
+      /* The duplicate is older, replace its data */
+      free(d->vs.data);
+      d->vs.data = buzzvstig_elem_clone(vm, data);
+      d->vs.batch = batch;
+      if(d->vs.type != type) {
+         /* Move the message to the right queue */
+         buzzoutmsg_vstigq_unlink(buzzoutmsg_vstigq(vm, d->vs.type), d);
+         d->vs.type = type;
+         buzzoutmsg_vstigq_push(buzzoutmsg_vstigq(vm, type), d);
+      }
+      return;
    }
    /* Create a new message */
    buzzoutmsg_t m = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
@@ -349,20 +466,162 @@ void buzzoutmsg_queue_append_vstig(buzzvm_t vm,
    m->vs.id = id;
    m->vs.key = buzzheap_clone(vm, key);
    m->vs.data = buzzvstig_elem_clone(vm, data);
-   /* Update the dictionary - this also invalidates e */
+   m->vs.batch = batch;
+   /* Add it to the dictionary and to the queue */
    buzzdict_set(vs, &m->vs.key, &m);
-   if(etype > -1) {
-      /* Remove the entry from the queue */
-      buzzdarray_remove(vm->outmsgs->queues[etype], eidx);
+   buzzoutmsg_vstigq_push(buzzoutmsg_vstigq(vm, type), m);
+}
+
+void buzzoutmsg_queue_append_vstig(buzzvm_t vm,
+                                   int type,
+                                   uint16_t id,
+                                   const buzzobj_t key,
+                                   const buzzvstig_elem_t data) {
+   buzzoutmsg_vstig_append(vm, type, id, key, data, 0);
+}
+
+void buzzoutmsg_queue_append_vstig_batch(buzzvm_t vm,
+                                         uint16_t id,
+                                         const buzzobj_t key,
+                                         const buzzvstig_elem_t data) {
+   buzzoutmsg_vstig_append(vm, BUZZMSG_VSTIG_PUT, id, key, data, 1);
+}
+
+/*
+ * Returns the number of PUT messages to pack in the next payload.
+ */
+static uint32_t buzzoutmsg_vstig_batch_size(buzzvm_t vm) {
+   buzzoutmsg_t f = vm->outmsgs->puts.first;
+   if(!f->vs.batch) return 1;
+   uint32_t n = 1;
+   buzzoutmsg_t m = f->vs.next;
+   while(m &&
+         n < BUZZOUTMSG_VSTIG_BATCH_MAX &&
+         m->vs.batch &&
+         m->vs.id == f->vs.id) {
+      ++n;
+      m = m->vs.next;
    }
-   /* Add a new message to the queue */
-   buzzdarray_push(vm->outmsgs->queues[type], &m);
+   return n;
 }
 
 /****************************************/
 /****************************************/
 
-buzzmsg_payload_t buzzoutmsg_queue_first(buzzvm_t vm) {
+void buzzoutmsg_queue_append_vstig_digest(buzzvm_t vm,
+                                          uint16_t id,
+                                          const uint32_t* buckets,
+                                          uint16_t size) {
+   /* Only the latest digest of a virtual stigmergy is worth sending */
+   buzzdarray_t q = vm->outmsgs->queues[BUZZMSG_VSTIG_DIGEST];
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(q); ++i) {
+      if(buzzdarray_get(q, i, buzzoutmsg_t)->dg.id == id) {
+         buzzdarray_remove(q, i);
+         break;
+      }
+   }
+   /* Make a new DIGEST message */
+   buzzoutmsg_t m = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
+   m->dg.type = BUZZMSG_VSTIG_DIGEST;
+   m->dg.id = id;
+   m->dg.nbuckets = size;
+   m->dg.bucket = 0;
+   m->dg.size = size;
+   m->dg.data = (uint32_t*)malloc(size * sizeof(uint32_t));
+   memcpy(m->dg.data, buckets, size * sizeof(uint32_t));
+   /* Queue it */
+   buzzdarray_push(q, &m);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzoutmsg_queue_append_vstig_bucket(buzzvm_t vm,
+                                          uint16_t id,
+                                          uint16_t nbuckets,
+                                          uint16_t bucket,
+                                          const uint32_t* entries,
+                                          uint16_t count) {
+   /* Only the latest description of a bucket is worth sending */
+   buzzdarray_t q = vm->outmsgs->queues[BUZZMSG_VSTIG_BUCKET];
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(q); ++i) {
+      buzzoutmsg_t e = buzzdarray_get(q, i, buzzoutmsg_t);
+      if(e->dg.id == id && e->dg.nbuckets == nbuckets && e->dg.bucket == bucket) {
+         buzzdarray_remove(q, i);
+         break;
+      }
+   }
+   /* Make a new BUCKET message */
+   buzzoutmsg_t m = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
+   m->dg.type = BUZZMSG_VSTIG_BUCKET;
+   m->dg.id = id;
+   m->dg.nbuckets = nbuckets;
+   m->dg.bucket = bucket;
+   m->dg.size = count;
+   m->dg.data = (uint32_t*)malloc(BUZZVSTIG_DIGEST_ENTRY_SIZE * count * sizeof(uint32_t));
+   memcpy(m->dg.data, entries, BUZZVSTIG_DIGEST_ENTRY_SIZE * count * sizeof(uint32_t));
+   /* Queue it */
+   buzzdarray_push(q, &m);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzoutmsg_queue_append_crdt(buzzvm_t vm,
+                                  buzzmsg_payload_t payload) {
+   /* Make a new DELTA message */
+   buzzoutmsg_t m = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
+   m->cr.type = BUZZMSG_CRDT_DELTA;
+   m->cr.payload = payload;
+   /* Queue it */
+   buzzdarray_push(vm->outmsgs->queues[BUZZMSG_CRDT_DELTA], &m);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzoutmsg_queue_append_route(buzzvm_t vm,
+                                   buzzmsg_payload_t payload) {
+   /* Make a new DATA or VECTOR message */
+   buzzoutmsg_t m = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
+   m->cr.type = buzzmsg_payload_type(payload);
+   m->cr.payload = payload;
+   /* Queue it */
+   buzzdarray_push(vm->outmsgs->queues[m->cr.type], &m);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzoutmsg_queue_append_aggregate(buzzvm_t vm,
+                                       buzzmsg_payload_t payload) {
+   /* Make a new AGGREGATE message */
+   buzzoutmsg_t m = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
+   m->cr.type = BUZZMSG_AGGREGATE;
+   m->cr.payload = payload;
+   /* Queue it */
+   buzzdarray_push(vm->outmsgs->queues[BUZZMSG_AGGREGATE], &m);
+}
+
+int buzzoutmsg_queue_aggregate_pending(buzzvm_t vm,
+                                       uint16_t id) {
+   buzzdarray_t q = vm->outmsgs->queues[BUZZMSG_AGGREGATE];
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(q); ++i) {
+      /* The id follows the type in the payload */
+      uint16_t mid;
+      buzzmsg_deserialize_u16(&mid, buzzdarray_get(q, i, buzzoutmsg_t)->cr.payload, 1);
+      if(mid == id) return 1;
+   }
+   return 0;
+}
+
+/****************************************/
+/****************************************/
+
+static buzzmsg_payload_t buzzoutmsg_queue_serialize(buzzvm_t vm) {
    if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_BROADCAST])) {
       /* Take the first message in the queue */
       buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_BROADCAST],
@@ -375,6 +634,12 @@ buzzmsg_payload_t buzzoutmsg_queue_first(buzzvm_t vm) {
       /* Return message */
       return m;
    }
+   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_ROUTE_DATA])) {
+      /* Take the first message in the queue, which is already serialized */
+      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_ROUTE_DATA],
+                                      0, buzzoutmsg_t);
+      return buzzdarray_clone(f->cr.payload);
+   }
    else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_SWARM_LIST])) {
       uint16_t i;
       /* Take the first message in the queue */
@@ -390,30 +655,105 @@ buzzmsg_payload_t buzzoutmsg_queue_first(buzzvm_t vm) {
       /* Return message */
       return m;      
    }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_VSTIG_PUT])) {
+   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_VSTIG_DIGEST])) {
+      /* Digests go before the updates, or a busy robot would never send them */
+      uint16_t i;
       /* Take the first message in the queue */
-      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_VSTIG_PUT],
+      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_VSTIG_DIGEST],
                                       0, buzzoutmsg_t);
       /* Make a new message */
+      buzzmsg_payload_t m = buzzmsg_payload_new(5 + f->dg.size * sizeof(uint32_t));
+      buzzmsg_serialize_u8(m, BUZZMSG_VSTIG_DIGEST);
+      buzzmsg_serialize_u16(m, f->dg.id);
+      buzzmsg_serialize_u16(m, f->dg.size);
+      for(i = 0; i < f->dg.size; ++i) {
+         buzzmsg_serialize_u32(m, f->dg.data[i]);
+      }
+      /* Return message */
+      return m;
+   }
+   else if(vm->outmsgs->puts.size > 0) {
+      /* Take the first messages in the queue */
+      buzzoutmsg_t f;
+      uint32_t i, n = buzzoutmsg_vstig_batch_size(vm);
+      /* All the entries use 64-bit timestamps if one needs them */
+      int wide = 0;
+      for(i = 0, f = vm->outmsgs->puts.first; i < n && !wide; ++i, f = f->vs.next)
+         wide = buzzvstig_elem_iswide(f->vs.data);
+      /* Make a new message; a VM that cannot read a batch ignores it whole */
+      buzzmsg_payload_t m = buzzmsg_payload_new(10 * n);
+      buzzmsg_serialize_u8(m,
+                           (n > 1 ? BUZZMSG_VSTIG_PUTMANY : BUZZMSG_VSTIG_PUT) |
+                           (wide ? BUZZMSG_FLAG_WIDE : 0));
+      buzzmsg_serialize_u16(m, vm->outmsgs->puts.first->vs.id);
+      for(i = 0, f = vm->outmsgs->puts.first; i < n; ++i, f = f->vs.next)
+         buzzvstig_elem_serialize(m, f->vs.key, f->vs.data, wide);
+      /* Return message */
+      return m;
+   }
+   else if(vm->outmsgs->queries.size > 0) {
+      /* Take the first message in the queue */
+      buzzoutmsg_t f = vm->outmsgs->queries.first;
+      /* Make a new message */
       buzzmsg_payload_t m = buzzmsg_payload_new(10);
-      buzzmsg_serialize_u8(m, BUZZMSG_VSTIG_PUT);
+      buzzmsg_serialize_u8(m, BUZZMSG_VSTIG_QUERY |
+                           (buzzvstig_elem_iswide(f->vs.data) ? BUZZMSG_FLAG_WIDE : 0));
       buzzmsg_serialize_u16(m, f->vs.id);
-      buzzvstig_elem_serialize(m, f->vs.key, f->vs.data);
+      buzzvstig_elem_serialize(m, f->vs.key, f->vs.data, buzzvstig_elem_iswide(f->vs.data));
       /* Return message */
       return m;
    }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_VSTIG_QUERY])) {
+   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_VSTIG_BUCKET])) {
+      uint16_t i;
       /* Take the first message in the queue */
-      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_VSTIG_QUERY],
+      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_VSTIG_BUCKET],
                                       0, buzzoutmsg_t);
       /* Make a new message */
-      buzzmsg_payload_t m = buzzmsg_payload_new(10);
-      buzzmsg_serialize_u8(m, BUZZMSG_VSTIG_QUERY);
-      buzzmsg_serialize_u16(m, f->vs.id);
-      buzzvstig_elem_serialize(m, f->vs.key, f->vs.data);
+      /* Use 16-bit timestamps unless some do not fit */
+      int wide = 0;
+      for(i = 0; i < f->dg.size && !wide; ++i) {
+         const uint32_t* e = f->dg.data + i * BUZZVSTIG_DIGEST_ENTRY_SIZE;
+         wide = e[1] != 0 || e[2] > UINT16_MAX;
+      }
+      buzzmsg_payload_t m = buzzmsg_payload_new(9 + f->dg.size * (wide ? 14 : 8));
+      buzzmsg_serialize_u8(m, BUZZMSG_VSTIG_BUCKET | (wide ? BUZZMSG_FLAG_WIDE : 0));
+      buzzmsg_serialize_u16(m, f->dg.id);
+      buzzmsg_serialize_u16(m, f->dg.nbuckets);
+      buzzmsg_serialize_u16(m, f->dg.bucket);
+      buzzmsg_serialize_u16(m, f->dg.size);
+      for(i = 0; i < f->dg.size; ++i) {
+         const uint32_t* e = f->dg.data + i * BUZZVSTIG_DIGEST_ENTRY_SIZE;
+         buzzmsg_serialize_u32(m, e[0]);
+         if(wide) {
+            buzzmsg_serialize_u32(m, e[1]);
+            buzzmsg_serialize_u32(m, e[2]);
+         }
+         else {
+            buzzmsg_serialize_u16(m, e[2]);
+         }
+         buzzmsg_serialize_u16(m, e[3]);
+      }
       /* Return message */
       return m;
    }
+   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_CRDT_DELTA])) {
+      /* Take the first message in the queue, which is already serialized */
+      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_CRDT_DELTA],
+                                      0, buzzoutmsg_t);
+      return buzzdarray_clone(f->cr.payload);
+   }
+   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_ROUTE_VECTOR])) {
+      /* Take the first message in the queue, which is already serialized */
+      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_ROUTE_VECTOR],
+                                      0, buzzoutmsg_t);
+      return buzzdarray_clone(f->cr.payload);
+   }
+   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_AGGREGATE])) {
+      /* Take the first message in the queue, which is already serialized */
+      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_AGGREGATE],
+                                      0, buzzoutmsg_t);
+      return buzzdarray_clone(f->cr.payload);
+   }
    else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_SWARM_JOIN])) {
       /* Take the first message in the queue */
       buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_SWARM_JOIN],
@@ -436,10 +776,45 @@ buzzmsg_payload_t buzzoutmsg_queue_first(buzzvm_t vm) {
       /* Return message */
       return m;      
    }
+   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_SWARM_DIGEST])) {
+      /* Digests go after join/leave, so they describe the membership the
+       * neighbors already received */
+      uint16_t i;
+      /* Take the first message in the queue */
+      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_SWARM_DIGEST],
+                                      0, buzzoutmsg_t);
+      /* Make a new message */
+      buzzmsg_payload_t m = buzzmsg_payload_new(7 + f->sw.size * sizeof(uint16_t));
+      buzzmsg_serialize_u8(m, BUZZMSG_SWARM_DIGEST);
+      buzzmsg_serialize_u32(m, f->sw.hash);
+      buzzmsg_serialize_u16(m, f->sw.size);
+      for(i = 0; i < f->sw.size; ++i) {
+         buzzmsg_serialize_u16(m, f->sw.ids[i]);
+      }
+      /* Return message */
+      return m;
+   }
    /* Empty queue */
    return NULL;
 }
 
+buzzmsg_payload_t buzzoutmsg_queue_first(buzzvm_t vm) {
+   /* Serialize the first message */
+   buzzmsg_payload_t m = buzzoutmsg_queue_serialize(vm);
+   /* Compress it if it is large enough */
+   if(m &&
+      vm->outmsgs->compress > 0 &&
+      buzzmsg_payload_size(m) >= vm->outmsgs->compress) {
+      buzzmsg_payload_t c = buzzcompress_payload_encode(m);
+      /* Keep the original if compression does not pay off */
+      if(c) {
+         buzzmsg_payload_destroy(&m);
+         m = c;
+      }
+   }
+   return m;
+}
+
 /****************************************/
 /****************************************/
 
@@ -448,31 +823,43 @@ void buzzoutmsg_queue_next(buzzvm_t vm) {
       /* Remove the first message in the queue */
       buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_BROADCAST], 0);
    }
+   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_ROUTE_DATA])) {
+      /* Remove the first message in the queue */
+      buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_ROUTE_DATA], 0);
+   }
    else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_SWARM_LIST])) {
       /* Remove the first message in the queue */
       buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_SWARM_LIST], 0);
    }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_VSTIG_PUT])) {
-      /* Take the first message in the queue */
-      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_VSTIG_PUT],
-                                      0, buzzoutmsg_t);
-      /* Remove the element in the vstig dictionary */
-      buzzdict_remove(
-         *buzzdict_get(vm->outmsgs->vstig, &f->vs.id, buzzdict_t),
-         &f->vs.key);
+   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_VSTIG_DIGEST])) {
       /* Remove the first message in the queue */
-      buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_VSTIG_PUT], 0);
+      buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_VSTIG_DIGEST], 0);
    }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_VSTIG_QUERY])) {
-      /* Take the first message in the queue */
-      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_VSTIG_QUERY],
-                                      0, buzzoutmsg_t);
-      /* Remove the element in the vstig dictionary */
-      buzzdict_remove(
-         *buzzdict_get(vm->outmsgs->vstig, &f->vs.id, buzzdict_t),
-         &f->vs.key);
+   else if(vm->outmsgs->puts.size > 0) {
+      /* Remove as many messages as were packed in the payload */
+      uint32_t n = buzzoutmsg_vstig_batch_size(vm);
+      while(n-- > 0)
+         buzzoutmsg_vstig_remove(vm, vm->outmsgs->puts.first);
+   }
+   else if(vm->outmsgs->queries.size > 0) {
+      /* Remove the first message in the queue */
+      buzzoutmsg_vstig_remove(vm, vm->outmsgs->queries.first);
+   }
+   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_VSTIG_BUCKET])) {
       /* Remove the first message in the queue */
-      buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_VSTIG_QUERY], 0);
+      buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_VSTIG_BUCKET], 0);
+   }
+   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_CRDT_DELTA])) {
+      /* Remove the first message in the queue */
+      buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_CRDT_DELTA], 0);
+   }
+   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_ROUTE_VECTOR])) {
+      /* Remove the first message in the queue */
+      buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_ROUTE_VECTOR], 0);
+   }
+   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_AGGREGATE])) {
+      /* Remove the first message in the queue */
+      buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_AGGREGATE], 0);
    }
    else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_SWARM_JOIN])) {
       /* Remove the first message in the queue */
@@ -482,6 +869,10 @@ void buzzoutmsg_queue_next(buzzvm_t vm) {
       /* Remove the first message in the queue */
       buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_SWARM_LEAVE], 0);
    }
+   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_SWARM_DIGEST])) {
+      /* Remove the first message in the queue */
+      buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_SWARM_DIGEST], 0);
+   }
 }
 
 /****************************************/
@@ -494,10 +885,10 @@ void buzzoutmsg_broadcast_mark(uint32_t pos, void* data, void* params) {
    buzzheap_obj_mark(msg->value, vm);
 }
 
-void buzzoutmsg_vstig_mark(uint32_t pos, void* data, void* params) {
-   struct buzzoutmsg_vstig_s* msg = *(struct buzzoutmsg_vstig_s**)data;
-   buzzvm_t vm = (buzzvm_t)params;
-   buzzheap_vstigobj_mark(&msg->key, &msg->data, vm);
+void buzzoutmsg_vstig_mark(struct buzzoutmsg_vstigq_s* q, buzzvm_t vm) {
+   buzzoutmsg_t m;
+   for(m = q->first; m; m = m->vs.next)
+      buzzheap_vstigobj_mark(&m->vs.key, &m->vs.data, vm);
 }
 
 void buzzoutmsg_gc(struct buzzvm_s* vm) {
@@ -506,12 +897,8 @@ void buzzoutmsg_gc(struct buzzvm_s* vm) {
                       buzzoutmsg_broadcast_mark,
                       vm);
    /* Go through all the vstig keys and values and mark them */
-   buzzdarray_foreach(vm->outmsgs->queues[BUZZMSG_VSTIG_PUT],
-                      buzzoutmsg_vstig_mark,
-                      vm);
-   buzzdarray_foreach(vm->outmsgs->queues[BUZZMSG_VSTIG_QUERY],
-                      buzzoutmsg_vstig_mark,
-                      vm);
+   buzzoutmsg_vstig_mark(&vm->outmsgs->puts, vm);
+   buzzoutmsg_vstig_mark(&vm->outmsgs->queries, vm);
 }
 
 /****************************************/
@@ -11,14 +11,34 @@ struct buzzvm_s;
 extern "C" {
 #endif
 
+   /*
+    * A queue of virtual stigmergy messages.
+    * The messages form an intrusive doubly linked list, so a message found
+    * through the vstig message dict is replaced or removed in O(1).
+    */
+   struct buzzoutmsg_vstigq_s {
+      /* The first message, or NULL if the queue is empty */
+      union buzzoutmsg_u* first;
+      /* The last message, or NULL if the queue is empty */
+      union buzzoutmsg_u* last;
+      /* The number of messages */
+      uint32_t size;
+   };
+
    /*
     * Data of a Buzz message queue.
     */
    struct buzzoutmsg_queue_s {
-      /* One queue for each message type */
+      /* One queue for each message type, except the vstig PUT and QUERY */
       buzzdarray_t queues[BUZZMSG_TYPE_COUNT];
+      /* Vstig PUT messages */
+      struct buzzoutmsg_vstigq_s puts;
+      /* Vstig QUERY messages */
+      struct buzzoutmsg_vstigq_s queries;
       /* Vstig message dict for fast duplicate management */
       buzzdict_t vstig;
+      /* Minimum payload size for compression (0 = never compress) */
+      uint32_t compress;
    };
    typedef struct buzzoutmsg_queue_s* buzzoutmsg_queue_t;
 
@@ -54,11 +74,23 @@ extern "C" {
    /*
     * Appends a new swarm list message.
     * @param vm The Buzz VM.
-    * @param ids A list of swarm ids in which the robot is a member.
+    * @param ids A list of swarm ids (uint16_t) in which the robot is a member.
     */
    extern void buzzoutmsg_queue_append_swarm_list(struct buzzvm_s* vm,
-                                                  const buzzdict_t ids);
+                                                  const buzzdarray_t ids);
    
+   /*
+    * Appends a new swarm digest message.
+    * A queued digest is replaced.
+    * @param vm The Buzz VM.
+    * @param hash The digest of the swarms in which the robot is a member.
+    * @param stale The robots (uint16_t) whose swarm list is requested.
+    * @see buzzswarm_members_hash
+    */
+   extern void buzzoutmsg_queue_append_swarm_digest(struct buzzvm_s* vm,
+                                                    uint32_t hash,
+                                                    const buzzdarray_t stale);
+
    /*
     * Appends a new swarm join/leave message.
     * @param vm The Buzz VM.
@@ -85,8 +117,101 @@ extern "C" {
                                              const buzzobj_t key,
                                              const buzzvstig_elem_t data);
 
+   /*
+    * Appends a new virtual stigmergy PUT message that can be packed with
+    * the next ones.
+    * Consecutive batched PUT messages for the same virtual stigmergy are
+    * sent as a single BUZZMSG_VSTIG_PUTMANY payload with up to
+    * BUZZOUTMSG_VSTIG_BATCH_MAX entries. A batch of one entry is sent as a
+    * plain BUZZMSG_VSTIG_PUT.
+    * @param vm The Buzz VM.
+    * @param id The id of the virtual stigmergy.
+    * @param key The key.
+    * @param data The data of the entry.
+    * @see buzzoutmsg_queue_append_vstig
+    */
+   extern void buzzoutmsg_queue_append_vstig_batch(struct buzzvm_s* vm,
+                                                   uint16_t id,
+                                                   const buzzobj_t key,
+                                                   const buzzvstig_elem_t data);
+
+   /*
+    * Appends a new virtual stigmergy digest message.
+    * A queued digest for the same virtual stigmergy is replaced.
+    * @param vm The Buzz VM.
+    * @param id The id of the virtual stigmergy.
+    * @param buckets The digest buckets.
+    * @param size The number of buckets.
+    * @see buzzvstig_digest
+    */
+   extern void buzzoutmsg_queue_append_vstig_digest(struct buzzvm_s* vm,
+                                                    uint16_t id,
+                                                    const uint32_t* buckets,
+                                                    uint16_t size);
+
+   /*
+    * Appends a new virtual stigmergy bucket message.
+    * A queued message for the same bucket is replaced.
+    * @param vm The Buzz VM.
+    * @param id The id of the virtual stigmergy.
+    * @param nbuckets The number of buckets in the digest.
+    * @param bucket The bucket.
+    * @param entries The descriptions of the entries in the bucket.
+    * @param count The number of entries.
+    * @see BUZZVSTIG_DIGEST_ENTRY_SIZE
+    * @see buzzvstig_digest_compare
+    */
+   extern void buzzoutmsg_queue_append_vstig_bucket(struct buzzvm_s* vm,
+                                                    uint16_t id,
+                                                    uint16_t nbuckets,
+                                                    uint16_t bucket,
+                                                    const uint32_t* entries,
+                                                    uint16_t count);
+
+   /*
+    * Appends a new shared structure delta message.
+    * The ownership of the payload is assumed by the message queue.
+    * @param vm The Buzz VM.
+    * @param payload The serialized message.
+    * @see buzzcrdt_flush
+    */
+   extern void buzzoutmsg_queue_append_crdt(struct buzzvm_s* vm,
+                                            buzzmsg_payload_t payload);
+
+   /*
+    * Appends a new routed message or distance vector.
+    * The type is read from the payload. The ownership of the payload is
+    * assumed by the message queue.
+    * @param vm The Buzz VM.
+    * @param payload The serialized message.
+    * @see buzzroute_gossip
+    */
+   extern void buzzoutmsg_queue_append_route(struct buzzvm_s* vm,
+                                             buzzmsg_payload_t payload);
+
+   /*
+    * Appends a new aggregate message.
+    * The ownership of the payload is assumed by the message queue.
+    * @param vm The Buzz VM.
+    * @param payload The serialized message.
+    * @see buzzaggregate_update
+    */
+   extern void buzzoutmsg_queue_append_aggregate(struct buzzvm_s* vm,
+                                                 buzzmsg_payload_t payload);
+
+   /*
+    * Returns 1 if a message of an aggregate is still in the queue.
+    * @param vm The Buzz VM.
+    * @param id The aggregate id.
+    * @return 1 if a message is queued, 0 otherwise.
+    */
+   extern int buzzoutmsg_queue_aggregate_pending(struct buzzvm_s* vm,
+                                                 uint16_t id);
+
    /*
     * Returns the first serialized message in the queue.
+    * If the message is at least msgq->compress bytes long and compression
+    * shrinks it, the compressed form is returned.
     * You are in charge of freeing both the message data and the payload.
     * @param vm The Buzz VM.
     * @return The message data or NULL.
@@ -120,4 +245,15 @@ extern "C" {
  */
 #define buzzoutmsg_queue_isempty(vm) (buzzoutmsg_queue_size(vm) == 0)
 
+/*
+ * Returns the number of virtual stigmergy PUT and QUERY messages in the queue.
+ * @param vm The Buzz VM.
+ */
+#define buzzoutmsg_queue_vstig_size(vm) ((vm)->outmsgs->puts.size + (vm)->outmsgs->queries.size)
+
+/*
+ * Maximum number of entries in a multi-entry PUT message.
+ */
+#define BUZZOUTMSG_VSTIG_BATCH_MAX 32
+
 #endif
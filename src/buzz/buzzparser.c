@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <unistd.h>
 
 /****************************************/
 /****************************************/
@@ -38,7 +39,7 @@ struct strarray_data_s {
    uint16_t pos;
 };
 
-void string_copy(const void* key, void* data, void* params) {
+static void string_copy(const void* key, void* data, void* params) {
    struct strarray_data_s* x = (struct strarray_data_s*)malloc(sizeof(struct strarray_data_s));
    x->str = *(char**)key;
    x->pos = *(uint16_t*)data;
@@ -46,18 +47,23 @@ void string_copy(const void* key, void* data, void* params) {
    buzzdarray_push(arr, &x);
 }
 
-int string_cmp(const void* a, const void* b) {
+static int string_cmp(const void* a, const void* b) {
    if((*(struct strarray_data_s**)a)->pos < (*(struct strarray_data_s**)b)->pos) return -1;
    if((*(struct strarray_data_s**)a)->pos > (*(struct strarray_data_s**)b)->pos) return  1;
    return 0;
 }
 
-void string_destroy(uint32_t pos, void* data, void* params) {
-   free((*(struct strarray_data_s**)data)->str);
+static void string_destroy(uint32_t pos, void* data, void* params) {
    free(*(struct strarray_data_s**)data);
 }
 
-uint32_t string_add(buzzdict_t strings, const char* str) {
+static void string_key_destroy(const void* key, void* data, void* params) {
+   free(*(char**)key);
+   free((void*)key);
+   free(data);
+}
+
+static uint32_t string_add(buzzdict_t strings, const char* str) {
    const uint16_t* ppos = buzzdict_get(strings, &str, uint16_t);
    if(!ppos) {
       /* String not found */
@@ -72,7 +78,7 @@ uint32_t string_add(buzzdict_t strings, const char* str) {
    }
 }
 
-void string_print(uint32_t pos, void* data, void* params) {
+static void string_print(uint32_t pos, void* data, void* params) {
    fprintf((FILE*)params, "'%s\n", (*(struct strarray_data_s**)data)->str);
 }
 
@@ -91,8 +97,8 @@ struct sym_s {
    int global;
 };
 
-const struct sym_s* sym_lookup(const char* sym,
-                               buzzdarray_t symstack) {
+static const struct sym_s* sym_lookup(const char* sym,
+                                      buzzdarray_t symstack) {
    const struct sym_s* symdata = NULL;
    /* Go through the symbol tables, from the top to the bottom */
    int64_t i;
@@ -107,7 +113,7 @@ const struct sym_s* sym_lookup(const char* sym,
    return NULL;
 }
 
-void sym_add(buzzparser_t par, const char* sym, int scope) {
+static void sym_add(buzzparser_t par, const char* sym, int scope) {
    /* Copy string */
    char* key = strdup(sym);
    /* Check whether symbol is global or local */
@@ -137,7 +143,7 @@ void sym_add(buzzparser_t par, const char* sym, int scope) {
    else       buzzdict_set(par->syms, &key, &symdata);
 }
 
-void sym_clone(const void* key, void* data, void* params) {
+static void sym_clone(const void* key, void* data, void* params) {
    struct sym_s* toclone = (struct sym_s*)data;
    /* Copy key */
    char* newkey = strdup(*(char**)key);
@@ -151,9 +157,9 @@ void sym_clone(const void* key, void* data, void* params) {
    buzzdict_set(((buzzparser_t)params)->syms, &newkey, &newsym);
 }
 
-void sym_destroy(const void* key,
-                void* data,
-                void* params) {
+static void sym_destroy(const void* key,
+                       void* data,
+                       void* params) {
    free(*(char**)key);
    free((void*)key);
    free(data);
@@ -161,16 +167,18 @@ void sym_destroy(const void* key,
 
 #define SYMT_BUCKETS 100
 
-void sym_print(const void* key, void* data, void* params) {
+static void sym_print(const void* key, void* data, void* params) {
    fprintf(stderr, "   symbol: '%s'\n", (*(char**)key));
 }
 
-void symt_print(uint32_t pos, void* data, void* params) {
+static void symt_print(uint32_t pos, void* data, void* params) {
    fprintf(stderr, "symbol stack level %u\n", pos);
    buzzdict_foreach(*((buzzdict_t*)data), sym_print, NULL);
 }
 
-void symstack_print(buzzparser_t par) {
+/* Only called from symt_print(), when debugging the parser */
+__attribute__((unused))
+static void symstack_print(buzzparser_t par) {
    fprintf(stderr, "===\n");
    buzzdarray_foreach(par->symstack, symt_print, NULL);
    fprintf(stderr, "===\n\n");
@@ -184,7 +192,7 @@ void symstack_print(buzzparser_t par) {
 
 #define symt_pop() { buzzdarray_pop(par->symstack); par->syms = buzzdarray_last(par->symstack, buzzdict_t); }
 
-void symt_destroy(uint32_t pos, void* data, void* params) {
+static void symt_destroy(uint32_t pos, void* data, void* params) {
    buzzdict_destroy((buzzdict_t*)data);
 }
 
@@ -221,7 +229,7 @@ struct chunk_s {
 };
 typedef struct chunk_s* chunk_t;
 
-chunk_t chunk_new(uint32_t label, const struct sym_s* sym) {
+static chunk_t chunk_new(uint32_t label, const struct sym_s* sym) {
    chunk_t c = (chunk_t)malloc(sizeof(struct chunk_s));
    c->label = label;
    c->csize = 0;
@@ -231,14 +239,26 @@ chunk_t chunk_new(uint32_t label, const struct sym_s* sym) {
    return c;
 }
 
-void chunk_destroy(uint32_t pos, void* data, void* params) {
+static void chunk_destroy(uint32_t pos, void* data, void* params) {
    chunk_t* c = (chunk_t*)data;
    free((*c)->code);
    free(*c);
    *c = NULL;
 }
 
-void chunk_addcode(chunk_t c, char* code, buzztok_t tok) {
+static void chunk_addraw(chunk_t c, const char* code, size_t l) {
+   /* Resize the code buffer */
+   if(c->csize + l >= c->ccap) {
+      do { c->ccap *= 2; } while(c->csize + l >= c->ccap);
+      c->code = realloc(c->code, c->ccap);
+   }
+   /* Copy the code */
+   memcpy(c->code + c->csize, code, l);
+   /* Update size */
+   c->csize += l;
+}
+
+static void chunk_addcode(chunk_t c, char* code, buzztok_t tok) {
    /* Append code to debug information */
    char* instr;
    if(tok) {
@@ -247,22 +267,13 @@ void chunk_addcode(chunk_t c, char* code, buzztok_t tok) {
    else {
       asprintf(&instr, "%s\n", code);
    }
-   /* Get length of the code */
-   size_t l = strlen(instr);
-   /* Resize the code buffer */
-   if(c->csize + l >= c->ccap) {
-      do { c->ccap *= 2; } while(c->csize + l >= c->ccap);
-      c->code = realloc(c->code, c->ccap);
-   }
    /* Copy the code */
-   strncpy(c->code + c->csize, instr, l);
-   /* Update size */
-   c->csize += l;
+   chunk_addraw(c, instr, strlen(instr));
    /* Cleanup */
    free(instr);
 }
 
-void chunk_finalize(chunk_t c) {
+static void chunk_finalize(chunk_t c) {
    /* Shrink the memory allocation */
    c->ccap = c->csize + 1;
    c->code = realloc(c->code, c->ccap);
@@ -277,7 +288,7 @@ void chunk_finalize(chunk_t c) {
       free(str);                                    \
    }
 
-void chunk_register(uint32_t pos, void* data, void* params) {
+static void chunk_register(uint32_t pos, void* data, void* params) {
    /* Cast params */
    chunk_t c = *(chunk_t*)data;
    FILE* f = (FILE*)params;
@@ -290,7 +301,7 @@ void chunk_register(uint32_t pos, void* data, void* params) {
    }
 }
 
-void chunk_print(uint32_t pos, void* data, void* params) {
+static void chunk_print(uint32_t pos, void* data, void* params) {
    /* Cast params */
    chunk_t c = *(chunk_t*)data;
    FILE* f = (FILE*)params;
@@ -349,8 +360,8 @@ void chunk_print(uint32_t pos, void* data, void* params) {
       } while(par->tok->type != BUZZTOK_EOF && par->tok->type == BUZZTOK_STATEND); \
    }
 
-int match(buzzparser_t par,
-          buzztok_type_e type) {
+static int match(buzzparser_t par,
+                 buzztok_type_e type) {
    if(par->tok->type == BUZZTOK_EOF) {
       fprintf(stderr,
               "%s: Syntax error: expected %s, found end of file\n",
@@ -376,48 +387,486 @@ int match(buzzparser_t par,
 /****************************************/
 /****************************************/
 
-int parse_script(buzzparser_t par);
+static int parse_script(buzzparser_t par);
+
+static int parse_statlist(buzzparser_t par);
+static int parse_stat(buzzparser_t par);
+static int parse_block(buzzparser_t par, int pushsymt);
+static int parse_blockstat(buzzparser_t par);
 
-int parse_statlist(buzzparser_t par);
-int parse_stat(buzzparser_t par);
-int parse_block(buzzparser_t par, int pushsymt);
-int parse_blockstat(buzzparser_t par);
+static int parse_var(buzzparser_t par);
+static int parse_fun(buzzparser_t par);
+static int parse_if(buzzparser_t par);
+static int parse_for(buzzparser_t par);
+static int parse_while(buzzparser_t par);
 
-int parse_var(buzzparser_t par);
-int parse_fun(buzzparser_t par);
-int parse_if(buzzparser_t par);
-int parse_for(buzzparser_t par);
-int parse_while(buzzparser_t par);
+static int parse_conditionlist(buzzparser_t par,
+                               int* numargs);
+static int parse_condition(buzzparser_t par);
+static int parse_comparison(buzzparser_t par);
 
-int parse_conditionlist(buzzparser_t par,
-                        int* numargs);
-int parse_condition(buzzparser_t par);
-int parse_comparison(buzzparser_t par);
+static int parse_expression(buzzparser_t par);
+static int parse_product(buzzparser_t par);
+static int parse_modulo(buzzparser_t par);
+static int parse_power(buzzparser_t par);
+static int parse_powerrest(buzzparser_t par);
+static int parse_bitshift(buzzparser_t par);
+static int parse_bitwiseandor(buzzparser_t par);
+static int parse_bitwisenot(buzzparser_t par);
+static int parse_operand(buzzparser_t par);
 
-int parse_expression(buzzparser_t par);
-int parse_product(buzzparser_t par);
-int parse_modulo(buzzparser_t par);
-int parse_power(buzzparser_t par);
-int parse_powerrest(buzzparser_t par);
-int parse_bitshift(buzzparser_t par);
-int parse_bitwiseandor(buzzparser_t par);
-int parse_bitwisenot(buzzparser_t par);
-int parse_operand(buzzparser_t par);
+static int parse_command(buzzparser_t par);
 
-int parse_command(buzzparser_t par);
+static int parse_idlist(buzzparser_t par);
+static int parse_idref(buzzparser_t par,
+                       int lvalue,
+                       struct idrefinfo_s* idrefinfo);
 
-int parse_idlist(buzzparser_t par);
-int parse_idreflist(buzzparser_t par);
-int parse_idref(buzzparser_t par,
-                int lvalue,
-                struct idrefinfo_s* idrefinfo);
+static int parse_lambda(buzzparser_t par);
 
-int parse_lambda(buzzparser_t par);
+static int parse_include(buzzparser_t par, int* spliced);
+
+static buzzparser_t buzzparser_init(buzzlex_t lex,
+                                    const char* scriptfn,
+                                    char* asmfn,
+                                    FILE* asmstream);
 
 /****************************************/
 /****************************************/
 
-int parse_script(buzzparser_t par) {
+/*
+ * The cache of included files
+ *
+ * A file included in the global scope is parsed on its own, as a
+ * module with its own string ids and labels. Its code is spliced into
+ * the script by changing the string ids and the labels. The next time
+ * the file is included, its code is taken from the cache, as long as
+ * the file and the files it includes have not changed.
+ */
+
+/* What must be changed in the code of a module */
+#define RELOC_STRING 0
+#define RELOC_LABEL  1
+#define RELOC_DEBUG  2
+
+struct reloc_s {
+   /* Position and length of the text to replace */
+   uint32_t pos;
+   uint32_t len;
+   /* Kind of relocation, one of RELOC_* */
+   int kind;
+   /* The string id or the label in the module */
+   uint32_t val;
+};
+
+/* A chunk of code of a module */
+struct modchunk_s {
+   /* The label in the module */
+   uint32_t label;
+   /* String id of the function name in the module, -1 for lambdas and the global scope */
+   int64_t sym;
+   /* The code */
+   char* code;
+   /* The relocations */
+   buzzdarray_t relocs;
+};
+
+/* A file a module depends upon */
+struct moddep_s {
+   /* The absolute file name */
+   char* fname;
+   /* The hash of the file content */
+   uint64_t hash;
+};
+
+/* A parsed included file */
+struct module_s {
+   /* The hash of the file content */
+   uint64_t hash;
+   /* The files it includes, as struct moddep_s */
+   buzzdarray_t deps;
+   /* The strings, by string id */
+   buzzdarray_t strings;
+   /* The string ids of the global symbols */
+   buzzdarray_t syms;
+   /* The number of labels */
+   uint32_t labels;
+   /* The chunks, as struct modchunk_s*; the first is the global scope */
+   buzzdarray_t chunks;
+};
+typedef struct module_s* module_t;
+
+struct buzzparser_cache_s {
+   /* The modules, by absolute file name */
+   buzzdict_t modules;
+   /* The include path the modules were parsed with */
+   char* incpath;
+   /* The working directory the modules were parsed in */
+   char* cwd;
+   /* The lexers of the scripts and modules being parsed */
+   buzzdarray_t lexers;
+};
+
+#define MODULE_HASH_INIT 14695981039346656037ULL
+
+static uint64_t module_hash(uint64_t hash, const char* buf, size_t size) {
+   /* FNV-1a */
+   size_t i;
+   for(i = 0; i < size; ++i) {
+      hash ^= (uint8_t)buf[i];
+      hash *= 1099511628211ULL;
+   }
+   return hash;
+}
+
+static int module_filehash(const char* fname, uint64_t* hash) {
+   FILE* fd = fopen(fname, "rb");
+   if(!fd) return 0;
+   char buf[4096];
+   size_t n;
+   *hash = MODULE_HASH_INIT;
+   while((n = fread(buf, 1, sizeof(buf), fd)) > 0)
+      *hash = module_hash(*hash, buf, n);
+   fclose(fd);
+   /* The lexer adds a newline at the end */
+   *hash = module_hash(*hash, "\n", 1);
+   return 1;
+}
+
+static void modchunk_destroy(uint32_t pos, void* data, void* params) {
+   struct modchunk_s* c = *(struct modchunk_s**)data;
+   free(c->code);
+   buzzdarray_destroy(&c->relocs);
+   free(c);
+}
+
+static void moddep_destroy(uint32_t pos, void* data, void* params) {
+   free(((struct moddep_s*)data)->fname);
+}
+
+static void modstring_destroy(uint32_t pos, void* data, void* params) {
+   free(*(char**)data);
+}
+
+static void module_destroy(const void* key, void* data, void* params) {
+   module_t m = *(module_t*)data;
+   buzzdarray_destroy(&m->deps);
+   buzzdarray_destroy(&m->strings);
+   buzzdarray_destroy(&m->syms);
+   buzzdarray_destroy(&m->chunks);
+   free(m);
+   free(*(char**)key);
+   free((void*)key);
+   free(data);
+}
+
+/*
+ * Finds what must be relocated in the code of a module
+ */
+static buzzdarray_t module_relocs(const char* code) {
+   buzzdarray_t relocs = buzzdarray_new(10, sizeof(struct reloc_s), NULL);
+   const char* line = code;
+   while(*line) {
+      /* The debug information starts at the first '|' */
+      const char* eol = strchr(line, '\n');
+      if(!eol) eol = line + strlen(line);
+      const char* dbg = memchr(line, '|', eol - line);
+      const char* iend = dbg ? dbg : eol;
+      struct reloc_s r;
+      char* end;
+      /* String ids */
+      if(strncmp(line, "\tpushs ", 7) == 0) {
+         r.kind = RELOC_STRING;
+         r.val = strtoul(line + 7, &end, 10);
+         r.pos = line + 7 - code;
+         r.len = end - (line + 7);
+         buzzdarray_push(relocs, &r);
+      }
+      /* Labels, both definitions and references */
+      const char* l;
+      for(l = line; l + sizeof(LABELREF) - 1 <= iend; ++l) {
+         if(memcmp(l, LABELREF, sizeof(LABELREF) - 1) == 0) {
+            l += sizeof(LABELREF) - 1;
+            r.kind = RELOC_LABEL;
+            r.val = strtoul(l, &end, 10);
+            r.pos = l - code;
+            r.len = end - l;
+            buzzdarray_push(relocs, &r);
+            break;
+         }
+      }
+      /* Code written when the next token was the end of the file,
+         which in the script is the token after the inclusion */
+      if(dbg && strncmp(dbg + 1, "0,", 2) == 0) {
+         r.kind = RELOC_DEBUG;
+         r.val = 0;
+         r.pos = dbg + 1 - code;
+         r.len = eol - (dbg + 1);
+         buzzdarray_push(relocs, &r);
+      }
+      line = *eol ? eol + 1 : eol;
+   }
+   return relocs;
+}
+
+/*
+ * Adds the code of a module chunk to a chunk, with the new string ids and labels
+ */
+static void module_reloc(chunk_t c,
+                         const struct modchunk_s* mc,
+                         const uint32_t* strids,
+                         uint32_t labels,
+                         const char* dbg) {
+   char num[16];
+   uint32_t i, prev = 0;
+   for(i = 0; i < buzzdarray_size(mc->relocs); ++i) {
+      const struct reloc_s* r = &buzzdarray_get(mc->relocs, i, struct reloc_s);
+      chunk_addraw(c, mc->code + prev, r->pos - prev);
+      if(r->kind == RELOC_STRING) {
+         snprintf(num, sizeof(num), "%u", strids[r->val]);
+         chunk_addraw(c, num, strlen(num));
+      }
+      else if(r->kind == RELOC_LABEL) {
+         snprintf(num, sizeof(num), "%u", labels + r->val);
+         chunk_addraw(c, num, strlen(num));
+      }
+      else {
+         chunk_addraw(c, dbg, strlen(dbg));
+      }
+      prev = r->pos + r->len;
+   }
+   chunk_addraw(c, mc->code + prev, strlen(mc->code + prev));
+}
+
+static void module_sym(const void* key, void* data, void* params) {
+   struct sym_s* sym = (struct sym_s*)data;
+   uint32_t pos = sym->pos;
+   if(sym->global) buzzdarray_push((buzzdarray_t)params, &pos);
+}
+
+/*
+ * Makes a module out of a parser that read an included file
+ */
+static module_t module_new(buzzparser_t par, uint64_t hash) {
+   module_t m = (module_t)malloc(sizeof(struct module_s));
+   m->hash = hash;
+   m->labels = par->labels;
+   /* Strings, by id */
+   m->strings = buzzdarray_new(10, sizeof(char*), modstring_destroy);
+   buzzdarray_t sarr = buzzdarray_new(10, sizeof(struct strarray_data_s*), string_destroy);
+   buzzdict_foreach(par->strings, string_copy, sarr);
+   buzzdarray_sort(sarr, string_cmp);
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(sarr); ++i) {
+      char* str = strdup(buzzdarray_get(sarr, i, struct strarray_data_s*)->str);
+      buzzdarray_push(m->strings, &str);
+   }
+   buzzdarray_destroy(&sarr);
+   /* Global symbols */
+   m->syms = buzzdarray_new(10, sizeof(uint32_t), NULL);
+   buzzdict_foreach(buzzdarray_get(par->symstack, 0, buzzdict_t), module_sym, m->syms);
+   /* Chunks, taking their code */
+   m->chunks = buzzdarray_new(buzzdarray_size(par->chunks), sizeof(struct modchunk_s*), modchunk_destroy);
+   for(i = 0; i < buzzdarray_size(par->chunks); ++i) {
+      chunk_t c = buzzdarray_get(par->chunks, i, chunk_t);
+      struct modchunk_s* mc = (struct modchunk_s*)malloc(sizeof(struct modchunk_s));
+      mc->label = c->label;
+      mc->sym = c->sym ? c->sym->pos : -1;
+      mc->code = c->code;
+      c->code = NULL;
+      mc->relocs = module_relocs(mc->code);
+      buzzdarray_push(m->chunks, &mc);
+   }
+   /* Dependencies: the files it read, and those of the modules spliced into it */
+   m->deps = buzzdarray_new(10, sizeof(struct moddep_s), moddep_destroy);
+   for(i = 0; i < buzzdarray_size(par->lex->closed); ++i) {
+      buzzlex_file_t f = buzzdarray_get(par->lex->closed, i, buzzlex_file_t);
+      struct moddep_s d = {
+         .fname = strdup(f->fname),
+         .hash = module_hash(MODULE_HASH_INIT, f->buf, f->buf_size)
+      };
+      buzzdarray_push(m->deps, &d);
+      const module_t* pm = buzzdict_get(par->cache->modules, &f->fname, module_t);
+      if(pm) {
+         uint32_t j;
+         for(j = 0; j < buzzdarray_size((*pm)->deps); ++j) {
+            const struct moddep_s* pd = &buzzdarray_get((*pm)->deps, j, struct moddep_s);
+            d.fname = strdup(pd->fname);
+            d.hash = pd->hash;
+            buzzdarray_push(m->deps, &d);
+         }
+      }
+   }
+   return m;
+}
+
+/*
+ * Parses an included file on its own
+ * On success, *status is PARSE_OK and the module is returned; if the
+ * file can't be parsed on its own, NULL is returned.
+ * On a syntax error, *status is PARSE_ERROR.
+ */
+static module_t module_parse(buzzparser_t outer, buzzlex_file_t f, uint64_t hash, int* status) {
+   /* Make a parser for the file, without the newline added by the lexer */
+   char* src = strndup(f->buf, f->buf_size - 1);
+   buzzparser_t par = buzzparser_init(buzzlex_new_fromstring(f->fname, src),
+                                      outer->scriptfn,
+                                      NULL,
+                                      NULL);
+   free(src);
+   par->cache = outer->cache;
+   buzzdarray_push(par->cache->lexers, &outer->lex);
+   /* Make the global scope, without a label */
+   symt_push();
+   par->chunk = chunk_new(0, NULL);
+   buzzdarray_push(par->chunks, &par->chunk);
+   /* Parse the statements */
+   par->tok = buzzlex_nexttok(par->lex);
+   while(par->tok->type != BUZZTOK_EOF &&
+         par->tok->type == BUZZTOK_STATEND) {
+      buzzlex_destroytok(&par->tok);
+      par->tok = buzzlex_nexttok(par->lex);
+   }
+   if(par->tok->type == BUZZTOK_EOF)
+      *status = buzzlex_done(par->lex) ? PARSE_OK : PARSE_ERROR;
+   else
+      *status = parse_statlist(par);
+   module_t m = NULL;
+   /* A stray } ends the statements before the end of the file */
+   if(*status == PARSE_OK && par->tok->type == BUZZTOK_EOF) {
+      chunk_finalize(par->chunk);
+      m = module_new(par, hash);
+   }
+   buzzdarray_pop(par->cache->lexers);
+   buzzparser_destroy(&par);
+   return m;
+}
+
+/*
+ * Returns 1 if the module and the files it includes have not changed
+ */
+static int module_uptodate(module_t m, uint64_t hash) {
+   if(m->hash != hash) return 0;
+   uint32_t i;
+   uint64_t h;
+   for(i = 0; i < buzzdarray_size(m->deps); ++i) {
+      const struct moddep_s* d = &buzzdarray_get(m->deps, i, struct moddep_s);
+      if(!module_filehash(d->fname, &h) || h != d->hash) return 0;
+   }
+   return 1;
+}
+
+/*
+ * Returns 1 if a file is being read, either below the given file in
+ * the script or by the scripts whose included files are being parsed
+ * The lexer does not include these files again.
+ */
+static int module_reading(buzzparser_t par, buzzlex_file_t f, const char* fname) {
+   uint32_t i, j;
+   for(i = 0; buzzdarray_get(par->lex->files, i, buzzlex_file_t) != f; ++i)
+      if(strcmp(fname, buzzdarray_get(par->lex->files, i, buzzlex_file_t)->fname) == 0)
+         return 1;
+   for(i = 0; i < buzzdarray_size(par->cache->lexers); ++i) {
+      buzzlex_t lex = buzzdarray_get(par->cache->lexers, i, buzzlex_t);
+      for(j = 0; j < buzzdarray_size(lex->files); ++j)
+         if(strcmp(fname, buzzdarray_get(lex->files, j, buzzlex_file_t)->fname) == 0)
+            return 1;
+   }
+   return 0;
+}
+
+/*
+ * Returns 1 if the module can be spliced at the current point
+ * It must not include the files being read.
+ */
+static int module_splicable(buzzparser_t par, buzzlex_file_t f, module_t m) {
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(m->deps); ++i)
+      if(module_reading(par, f, buzzdarray_get(m->deps, i, struct moddep_s).fname))
+         return 0;
+   return 1;
+}
+
+/*
+ * Adds the code of a module to the script
+ */
+static void module_splice(buzzparser_t par, module_t m) {
+   uint32_t i;
+   /* Get the string ids in the script, in the order of the module */
+   uint32_t n = buzzdarray_size(m->strings);
+   uint32_t* strids = (uint32_t*)malloc((n ? n : 1) * sizeof(uint32_t));
+   for(i = 0; i < n; ++i)
+      strids[i] = string_add(par->strings, buzzdarray_get(m->strings, i, char*));
+   /* Add the global symbols */
+   for(i = 0; i < buzzdarray_size(m->syms); ++i) {
+      const char* sym = buzzdarray_get(m->strings, buzzdarray_get(m->syms, i, uint32_t), char*);
+      if(!sym_lookup(sym, par->symstack)) sym_add(par, sym, SCOPE_GLOBAL);
+   }
+   /* The code written at the end of the module refers to the token after the inclusion */
+   char* dbg;
+   asprintf(&dbg, "%" PRIu64 ",%" PRIu64 ",%s", par->tok->line, par->tok->col, par->tok->fname);
+   /* Add the code */
+   uint32_t labels = par->labels;
+   par->labels += m->labels;
+   for(i = 0; i < buzzdarray_size(m->chunks); ++i) {
+      const struct modchunk_s* mc = buzzdarray_get(m->chunks, i, struct modchunk_s*);
+      if(i == 0) {
+         /* The global scope goes into the current chunk */
+         module_reloc(par->chunk, mc, strids, labels, dbg);
+      }
+      else {
+         const struct sym_s* sym = NULL;
+         if(mc->sym >= 0)
+            sym = sym_lookup(buzzdarray_get(m->strings, mc->sym, char*), par->symstack);
+         chunk_t c = chunk_new(labels + mc->label, sym);
+         module_reloc(c, mc, strids, labels, dbg);
+         chunk_finalize(c);
+         buzzdarray_push(par->chunks, &c);
+      }
+   }
+   free(dbg);
+   free(strids);
+}
+
+/*
+ * Splices the file whose inclusion starts at the current token, if any
+ * On return, *spliced is 1 if a file was spliced, and the current
+ * token is the one after the inclusion.
+ */
+static int parse_include(buzzparser_t par, int* spliced) {
+   *spliced = 0;
+   /* Only the files included in the global scope are cached */
+   if(!par->cache || buzzdarray_size(par->symstack) != 1) return PARSE_OK;
+   buzzlex_file_t f = buzzlex_newfile(par->lex);
+   if(!f || module_reading(par, f, f->fname)) return PARSE_OK;
+   /* Look for the module in the cache, or parse it */
+   uint64_t hash = module_hash(MODULE_HASH_INIT, f->buf, f->buf_size);
+   const module_t* pm = buzzdict_get(par->cache->modules, &f->fname, module_t);
+   module_t m;
+   if(pm && module_uptodate(*pm, hash)) {
+      m = *pm;
+   }
+   else {
+      int status;
+      m = module_parse(par, f, hash, &status);
+      if(status == PARSE_ERROR) return PARSE_ERROR;
+      if(!m) return PARSE_OK;
+      char* fname = strdup(f->fname);
+      buzzdict_set(par->cache->modules, &fname, &m);
+   }
+   if(!module_splicable(par, f, m)) return PARSE_OK;
+   /* Skip the file and add its code */
+   buzzlex_closefile(par->lex, f);
+   fetchtok();
+   module_splice(par, m);
+   *spliced = 1;
+   return PARSE_OK;
+}
+
+/****************************************/
+/****************************************/
+
+static int parse_script(buzzparser_t par) {
    /* Fetch the first token */
    par->tok = buzzlex_nexttok(par->lex);
    while(par->tok->type != BUZZTOK_EOF &&
@@ -446,9 +895,11 @@ int parse_script(buzzparser_t par) {
 /****************************************/
 /****************************************/
 
-int parse_statlist(buzzparser_t par) {
-   /* Parse first statement */
-   if(!parse_stat(par)) return PARSE_ERROR;
+static int parse_statlist(buzzparser_t par) {
+   /* Parse first statement, unless it starts a cached included file */
+   int spliced;
+   if(!parse_include(par, &spliced)) return PARSE_ERROR;
+   if(!spliced && !parse_stat(par)) return PARSE_ERROR;
    /* Keep parsing statements as long as you find tokens */
    while(par->tok->type != BUZZTOK_EOF && par->tok->type != BUZZTOK_BLOCKCLOSE) {
       while(par->tok->type != BUZZTOK_EOF && par->tok->type == BUZZTOK_STATEND) {
@@ -458,8 +909,9 @@ int parse_statlist(buzzparser_t par) {
       /* Make sure a file inclusion error did not happen */
       if(par->tok->type == BUZZTOK_EOF && !buzzlex_done(par->lex))
 	  return PARSE_ERROR;
-      /* Parse the statement */
-      if(!parse_stat(par)) return PARSE_ERROR;
+      /* Parse the statement, unless it starts a cached included file */
+      if(!parse_include(par, &spliced)) return PARSE_ERROR;
+      if(!spliced && !parse_stat(par)) return PARSE_ERROR;
    }
 
    /* Make sure a file inclusion error did not happen */
@@ -469,7 +921,7 @@ int parse_statlist(buzzparser_t par) {
    return PARSE_OK;
 }
 
-int parse_stat(buzzparser_t par) {
+static int parse_stat(buzzparser_t par) {
    if(par->tok->type == BUZZTOK_STATEND || par->tok->type == BUZZTOK_BLOCKCLOSE)
       return PARSE_OK;
    if(par->tok->type == BUZZTOK_VAR)
@@ -507,7 +959,7 @@ void buzzparser_symdel(uint32_t pos, void* data, void* params) {
    buzzdict_remove((buzzdict_t)params, (char**)data);
 }
 
-int parse_block(buzzparser_t par, int pushsymt) {
+static int parse_block(buzzparser_t par, int pushsymt) {
    tokmatch(BUZZTOK_BLOCKOPEN);
    fetchtok();
    if(par->tok->type == BUZZTOK_BLOCKCLOSE) {
@@ -554,7 +1006,7 @@ int parse_block(buzzparser_t par, int pushsymt) {
 /****************************************/
 /****************************************/
 
-int parse_blockstat(buzzparser_t par) {
+static int parse_blockstat(buzzparser_t par) {
    if(par->tok->type == BUZZTOK_BLOCKOPEN) {
       /* It's a block */
       return parse_block(par, 1);
@@ -568,7 +1020,7 @@ int parse_blockstat(buzzparser_t par) {
 /****************************************/
 /****************************************/
 
-int parse_var(buzzparser_t par) {
+static int parse_var(buzzparser_t par) {
    /* Match the 'var' token */
    tokmatch(BUZZTOK_VAR);
    fetchtok();
@@ -623,7 +1075,7 @@ int parse_var(buzzparser_t par) {
    return PARSE_OK;
 }
 
-int parse_fun(buzzparser_t par) {
+static int parse_fun(buzzparser_t par) {
    tokmatch(BUZZTOK_FUN);
    fetchtok();
    tokmatch(BUZZTOK_ID);
@@ -674,7 +1126,7 @@ int parse_fun(buzzparser_t par) {
    return PARSE_OK;
 }
 
-int parse_if(buzzparser_t par) {
+static int parse_if(buzzparser_t par) {
    /* Save labels for else branch and for if end */
    uint32_t lab1 = par->labels;
    uint32_t lab2 = par->labels + 1;
@@ -713,7 +1165,7 @@ int parse_if(buzzparser_t par) {
 /****************************************/
 /****************************************/
 
-int parse_for(buzzparser_t par) {
+static int parse_for(buzzparser_t par) {
    /*
     * for(init, cond, update) body
     *
@@ -774,7 +1226,7 @@ int parse_for(buzzparser_t par) {
 /****************************************/
 /****************************************/
 
-int parse_while(buzzparser_t par) {
+static int parse_while(buzzparser_t par) {
    /* Save labels for while start and end */
    uint32_t wstart = par->labels;
    uint32_t wend = par->labels + 1;
@@ -804,8 +1256,8 @@ int parse_while(buzzparser_t par) {
 /****************************************/
 /****************************************/
 
-int parse_conditionlist(buzzparser_t par,
-                        int* numargs) {
+static int parse_conditionlist(buzzparser_t par,
+                               int* numargs) {
    *numargs = 0;
    if(par->tok->type == BUZZTOK_PARCLOSE) return PARSE_OK;
    if(!parse_condition(par)) return PARSE_ERROR;
@@ -818,7 +1270,7 @@ int parse_conditionlist(buzzparser_t par,
    return PARSE_OK;
 }
 
-int parse_condition(buzzparser_t par) {
+static int parse_condition(buzzparser_t par) {
    if(par->tok->type == BUZZTOK_LNOT) {
       fetchtok();
       if(!parse_condition(par)) return PARSE_ERROR;
@@ -837,7 +1289,7 @@ int parse_condition(buzzparser_t par) {
    return PARSE_OK;
 }
 
-int parse_comparison(buzzparser_t par) {
+static int parse_comparison(buzzparser_t par) {
    if(!parse_expression(par)) return PARSE_ERROR;
    if(par->tok->type == BUZZTOK_CMP) {
       char op[4];
@@ -857,7 +1309,7 @@ int parse_comparison(buzzparser_t par) {
 /****************************************/
 /****************************************/
 
-int parse_expression(buzzparser_t par) {
+static int parse_expression(buzzparser_t par) {
    if(par->tok->type == BUZZTOK_BLOCKOPEN) {
       /* Table definition */
       /* Consume the { */
@@ -961,7 +1413,7 @@ int parse_expression(buzzparser_t par) {
    return PARSE_OK;
 }
 
-int parse_product(buzzparser_t par) {
+static int parse_product(buzzparser_t par) {
    if(!parse_modulo(par)) return PARSE_ERROR;
    while(par->tok->type == BUZZTOK_MULDIV) {
       char op = par->tok->value[0];
@@ -977,7 +1429,7 @@ int parse_product(buzzparser_t par) {
    return PARSE_OK;
 }
 
-int parse_modulo(buzzparser_t par) {
+static int parse_modulo(buzzparser_t par) {
    if(!parse_power(par)) return PARSE_ERROR;
    while(par->tok->type == BUZZTOK_MOD) {
       fetchtok();
@@ -987,11 +1439,11 @@ int parse_modulo(buzzparser_t par) {
    return PARSE_OK;
 }
 
-int parse_power(buzzparser_t par) {
+static int parse_power(buzzparser_t par) {
    return parse_bitshift(par) && parse_powerrest(par);
 }
 
-int parse_powerrest(buzzparser_t par) {
+static int parse_powerrest(buzzparser_t par) {
    if(par->tok->type == BUZZTOK_POW) {
       fetchtok();
       if(!parse_power(par)) return PARSE_ERROR;
@@ -1000,7 +1452,7 @@ int parse_powerrest(buzzparser_t par) {
    return PARSE_OK;
 }
 
-int parse_bitshift(buzzparser_t par) {
+static int parse_bitshift(buzzparser_t par) {
    if(!parse_bitwiseandor(par)) return PARSE_ERROR;
    while(par->tok->type == BUZZTOK_LRSHIFT) {
       char op[3];
@@ -1014,7 +1466,7 @@ int parse_bitshift(buzzparser_t par) {
    return PARSE_OK;
 }
 
-int parse_bitwiseandor(buzzparser_t par) {
+static int parse_bitwiseandor(buzzparser_t par) {
    if(!parse_bitwisenot(par)) return PARSE_ERROR;
    while(par->tok->type == BUZZTOK_BANDOR) {
       char op = par->tok->value[0];
@@ -1027,7 +1479,7 @@ int parse_bitwiseandor(buzzparser_t par) {
    return PARSE_OK;
 }
 
-int parse_bitwisenot(buzzparser_t par) {
+static int parse_bitwisenot(buzzparser_t par) {
    if(par->tok->type == BUZZTOK_BNOT) {
       fetchtok();
       if(!parse_bitwisenot(par)) return PARSE_ERROR;
@@ -1038,7 +1490,7 @@ int parse_bitwisenot(buzzparser_t par) {
    return PARSE_OK;
 }
 
-int parse_operand(buzzparser_t par) {
+static int parse_operand(buzzparser_t par) {
    if(par->tok->type == BUZZTOK_FUN) {
       chunk_append("\tpushl " LABELREF "%u", par->labels);
       if(!parse_lambda(par)) return PARSE_ERROR;
@@ -1101,7 +1553,7 @@ int parse_operand(buzzparser_t par) {
 /****************************************/
 /****************************************/
 
-int parse_command(buzzparser_t par) {
+static int parse_command(buzzparser_t par) {
    if(par->tok->type == BUZZTOK_RETURN) {
       /* Return statement */
       fetchtok();
@@ -1170,7 +1622,7 @@ int parse_command(buzzparser_t par) {
 /****************************************/
 /****************************************/
 
-int parse_idlist(buzzparser_t par) {
+static int parse_idlist(buzzparser_t par) {
    /* Empty list */
    if(par->tok->type == BUZZTOK_PARCLOSE)
       return PARSE_OK;
@@ -1201,33 +1653,9 @@ int parse_idlist(buzzparser_t par) {
    return PARSE_OK;
 }
 
-int parse_idreflist(buzzparser_t par) {
-   fetchtok();
-   if(par->tok->type == BUZZTOK_PARCLOSE)
-      return PARSE_OK;
-   struct idrefinfo_s idrefinfo;
-   if(!parse_idref(par, 0, &idrefinfo)) return PARSE_ERROR;
-   fetchtok();
-   while(par->tok->type == BUZZTOK_LISTSEP) {
-      fetchtok();
-      if(!parse_idref(par, 0, &idrefinfo)) return PARSE_ERROR;
-      fetchtok();
-   }
-   if(par->tok && par->tok->type == BUZZTOK_PARCLOSE) {
-      return PARSE_OK;
-   }
-   fprintf(stderr,
-           "%s:%" PRIu64 ":%" PRIu64 ": Syntax error: expected , or ), found %s\n",
-           buzzlex_getfile(par->lex)->fname,
-           par->tok->line,
-           par->tok->col,
-           buzztok_desc[par->tok->type]);
-   return PARSE_ERROR;
-}
-
-int parse_idref(buzzparser_t par,
-                int lvalue,
-                struct idrefinfo_s* idrefinfo) {
+static int parse_idref(buzzparser_t par,
+                       int lvalue,
+                       struct idrefinfo_s* idrefinfo) {
    /* Start with an id */
    tokmatch(BUZZTOK_ID);
    /* Look it up in the symbol table */
@@ -1322,7 +1750,7 @@ int parse_idref(buzzparser_t par,
 /****************************************/
 /****************************************/
 
-int parse_lambda(buzzparser_t par) {
+static int parse_lambda(buzzparser_t par) {
    tokmatch(BUZZTOK_FUN);
    fetchtok();
    /* Make a new chunk for this function and get the associated symbol */
@@ -1361,33 +1789,20 @@ int parse_lambda(buzzparser_t par) {
 /****************************************/
 /****************************************/
 
-buzzparser_t buzzparser_new(int argc,
-                            char** argv) {
-   /* Argument parsing */
-   if(argc < 3 || argc > 4) {
-      fprintf(stderr, "buzzparser_new(): expected 3 or 4 arguments, got %d\n", argc);
-      return NULL;
-   }
+static buzzparser_t buzzparser_init(buzzlex_t lex,
+                                     const char* scriptfn,
+                                     char* asmfn,
+                                     FILE* asmstream) {
    /* Create parser state */
    buzzparser_t par = (buzzparser_t)malloc(sizeof(struct buzzparser_s));
-   /* Create lexer */
-   par->lex = buzzlex_new(argv[1]);
-   if(!par->lex) {
-      free(par);
-      return NULL;
-   }
+   par->lex = lex;
+   par->tok = NULL;
+   par->cache = NULL;
    /* Copy the script file name */
-   par->scriptfn = strdup(argv[1]);
-   /* Copy string */
-   par->asmfn = strdup(argv[2]);
-   /* Open file */
-   par->asmstream = fopen(par->asmfn, "w");
-   if(!par->asmstream) {
-      perror(par->asmfn);
-      free(par->asmfn);
-      free(par);
-      return NULL;
-   }
+   par->scriptfn = strdup(scriptfn);
+   /* Take the output stream */
+   par->asmfn = asmfn;
+   par->asmstream = asmstream;
    /* Initialize label counter */
    par->labels = 0;
    /* Initialize chunk list */
@@ -1401,7 +1816,32 @@ buzzparser_t buzzparser_new(int argc,
                                sizeof(uint16_t),
                                buzzdict_strkeyhash,
                                buzzdict_strkeycmp,
-                               NULL);
+                               string_key_destroy);
+   return par;
+}
+
+/****************************************/
+/****************************************/
+
+buzzparser_t buzzparser_new(int argc,
+                            char** argv) {
+   /* Argument parsing */
+   if(argc < 3 || argc > 4) {
+      fprintf(stderr, "buzzparser_new(): expected 3 or 4 arguments, got %d\n", argc);
+      return NULL;
+   }
+   /* Create lexer */
+   buzzlex_t lex = buzzlex_new(argv[1]);
+   if(!lex) return NULL;
+   /* Open file */
+   FILE* asmstream = fopen(argv[2], "w");
+   if(!asmstream) {
+      perror(argv[2]);
+      buzzlex_destroy(&lex);
+      return NULL;
+   }
+   /* Create parser state */
+   buzzparser_t par = buzzparser_init(lex, argv[1], strdup(argv[2]), asmstream);
    /* If 4 arguments were passed, we have a symbol table to parse  */
    if(argc == 4) {
       /* Open the file */
@@ -1434,12 +1874,82 @@ buzzparser_t buzzparser_new(int argc,
 /****************************************/
 /****************************************/
 
+buzzparser_t buzzparser_new_fromstring(const char* fname,
+                                       const char* src,
+                                       FILE* asmstream) {
+   return buzzparser_init(buzzlex_new_fromstring(fname, src),
+                          fname,
+                          NULL,
+                          asmstream);
+}
+
+/****************************************/
+/****************************************/
+
+buzzparser_cache_t buzzparser_cache_new() {
+   buzzparser_cache_t cache = (buzzparser_cache_t)malloc(sizeof(struct buzzparser_cache_s));
+   cache->modules = buzzdict_new(20,
+                                 sizeof(char*),
+                                 sizeof(module_t),
+                                 buzzdict_strkeyhash,
+                                 buzzdict_strkeycmp,
+                                 module_destroy);
+   cache->incpath = strdup("");
+   cache->cwd = strdup("");
+   cache->lexers = buzzdarray_new(1, sizeof(buzzlex_t), NULL);
+   return cache;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzparser_cache_destroy(buzzparser_cache_t* cache) {
+   buzzdict_destroy(&(*cache)->modules);
+   free((*cache)->incpath);
+   free((*cache)->cwd);
+   buzzdarray_destroy(&(*cache)->lexers);
+   free(*cache);
+   *cache = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzparser_cache_check(buzzparser_cache_t cache) {
+   /* The included files are looked up in the include path and in the working directory */
+   const char* incpath = getenv("BUZZ_INCLUDE_PATH");
+   if(!incpath) incpath = "";
+   char* cwd = getcwd(NULL, 0);
+   if(!cwd) cwd = strdup("");
+   /* If any of them changed, the cached files might not be the right ones */
+   if(strcmp(incpath, cache->incpath) != 0 ||
+      strcmp(cwd, cache->cwd) != 0) {
+      buzzdict_destroy(&cache->modules);
+      cache->modules = buzzdict_new(20,
+                                    sizeof(char*),
+                                    sizeof(module_t),
+                                    buzzdict_strkeyhash,
+                                    buzzdict_strkeycmp,
+                                    module_destroy);
+      free(cache->incpath);
+      cache->incpath = strdup(incpath);
+      free(cache->cwd);
+      cache->cwd = cwd;
+   }
+   else {
+      free(cwd);
+   }
+}
+
+/****************************************/
+/****************************************/
+
 void buzzparser_destroy(buzzparser_t* par) {
    buzzdict_destroy(&((*par)->strings));
    buzzdarray_destroy(&((*par)->chunks));
    buzzdarray_destroy(&((*par)->symstack));
    free((*par)->asmfn);
-   fclose((*par)->asmstream);
+   if((*par)->asmstream) fclose((*par)->asmstream);
    free((*par)->scriptfn);
    buzzlex_destroy(&((*par)->lex));
    if((*par)->tok) buzzlex_destroytok(&((*par)->tok));
@@ -1454,6 +1964,7 @@ int buzzparser_parse(buzzparser_t par) {
    /*
     * Parse the script
     */
+   if(par->cache) buzzparser_cache_check(par->cache);
    if(!parse_script(par)) return PARSE_ERROR;
    /*
     * Write to file
@@ -17,6 +17,14 @@ extern "C" {
    /* Forward declaration to contain a code chunk */
    struct chunk_s;
 
+   /*
+    * The cache of included files.
+    * It keeps the parsed code of the files included in the global
+    * scope, so that parsing another script that includes them only
+    * changes their string ids and labels.
+    */
+   typedef struct buzzparser_cache_s* buzzparser_cache_t;
+
    /* The parser state */
    struct buzzparser_s {
       /* The script file name */
@@ -41,6 +49,8 @@ extern "C" {
       buzzdict_t strings;
       /* Label counter */
       uint32_t labels;
+      /* The cache of included files, NULL if not used */
+      buzzparser_cache_t cache;
    };
    typedef struct buzzparser_s* buzzparser_t;
 
@@ -58,6 +68,19 @@ extern "C" {
    extern buzzparser_t buzzparser_new(int argc,
                                       char** argv);
 
+   /*
+    * Creates a new parser for a script held in memory.
+    * The parser writes the assembler code into the given stream, and
+    * closes it when it is destroyed.
+    * @param fname The name of the script, used in the debug information.
+    * @param src The script source code.
+    * @param asmstream The output assembler stream.
+    * @return The parser state.
+    */
+   extern buzzparser_t buzzparser_new_fromstring(const char* fname,
+                                                 const char* src,
+                                                 FILE* asmstream);
+
    /*
     * Destroys the parser.
     * @param par The parser.
@@ -70,6 +93,22 @@ extern "C" {
     */
    extern int buzzparser_parse(buzzparser_t par);
 
+   /*
+    * Creates a new cache of included files.
+    * To use it, set the cache field of a parser before parsing.
+    * A file is taken from the cache if neither its content nor the
+    * content of the files it includes has changed. The cache is
+    * cleared if the include path or the working directory change.
+    * @return The cache.
+    */
+   extern buzzparser_cache_t buzzparser_cache_new();
+
+   /*
+    * Destroys a cache of included files.
+    * @param cache The cache.
+    */
+   extern void buzzparser_cache_destroy(buzzparser_cache_t* cache);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,512 @@
+#include "buzzroute.h"
+#include "buzzvm.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/****************************************/
+/****************************************/
+
+#define function_register(FNAME, FPOINTER)                      \
+   buzzvm_dup(vm);                                              \
+   buzzvm_pushs(vm, buzzvm_string_register(vm, (FNAME), 1));    \
+   buzzvm_pushcc(vm, buzzvm_function_register(vm, (FPOINTER))); \
+   buzzvm_tput(vm);
+
+#define id_get()                                          \
+   buzzvm_lload(vm, 0);                                   \
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "id", 1)); \
+   buzzvm_tget(vm);                                       \
+   uint16_t id = buzzvm_stack_at(vm, 1)->i.value;
+
+/*
+ * Key of a destination in the distance-vector table.
+ */
+#define route_key(kind, id) (((uint32_t)(kind) << 16) | (id))
+
+/*
+ * Returns 1 if sequence number a is newer than b, taking wraparound
+ * into account.
+ */
+#define route_seq_newer(a, b) ((int16_t)((uint16_t)(a) - (uint16_t)(b)) > 0)
+
+/****************************************/
+/****************************************/
+
+buzzroute_t buzzroute_new() {
+   buzzroute_t r = (buzzroute_t)calloc(1, sizeof(struct buzzroute_s));
+   r->table = buzzdict_new(10,
+                           sizeof(uint32_t),
+                           sizeof(struct buzzroute_entry_s),
+                           buzzdict_uint32keyhash,
+                           buzzdict_uint32keycmp,
+                           NULL);
+   r->gradients = buzzdict_new(10,
+                               sizeof(uint16_t),
+                               sizeof(uint8_t),
+                               buzzdict_uint16keyhash,
+                               buzzdict_uint16keycmp,
+                               NULL);
+   r->timer = BUZZROUTE_REFRESH;
+   return r;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzroute_destroy(buzzroute_t* r) {
+   buzzdict_destroy(&(*r)->table);
+   buzzdict_destroy(&(*r)->gradients);
+   free(*r);
+   *r = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Returns the entry of a destination, or NULL if no route is known.
+ */
+static buzzroute_entry_t route_get(buzzroute_t r, uint8_t kind, uint16_t id) {
+   uint32_t k = route_key(kind, id);
+   return (buzzroute_entry_t)buzzdict_rawget(r->table, &k);
+}
+
+/*
+ * Makes this robot a destination. The entry gets a new sequence number,
+ * so it wins over the stale routes the neighbors may still have.
+ */
+static void route_own_add(buzzvm_t vm, uint8_t kind, uint16_t id) {
+   buzzroute_t r = vm->route;
+   uint32_t k = route_key(kind, id);
+   struct buzzroute_entry_s e;
+   e.origin = vm->robot;
+   e.seq = ++r->seq;
+   e.hops = 0;
+   e.distance = 0;
+   e.next = vm->robot;
+   e.age = 0;
+   e.changed = 1;
+   buzzdict_set(r->table, &k, &e);
+}
+
+/*
+ * Stops this robot from being a destination. The neighbors forget their
+ * routes when the sequence number stops increasing.
+ */
+static void route_own_remove(buzzvm_t vm, uint8_t kind, uint16_t id) {
+   buzzroute_entry_t e = route_get(vm->route, kind, id);
+   if(e && e->hops == 0) {
+      uint32_t k = route_key(kind, id);
+      buzzdict_remove(vm->route->table, &k);
+   }
+}
+
+/****************************************/
+/****************************************/
+
+struct route_gossip_s {
+   buzzvm_t vm;
+   int refresh;
+   buzzdarray_t expired;
+   buzzdarray_t changed;
+};
+
+static void route_gossip_entry(const void* key, void* data, void* params) {
+   buzzroute_entry_t e = (buzzroute_entry_t)data;
+   struct route_gossip_s* g = (struct route_gossip_s*)params;
+   if(e->hops == 0) {
+      /* This robot is the destination */
+      if(g->refresh) {
+         e->seq = g->vm->route->seq;
+         e->changed = 1;
+      }
+   }
+   else if(++e->age > BUZZROUTE_MISSES * BUZZROUTE_REFRESH) {
+      buzzdarray_push(g->expired, (void*)key);
+      return;
+   }
+   if(e->changed) {
+      buzzdarray_push(g->changed, (void*)key);
+      e->changed = 0;
+   }
+}
+
+void buzzroute_gossip(buzzvm_t vm) {
+   buzzroute_t r = vm->route;
+   if(buzzdict_isempty(r->table)) return;
+   /* Is it time to increase the sequence numbers? */
+   struct route_gossip_s g;
+   g.vm = vm;
+   g.refresh = (--r->timer == 0);
+   if(g.refresh) {
+      r->timer = BUZZROUTE_REFRESH;
+      ++r->seq;
+   }
+   /* Age the entries and collect the ones to advertise */
+   g.expired = buzzdarray_new(1, sizeof(uint32_t), NULL);
+   g.changed = buzzdarray_new(10, sizeof(uint32_t), NULL);
+   buzzdict_foreach(r->table, route_gossip_entry, &g);
+   uint32_t i, j;
+   for(i = 0; i < buzzdarray_size(g.expired); ++i)
+      buzzdict_remove(r->table, &buzzdarray_get(g.expired, i, uint32_t));
+   /* Pack the changes in as few messages as possible */
+   for(i = 0; i < buzzdarray_size(g.changed); i += BUZZROUTE_VECTOR_MAX) {
+      uint32_t n = buzzdarray_size(g.changed) - i;
+      if(n > BUZZROUTE_VECTOR_MAX) n = BUZZROUTE_VECTOR_MAX;
+      buzzmsg_payload_t m = buzzmsg_payload_new(3 + n * 13);
+      buzzmsg_serialize_u8(m, BUZZMSG_ROUTE_VECTOR);
+      buzzmsg_serialize_u16(m, n);
+      for(j = i; j < i + n; ++j) {
+         uint32_t k = buzzdarray_get(g.changed, j, uint32_t);
+         const struct buzzroute_entry_s* e =
+            buzzdict_get(r->table, &k, struct buzzroute_entry_s);
+         buzzmsg_serialize_u8(m, k >> 16);
+         buzzmsg_serialize_u16(m, k & 0xFFFF);
+         buzzmsg_serialize_u16(m, e->origin);
+         buzzmsg_serialize_u16(m, e->seq);
+         buzzmsg_serialize_u16(m, e->hops);
+         buzzmsg_serialize_float(m, e->distance);
+      }
+      buzzoutmsg_queue_append_route(vm, m);
+      ++r->vectors;
+   }
+   buzzdarray_destroy(&g.expired);
+   buzzdarray_destroy(&g.changed);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Merges an entry of a distance vector sent by a neighbor.
+ * The sequence numbers of different origins, such as the sources of a
+ * gradient, are unrelated: only the distance tells which one is best.
+ */
+static void route_merge(buzzvm_t vm,
+                        uint16_t rid,
+                        float link,
+                        uint8_t kind,
+                        uint16_t id,
+                        uint16_t origin,
+                        uint16_t seq,
+                        uint16_t hops,
+                        float distance) {
+   buzzroute_t r = vm->route;
+   /* Ignore the routes to this robot and the gradients the script did not create */
+   if(kind > BUZZROUTE_ROBOT) return;
+   if(kind == BUZZROUTE_ROBOT && id == vm->robot) return;
+   if(origin == vm->robot) return;
+   if(kind == BUZZROUTE_GRADIENT && !buzzdict_exists(r->gradients, &id)) return;
+   if(hops >= BUZZROUTE_MAXHOPS) return;
+   buzzroute_entry_t e = route_get(r, kind, id);
+   if(!e) {
+      /* New destination */
+      uint32_t k = route_key(kind, id);
+      struct buzzroute_entry_s n;
+      n.origin = origin;
+      n.seq = seq;
+      n.hops = hops + 1;
+      n.distance = distance + link;
+      n.next = rid;
+      n.age = 0;
+      n.changed = 1;
+      buzzdict_set(r->table, &k, &n);
+      return;
+   }
+   /* This robot is the destination */
+   if(e->hops == 0) return;
+   /* Take newer routes, better routes, and the news from the current next hop */
+   int same = (origin == e->origin);
+   int newer = same && route_seq_newer(seq, e->seq);
+   if(same && !newer && seq != e->seq) return;
+   if(newer || distance + link < e->distance || rid == e->next) {
+      /* Only advertise what the neighbors need to know, not small
+       * changes of distance, or the updates would never stop */
+      if(newer || !same || rid != e->next || hops + 1 != e->hops) e->changed = 1;
+      e->origin = origin;
+      e->seq = seq;
+      e->hops = hops + 1;
+      e->distance = distance + link;
+      e->next = rid;
+      e->age = 0;
+   }
+}
+
+int buzzroute_vector_receive(buzzvm_t vm,
+                             uint16_t rid,
+                             buzzmsg_payload_t msg) {
+   /* The cost of the link is the distance to the neighbor, if known */
+   float link;
+   if(!buzzneighbors_distance(vm, rid, &link)) link = 1;
+   /* Go through the entries */
+   uint16_t n, i;
+   int64_t pos = buzzmsg_deserialize_u16(&n, msg, 1);
+   for(i = 0; i < n && pos >= 0; ++i) {
+      uint8_t kind;
+      uint16_t id, origin, seq, hops;
+      float distance;
+      pos = buzzmsg_deserialize_u8(&kind, msg, pos);
+      if(pos >= 0) pos = buzzmsg_deserialize_u16(&id, msg, pos);
+      if(pos >= 0) pos = buzzmsg_deserialize_u16(&origin, msg, pos);
+      if(pos >= 0) pos = buzzmsg_deserialize_u16(&seq, msg, pos);
+      if(pos >= 0) pos = buzzmsg_deserialize_u16(&hops, msg, pos);
+      if(pos >= 0) pos = buzzmsg_deserialize_float(&distance, msg, pos);
+      if(pos >= 0) route_merge(vm, rid, link, kind, id, origin, seq, hops, distance);
+   }
+   return pos < 0 ? -1 : 0;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Makes the header of a routed message.
+ */
+static buzzmsg_payload_t route_data_new(uint16_t src,
+                                        uint16_t dest,
+                                        uint16_t next,
+                                        uint8_t ttl) {
+   buzzmsg_payload_t m = buzzmsg_payload_new(16);
+   buzzmsg_serialize_u8(m, BUZZMSG_ROUTE_DATA);
+   buzzmsg_serialize_u16(m, src);
+   buzzmsg_serialize_u16(m, dest);
+   buzzmsg_serialize_u16(m, next);
+   buzzmsg_serialize_u8(m, ttl);
+   return m;
+}
+
+int buzzroute_data_receive(buzzvm_t vm,
+                           buzzmsg_payload_t msg) {
+   buzzroute_t r = vm->route;
+   /* Deserialize the header */
+   uint16_t src, dest, next;
+   uint8_t ttl;
+   int64_t pos = buzzmsg_deserialize_u16(&src, msg, 1);
+   if(pos >= 0) pos = buzzmsg_deserialize_u16(&dest, msg, pos);
+   if(pos >= 0) pos = buzzmsg_deserialize_u16(&next, msg, pos);
+   if(pos >= 0) pos = buzzmsg_deserialize_u8(&ttl, msg, pos);
+   if(pos < 0) return -1;
+   /* Overheard message for another robot */
+   if(next != vm->robot) return 0;
+   if(dest == vm->robot) {
+      /* Message for this robot */
+      if(!r->listener) {
+         ++r->dropped;
+         return 0;
+      }
+      buzzobj_t value;
+      pos = buzzobj_deserialize(&value, msg, pos, vm);
+      if(pos < 0) return -1;
+      buzzobj_t srco = buzzheap_newobj(vm, BUZZTYPE_INT);
+      srco->i.value = src;
+      ++r->delivered;
+      buzzvm_push(vm, r->listener);
+      buzzvm_push(vm, value);
+      buzzvm_push(vm, srco);
+      buzzvm_closure_call(vm, 2);
+      buzzvm_pop(vm);
+      return 0;
+   }
+   /* Message to forward */
+   buzzroute_entry_t e = route_get(r, BUZZROUTE_ROBOT, dest);
+   if(ttl == 0 || !e) {
+      ++r->dropped;
+      return 0;
+   }
+   /* Copy the value as is, behind a new header */
+   buzzmsg_payload_t m = route_data_new(src, dest, e->next, ttl - 1);
+   for(; pos < buzzmsg_payload_size(msg); ++pos)
+      buzzmsg_serialize_u8(m, buzzmsg_payload_get(msg, pos));
+   buzzoutmsg_queue_append_route(vm, m);
+   ++r->forwarded;
+   return 0;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzroute_gc(buzzvm_t vm) {
+   if(vm->route->listener)
+      buzzheap_obj_mark(vm->route->listener, vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzroute_register(buzzvm_t vm) {
+   /* Add 'gradient' table */
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "gradient", 1));
+   buzzvm_pusht(vm);
+   function_register("create", buzzroute_gradient_create);
+   buzzvm_gstore(vm);
+   /* Add 'route' table */
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "route", 1));
+   buzzvm_pusht(vm);
+   function_register("send",   buzzroute_send);
+   function_register("listen", buzzroute_listen);
+   function_register("ignore", buzzroute_ignore);
+   function_register("hops",   buzzroute_hops);
+   buzzvm_gstore(vm);
+   return vm->state;
+}
+
+/****************************************/
+/****************************************/
+
+int buzzroute_gradient_create(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 1);
+   /* Get the id */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
+   uint16_t id = buzzvm_stack_at(vm, 1)->i.value;
+   buzzvm_pop(vm);
+   /* Follow the gradient */
+   if(!buzzdict_exists(vm->route->gradients, &id)) {
+      uint8_t source = 0;
+      buzzdict_set(vm->route->gradients, &id, &source);
+   }
+   /* Make the gradient table */
+   buzzvm_pusht(vm);
+   function_register("source", buzzroute_gradient_source);
+   function_register("get",    buzzroute_gradient_get);
+   function_register("hops",   buzzroute_gradient_hops);
+   function_register("parent", buzzroute_gradient_parent);
+   buzzvm_dup(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "id", 1));
+   buzzvm_pushi(vm, id);
+   buzzvm_tput(vm);
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzroute_gradient_source(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 1);
+   /* Get the gradient id */
+   id_get();
+   /* Get the flag */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
+   uint8_t source = buzzvm_stack_at(vm, 1)->i.value != 0;
+   buzzdict_set(vm->route->gradients, &id, &source);
+   if(source) {
+      buzzroute_entry_t e = route_get(vm->route, BUZZROUTE_GRADIENT, id);
+      if(!e || e->hops > 0) route_own_add(vm, BUZZROUTE_GRADIENT, id);
+   }
+   else {
+      route_own_remove(vm, BUZZROUTE_GRADIENT, id);
+   }
+   return buzzvm_ret0(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzroute_gradient_get(buzzvm_t vm) {
+   id_get();
+   buzzroute_entry_t e = route_get(vm->route, BUZZROUTE_GRADIENT, id);
+   if(e) buzzvm_pushf(vm, e->distance);
+   else buzzvm_pushnil(vm);
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzroute_gradient_hops(buzzvm_t vm) {
+   id_get();
+   buzzroute_entry_t e = route_get(vm->route, BUZZROUTE_GRADIENT, id);
+   if(e) buzzvm_pushi(vm, e->hops);
+   else buzzvm_pushnil(vm);
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzroute_gradient_parent(buzzvm_t vm) {
+   id_get();
+   buzzroute_entry_t e = route_get(vm->route, BUZZROUTE_GRADIENT, id);
+   if(e) buzzvm_pushi(vm, e->next);
+   else buzzvm_pushnil(vm);
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzroute_send(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 2);
+   /* Get the destination and the value */
+   buzzvm_lload(vm, 1);
+   buzzvm_lload(vm, 2);
+   buzzvm_type_assert(vm, 2, BUZZTYPE_INT);
+   uint16_t dest = buzzvm_stack_at(vm, 2)->i.value;
+   buzzobj_t value = buzzvm_stack_at(vm, 1);
+   if(dest == vm->robot) {
+      /* Deliver to this robot at the next step */
+      if(!vm->route->listener) {
+         buzzvm_pushi(vm, 0);
+         return buzzvm_ret1(vm);
+      }
+      buzzmsg_payload_t m = route_data_new(vm->robot, dest, vm->robot, 0);
+      buzzobj_serialize(m, value);
+      buzzinmsg_queue_append(vm, vm->robot, m);
+   }
+   else {
+      /* Send to the next hop, if a route is known */
+      buzzroute_entry_t e = route_get(vm->route, BUZZROUTE_ROBOT, dest);
+      if(!e) {
+         buzzvm_pushi(vm, 0);
+         return buzzvm_ret1(vm);
+      }
+      buzzmsg_payload_t m = route_data_new(vm->robot, dest, e->next, BUZZROUTE_MAXHOPS);
+      buzzobj_serialize(m, value);
+      buzzoutmsg_queue_append_route(vm, m);
+   }
+   buzzvm_pushi(vm, 1);
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzroute_listen(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 1);
+   /* Get the closure */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
+   vm->route->listener = buzzvm_stack_at(vm, 1);
+   /* Advertise a route to this robot */
+   if(!route_get(vm->route, BUZZROUTE_ROBOT, vm->robot))
+      route_own_add(vm, BUZZROUTE_ROBOT, vm->robot);
+   return buzzvm_ret0(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzroute_ignore(buzzvm_t vm) {
+   vm->route->listener = NULL;
+   route_own_remove(vm, BUZZROUTE_ROBOT, vm->robot);
+   return buzzvm_ret0(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzroute_hops(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 1);
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
+   uint16_t dest = buzzvm_stack_at(vm, 1)->i.value;
+   buzzroute_entry_t e = route_get(vm->route, BUZZROUTE_ROBOT, dest);
+   if(e) buzzvm_pushi(vm, e->hops);
+   else buzzvm_pushnil(vm);
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
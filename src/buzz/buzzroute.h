@@ -0,0 +1,221 @@
+#ifndef BUZZROUTE_H
+#define BUZZROUTE_H
+
+#include <buzz/buzzdict.h>
+#include <buzz/buzzmsg.h>
+#include <buzz/buzztype.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /*
+    * Forward declaration of the Buzz VM state.
+    */
+   struct buzzvm_s;
+
+   /*
+    * The kinds of destination in the distance-vector table.
+    */
+   typedef enum {
+      BUZZROUTE_GRADIENT = 0, // A gradient, whose sources are the destination
+      BUZZROUTE_ROBOT         // A robot that listens to routed messages
+   } buzzroute_kind_e;
+
+   /*
+    * An entry of the distance-vector table.
+    */
+   struct buzzroute_entry_s {
+      /* Robot that set the sequence number: the destination itself, or
+       * the source of the gradient the route leads to */
+      uint16_t origin;
+      /* Sequence number set by the origin, newer numbers win */
+      uint16_t seq;
+      /* Hops to the destination, 0 if this robot is the destination */
+      uint16_t hops;
+      /* Distance to the destination */
+      float distance;
+      /* Next hop towards the destination */
+      uint16_t next;
+      /* Steps since the entry was last confirmed */
+      uint16_t age;
+      /* 1 if the entry must be advertised at the next step */
+      uint8_t changed;
+   };
+   typedef struct buzzroute_entry_s* buzzroute_entry_t;
+
+   /*
+    * The routing state of a VM.
+    */
+   struct buzzroute_s {
+      /* (kind << 16 | id) (uint32_t) -> struct buzzroute_entry_s */
+      buzzdict_t table;
+      /* The gradients created by the script, as id (uint16_t) -> uint8_t */
+      buzzdict_t gradients;
+      /* The closure called on routed messages, or NULL if none */
+      buzzobj_t listener;
+      /* The last sequence number used for the routes to this robot */
+      uint16_t seq;
+      /* Steps before the sequence number is increased */
+      uint16_t timer;
+      /* Statistics */
+      uint32_t vectors;
+      uint32_t forwarded;
+      uint32_t delivered;
+      uint32_t dropped;
+   };
+   typedef struct buzzroute_s* buzzroute_t;
+
+   /*
+    * Creates the routing state of a VM.
+    * @return The routing state.
+    */
+   extern buzzroute_t buzzroute_new();
+
+   /*
+    * Destroys the routing state of a VM.
+    * @param r The routing state.
+    */
+   extern void buzzroute_destroy(buzzroute_t* r);
+
+   /*
+    * Registers the 'gradient' and 'route' tables.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzroute_register(struct buzzvm_s* vm);
+
+   /*
+    * Ages the table, refreshes the routes to this robot and queues the
+    * entries that changed since the last step in vector messages.
+    * Called by buzzvm_process_outmsgs().
+    * @param vm The Buzz VM data.
+    */
+   extern void buzzroute_gossip(struct buzzvm_s* vm);
+
+   /*
+    * Merges a distance vector received from a neighbor.
+    * Called by buzzvm_process_inmsgs().
+    * @param vm The Buzz VM data.
+    * @param rid The id of the robot that sent the message.
+    * @param msg The message.
+    * @return 0 on success, -1 if the message is malformed.
+    */
+   extern int buzzroute_vector_receive(struct buzzvm_s* vm,
+                                       uint16_t rid,
+                                       buzzmsg_payload_t msg);
+
+   /*
+    * Delivers or forwards a routed message.
+    * Called by buzzvm_process_inmsgs().
+    * @param vm The Buzz VM data.
+    * @param msg The message.
+    * @return 0 on success, -1 if the message is malformed.
+    */
+   extern int buzzroute_data_receive(struct buzzvm_s* vm,
+                                     buzzmsg_payload_t msg);
+
+   /*
+    * Marks the routing objects in use.
+    * Called by buzzheap_gc().
+    * @param vm The Buzz VM data.
+    */
+   extern void buzzroute_gc(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to create a new gradient.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzroute_gradient_create(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to make this robot a source of a gradient, or to stop.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzroute_gradient_source(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to push the distance to the closest source of a
+    * gradient, or nil if no source is known.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzroute_gradient_get(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to push the hops to the closest source of a gradient,
+    * or nil if no source is known.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzroute_gradient_hops(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to push the neighbor towards the closest source of a
+    * gradient, or nil if no source is known.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzroute_gradient_parent(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to send a value to a robot over several hops.
+    * Pushes 1 if a route is known and the message was queued, 0 otherwise.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzroute_send(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to install the listener of routed messages. The robot
+    * is reachable from the others as long as it listens.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzroute_listen(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to remove the listener of routed messages.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzroute_ignore(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to push the hops to a robot, or nil if no route is
+    * known.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzroute_hops(struct buzzvm_s* vm);
+
+#ifdef __cplusplus
+}
+#endif
+
+/*
+ * Steps between two increases of the sequence numbers of this robot.
+ * Each increase is flooded once, so this is the refresh rate of the
+ * routes.
+ */
+#define BUZZROUTE_REFRESH 20
+
+/*
+ * Refresh periods without news after which a route is removed.
+ */
+#define BUZZROUTE_MISSES 3
+
+/*
+ * Maximum hops of a route or a routed message.
+ */
+#define BUZZROUTE_MAXHOPS 64
+
+/*
+ * Maximum number of entries in a vector message.
+ */
+#define BUZZROUTE_VECTOR_MAX 64
+
+#endif
@@ -1,48 +1,24 @@
 #include <buzz/buzzasm.h>
+#include <buzz/buzzudp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 void usage(const char* path, int status) {
-   fprintf(stderr, "Usage:\n\t%s [--trace] <file.bo> <file.bdb>\n\n", path);
+   fprintf(stderr, "Usage:\n\t%s [--trace] [--udp <robot> [--port <port>] [--steps <n>] [--period <ms>]] <file.bo> <file.bdb>\n\n", path);
    exit(status);
 }
 
+/* Returns the time in milliseconds */
+int64_t now() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 int print(buzzvm_t vm) {
-   for(int i = 1; i < buzzdarray_size(vm->lsyms->syms); ++i) {
-      buzzvm_lload(vm, i);
-      buzzobj_t o = buzzvm_stack_at(vm, 1);
-      buzzvm_pop(vm);
-      switch(o->o.type) {
-         case BUZZTYPE_NIL:
-            fprintf(stdout, "[nil]");
-            break;
-         case BUZZTYPE_INT:
-            fprintf(stdout, "%d", o->i.value);
-            break;
-         case BUZZTYPE_FLOAT:
-            fprintf(stdout, "%f", o->f.value);
-            break;
-         case BUZZTYPE_TABLE:
-            fprintf(stdout, "[table with %d elems]", (buzzdict_size(o->t.value)));
-            break;
-         case BUZZTYPE_CLOSURE:
-            if(o->c.value.isnative)
-               fprintf(stdout, "[n-closure @%d]", o->c.value.ref);
-            else
-               fprintf(stdout, "[c-closure @%d]", o->c.value.ref);
-            break;
-         case BUZZTYPE_STRING:
-            fprintf(stdout, "%s", o->s.value.str);
-            break;
-         case BUZZTYPE_USERDATA:
-            fprintf(stdout, "[userdata @%p]", o->u.value);
-            break;
-         default:
-            break;
-      }
-   }
-   fprintf(stdout, "\n");
+   buzzdebug_print_args(vm, stdout);
    return buzzvm_ret0(vm);
 }
 
@@ -53,21 +29,48 @@ int main(int argc, char** argv) {
    char* dbgfname;
    /* Whether or not to show the assembly information */
    int trace = 0;
+   /* The robot id, or -1 to run without messaging */
+   long robot = -1;
+   /* The UDP port */
+   long port = BUZZUDP_DEFAULT_PORT;
+   /* The number of control steps (0 = forever) */
+   long steps = 0;
+   /* The duration of a control step in ms */
+   long period = 100;
    /* Parse command line */
-   if(argc < 3 || argc > 4) usage(argv[0], 0);
-   if(argc == 3) {
-      bcfname = argv[1];
-      dbgfname = argv[2];
-   }
-   else {
-      bcfname = argv[2];
-      dbgfname = argv[3];
-      if(strcmp(argv[1], "--trace") != 0) {
-         fprintf(stderr, "error: %s: unrecognized option '%s'\n", argv[0], argv[1]);
+   int i = 1;
+   while(i < argc - 2) {
+      if(strcmp(argv[i], "--trace") == 0) {
+         trace = 1;
+         ++i;
+      }
+      else if(i + 1 < argc - 2 && (
+                 strcmp(argv[i], "--udp") == 0 ||
+                 strcmp(argv[i], "--port") == 0 ||
+                 strcmp(argv[i], "--steps") == 0 ||
+                 strcmp(argv[i], "--period") == 0)) {
+         char* end;
+         long v = strtol(argv[i+1], &end, 10);
+         if(*end != 0 || v < 0 ||
+            (strcmp(argv[i], "--udp") == 0 && v > UINT16_MAX) ||
+            (strcmp(argv[i], "--port") == 0 && v > UINT16_MAX)) {
+            fprintf(stderr, "error: %s: invalid value '%s' for option '%s'\n", argv[0], argv[i+1], argv[i]);
+            usage(argv[0], 1);
+         }
+         if(strcmp(argv[i], "--udp") == 0) robot = v;
+         else if(strcmp(argv[i], "--port") == 0) port = v;
+         else if(strcmp(argv[i], "--steps") == 0) steps = v;
+         else period = v;
+         i += 2;
+      }
+      else {
+         fprintf(stderr, "error: %s: unrecognized option '%s'\n", argv[0], argv[i]);
          usage(argv[0], 1);
       }
-      trace = 1;
    }
+   if(i != argc - 2) usage(argv[0], 0);
+   bcfname = argv[argc - 2];
+   dbgfname = argv[argc - 1];
    /* Read bytecode and fill in data structure */
    FILE* fd = fopen(bcfname, "rb");
    if(!fd) perror(bcfname);
@@ -85,7 +88,7 @@ int main(int argc, char** argv) {
       perror(dbgfname);
    }
    /* Create new VM */
-   buzzvm_t vm = buzzvm_new(1);
+   buzzvm_t vm = buzzvm_new(robot >= 0 ? robot : 1);
    /* Set byte code */
    buzzvm_set_bcode(vm, bcode_buf, bcode_size);
    /* Register hook functions */
@@ -95,6 +98,37 @@ int main(int argc, char** argv) {
    /* Run byte code */
    do if(trace) buzzdebug_stack_dump(vm, 1, stdout);
    while(buzzvm_step(vm) == BUZZVM_STATE_READY);
+   /* Execute the control loop, exchanging messages over UDP */
+   if(robot >= 0 && vm->state == BUZZVM_STATE_DONE) {
+      buzztransport_t t = buzzudp_transport_new(robot, NULL, port, 1024);
+      if(!t) {
+         perror("bzzrun: UDP transport");
+         exit(1);
+      }
+      if(buzzvm_function_call(vm, "init", 0) == BUZZVM_STATE_READY) {
+         buzzvm_pop(vm);
+         long s;
+         int64_t next = now();
+         for(s = 0; steps == 0 || s < steps; ++s) {
+            if(buzztransport_step(t, vm) != BUZZVM_STATE_READY) break;
+            /* Wait for the rest of the period, receiving the packets */
+            next += period;
+            int64_t remaining = next - now();
+            if(remaining < 0) {
+               /* The step took too long, don't try to catch up */
+               next -= remaining;
+               remaining = 0;
+            }
+            if(buzztransport_wait(t, remaining) < 0)
+               perror("bzzrun: UDP transport");
+         }
+         if(vm->state == BUZZVM_STATE_READY)
+            buzzvm_function_call(vm, "destroy", 0);
+      }
+      buzztransport_destroy(&t);
+      /* The control loop ends with the VM ready, like the script */
+      if(vm->state == BUZZVM_STATE_READY) vm->state = BUZZVM_STATE_DONE;
+   }
    /* Done running, check final state */
    int retval;
    if(vm->state == BUZZVM_STATE_DONE) {
@@ -107,21 +141,8 @@ int main(int argc, char** argv) {
    else {
       /* Execution terminated with errors */
       if(trace) buzzdebug_stack_dump(vm, 1, stdout);
-      const buzzdebug_entry_t* dbg = buzzdebug_info_get_fromoffset(dbg_buf, &vm->oldpc);
-      if(dbg != NULL) {
-         fprintf(stderr, "%s: execution terminated abnormally at %s:%" PRIu64 ":%" PRIu64 " : %s\n\n",
-                 bcfname,
-                 (*dbg)->fname,
-                 (*dbg)->line,
-                 (*dbg)->col,
-                 vm->errormsg);
-      }
-      else {
-         fprintf(stderr, "%s: execution terminated abnormally at bytecode offset %d: %s\n\n",
-                 bcfname,
-                 vm->oldpc,
-                 vm->errormsg);
-      }
+      buzzdebug_print_error(vm, dbg_buf, bcfname, stderr);
+      fprintf(stderr, "\n");
       retval = 1;
    }
    /* Destroy VM */
@@ -2,6 +2,7 @@
 #include "buzzvm.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /****************************************/
 /****************************************/
@@ -21,26 +22,120 @@
 /****************************************/
 /****************************************/
 
+/*
+ * Swarm set operations.
+ */
+#define buzzswarm_set_word(i) ((i) >> 5)
+#define buzzswarm_set_bit(i)  ((uint32_t)1 << ((i) & 31))
+
+static void buzzswarm_set_init(buzzswarm_set_t s) {
+   s->words = NULL;
+   s->size = 0;
+}
+
+static void buzzswarm_set_clear(buzzswarm_set_t s) {
+   free(s->words);
+   buzzswarm_set_init(s);
+}
+
+static int buzzswarm_set_has(const buzzswarm_set_t s,
+                             uint16_t i) {
+   return buzzswarm_set_word(i) < s->size &&
+      (s->words[buzzswarm_set_word(i)] & buzzswarm_set_bit(i));
+}
+
+static void buzzswarm_set_add(buzzswarm_set_t s,
+                              uint16_t i) {
+   uint16_t w = buzzswarm_set_word(i);
+   if(w >= s->size) {
+      s->words = (uint32_t*)realloc(s->words, (w + 1) * sizeof(uint32_t));
+      memset(s->words + s->size, 0, (w + 1 - s->size) * sizeof(uint32_t));
+      s->size = w + 1;
+   }
+   s->words[w] |= buzzswarm_set_bit(i);
+}
+
+static void buzzswarm_set_remove(buzzswarm_set_t s,
+                                 uint16_t i) {
+   if(buzzswarm_set_word(i) < s->size)
+      s->words[buzzswarm_set_word(i)] &= ~buzzswarm_set_bit(i);
+}
+
+static int buzzswarm_set_isempty(const buzzswarm_set_t s) {
+   uint16_t w;
+   for(w = 0; w < s->size; ++w)
+      if(s->words[w]) return 0;
+   return 1;
+}
+
+/*
+ * Appends the ids of the swarms in a set to a list.
+ */
+static void buzzswarm_set_ids(const buzzswarm_set_t s,
+                              buzzdarray_t ids,
+                              buzzdarray_t list) {
+   uint16_t w;
+   for(w = 0; w < s->size; ++w) {
+      uint32_t x = s->words[w];
+      while(x) {
+         uint16_t i = (w << 5) + __builtin_ctz(x);
+         buzzdarray_push(list, &buzzdarray_get(ids, i, uint16_t));
+         x &= x - 1;
+      }
+   }
+}
+
+/*
+ * Returns the digest of the swarms in a set.
+ * The ids are mixed and summed, so the order of the swarms, which
+ * depends on the indices, does not matter.
+ */
+static uint32_t buzzswarm_set_hash(const buzzswarm_set_t s,
+                                   buzzdarray_t ids) {
+   uint32_t h = 0;
+   uint16_t w;
+   for(w = 0; w < s->size; ++w) {
+      uint32_t x = s->words[w];
+      while(x) {
+         uint32_t k = buzzdarray_get(ids, (w << 5) + __builtin_ctz(x), uint16_t);
+         k = (k + 1) * 0x9E3779B1;
+         k ^= k >> 15;
+         k *= 0x85EBCA77;
+         k ^= k >> 13;
+         h += k;
+         x &= x - 1;
+      }
+   }
+   return h;
+}
+
+/****************************************/
+/****************************************/
+
 /*
  * An element in the data structure that stores robot
  * membership data.
  */
 struct buzzswarm_elem_s {
-   buzzdarray_t swarms;
+   struct buzzswarm_set_s swarms;
    uint16_t age;
+   /* The last digest received, compared once all the messages are processed */
+   uint32_t digest;
+   uint8_t check;
 };
 typedef struct buzzswarm_elem_s* buzzswarm_elem_t;
 
 buzzswarm_elem_t buzzswarm_elem_new() {
    buzzswarm_elem_t e = (buzzswarm_elem_t)malloc(sizeof(struct buzzswarm_elem_s));
-   e->swarms = buzzdarray_new(1, sizeof(uint16_t), NULL);
+   buzzswarm_set_init(&e->swarms);
    e->age = 0;
+   e->check = 0;
    return e;
 }
 
 void buzzswarm_elem_destroy(const void* key, void* data, void* params) {
    buzzswarm_elem_t e = *(buzzswarm_elem_t*)data;
-   buzzdarray_destroy(&(e->swarms));
+   buzzswarm_set_clear(&e->swarms);
    free(e);
    free((void*)key);
    free(data);
@@ -50,19 +145,71 @@ void buzzswarm_elem_destroy(const void* key, void* data, void* params) {
 /****************************************/
 
 buzzswarm_members_t buzzswarm_members_new() {
-   return buzzdict_new(10,
-                       sizeof(uint16_t),
-                       sizeof(buzzswarm_elem_t),
-                       buzzdict_uint16keyhash,
-                       buzzdict_uint16keycmp,
-                       buzzswarm_elem_destroy);
+   buzzswarm_members_t m = (buzzswarm_members_t)malloc(sizeof(struct buzzswarm_members_s));
+   m->index = buzzdict_new(BUZZSWARM_INDEX_BUCKETS,
+                           sizeof(uint16_t),
+                           sizeof(uint16_t),
+                           buzzdict_uint16keyhash,
+                           buzzdict_uint16keycmp,
+                           NULL);
+   m->ids = buzzdarray_new(10, sizeof(uint16_t), NULL);
+   m->robots = buzzdict_new(10,
+                            sizeof(uint16_t),
+                            sizeof(buzzswarm_elem_t),
+                            buzzdict_uint16keyhash,
+                            buzzdict_uint16keycmp,
+                            buzzswarm_elem_destroy);
+   buzzswarm_set_init(&m->known);
+   buzzswarm_set_init(&m->in);
+   m->version = 0;
+   m->sent = 0;
+   m->arrived = 0;
+   m->stale = buzzdarray_new(1, sizeof(uint16_t), NULL);
+   m->minperiod = BUZZSWARM_HEARTBEAT_MIN;
+   m->maxperiod = BUZZSWARM_HEARTBEAT_MAX;
+   m->period = m->minperiod;
+   m->timer = m->period;
+   m->listtimer = BUZZSWARM_LIST_PERIOD;
+   m->lists = 0;
+   m->digests = 0;
+   m->requests = 0;
+   return m;
 }
 
 /****************************************/
 /****************************************/
 
 void buzzswarm_members_destroy(buzzswarm_members_t* m) {
-   buzzdict_destroy(m);
+   buzzdict_destroy(&(*m)->index);
+   buzzdarray_destroy(&(*m)->ids);
+   buzzdict_destroy(&(*m)->robots);
+   buzzswarm_set_clear(&(*m)->known);
+   buzzswarm_set_clear(&(*m)->in);
+   buzzdarray_destroy(&(*m)->stale);
+   free(*m);
+   *m = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+uint16_t buzzswarm_members_index(buzzswarm_members_t m,
+                                 uint16_t swarm) {
+   const uint16_t* i = buzzdict_get(m->index, &swarm, uint16_t);
+   if(i) return *i;
+   uint16_t ni = buzzdarray_size(m->ids);
+   buzzdict_set(m->index, &swarm, &ni);
+   buzzdarray_push(m->ids, &swarm);
+   return ni;
+}
+
+/*
+ * Returns the index of a swarm, or -1 if the swarm was never seen.
+ */
+static int32_t buzzswarm_members_find(buzzswarm_members_t m,
+                                      uint16_t swarm) {
+   const uint16_t* i = buzzdict_get(m->index, &swarm, uint16_t);
+   return i ? *i : -1;
 }
 
 /****************************************/
@@ -71,25 +218,22 @@ void buzzswarm_members_destroy(buzzswarm_members_t* m) {
 void buzzswarm_members_join(buzzswarm_members_t m,
                             uint16_t robot,
                             uint16_t swarm) {
+   uint16_t i = buzzswarm_members_index(m, swarm);
    /* Is an entry for the passed robot already present? */
-   const buzzswarm_elem_t* e = buzzdict_get(m, &robot, buzzswarm_elem_t);
+   const buzzswarm_elem_t* e = buzzdict_get(m->robots, &robot, buzzswarm_elem_t);
    if(e) {
       /* Yes, update it */
       (*e)->age = 0;
-      /* Search for the passed id; if found, nothing to do */
-      uint32_t i;
-      for(i = 0; i < buzzdarray_size((*e)->swarms); ++i) {
-         if(buzzdarray_get((*e)->swarms, i, uint16_t) == swarm) return;
-      }
-      /* If we get here, it's because we got new information - add it */
-      buzzdarray_push((*e)->swarms, &swarm);
+      buzzswarm_set_add(&(*e)->swarms, i);
    }
    else {
       /* No, create it */
       buzzswarm_elem_t ne = buzzswarm_elem_new();
-      buzzdarray_push(ne->swarms, &swarm);
+      buzzswarm_set_add(&ne->swarms, i);
       /* Add it to the structure */
-      buzzdict_set(m, &robot, &ne);
+      buzzdict_set(m->robots, &robot, &ne);
+      /* The new neighbor needs the swarms of this robot */
+      m->arrived = 1;
    }
 }
 
@@ -100,21 +244,15 @@ void buzzswarm_members_leave(buzzswarm_members_t m,
                              uint16_t robot,
                              uint16_t swarm) {
    /* Is an entry for the passed robot present? */
-   const buzzswarm_elem_t* e = buzzdict_get(m, &robot, buzzswarm_elem_t);
+   const buzzswarm_elem_t* e = buzzdict_get(m->robots, &robot, buzzswarm_elem_t);
    if(e) {
       /* Yes, update it */
       (*e)->age = 0;
-      /* Search for the passed id */
-      uint32_t i;
-      for(i = 0; i < buzzdarray_size((*e)->swarms); ++i) {
-         if(buzzdarray_get((*e)->swarms, i, uint16_t) == swarm) break;
-      }
-      /* If the element was found, remove it */
-      if(i < buzzdarray_size((*e)->swarms))
-         buzzdarray_remove((*e)->swarms, i);
+      int32_t i = buzzswarm_members_find(m, swarm);
+      if(i >= 0) buzzswarm_set_remove(&(*e)->swarms, i);
       /* If no swarm id is known for this robot, remove the entry altogether */
-      if(buzzdarray_isempty((*e)->swarms))
-         buzzdict_remove(m, &robot);
+      if(buzzswarm_set_isempty(&(*e)->swarms))
+         buzzdict_remove(m->robots, &robot);
    }
    /* Nothing to do if you get a 'leave' message for someone you don't know */
 }
@@ -126,21 +264,28 @@ void buzzswarm_members_refresh(buzzswarm_members_t m,
                                uint16_t robot,
                                buzzdarray_t swarms) {
    /* Is an entry for the passed robot already present? */
-   const buzzswarm_elem_t* e = buzzdict_get(m, &robot, buzzswarm_elem_t);
+   const buzzswarm_elem_t* e = buzzdict_get(m->robots, &robot, buzzswarm_elem_t);
+   buzzswarm_elem_t x;
    if(e) {
       /* Yes, update it */
-      (*e)->age = 0;
-      buzzdarray_destroy(&((*e)->swarms));
-      (*e)->swarms = swarms;
+      x = *e;
+      x->age = 0;
+      if(x->swarms.size > 0)
+         memset(x->swarms.words, 0, x->swarms.size * sizeof(uint32_t));
    }
    else {
       /* No, create it */
-      buzzswarm_elem_t ne = buzzswarm_elem_new();
-      buzzdarray_destroy(&(ne->swarms));
-      ne->swarms = swarms;
+      x = buzzswarm_elem_new();
       /* Add it to the structure */
-      buzzdict_set(m, &robot, &ne);
+      buzzdict_set(m->robots, &robot, &x);
+      /* The new neighbor needs the swarms of this robot */
+      m->arrived = 1;
    }
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(swarms); ++i)
+      buzzswarm_set_add(&x->swarms,
+                        buzzswarm_members_index(m, buzzdarray_get(swarms, i, uint16_t)));
+   buzzdarray_destroy(&swarms);
 }
 
 /****************************************/
@@ -151,16 +296,174 @@ int buzzswarm_members_isrobotin(buzzswarm_members_t m,
                                 uint16_t swarm) {
    /* Is an entry for the passed robot present?
     * If not, return false */
-   const buzzswarm_elem_t* e = buzzdict_get(m, &robot, buzzswarm_elem_t);
+   const buzzswarm_elem_t* e = buzzdict_get(m->robots, &robot, buzzswarm_elem_t);
    if(!e) return 0;
    /* If we get here, an entry is present
     * Does it contain the passed swarm id? */
-   uint32_t i;
-   for(i = 0; i < buzzdarray_size((*e)->swarms); ++i) {
-      if(buzzdarray_get((*e)->swarms, i, uint16_t) == swarm) return 1;
+   int32_t i = buzzswarm_members_find(m, swarm);
+   return i >= 0 && buzzswarm_set_has(&(*e)->swarms, i);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzswarm_members_create(buzzswarm_members_t m,
+                              uint16_t swarm) {
+   buzzswarm_set_add(&m->known, buzzswarm_members_index(m, swarm));
+}
+
+/****************************************/
+/****************************************/
+
+void buzzswarm_members_set(buzzswarm_members_t m,
+                           uint16_t swarm,
+                           int in) {
+   uint16_t i = buzzswarm_members_index(m, swarm);
+   buzzswarm_set_add(&m->known, i);
+   /* A change must be gossiped */
+   if(!in != !buzzswarm_set_has(&m->in, i)) ++m->version;
+   if(in) buzzswarm_set_add(&m->in, i);
+   else buzzswarm_set_remove(&m->in, i);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzswarm_members_amin(buzzswarm_members_t m,
+                           uint16_t swarm) {
+   int32_t i = buzzswarm_members_find(m, swarm);
+   if(i < 0 || !buzzswarm_set_has(&m->known, i)) return -1;
+   return buzzswarm_set_has(&m->in, i);
+}
+
+/****************************************/
+/****************************************/
+
+buzzdarray_t buzzswarm_members_mine(buzzswarm_members_t m) {
+   buzzdarray_t l = buzzdarray_new(1, sizeof(uint16_t), NULL);
+   buzzswarm_set_ids(&m->in, m->ids, l);
+   return l;
+}
+
+/****************************************/
+/****************************************/
+
+uint32_t buzzswarm_members_hash(buzzswarm_members_t m,
+                                int32_t robot) {
+   if(robot < 0) return buzzswarm_set_hash(&m->in, m->ids);
+   uint16_t r = robot;
+   const buzzswarm_elem_t* e = buzzdict_get(m->robots, &r, buzzswarm_elem_t);
+   return e ? buzzswarm_set_hash(&(*e)->swarms, m->ids) : 0;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzswarm_members_heartbeat(buzzswarm_members_t m,
+                                 uint16_t robot,
+                                 uint32_t hash) {
+   /* Is an entry for the passed robot already present? */
+   const buzzswarm_elem_t* e = buzzdict_get(m->robots, &robot, buzzswarm_elem_t);
+   buzzswarm_elem_t x;
+   if(e) {
+      /* Yes, the robot is still around */
+      x = *e;
+      x->age = 0;
+   }
+   else {
+      /* No, create an empty one, so the next heartbeats are not arrivals */
+      x = buzzswarm_elem_new();
+      buzzdict_set(m->robots, &robot, &x);
+      /* The new neighbor needs the swarms of this robot */
+      m->arrived = 1;
    }
-   /* If we get here, it's because we couldn't find the id */
-   return 0;
+   /* The messages of a robot are not processed in order, so the joins and
+    * leaves sent with the digest may come next: compare in update() */
+   x->digest = hash;
+   x->check = 1;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzswarm_members_period(buzzswarm_members_t m,
+                              uint16_t minperiod,
+                              uint16_t maxperiod) {
+   m->minperiod = minperiod > 0 ? minperiod : 1;
+   m->maxperiod = maxperiod > m->minperiod ? maxperiod : m->minperiod;
+   m->period = m->minperiod;
+   if(m->timer > m->period) m->timer = m->period;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzswarm_members_gossip(buzzvm_t vm) {
+   buzzswarm_members_t m = vm->swarmmembers;
+   /* Nothing to say until the script creates a swarm */
+   if(m->known.size == 0) return;
+   /* After a change, the heartbeat is fast again; the change itself was
+    * sent as join/leave messages */
+   if(m->version != m->sent) {
+      m->sent = m->version;
+      m->period = m->minperiod;
+      m->timer = m->period;
+   }
+   /* Send the full list to the new neighbors, and regularly for the
+    * older robots, which ignore the heartbeats */
+   if(m->listtimer > 0)
+      --m->listtimer;
+   if(m->arrived || m->listtimer == 0) {
+      m->arrived = 0;
+      m->listtimer = BUZZSWARM_LIST_PERIOD;
+      buzzdarray_t ids = buzzswarm_members_mine(m);
+      buzzoutmsg_queue_append_swarm_list(vm, ids);
+      buzzdarray_destroy(&ids);
+      ++m->lists;
+   }
+   /* Send the digest when the heartbeat is due or a list must be requested */
+   if(m->timer > 0)
+      --m->timer;
+   if(m->timer == 0 || !buzzdarray_isempty(m->stale)) {
+      buzzoutmsg_queue_append_swarm_digest(vm,
+                                           buzzswarm_members_hash(m, -1),
+                                           m->stale);
+      buzzdarray_clear(m->stale, 1);
+      ++m->digests;
+      if(m->timer == 0) {
+         /* Back off while nothing changes */
+         m->period = m->period < m->maxperiod / 2 ? m->period * 2 : m->maxperiod;
+         m->timer = m->period;
+      }
+   }
+}
+
+/****************************************/
+/****************************************/
+
+struct buzzswarm_members_stats_s {
+   buzzswarm_stats_t s;
+   uint64_t total;
+};
+
+void stats_swarm_elem(const void* key, void* data, void* params) {
+   buzzswarm_elem_t e = *(buzzswarm_elem_t*)data;
+   struct buzzswarm_members_stats_s* x = (struct buzzswarm_members_stats_s*)params;
+   if(e->age > x->s->maxage) x->s->maxage = e->age;
+   x->total += e->age;
+}
+
+void buzzswarm_members_stats(buzzswarm_members_t m,
+                             buzzswarm_stats_t s) {
+   struct buzzswarm_members_stats_s x = { .s = s, .total = 0 };
+   s->robots = buzzdict_size(m->robots);
+   s->maxage = 0;
+   buzzdict_foreach(m->robots, stats_swarm_elem, &x);
+   s->meanage = s->robots > 0 ? (float)x.total / s->robots : 0.0f;
+   s->period = m->period;
+   s->lists = m->lists;
+   s->digests = m->digests;
+   s->requests = m->requests;
 }
 
 /****************************************/
@@ -169,6 +472,7 @@ int buzzswarm_members_isrobotin(buzzswarm_members_t m,
 struct buzzswarm_members_print_s {
    FILE* stream;
    uint16_t robot;
+   buzzdarray_t ids;
 };
 typedef struct buzzswarm_members_print_s* buzzswarm_members_print_t;
 
@@ -176,16 +480,19 @@ void print_swarm_elem(const void* key, void* data, void* params) {
    buzzswarm_elem_t e = *(buzzswarm_elem_t*)data;
    buzzswarm_members_print_t p = (buzzswarm_members_print_t)params;
    fprintf(stdout, "   %u:%u:", p->robot, *(uint16_t*)key);
-   if(!buzzdarray_isempty(e->swarms)) {
+   buzzdarray_t l = buzzdarray_new(1, sizeof(uint16_t), NULL);
+   buzzswarm_set_ids(&e->swarms, p->ids, l);
+   if(!buzzdarray_isempty(l)) {
       fprintf(p->stream,
               "%u",
-              buzzdarray_get(e->swarms, 0, uint16_t));
-      for(uint32_t i = 1; i < buzzdarray_size(e->swarms); ++i) {
+              buzzdarray_get(l, 0, uint16_t));
+      for(uint32_t i = 1; i < buzzdarray_size(l); ++i) {
          fprintf(p->stream,
                  " %u",
-                 buzzdarray_get(e->swarms, i, uint16_t));
+                 buzzdarray_get(l, i, uint16_t));
       }
    }
+   buzzdarray_destroy(&l);
    fprintf(stdout, "\n");
 }
 
@@ -195,20 +502,18 @@ void buzzswarm_members_print(FILE* stream,
    fprintf(stream,
            "ROBOT %u: swarm member table size: %u\n",
            robot,
-           buzzdict_size(m));
+           buzzdict_size(m->robots));
    struct buzzswarm_members_print_s x = {
       .stream = stream,
-      .robot = robot
+      .robot = robot,
+      .ids = m->ids
    };
-   buzzdict_foreach(m, print_swarm_elem, &x);
+   buzzdict_foreach(m->robots, print_swarm_elem, &x);
 }
 
 /****************************************/
 /****************************************/
 
-/* Maximum age (in steps) for swarm membership to be remembered */
-static int MEMBERSHIP_AGE_MAX = 50;
-
 /* Information on element to delete */
 struct buzzswarm_members_todelete_s {
    uint16_t key;
@@ -216,32 +521,52 @@ struct buzzswarm_members_todelete_s {
 };
 typedef struct buzzswarm_members_todelete_s* buzzswarm_members_todelete_t;
 
+/* Elements to delete and maximum age (in steps) */
+struct buzzswarm_members_check_s {
+   buzzswarm_members_t m;
+   buzzswarm_members_todelete_t todel;
+   uint32_t agemax;
+};
+
 /* Function that checks whether an element must be deleted */
 void check_swarm_elem(const void* key, void* data, void* params) {
    buzzswarm_elem_t elem = *(buzzswarm_elem_t*)data;
-   buzzswarm_members_todelete_t* todel = (buzzswarm_members_todelete_t*)params;
+   struct buzzswarm_members_check_s* c = (struct buzzswarm_members_check_s*)params;
+   /* Request the list if the information is out of date */
+   if(elem->check) {
+      elem->check = 0;
+      if(buzzswarm_set_hash(&elem->swarms, c->m->ids) != elem->digest) {
+         buzzdarray_push(c->m->stale, (uint16_t*)key);
+         ++c->m->requests;
+      }
+   }
    /* Increase the element's age */
-   ++elem->age;
+   if(elem->age < UINT16_MAX) ++elem->age;
    /* Mark the element to delete if it exceeds the maximum age */
-   if(elem->age > MEMBERSHIP_AGE_MAX) {
+   if(elem->age > c->agemax) {
       buzzswarm_members_todelete_t x =
          (buzzswarm_members_todelete_t)malloc(
             sizeof(struct buzzswarm_members_todelete_s));
       x->key = *(uint16_t*)key;
-      x->next = *todel;
-      *todel = x;
+      x->next = c->todel;
+      c->todel = x;
    }
 }
 
 void buzzswarm_members_update(buzzswarm_members_t m) {
    /* Go through elements and make a list of the elements to erase */
-   buzzswarm_members_todelete_t todel = NULL;
-   buzzdict_foreach(m, check_swarm_elem, &todel);
+   struct buzzswarm_members_check_s c = {
+      .m = m,
+      .todel = NULL,
+      .agemax = (uint32_t)m->maxperiod * BUZZSWARM_HEARTBEAT_MISSES
+   };
+   buzzdict_foreach(m->robots, check_swarm_elem, &c);
    /* Erase elements */
+   buzzswarm_members_todelete_t todel = c.todel;
    buzzswarm_members_todelete_t next;
    while(todel) {
       next = todel->next;
-      buzzdict_remove(m, &todel->key);
+      buzzdict_remove(m->robots, &todel->key);
       free(todel);
       todel = next;
    }
@@ -294,10 +619,7 @@ int buzzswarm_create(buzzvm_t vm) {
    buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
    uint16_t id = buzzvm_stack_at(vm, 1)->i.value;
    /* Add a new entry if necessary */
-   if(!buzzdict_exists(vm->swarms, &id)) {
-      uint8_t v = 0;
-      buzzdict_set(vm->swarms, &id, &v);
-   }
+   buzzswarm_members_create(vm->swarmmembers, id);
    /* Create a table to return */
    make_table(vm, id);
    /* Return */
@@ -347,8 +669,8 @@ int buzzswarm_others(buzzvm_t vm) {
    buzzvm_tget(vm);
    uint16_t id1 = buzzvm_stack_at(vm, 1)->i.value;
    /* Get the swarm entry */
-   const uint8_t* x = buzzdict_get(vm->swarms, &id1, uint8_t);
-   if(!x) {
+   int x = buzzswarm_members_amin(vm->swarmmembers, id1);
+   if(x < 0) {
       buzzvm_seterror(vm,
                       BUZZVM_ERROR_SWARM,
                       NULL);
@@ -359,8 +681,8 @@ int buzzswarm_others(buzzvm_t vm) {
    buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
    uint16_t id2 = buzzvm_stack_at(vm, 1)->i.value;
    /* Add a new entry for the swarm */
-   uint8_t v = *x ? 0 : 1;
-   buzzdict_set(vm->swarms, &id2, &v);
+   uint8_t v = x ? 0 : 1;
+   buzzswarm_members_set(vm->swarmmembers, id2, v);
    /* Send update, if necessary */
    if(v)
       buzzoutmsg_queue_append_swarm_joinleave(
@@ -379,10 +701,9 @@ int buzzswarm_join(buzzvm_t vm) {
    /* Get the id */
    id_get();
    /* Join the swarm, if known */
-   if(buzzdict_exists(vm->swarms, &id)) {
+   if(buzzswarm_members_amin(vm->swarmmembers, id) >= 0) {
       /* Store membership */
-      uint8_t v = 1;
-      buzzdict_set(vm->swarms, &id, &v);
+      buzzswarm_members_set(vm->swarmmembers, id, 1);
       /* Send update */
       buzzoutmsg_queue_append_swarm_joinleave(
          vm, BUZZMSG_SWARM_JOIN, id);
@@ -405,10 +726,9 @@ int buzzswarm_leave(buzzvm_t vm) {
    /* Get the id */
    id_get();
    /* Leave the swarm, if known */
-   if(buzzdict_exists(vm->swarms, &id)) {
+   if(buzzswarm_members_amin(vm->swarmmembers, id) >= 0) {
       /* Store membership */
-      uint8_t v = 0;
-      buzzdict_set(vm->swarms, &id, &v);
+      buzzswarm_members_set(vm->swarmmembers, id, 0);
       /* Send update */
       buzzoutmsg_queue_append_swarm_joinleave(
          vm, BUZZMSG_SWARM_LEAVE, id);
@@ -431,15 +751,15 @@ int buzzswarm_in(buzzvm_t vm) {
    /* Get the id */
    id_get();
    /* Get the swarm entry */
-   const uint8_t* x = buzzdict_get(vm->swarms, &id, uint8_t);
-   if(!x) {
+   int x = buzzswarm_members_amin(vm->swarmmembers, id);
+   if(x < 0) {
       buzzvm_seterror(vm,
                       BUZZVM_ERROR_SWARM,
                       NULL);
       return vm->state;
    }
    /* Push the return value */
-   buzzvm_pushi(vm, *x);
+   buzzvm_pushi(vm, x);
    /* Return */
    return buzzvm_ret1(vm);
 }
@@ -456,9 +776,9 @@ int buzzswarm_select(buzzvm_t vm) {
    buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
    uint8_t in = buzzvm_stack_at(vm, 1)->i.value;
    /* Update the swarm, if known */
-   if(buzzdict_exists(vm->swarms, &id)) {
+   if(buzzswarm_members_amin(vm->swarmmembers, id) >= 0) {
       /* Store membership */
-      buzzdict_set(vm->swarms, &id, &in);
+      buzzswarm_members_set(vm->swarmmembers, id, in);
       /* Send update */
       buzzoutmsg_queue_append_swarm_joinleave(
          vm,
@@ -483,15 +803,15 @@ int buzzswarm_exec(buzzvm_t vm) {
    /* Get the id */
    id_get();
    /* Get the swarm entry */
-   const uint8_t* x = buzzdict_get(vm->swarms, &id, uint8_t);
-   if(!x) {
+   int x = buzzswarm_members_amin(vm->swarmmembers, id);
+   if(x < 0) {
       buzzvm_seterror(vm,
                       BUZZVM_ERROR_SWARM,
                       NULL);
       return vm->state;
    }
    /* Check whether the robot is in the swarm */
-   if(*x) {
+   if(x) {
       /* Get the closure */
       buzzvm_lload(vm, 1);
       buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
@@ -542,10 +862,8 @@ static int buzzswarm_check(struct buzzvm_s* vm) {
     */
    /* Get the id */
    uint16_t id = buzzvm_stack_at(vm, 1)->i.value;
-   /* Fetch the swarm with the given id */
-   const uint8_t* x = buzzdict_get(vm->swarms, &id, uint8_t);
    /* Return 1 if the robot is in the swarm, 0 otherwise */
-   return (x && *x);
+   return buzzswarm_members_amin(vm->swarmmembers, id) > 0;
 }
 
 /****************************************/
@@ -570,7 +888,7 @@ static int buzzswarm_check(struct buzzvm_s* vm) {
    /* Membership condition */                                     \
    uint8_t v = COND;                                              \
    /* Add a new entry to the swarm list */                        \
-   buzzdict_set(vm->swarms, &id, &v);                             \
+   buzzswarm_members_set(vm->swarmmembers, id, v);                \
    /* Create a table */                                           \
    make_table(vm, id);                                            \
    /* Send update, if necessary */                                \
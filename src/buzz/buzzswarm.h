@@ -14,9 +14,86 @@ extern "C" {
    struct buzzvm_s;
 
    /*
-    * Data type for the robot membership data structure.
+    * A set of swarms, as a bitset over the swarm indices.
+    * @see buzzswarm_members_index()
     */
-   typedef buzzdict_t buzzswarm_members_t;
+   struct buzzswarm_set_s {
+      /* The bits, 32 swarms per word */
+      uint32_t* words;
+      /* The number of words */
+      uint16_t size;
+   };
+   typedef struct buzzswarm_set_s* buzzswarm_set_t;
+
+   /*
+    * Counters and staleness of the swarm membership information.
+    * @see buzzswarm_members_stats()
+    */
+   struct buzzswarm_stats_s {
+      /* The number of neighbors in the membership table */
+      uint32_t robots;
+      /* The steps since the oldest entry was confirmed */
+      uint16_t maxage;
+      /* The average steps since the entries were confirmed */
+      float meanage;
+      /* The current heartbeat period */
+      uint16_t period;
+      /* The swarm lists sent */
+      uint32_t lists;
+      /* The digests sent */
+      uint32_t digests;
+      /* The neighbors found out of date, whose list was requested */
+      uint32_t requests;
+   };
+   typedef struct buzzswarm_stats_s* buzzswarm_stats_t;
+
+   /*
+    * The robot membership data structure.
+    * Swarm ids are remapped to dense indices, in order of first use, so
+    * the swarms of a robot fit in a few words whatever their ids.
+    *
+    * The membership of this robot is gossiped on change: joins and leaves
+    * are sent when they happen, and a digest (a hash of the swarm list)
+    * is sent as heartbeat. The heartbeat period starts at minperiod after
+    * every change and doubles up to maxperiod. A neighbor whose digest
+    * does not match the local information is asked for its full list in
+    * the next digest. The full list is also sent when a new neighbor
+    * shows up.
+    */
+   struct buzzswarm_members_s {
+      /* Swarm id -> index (uint16_t) */
+      buzzdict_t index;
+      /* Index -> swarm id (uint16_t) */
+      buzzdarray_t ids;
+      /* Robot id -> swarms the robot is a member of */
+      buzzdict_t robots;
+      /* The swarms created by this robot */
+      struct buzzswarm_set_s known;
+      /* The swarms this robot is a member of */
+      struct buzzswarm_set_s in;
+      /* Version of the swarms of this robot, increased at every change */
+      uint16_t version;
+      /* Version when the heartbeat period was last reset */
+      uint16_t sent;
+      /* 1 if a neighbor needs the full swarm list of this robot */
+      uint8_t arrived;
+      /* Robots whose swarm list must be requested (uint16_t) */
+      buzzdarray_t stale;
+      /* Heartbeat period bounds, in steps */
+      uint16_t minperiod;
+      uint16_t maxperiod;
+      /* Current heartbeat period */
+      uint16_t period;
+      /* Steps to the next heartbeat */
+      uint16_t timer;
+      /* Steps to the next full swarm list */
+      uint16_t listtimer;
+      /* Counters */
+      uint32_t lists;
+      uint32_t digests;
+      uint32_t requests;
+   };
+   typedef struct buzzswarm_members_s* buzzswarm_members_t;
 
    /*
     * Creates a new swarm membership structure.
@@ -73,8 +150,107 @@ extern "C" {
                                           uint16_t robot,
                                           uint16_t swarm);
 
+   /*
+    * Returns the index of a swarm, assigning the next one if necessary.
+    * @param m The swarm membership structure.
+    * @param swarm The swarm id.
+    * @return The index of the swarm.
+    */
+   extern uint16_t buzzswarm_members_index(buzzswarm_members_t m,
+                                           uint16_t swarm);
+
+   /*
+    * Marks a swarm as created by this robot.
+    * @param m The swarm membership structure.
+    * @param swarm The swarm id.
+    */
+   extern void buzzswarm_members_create(buzzswarm_members_t m,
+                                        uint16_t swarm);
+
+   /*
+    * Sets whether this robot is a member of a swarm it created.
+    * @param m The swarm membership structure.
+    * @param swarm The swarm id.
+    * @param in 1 if the robot is a member, 0 otherwise.
+    */
+   extern void buzzswarm_members_set(buzzswarm_members_t m,
+                                     uint16_t swarm,
+                                     int in);
+
+   /*
+    * Returns whether this robot is a member of a swarm.
+    * @param m The swarm membership structure.
+    * @param swarm The swarm id.
+    * @return 1 if the robot is a member, 0 if it is not, -1 if it did not create the swarm.
+    */
+   extern int buzzswarm_members_amin(buzzswarm_members_t m,
+                                     uint16_t swarm);
+
+   /*
+    * Returns the swarms this robot is a member of.
+    * @param m The swarm membership structure.
+    * @return A new list of swarm ids (uint16_t). Destroy it after use.
+    */
+   extern buzzdarray_t buzzswarm_members_mine(buzzswarm_members_t m);
+
+   /*
+    * Returns the digest of a list of swarms.
+    * The digest does not depend on the order of the swarms.
+    * @param m The swarm membership structure.
+    * @param robot The robot id, or -1 for this robot.
+    * @return The digest of the swarms of the robot (0 if none).
+    */
+   extern uint32_t buzzswarm_members_hash(buzzswarm_members_t m,
+                                          int32_t robot);
+
+   /*
+    * Processes the heartbeat of a neighbor.
+    * The entry of the robot is refreshed. If the digest does not match the
+    * local information after the messages of the step are processed, the
+    * full list of the robot is requested.
+    * @see buzzswarm_members_update()
+    * @param m The swarm membership structure.
+    * @param robot The robot id.
+    * @param hash The digest of the swarms of the robot.
+    */
+   extern void buzzswarm_members_heartbeat(buzzswarm_members_t m,
+                                           uint16_t robot,
+                                           uint32_t hash);
+
+   /*
+    * Sets the bounds of the heartbeat period.
+    * The period starts at minperiod after every change and doubles up to
+    * maxperiod. The information on a neighbor is forgotten after
+    * BUZZSWARM_HEARTBEAT_MISSES heartbeats at maxperiod are missed.
+    * Call this function from the host, typically after buzzvm_new().
+    * @param m The swarm membership structure.
+    * @param minperiod The minimum period, in steps (at least 1).
+    * @param maxperiod The maximum period, in steps (at least minperiod).
+    */
+   extern void buzzswarm_members_period(buzzswarm_members_t m,
+                                        uint16_t minperiod,
+                                        uint16_t maxperiod);
+
+   /*
+    * Queues the swarm messages due at this step.
+    * Called at every step by buzzvm_process_outmsgs().
+    * @param vm The Buzz VM state.
+    */
+   extern void buzzswarm_members_gossip(struct buzzvm_s* vm);
+
+   /*
+    * Returns the counters and the staleness of the membership information.
+    * @param m The swarm membership structure.
+    * @param s The structure to fill.
+    */
+   extern void buzzswarm_members_stats(buzzswarm_members_t m,
+                                       buzzswarm_stats_t s);
+
    /*
     * Updates the information in the swarm membership structure.
+    * The digests received are compared with the local information, and the
+    * entries that were not confirmed for BUZZSWARM_HEARTBEAT_MISSES
+    * heartbeats at the maximum period are removed.
     * @param m The swarm membership structure.
     */
    extern void buzzswarm_members_update(buzzswarm_members_t m);
@@ -177,4 +353,29 @@ extern "C" {
 }
 #endif
 
+/*
+ * Number of buckets of the swarm id -> index dictionary.
+ * Swarm ids are usually small, consecutive numbers, so most swarms get a
+ * bucket of their own.
+ */
+#define BUZZSWARM_INDEX_BUCKETS 64
+
+/*
+ * Default bounds of the heartbeat period, in steps.
+ */
+#define BUZZSWARM_HEARTBEAT_MIN 10
+#define BUZZSWARM_HEARTBEAT_MAX 80
+
+/*
+ * Number of missed heartbeats after which a neighbor is forgotten.
+ */
+#define BUZZSWARM_HEARTBEAT_MISSES 3
+
+/*
+ * Maximum number of steps between two full swarm lists.
+ * Older versions of Buzz ignore the heartbeats and forget the swarms of a
+ * robot after 50 steps without a list.
+ */
+#define BUZZSWARM_LIST_PERIOD 40
+
 #endif
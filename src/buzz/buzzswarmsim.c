@@ -0,0 +1,218 @@
+#include <buzz/buzzasm.h>
+#include <buzz/buzzbus.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Whether or not to show the output of log() */
+static int quiet = 0;
+
+void usage(const char* path, int status) {
+   fprintf(stderr, "Usage:\n\t%s [options] <file.bo> <file.bdb>\n\n", path);
+   fprintf(stderr, "Options:\n");
+   fprintf(stderr, "\t--robots <n>      number of robots (default: 10)\n");
+   fprintf(stderr, "\t--steps <k>       number of control steps (default: 100)\n");
+   fprintf(stderr, "\t--arena <side>    side of the square arena (default: sqrt(n))\n");
+   fprintf(stderr, "\t--range <r>       communication range, 0 = unlimited (default: 2)\n");
+   fprintf(stderr, "\t--loss <p>        packet loss probability (default: 0)\n");
+   fprintf(stderr, "\t--bandwidth <b>   bytes a robot receives per step, 0 = unlimited (default: 0)\n");
+   fprintf(stderr, "\t--mtu <m>         maximum packet size in bytes (default: 100)\n");
+   fprintf(stderr, "\t--seed <s>        random seed (default: 1)\n");
+   fprintf(stderr, "\t--quiet           ignore the output of log()\n\n");
+   exit(status);
+}
+
+int print(buzzvm_t vm) {
+   if(quiet) return buzzvm_ret0(vm);
+   fprintf(stdout, "[ROBOT %u] ", vm->robot);
+   buzzdebug_print_args(vm, stdout);
+   return buzzvm_ret0(vm);
+}
+
+/*
+ * Parses a numeric option, exiting on error.
+ */
+double parse_number(const char* path, const char* opt, const char* val, double min, double max) {
+   char* end;
+   double v = strtod(val, &end);
+   if(*end != 0 || !(v >= min && v <= max)) {
+      fprintf(stderr, "error: %s: invalid value '%s' for option '%s'\n", path, val, opt);
+      usage(path, 1);
+   }
+   return v;
+}
+
+/*
+ * Returns the current time in seconds.
+ */
+double now() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char** argv) {
+   /* Parameters */
+   long robots = 10;
+   long steps = 100;
+   double arena = -1.0;
+   double range = 2.0;
+   double loss = 0.0;
+   long bandwidth = 0;
+   long mtu = 100;
+   long seed = 1;
+   /* Parse command line */
+   int i = 1;
+   while(i < argc - 2) {
+      if(strcmp(argv[i], "--quiet") == 0) {
+         quiet = 1;
+         ++i;
+         continue;
+      }
+      if(i + 1 >= argc - 2) {
+         fprintf(stderr, "error: %s: unrecognized option '%s'\n", argv[0], argv[i]);
+         usage(argv[0], 1);
+      }
+      if(strcmp(argv[i], "--robots") == 0)
+         robots = parse_number(argv[0], argv[i], argv[i+1], 1, UINT16_MAX + 1);
+      else if(strcmp(argv[i], "--steps") == 0)
+         steps = parse_number(argv[0], argv[i], argv[i+1], 0, INT32_MAX);
+      else if(strcmp(argv[i], "--arena") == 0)
+         arena = parse_number(argv[0], argv[i], argv[i+1], 0, HUGE_VAL);
+      else if(strcmp(argv[i], "--range") == 0)
+         range = parse_number(argv[0], argv[i], argv[i+1], 0, HUGE_VAL);
+      else if(strcmp(argv[i], "--loss") == 0)
+         loss = parse_number(argv[0], argv[i], argv[i+1], 0, 1);
+      else if(strcmp(argv[i], "--bandwidth") == 0)
+         bandwidth = parse_number(argv[0], argv[i], argv[i+1], 0, UINT32_MAX);
+      else if(strcmp(argv[i], "--mtu") == 0)
+         mtu = parse_number(argv[0], argv[i], argv[i+1], 8, UINT16_MAX);
+      else if(strcmp(argv[i], "--seed") == 0)
+         seed = parse_number(argv[0], argv[i], argv[i+1], 0, INT32_MAX);
+      else {
+         fprintf(stderr, "error: %s: unrecognized option '%s'\n", argv[0], argv[i]);
+         usage(argv[0], 1);
+      }
+      i += 2;
+   }
+   if(i != argc - 2) usage(argv[0], 0);
+   char* bcfname = argv[argc - 2];
+   char* dbgfname = argv[argc - 1];
+   if(arena < 0.0) arena = sqrt(robots);
+   /* Read bytecode */
+   FILE* fd = fopen(bcfname, "rb");
+   if(!fd) {
+      perror(bcfname);
+      return 1;
+   }
+   fseek(fd, 0, SEEK_END);
+   size_t bcode_size = ftell(fd);
+   rewind(fd);
+   uint8_t* bcode_buf = (uint8_t*)malloc(bcode_size);
+   if(fread(bcode_buf, 1, bcode_size, fd) < bcode_size) {
+      perror(bcfname);
+      return 1;
+   }
+   fclose(fd);
+   /* Read debug information */
+   buzzdebug_t dbg_buf = buzzdebug_new();
+   if(!buzzdebug_fromfile(dbg_buf, dbgfname)) {
+      perror(dbgfname);
+      return 1;
+   }
+   /* Create the radio medium */
+   buzzbus_t bus = buzzbus_new(range);
+   bus->loss = loss;
+   bus->bandwidth = bandwidth;
+   buzzbus_seed(bus, seed);
+   srand48(seed);
+   /* Create the robots, scattered uniformly in the arena */
+   buzzvm_t* vms = (buzzvm_t*)calloc(robots, sizeof(buzzvm_t));
+   buzztransport_t* ts = (buzztransport_t*)calloc(robots, sizeof(buzztransport_t));
+   double t0 = now();
+   long r;
+   for(r = 0; r < robots; ++r) {
+      vms[r] = buzzvm_new(r);
+      ts[r] = buzzbus_transport_new(bus, r, mtu);
+      buzzbus_set_position(ts[r],
+                           drand48() * arena,
+                           drand48() * arena,
+                           0.0f,
+                           drand48() * 2.0 * M_PI);
+      buzzvm_t vm = vms[r];
+      if(buzzvm_set_bcode(vm, bcode_buf, bcode_size) != BUZZVM_STATE_READY) continue;
+      /* Give each robot a different random seed */
+      buzzvm_pushs(vm, buzzvm_string_register(vm, "math", 1));
+      buzzvm_gload(vm);
+      buzzvm_pushs(vm, buzzvm_string_register(vm, "rng", 1));
+      buzzvm_tget(vm);
+      buzzvm_pushs(vm, buzzvm_string_register(vm, "setseed", 1));
+      buzzvm_tget(vm);
+      buzzvm_pushi(vm, lrand48() % 65536);
+      buzzvm_closure_call(vm, 1);
+      buzzvm_pop(vm);
+      /* Register hook functions */
+      buzzvm_pushs(vm, buzzvm_string_register(vm, "log", 1));
+      buzzvm_pushcc(vm, buzzvm_function_register(vm, print));
+      buzzvm_gstore(vm);
+      /* Execute the global part of the script and call init() */
+      if(buzzvm_execute_script(vm) == BUZZVM_STATE_DONE &&
+         buzzvm_function_call(vm, "init", 0) == BUZZVM_STATE_READY)
+         buzzvm_pop(vm);
+   }
+   double t1 = now();
+   /* Run the control steps */
+   uint64_t vmsteps = 0;
+   long k;
+   for(k = 0; k < steps; ++k) {
+      for(r = 0; r < robots; ++r) {
+         if(vms[r]->state != BUZZVM_STATE_READY) continue;
+         buzztransport_step(ts[r], vms[r]);
+         ++vmsteps;
+      }
+      buzzbus_tick(bus);
+   }
+   double t2 = now();
+   /* Report errors */
+   long errors = 0;
+   for(r = 0; r < robots; ++r) {
+      if(vms[r]->state == BUZZVM_STATE_READY ||
+         vms[r]->state == BUZZVM_STATE_DONE) continue;
+      fprintf(stderr, "[ROBOT %u] ", vms[r]->robot);
+      buzzdebug_print_error(vms[r], dbg_buf, bcfname, stderr);
+      ++errors;
+   }
+   /* Report throughput */
+   uint64_t pktsent = 0, msgsent = 0, msgreceived = 0;
+   for(r = 0; r < robots; ++r) {
+      pktsent += ts[r]->sent;
+      msgsent += ts[r]->msgsent;
+      msgreceived += ts[r]->msgreceived;
+   }
+   double elapsed = t2 - t1 > 0.0 ? t2 - t1 : 1e-9;
+   fprintf(stdout, "robots:            %ld (%ld in error)\n", robots, errors);
+   fprintf(stdout, "steps:             %ld\n", steps);
+   fprintf(stdout, "setup time:        %.3f s\n", t1 - t0);
+   fprintf(stdout, "run time:          %.3f s\n", t2 - t1);
+   fprintf(stdout, "VM steps:          %" PRIu64 " (%.0f/s)\n", vmsteps, vmsteps / elapsed);
+   fprintf(stdout, "packets sent:      %" PRIu64 " (%.0f/s)\n", pktsent, pktsent / elapsed);
+   fprintf(stdout, "packets delivered: %" PRIu64 " (%" PRIu64 " dropped)\n", bus->delivered, bus->dropped);
+   fprintf(stdout, "messages sent:     %" PRIu64 " (%.0f/s)\n", msgsent, msgsent / elapsed);
+   fprintf(stdout, "messages received: %" PRIu64 " (%.0f/s)\n", msgreceived, msgreceived / elapsed);
+   /* Cleanup */
+   for(r = 0; r < robots; ++r) {
+      if(vms[r]->state == BUZZVM_STATE_READY)
+         buzzvm_function_call(vms[r], "destroy", 0);
+      buzztransport_destroy(&ts[r]);
+      buzzvm_destroy(&vms[r]);
+   }
+   free(ts);
+   free(vms);
+   buzzbus_destroy(&bus);
+   free(bcode_buf);
+   buzzdebug_destroy(&dbg_buf);
+   /* All done */
+   return errors > 0;
+}
@@ -0,0 +1,227 @@
+#include "buzztransport.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/****************************************/
+/****************************************/
+
+/*
+ * Default values for the fragmentation layer.
+ */
+#define BUZZTRANSPORT_FRAG_TIMEOUT  20
+#define BUZZTRANSPORT_FRAG_MAXBYTES 65536
+
+/*
+ * Maximum number of packets kept between two steps.
+ */
+#define BUZZTRANSPORT_PENDING_MAX 1024
+
+/****************************************/
+/****************************************/
+
+static int buzztransport_neighbor_default(buzztransport_t t,
+                                          uint16_t rid,
+                                          float* distance,
+                                          float* azimuth,
+                                          float* elevation,
+                                          void* params) {
+   *distance = 0.0f;
+   *azimuth = 0.0f;
+   *elevation = 0.0f;
+   return 1;
+}
+
+/****************************************/
+/****************************************/
+
+static void buzztransport_packet_destroy(uint32_t pos, void* data, void* params) {
+   buzzmsg_payload_destroy((buzzmsg_payload_t*)data);
+}
+
+/****************************************/
+/****************************************/
+
+static int64_t buzztransport_now() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/****************************************/
+/****************************************/
+
+buzztransport_t buzztransport_new(uint16_t robot,
+                                  uint32_t mtu) {
+   buzztransport_t t = (buzztransport_t)calloc(1, sizeof(struct buzztransport_s));
+   t->neighbor = buzztransport_neighbor_default;
+   t->robot = robot;
+   /* A packet must have room for the robot id and a frame size */
+   t->mtu = mtu > 3 * sizeof(uint16_t) ? mtu : 3 * sizeof(uint16_t) + 1;
+   t->frag = buzzfrag_new(t->mtu - 2 * sizeof(uint16_t),
+                          BUZZTRANSPORT_FRAG_TIMEOUT,
+                          BUZZTRANSPORT_FRAG_MAXBYTES);
+   t->buf = (uint8_t*)malloc(t->mtu);
+   t->pending = buzzdarray_new(16,
+                               sizeof(buzzmsg_payload_t),
+                               buzztransport_packet_destroy);
+   return t;
+}
+
+/****************************************/
+/****************************************/
+
+void buzztransport_destroy(buzztransport_t* t) {
+   if((*t)->destroy) (*t)->destroy(*t);
+   buzzfrag_destroy(&(*t)->frag);
+   free((*t)->buf);
+   buzzdarray_destroy(&(*t)->pending);
+   free(*t);
+   *t = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+void buzztransport_set_neighbor(buzztransport_t t,
+                                buzztransport_neighbor_funp fun,
+                                void* params) {
+   t->neighbor = fun ? fun : buzztransport_neighbor_default;
+   t->neighborparams = params;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Updates the neighbor information with the sender of a packet and
+ * passes its frames to the fragmentation layer.
+ */
+static void buzztransport_packet_in(buzztransport_t t,
+                                    buzzvm_t vm,
+                                    buzzmsg_payload_t pkt) {
+   ++t->received;
+   int64_t size = buzzmsg_payload_size(pkt);
+   /* Get robot id and update neighbor information */
+   uint16_t rid;
+   float distance, azimuth, elevation;
+   int64_t pos = buzzmsg_deserialize_u16(&rid, pkt, 0);
+   if(pos < 0 || rid == vm->robot ||
+      !t->neighbor(t, rid, &distance, &azimuth, &elevation, t->neighborparams))
+      return;
+   buzzneighbors_add(vm, rid, distance, azimuth, elevation);
+   /* Go through the frames until there's nothing else to read */
+   uint16_t fsize;
+   while((pos = buzzmsg_deserialize_u16(&fsize, pkt, pos)) > 0 &&
+         fsize > 0 &&
+         pos + fsize <= size) {
+      buzzfrag_in(t->frag,
+                  vm,
+                  rid,
+                  buzzmsg_payload_frombuffer((uint8_t*)pkt->data + pos, fsize));
+      pos += fsize;
+      ++t->msgreceived;
+   }
+}
+
+/****************************************/
+/****************************************/
+
+void buzztransport_process_inmsgs(buzztransport_t t,
+                                  buzzvm_t vm) {
+   /* Drop incomplete messages that timed out */
+   buzzfrag_update(t->frag);
+   /* Reset neighbor information */
+   buzzneighbors_reset(vm);
+   /* Go through the packets kept by buzztransport_wait() */
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(t->pending); ++i)
+      buzztransport_packet_in(t, vm, buzzdarray_get(t->pending, i, buzzmsg_payload_t));
+   buzzdarray_clear(t->pending, 16);
+   /* Go through the packets */
+   int64_t size;
+   while((size = t->recv(t, t->buf, t->mtu)) > 0) {
+      buzzmsg_payload_t pkt = buzzmsg_payload_frombuffer(t->buf, size);
+      buzztransport_packet_in(t, vm, pkt);
+      buzzmsg_payload_destroy(&pkt);
+   }
+   if(size < 0)
+      fprintf(stderr, "[WARNING] [ROBOT %u] Error receiving packets\n", vm->robot);
+   /* Process messages */
+   buzzvm_process_inmsgs(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzztransport_wait(buzztransport_t t,
+                       int timeout) {
+   int64_t deadline = buzztransport_now() + timeout;
+   int r;
+   while((r = t->poll(t, timeout > 0 ? timeout : 0)) > 0) {
+      /* Keep the packets for the next step, dropping them if too many */
+      int64_t size;
+      while((size = t->recv(t, t->buf, t->mtu)) > 0) {
+         if(buzzdarray_size(t->pending) >= BUZZTRANSPORT_PENDING_MAX) continue;
+         buzzmsg_payload_t pkt = buzzmsg_payload_frombuffer(t->buf, size);
+         buzzdarray_push(t->pending, &pkt);
+      }
+      if(size < 0) return -1;
+      timeout = deadline - buzztransport_now();
+      if(timeout <= 0) return 0;
+   }
+   return r;
+}
+
+/****************************************/
+/****************************************/
+
+void buzztransport_process_outmsgs(buzztransport_t t,
+                                   buzzvm_t vm) {
+   /* Process outgoing messages */
+   buzzvm_process_outmsgs(vm);
+   /* Send robot id */
+   buzzmsg_payload_t pkt = buzzmsg_payload_new(t->mtu);
+   buzzmsg_serialize_u16(pkt, vm->robot);
+   /* Send frames until the packet is full */
+   buzzmsg_payload_t m;
+   while((m = buzzfrag_out_first(t->frag, vm))) {
+      /* Make sure the next frame fits the packet */
+      if(buzzmsg_payload_size(pkt) + sizeof(uint16_t) + buzzmsg_payload_size(m) > t->mtu) {
+         buzzmsg_payload_destroy(&m);
+         break;
+      }
+      /* Add frame length and frame to the packet */
+      buzzmsg_serialize_u16(pkt, buzzmsg_payload_size(m));
+      uint32_t i;
+      for(i = 0; i < buzzmsg_payload_size(m); ++i)
+         buzzmsg_serialize_u8(pkt, buzzmsg_payload_get(m, i));
+      /* Get rid of frame */
+      buzzfrag_out_next(t->frag, vm);
+      buzzmsg_payload_destroy(&m);
+      ++t->msgsent;
+   }
+   /* Send the packet, even if empty, so the neighbors know about us */
+   if(t->send(t, (uint8_t*)pkt->data, buzzmsg_payload_size(pkt)) == 0)
+      ++t->sent;
+   else
+      fprintf(stderr, "[WARNING] [ROBOT %u] Error sending packet\n", vm->robot);
+   buzzmsg_payload_destroy(&pkt);
+}
+
+/****************************************/
+/****************************************/
+
+buzzvm_state buzztransport_step(buzztransport_t t,
+                                buzzvm_t vm) {
+   buzztransport_process_inmsgs(t, vm);
+   if(buzzvm_function_call(vm, "step", 0) != BUZZVM_STATE_READY)
+      return vm->state;
+   /* Remove useless return value from stack */
+   buzzvm_pop(vm);
+   buzztransport_process_outmsgs(t, vm);
+   return vm->state;
+}
+
+/****************************************/
+/****************************************/
@@ -0,0 +1,188 @@
+#ifndef BUZZTRANSPORT_H
+#define BUZZTRANSPORT_H
+
+#include <buzz/buzzvm.h>
+#include <buzz/buzzfrag.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   struct buzztransport_s;
+
+   /*
+    * Function pointer to send a packet to the neighbors.
+    * @param t The transport.
+    * @param buf The packet data.
+    * @param size The packet size.
+    * @return 0 on success, -1 on error.
+    */
+   typedef int (*buzztransport_send_funp)(struct buzztransport_s* t,
+                                          const uint8_t* buf,
+                                          uint32_t size);
+
+   /*
+    * Function pointer to receive a packet.
+    * This function must not block.
+    * @param t The transport.
+    * @param buf The buffer to fill with the packet data.
+    * @param cap The capacity of the buffer.
+    * @return The size of the packet, 0 if no packet is available, -1 on error.
+    */
+   typedef int64_t (*buzztransport_recv_funp)(struct buzztransport_s* t,
+                                              uint8_t* buf,
+                                              uint32_t cap);
+
+   /*
+    * Function pointer to wait for packets.
+    * @param t The transport.
+    * @param timeout The maximum time to wait in milliseconds (0 = don't wait).
+    * @return 1 if packets are available, 0 if not, -1 on error.
+    */
+   typedef int (*buzztransport_poll_funp)(struct buzztransport_s* t,
+                                          int timeout);
+
+   /*
+    * Function pointer to get the position of a neighbor.
+    * The position is expressed in the local frame of the robot.
+    * @param t The transport.
+    * @param rid The id of the neighbor.
+    * @param distance The distance to the neighbor.
+    * @param azimuth The angle to the neighbor on the XY plane.
+    * @param elevation The angle to the neighbor with respect to the XY plane.
+    * @param params Parameters set with buzztransport_set_neighbor().
+    * @return 1 if the robot is a neighbor, 0 if its packets must be discarded.
+    */
+   typedef int (*buzztransport_neighbor_funp)(struct buzztransport_s* t,
+                                              uint16_t rid,
+                                              float* distance,
+                                              float* azimuth,
+                                              float* elevation,
+                                              void* params);
+
+   /*
+    * Function pointer to destroy the backend-specific data.
+    * @param t The transport.
+    */
+   typedef void (*buzztransport_destroy_funp)(struct buzztransport_s* t);
+
+   /*
+    * A message transport.
+    *
+    * A transport moves packets between robots. At each step, a robot sends
+    * a single packet that contains its id and as many messages as fit the
+    * MTU:
+    *
+    *    [u16 robot id][u16 size][message]...[u16 size][message]
+    *
+    * Messages larger than the MTU are fragmented, see buzzfrag.h.
+    *
+    * Backends fill in the function pointers and the backend data.
+    */
+   struct buzztransport_s {
+      /* Sends a packet */
+      buzztransport_send_funp send;
+      /* Receives a packet */
+      buzztransport_recv_funp recv;
+      /* Waits for packets */
+      buzztransport_poll_funp poll;
+      /* Destroys the backend */
+      buzztransport_destroy_funp destroy;
+      /* Returns the position of a neighbor */
+      buzztransport_neighbor_funp neighbor;
+      /* Parameters for the neighbor function */
+      void* neighborparams;
+      /* Backend-specific data */
+      void* data;
+      /* The robot id */
+      uint16_t robot;
+      /* Maximum size of a packet */
+      uint32_t mtu;
+      /* Fragmentation layer */
+      buzzfrag_t frag;
+      /* Packet buffer */
+      uint8_t* buf;
+      /* Packets received by buzztransport_wait() */
+      buzzdarray_t pending;
+      /* Packet counters */
+      uint64_t sent;
+      uint64_t received;
+      /* Message counters (a fragment counts as a message) */
+      uint64_t msgsent;
+      uint64_t msgreceived;
+   };
+   typedef struct buzztransport_s* buzztransport_t;
+
+   /*
+    * Creates a new transport.
+    * This function is meant to be called by the backends.
+    * The neighbor function is initialized to consider every sender a
+    * neighbor at distance zero.
+    * @param robot The robot id.
+    * @param mtu The maximum size of a packet.
+    * @return A new transport, with the backend function pointers set to NULL.
+    */
+   extern buzztransport_t buzztransport_new(uint16_t robot,
+                                            uint32_t mtu);
+
+   /*
+    * Destroys a transport.
+    * @param t The transport.
+    */
+   extern void buzztransport_destroy(buzztransport_t* t);
+
+   /*
+    * Sets the function that returns the position of a neighbor.
+    * @param t The transport.
+    * @param fun The function.
+    * @param params The parameters passed to the function.
+    */
+   extern void buzztransport_set_neighbor(buzztransport_t t,
+                                          buzztransport_neighbor_funp fun,
+                                          void* params);
+
+   /*
+    * Receives the packets, updates the neighbors and processes the messages.
+    * @param t The transport.
+    * @param vm The Buzz VM.
+    */
+   extern void buzztransport_process_inmsgs(buzztransport_t t,
+                                            buzzvm_t vm);
+
+   /*
+    * Processes the outgoing messages and sends a packet.
+    * @param t The transport.
+    * @param vm The Buzz VM.
+    */
+   extern void buzztransport_process_outmsgs(buzztransport_t t,
+                                             buzzvm_t vm);
+
+   /*
+    * Waits for the given time, receiving the packets that arrive.
+    * The packets are kept for the next call to
+    * buzztransport_process_inmsgs(), so the backend buffers do not
+    * fill up between two steps. Returns early if the backend cannot
+    * wait, such as the in-process bus.
+    * @param t The transport.
+    * @param timeout The time to wait in milliseconds (0 = don't wait).
+    * @return 0 if no error, -1 otherwise.
+    */
+   extern int buzztransport_wait(buzztransport_t t,
+                                 int timeout);
+
+   /*
+    * Executes a control step.
+    * The step consists of processing the incoming messages, calling the
+    * Buzz function 'step', and processing the outgoing messages.
+    * @param t The transport.
+    * @param vm The Buzz VM.
+    * @return The state of the VM.
+    */
+   extern buzzvm_state buzztransport_step(buzztransport_t t,
+                                          buzzvm_t vm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -8,7 +8,7 @@
 
 #define BUZZTYPE_TABLE_BUCKETS 10
 
-const char *buzztype_desc[] = { "nil", "integer", "float", "string", "table", "closure", "userdata" };
+const char* const buzztype_desc[] = { "nil", "integer", "float", "string", "table", "closure", "userdata" };
 
 /****************************************/
 /****************************************/
@@ -20,7 +20,7 @@
 extern "C" {
 #endif
 
-   extern const char *buzztype_desc[];
+   extern const char* const buzztype_desc[];
 
    /*
     * Nil
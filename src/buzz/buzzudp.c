@@ -0,0 +1,137 @@
+#include "buzzudp.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/****************************************/
+/****************************************/
+
+struct buzzudp_s {
+   /* The socket */
+   int fd;
+   /* The address of the multicast group */
+   struct sockaddr_in group;
+};
+typedef struct buzzudp_s* buzzudp_t;
+
+/****************************************/
+/****************************************/
+
+static int buzzudp_send(buzztransport_t t,
+                        const uint8_t* buf,
+                        uint32_t size) {
+   buzzudp_t u = (buzzudp_t)t->data;
+   if(sendto(u->fd, buf, size, 0,
+             (struct sockaddr*)&u->group, sizeof(u->group)) < 0)
+      return -1;
+   return 0;
+}
+
+/****************************************/
+/****************************************/
+
+static int64_t buzzudp_recv(buzztransport_t t,
+                            uint8_t* buf,
+                            uint32_t cap) {
+   buzzudp_t u = (buzzudp_t)t->data;
+   uint16_t rid = htons(t->robot);
+   while(1) {
+      ssize_t size = recv(u->fd, buf, cap, 0);
+      if(size < 0)
+         return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+      /* Skip the packets sent by this robot, which loop back to us */
+      if(size >= sizeof(uint16_t) && memcmp(buf, &rid, sizeof(uint16_t)) == 0)
+         continue;
+      if(size > 0) return size;
+   }
+}
+
+/****************************************/
+/****************************************/
+
+static int buzzudp_poll(buzztransport_t t,
+                        int timeout) {
+   buzzudp_t u = (buzzudp_t)t->data;
+   struct pollfd pfd = {
+      .fd = u->fd,
+      .events = POLLIN
+   };
+   return poll(&pfd, 1, timeout);
+}
+
+/****************************************/
+/****************************************/
+
+static void buzzudp_destroy(buzztransport_t t) {
+   buzzudp_t u = (buzzudp_t)t->data;
+   close(u->fd);
+   free(u);
+}
+
+/****************************************/
+/****************************************/
+
+buzztransport_t buzzudp_transport_new(uint16_t robot,
+                                      const char* group,
+                                      uint16_t port,
+                                      uint32_t mtu) {
+   /* Parse the group address */
+   struct sockaddr_in addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(port);
+   if(inet_pton(AF_INET, group ? group : BUZZUDP_DEFAULT_GROUP, &addr.sin_addr) != 1) {
+      errno = EINVAL;
+      return NULL;
+   }
+   /* Create the socket */
+   int fd = socket(AF_INET, SOCK_DGRAM, 0);
+   if(fd < 0) return NULL;
+   /* Let all the robots on this machine bind the same port */
+   int one = 1;
+   struct sockaddr_in any;
+   memset(&any, 0, sizeof(any));
+   any.sin_family = AF_INET;
+   any.sin_addr.s_addr = htonl(INADDR_ANY);
+   any.sin_port = htons(port);
+   /* Send and receive through the loopback interface */
+   struct in_addr lo;
+   lo.s_addr = htonl(INADDR_LOOPBACK);
+   struct ip_mreq mreq;
+   mreq.imr_multiaddr = addr.sin_addr;
+   mreq.imr_interface = lo;
+   if(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+#ifdef SO_REUSEPORT
+      setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0 ||
+#endif
+      bind(fd, (struct sockaddr*)&any, sizeof(any)) < 0 ||
+      setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &lo, sizeof(lo)) < 0 ||
+      setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &one, sizeof(one)) < 0 ||
+      setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0 ||
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+      int err = errno;
+      close(fd);
+      errno = err;
+      return NULL;
+   }
+   /* Create the transport */
+   buzztransport_t t = buzztransport_new(robot, mtu);
+   buzzudp_t u = (buzzudp_t)malloc(sizeof(struct buzzudp_s));
+   u->fd = fd;
+   u->group = addr;
+   t->data = u;
+   t->send = buzzudp_send;
+   t->recv = buzzudp_recv;
+   t->poll = buzzudp_poll;
+   t->destroy = buzzudp_destroy;
+   return t;
+}
+
+/****************************************/
+/****************************************/
@@ -0,0 +1,43 @@
+#ifndef BUZZUDP_H
+#define BUZZUDP_H
+
+#include <buzz/buzztransport.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /*
+    * Creates a new transport based on UDP multicast.
+    *
+    * The packets are sent to the given multicast group through the loopback
+    * interface, so all the robots must run on the same machine. Every robot
+    * that joined the group is considered a neighbor at distance zero, unless
+    * a different neighbor function is set with buzztransport_set_neighbor().
+    * Destroy the transport with buzztransport_destroy().
+    * @param robot The robot id.
+    * @param group The multicast group, or NULL for BUZZUDP_DEFAULT_GROUP.
+    * @param port The UDP port.
+    * @param mtu The maximum size of a packet.
+    * @return A new transport, or NULL in case of error (errno is set).
+    */
+   extern buzztransport_t buzzudp_transport_new(uint16_t robot,
+                                                const char* group,
+                                                uint16_t port,
+                                                uint32_t mtu);
+
+#ifdef __cplusplus
+}
+#endif
+
+/*
+ * The default multicast group.
+ */
+#define BUZZUDP_DEFAULT_GROUP "239.255.42.99"
+
+/*
+ * The default UDP port.
+ */
+#define BUZZUDP_DEFAULT_PORT 24580
+
+#endif
@@ -1,9 +1,11 @@
 #include "buzzvm.h"
 #include "buzzvstig.h"
+#include "buzzcrdt.h"
 #include "buzzswarm.h"
 #include "buzzmath.h"
 #include "buzzio.h"
 #include "buzzstring.h"
+#include "buzzcompress.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -12,13 +14,11 @@
 /****************************************/
 /****************************************/
 
-const char *buzzvm_state_desc[] = { "no code", "ready", "done", "error", "stopped" };
+const char* const buzzvm_state_desc[] = { "no code", "ready", "done", "error", "stopped" };
 
-const char *buzzvm_error_desc[] = { "none", "unknown instruction", "stack error", "wrong number of local variables", "pc out of range", "function id out of range", "type mismatch", "unknown string id", "unknown swarm id" };
+const char* const buzzvm_error_desc[] = { "none", "unknown instruction", "stack error", "wrong number of local variables", "pc out of range", "function id out of range", "type mismatch", "unknown string id", "unknown swarm id" };
 
-const char *buzzvm_instr_desc[] = {"nop", "done", "pushnil", "dup", "pop", "ret0", "ret1", "add", "sub", "mul", "div", "mod", "pow", "unm", "land", "lor", "lnot", "band", "bor", "bnot", "lshift", "rshift", "eq", "neq", "gt", "gte", "lt", "lte", "gload", "gstore", "pusht", "tput", "tget", "callc", "calls", "pushf", "pushi", "pushs", "pushcn", "pushcc", "pushl", "lload", "lstore", "lremove", "jump", "jumpz", "jumpnz"};
-
-static uint16_t SWARM_BROADCAST_PERIOD = 10;
+const char* const buzzvm_instr_desc[] = {"nop", "done", "pushnil", "dup", "pop", "ret0", "ret1", "add", "sub", "mul", "div", "mod", "pow", "unm", "land", "lor", "lnot", "band", "bor", "bnot", "lshift", "rshift", "eq", "neq", "gt", "gte", "lt", "lte", "gload", "gstore", "pusht", "tput", "tget", "callc", "calls", "pushf", "pushi", "pushs", "pushcn", "pushcc", "pushl", "lload", "lstore", "lremove", "jump", "jumpz", "jumpnz"};
 
 /****************************************/
 /****************************************/
@@ -201,6 +201,7 @@ const char* buzzvm_strerror(buzzvm_t vm) {
 #define BUZZVM_LSYMTS_INIT_CAPACITY  20
 #define BUZZVM_SYMS_INIT_CAPACITY    20
 #define BUZZVM_STRINGS_INIT_CAPACITY 20
+#define BUZZVM_FRAMES_POOL_MAX       16
 
 /****************************************/
 /****************************************/
@@ -217,6 +218,8 @@ void buzzvm_lsyms_destroy(uint32_t pos,
                           void* data,
                           void* params) {
    buzzvm_lsyms_t s = *(buzzvm_lsyms_t*)data;
+   /* NULL for a table moved to the pool */
+   if(!s) return;
    buzzdarray_destroy(&(s->syms));
    free(s);
 }
@@ -224,12 +227,95 @@ void buzzvm_lsyms_destroy(uint32_t pos,
 /****************************************/
 /****************************************/
 
+/*
+ * Removes the last element of a list of stacks or local symbol
+ * tables and returns it, without destroying it.
+ */
+static void* buzzvm_detach_last(buzzdarray_t da) {
+   void* x = (void*)buzzdarray_last(da, void*);
+   void* null = NULL;
+   buzzdarray_set(da, buzzdarray_size(da) - 1, &null);
+   buzzdarray_pop(da);
+   return x;
+}
+
+/*
+ * Returns a local symbol table for a call, initialized with the
+ * activation record of the closure.
+ * The table is taken from the pool when possible.
+ */
+static buzzvm_lsyms_t buzzvm_lsyms_get(buzzvm_t vm,
+                                       uint8_t isswarm,
+                                       buzzdarray_t actrec) {
+   if(buzzdarray_isempty(vm->freelsyms))
+      return buzzvm_lsyms_new(isswarm, buzzdarray_clone(actrec));
+   buzzvm_lsyms_t s = (buzzvm_lsyms_t)buzzvm_detach_last(vm->freelsyms);
+   s->isswarm = isswarm;
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(actrec); ++i)
+      buzzdarray_push(s->syms, &buzzdarray_get(actrec, i, buzzobj_t));
+   return s;
+}
+
+/*
+ * Removes the local symbol table of the returning call,
+ * keeping it in the pool when there is room.
+ */
+static void buzzvm_lsyms_release(buzzvm_t vm) {
+   if(buzzdarray_size(vm->freelsyms) >= BUZZVM_FRAMES_POOL_MAX) {
+      buzzdarray_pop(vm->lsymts);
+      return;
+   }
+   buzzvm_lsyms_t s = (buzzvm_lsyms_t)buzzvm_detach_last(vm->lsymts);
+   buzzdarray_clear(s->syms, buzzdarray_capacity(s->syms));
+   buzzdarray_push(vm->freelsyms, &s);
+}
+
+/*
+ * Returns an empty stack for a call.
+ * The stack is taken from the pool when possible.
+ */
+static buzzdarray_t buzzvm_stack_get(buzzvm_t vm) {
+   if(buzzdarray_isempty(vm->freestacks))
+      return buzzdarray_new(1, sizeof(buzzobj_t), NULL);
+   return (buzzdarray_t)buzzvm_detach_last(vm->freestacks);
+}
+
+/*
+ * Removes the stack of the returning call,
+ * keeping it in the pool when there is room.
+ */
+static void buzzvm_stack_release(buzzvm_t vm) {
+   if(buzzdarray_size(vm->freestacks) >= BUZZVM_FRAMES_POOL_MAX) {
+      buzzdarray_pop(vm->stacks);
+      return;
+   }
+   buzzdarray_t s = (buzzdarray_t)buzzvm_detach_last(vm->stacks);
+   buzzdarray_clear(s, buzzdarray_capacity(s));
+   buzzdarray_push(vm->freestacks, &s);
+}
+
+/****************************************/
+/****************************************/
+
 void buzzvm_vstig_destroy(const void* key, void* data, void* params) {
    free((void*)key);
    buzzvstig_destroy((buzzvstig_t*)data);
    free(data);
 }
 
+void buzzvm_vstiglog_destroy(const void* key, void* data, void* params) {
+   free((void*)key);
+   free(*(char**)data);
+   free(data);
+}
+
+void buzzvm_crdt_destroy(const void* key, void* data, void* params) {
+   free((void*)key);
+   buzzcrdt_destroy((buzzcrdt_t*)data);
+   free(data);
+}
+
 /****************************************/
 /****************************************/
 
@@ -237,7 +323,81 @@ void buzzvm_outmsg_destroy(uint32_t pos, void* data, void* param) {
    fprintf(stderr, "[TODO] %s:%d\n", __FILE__, __LINE__);
 }
 
+/*
+ * Applies an entry received in a PUT message.
+ */
+static void buzzvm_vstig_put(buzzvm_t vm,
+                             uint16_t id,
+                             buzzvstig_t vs,
+                             buzzobj_t k,
+                             buzzvstig_elem_t v,
+                             int wide,
+                             int batch) {
+   /* In anti-entropy mode, updates are not relayed; in a spatial
+    * stigmergy, only the cells within range are relayed */
+   int flood = (vs->mode == BUZZVSTIG_MODE_FLOOD) && buzzvstig_inrange(vs, k);
+   /* Fetch local vstig element */
+   const buzzvstig_elem_t* l = buzzvstig_fetch(vs, &k);
+   /* Restore the high bits of a 16-bit timestamp */
+   if(l && !wide) v->timestamp = buzzvstig_ts_extend((*l)->timestamp, v->timestamp);
+   buzzvstig_clock_update(vm, v->timestamp);
+   if(!l && buzzvstig_isexpired(vs, k, v->timestamp)) {
+      /* The element expired here, do not bring it back */
+      free(v);
+      return;
+   }
+   if((!l)                                              || /* Element not found */
+      buzzvstig_ts_newer(v->timestamp, (*l)->timestamp)) { /* Local element is older */
+      /* Local element must be updated */
+      /* Store element */
+      buzzvstig_store(vs, &k, &v);
+      if(!flood) return;
+      if(batch) buzzoutmsg_queue_append_vstig_batch(vm, id, k, v);
+      else buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, v);
+   }
+   else if(((*l)->timestamp == v->timestamp) && /* Same timestamp */
+           ((*l)->robot != v->robot)) {         /* Different robot */
+      /* Conflict! */
+      /* Call conflict manager */
+      buzzvstig_elem_t c =
+         buzzvstig_onconflict_call(vm, vs, k, *l, v);
+      if(!c) {
+         fprintf(stderr, "[WARNING] [ROBOT %u] Error resolving PUT conflict\n", vm->robot);
+         return;
+      }
+      /* Get rid of useless vstig element */
+      free(v);
+      /* Did this robot lose the conflict? */
+      if((c->robot != vm->robot) &&
+         ((*l)->robot == vm->robot)) {
+         /* Yes */
+         /* Save current local entry */
+         buzzvstig_elem_t ol = buzzvstig_elem_clone(vm, *l);
+         /* Store winning value */
+         buzzvstig_store(vs, &k, &c);
+         /* Call conflict lost manager */
+         buzzvstig_onconflictlost_call(vm, vs, k, ol);
+      }
+      else {
+         /* This robot did not lose the conflict */
+         /* Just propagate the PUT message */
+         buzzvstig_store(vs, &k, &c);
+      }
+      if(flood) buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, c);
+   }
+   else {
+      /* Remote element is older, ignore it */
+      /* Get rid of useless vstig element */
+      free(v);
+   }
+}
+
+/****************************************/
+/****************************************/
+
 void buzzvm_process_inmsgs(buzzvm_t vm) {
+   /* Expire the old values of neighbors.latest() */
+   buzzneighbors_latest_update(vm);
    /* Go through the messages */
    while(!buzzinmsg_queue_isempty(vm->inmsgs)) {
       /* Make sure the VM is in the right state */
@@ -246,21 +406,34 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
       uint16_t rid;
       buzzmsg_payload_t msg;
       buzzinmsg_queue_extract(vm, &rid, &msg);
+      /* Decompress the message, if necessary */
+      if(buzzcompress_payload_iscompressed(msg)) {
+         buzzmsg_payload_t d = buzzcompress_payload_decode(msg);
+         buzzmsg_payload_destroy(&msg);
+         if(!d) {
+            fprintf(stderr, "[WARNING] [ROBOT %u] Malformed compressed message received\n", vm->robot);
+            continue;
+         }
+         msg = d;
+      }
       /* Dispatch the message wrt its type in msg->payload[0] */
-      switch(buzzmsg_payload_get(msg, 0)) {
+      switch(buzzmsg_payload_type(msg)) {
          case BUZZMSG_BROADCAST: {
             /* Deserialize the topic */
             buzzobj_t topic;
             int64_t pos = buzzobj_deserialize(&topic, msg, 1, vm);
-            /* Make sure there's a listener to call */
+            /* Make sure there's a listener to call or a table to update */
             const buzzobj_t* l = buzzdict_get(vm->listeners, &topic->s.value.sid, buzzobj_t);
-            if(!l) {
+            if(!l && !buzzdict_exists(vm->neighbors->latest, &topic->s.value.sid)) {
                /* No listener, ignore message */
                break;
             }
             /* Deserialize value */
             buzzobj_t value;
             pos = buzzobj_deserialize(&value, msg, pos, vm);
+            /* Update the table of neighbors.latest() */
+            buzzneighbors_latest_put(vm, topic->s.value.sid, rid, value);
+            if(!l) break;
             /* Make an object for the robot id */
             buzzobj_t rido = buzzheap_newobj(vm, BUZZTYPE_INT);
             rido->i.value = rid;
@@ -273,7 +446,8 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
             buzzvm_pop(vm);
             break;
          }
-         case BUZZMSG_VSTIG_PUT: {
+         case BUZZMSG_VSTIG_PUT:
+         case BUZZMSG_VSTIG_PUTMANY: {
             /* Deserialize the vstig id */
             uint16_t id;
             int64_t pos = buzzmsg_deserialize_u16(&id, msg, 1);
@@ -285,60 +459,23 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
             const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
             if(!vs) break;
             /* Virtual stigmergy found */
-            /* Deserialize key and value from msg */
-            buzzobj_t k;          // key
-            buzzvstig_elem_t v =  // value
-               (buzzvstig_elem_t)malloc(sizeof(struct buzzvstig_elem_s));
-            if(buzzvstig_elem_deserialize(&k, &v, msg, pos, vm) < 0) {
-               fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_VSTIG_PUT message received\n", vm->robot);
-               free(v);
-               break;
-            }
-            /* Deserialization successful */
-            /* Fetch local vstig element */
-            const buzzvstig_elem_t* l = buzzvstig_fetch(*vs, &k);
-            if((!l)                             || /* Element not found */
-               ((*l)->timestamp < v->timestamp)) { /* Local element is older */
-               /* Local element must be updated */
-               /* Store element */
-               buzzvstig_store(*vs, &k, &v);
-               buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, v);
-            }
-            else if(((*l)->timestamp == v->timestamp) && /* Same timestamp */
-                    ((*l)->robot != v->robot)) {         /* Different robot */
-               /* Conflict! */
-               /* Call conflict manager */
-               buzzvstig_elem_t c =
-                  buzzvstig_onconflict_call(vm, *vs, k, *l, v);
-               if(!c) {
-                  fprintf(stderr, "[WARNING] [ROBOT %u] Error resolving PUT conflict\n", vm->robot);
+            /* Go through the entries, more than one if sent by putmany() */
+            int wide = (buzzmsg_payload_get(msg, 0) & BUZZMSG_FLAG_WIDE) != 0;
+            int batch = (buzzmsg_payload_type(msg) == BUZZMSG_VSTIG_PUTMANY);
+            do {
+               /* Deserialize key and value from msg */
+               buzzobj_t k;          // key
+               buzzvstig_elem_t v =  // value
+                  (buzzvstig_elem_t)malloc(sizeof(struct buzzvstig_elem_s));
+               pos = buzzvstig_elem_deserialize(&k, &v, msg, pos, wide, vm);
+               if(pos < 0) {
+                  fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_VSTIG_PUT message received\n", vm->robot);
+                  free(v);
                   break;
                }
-               /* Get rid of useless vstig element */
-               free(v);
-               /* Did this robot lose the conflict? */
-               if((c->robot != vm->robot) &&
-                  ((*l)->robot == vm->robot)) {
-                  /* Yes */
-                  /* Save current local entry */
-                  buzzvstig_elem_t ol = buzzvstig_elem_clone(vm, *l);
-                  /* Store winning value */
-                  buzzvstig_store(*vs, &k, &c);
-                  /* Call conflict lost manager */
-                  buzzvstig_onconflictlost_call(vm, *vs, k, ol);
-               }
-               else {
-                  /* This robot did not lose the conflict */
-                  /* Just propagate the PUT message */
-                  buzzvstig_store(*vs, &k, &c);
-               }
-               buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, c);
-            }
-            else {
-               /* Remote element is older, ignore it */
-               /* Get rid of useless vstig element */
-               free(v);
-            }
+               /* Relay the entries of a batch as a batch */
+               buzzvm_vstig_put(vm, id, *vs, k, v, wide, batch);
+            } while(batch && pos < buzzmsg_payload_size(msg));
             break;
          }
          case BUZZMSG_VSTIG_QUERY: {
@@ -353,7 +490,8 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
             buzzobj_t k;         // key
             buzzvstig_elem_t v = // value
                (buzzvstig_elem_t)malloc(sizeof(struct buzzvstig_elem_s));
-            if(buzzvstig_elem_deserialize(&k, &v, msg, pos, vm) < 0) {
+            int wide = (buzzmsg_payload_get(msg, 0) & BUZZMSG_FLAG_WIDE) != 0;
+            if(buzzvstig_elem_deserialize(&k, &v, msg, pos, wide, vm) < 0) {
                fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_VSTIG_QUERY message received (2)\n", vm->robot);
                free(v);
                break;
@@ -367,30 +505,40 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
                break;
             }
             /* Virtual stigmergy found */
+            /* In anti-entropy mode, queries and updates are not relayed; in a
+             * spatial stigmergy, only the cells within range are relayed */
+            int flood = ((*vs)->mode == BUZZVSTIG_MODE_FLOOD) && buzzvstig_inrange(*vs, k);
             /* Fetch local vstig element */
             const buzzvstig_elem_t* l = buzzvstig_fetch(*vs, &k);
             if(!l) {
                /* Element not found */
                if(v->data->o.type == BUZZTYPE_NIL) {
                   /* This robot knows nothing about the query, just propagate it */
-                  buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_QUERY, id, k, v);
+                  if(flood) buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_QUERY, id, k, v);
+                  free(v);
+               }
+               else if(buzzvstig_isexpired(*vs, k, v->timestamp)) {
+                  /* The element expired here, do not flood it again */
                   free(v);
                }
                else {
                   /* Store element and propagate PUT message */
                   buzzvstig_store(*vs, &k, &v);
-                  buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, v);
+                  if(flood) buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, v);
                }
                break;
             }
             /* Element found */
-            if((*l)->timestamp < v->timestamp) {
+            /* Restore the high bits of a 16-bit timestamp */
+            if(!wide) v->timestamp = buzzvstig_ts_extend((*l)->timestamp, v->timestamp);
+            buzzvstig_clock_update(vm, v->timestamp);
+            if(buzzvstig_ts_newer(v->timestamp, (*l)->timestamp)) {
                /* Local element is older */
                /* Store element */
                buzzvstig_store(*vs, &k, &v);
-               buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, v);
+               if(flood) buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, v);
             }
-            else if((*l)->timestamp > v->timestamp) {
+            else if(buzzvstig_ts_newer((*l)->timestamp, v->timestamp)) {
                /* Local element is newer */
                /* Append a PUT message to the out message queue */
                buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, *l);
@@ -421,7 +569,7 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
                   /* Just propagate the PUT message */
                   buzzvstig_store(*vs, &k, &c);
                }
-               buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, c);
+               if(flood) buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, c);
             }
             else {
                /* Remote element is same as local, ignore it */
@@ -430,6 +578,107 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
             }
             break;
          }
+         case BUZZMSG_VSTIG_DIGEST: {
+            /* Deserialize the vstig id and the number of buckets */
+            uint16_t id, nbuckets;
+            int64_t pos = buzzmsg_deserialize_u16(&id, msg, 1);
+            if(pos >= 0) pos = buzzmsg_deserialize_u16(&nbuckets, msg, pos);
+            if(pos < 0 ||
+               nbuckets == 0 ||
+               nbuckets > BUZZVSTIG_DIGEST_MAXBUCKETS ||
+               (nbuckets & (nbuckets - 1)) != 0) {
+               fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_VSTIG_DIGEST message received\n", vm->robot);
+               break;
+            }
+            /* Look for virtual stigmergy */
+            const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+            if(!vs || (*vs)->mode != BUZZVSTIG_MODE_ANTIENTROPY) break;
+            /* Deserialize the buckets */
+            uint32_t buckets[BUZZVSTIG_DIGEST_MAXBUCKETS];
+            uint16_t i;
+            for(i = 0; i < nbuckets && pos >= 0; ++i)
+               pos = buzzmsg_deserialize_u32(buckets + i, msg, pos);
+            if(pos < 0) {
+               fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_VSTIG_DIGEST message received\n", vm->robot);
+               break;
+            }
+            if(nbuckets < buzzvstig_digest_size(*vs)) {
+               /* The digest is too coarse to compare entries, send a finer one */
+               (*vs)->digesttimer = 1;
+            }
+            else {
+               /* Describe the buckets that differ */
+               buzzvstig_digest_compare(vm, id, *vs, buckets, nbuckets);
+            }
+            break;
+         }
+         case BUZZMSG_VSTIG_BUCKET: {
+            /* Deserialize the vstig id, the bucket and the number of entries */
+            uint16_t id, nbuckets, bucket, count;
+            int64_t pos = buzzmsg_deserialize_u16(&id, msg, 1);
+            if(pos >= 0) pos = buzzmsg_deserialize_u16(&nbuckets, msg, pos);
+            if(pos >= 0) pos = buzzmsg_deserialize_u16(&bucket, msg, pos);
+            if(pos >= 0) pos = buzzmsg_deserialize_u16(&count, msg, pos);
+            if(pos < 0 ||
+               nbuckets == 0 ||
+               (nbuckets & (nbuckets - 1)) != 0 ||
+               nbuckets > BUZZVSTIG_DIGEST_MAXBUCKETS ||
+               bucket >= nbuckets) {
+               fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_VSTIG_BUCKET message received\n", vm->robot);
+               break;
+            }
+            /* Look for virtual stigmergy */
+            const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+            if(!vs || (*vs)->mode != BUZZVSTIG_MODE_ANTIENTROPY) break;
+            /* Deserialize the (key, timestamp, robot) entries */
+            int wide = (buzzmsg_payload_get(msg, 0) & BUZZMSG_FLAG_WIDE) != 0;
+            uint32_t* entries = (uint32_t*)malloc(BUZZVSTIG_DIGEST_ENTRY_SIZE * count * sizeof(uint32_t));
+            uint32_t i;
+            for(i = 0; i < count && pos >= 0; ++i) {
+               uint32_t* e = entries + BUZZVSTIG_DIGEST_ENTRY_SIZE * i;
+               uint16_t ts, robot;
+               pos = buzzmsg_deserialize_u32(e, msg, pos);
+               if(wide) {
+                  if(pos >= 0) pos = buzzmsg_deserialize_u32(e + 1, msg, pos);
+                  if(pos >= 0) pos = buzzmsg_deserialize_u32(e + 2, msg, pos);
+               }
+               else if(pos >= 0) {
+                  pos = buzzmsg_deserialize_u16(&ts, msg, pos);
+                  e[1] = 0;
+                  e[2] = ts;
+               }
+               if(pos >= 0) pos = buzzmsg_deserialize_u16(&robot, msg, pos);
+               e[3] = robot;
+            }
+            if(pos < 0) {
+               fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_VSTIG_BUCKET message received\n", vm->robot);
+               free(entries);
+               break;
+            }
+            /* Send the entries the neighbor is missing */
+            buzzvstig_digest_repair(vm, id, *vs, nbuckets, bucket, entries, count);
+            free(entries);
+            break;
+         }
+         case BUZZMSG_CRDT_DELTA: {
+            /* Deserialize the id and the type of the shared structure */
+            uint16_t id;
+            uint8_t type;
+            int64_t pos = buzzmsg_deserialize_u16(&id, msg, 1);
+            if(pos >= 0) pos = buzzmsg_deserialize_u8(&type, msg, pos);
+            if(pos < 0) {
+               fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_CRDT_DELTA message received\n", vm->robot);
+               break;
+            }
+            /* Look for the shared structure */
+            const buzzcrdt_t* c = buzzdict_get(vm->crdts, &id, buzzcrdt_t);
+            if(!c || (*c)->type != type) break;
+            /* Merge the changes */
+            int wide = (buzzmsg_payload_get(msg, 0) & BUZZMSG_FLAG_WIDE) != 0;
+            if(buzzcrdt_merge(vm, *c, msg, pos, wide) < 0)
+               fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_CRDT_DELTA message received\n", vm->robot);
+            break;
+         }
          case BUZZMSG_SWARM_LIST: {
             /* Deserialize number of swarm ids */
             uint16_t nsids;
@@ -477,6 +726,48 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
             buzzswarm_members_leave(vm->swarmmembers, rid, sid);
             break;
          }
+         case BUZZMSG_ROUTE_DATA: {
+            /* Deliver the message or send it to the next hop */
+            if(buzzroute_data_receive(vm, msg) < 0)
+               fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_ROUTE_DATA message received\n", vm->robot);
+            break;
+         }
+         case BUZZMSG_ROUTE_VECTOR: {
+            /* Update the distance-vector table */
+            if(buzzroute_vector_receive(vm, rid, msg) < 0)
+               fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_ROUTE_VECTOR message received\n", vm->robot);
+            break;
+         }
+         case BUZZMSG_AGGREGATE: {
+            /* Merge the state of the neighbor */
+            if(buzzaggregate_receive(vm, rid, msg) < 0)
+               fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_AGGREGATE message received\n", vm->robot);
+            break;
+         }
+         case BUZZMSG_SWARM_DIGEST: {
+            /* Deserialize the digest and the number of requests */
+            uint32_t hash;
+            uint16_t n;
+            int64_t pos = buzzmsg_deserialize_u32(&hash, msg, 1);
+            if(pos >= 0) pos = buzzmsg_deserialize_u16(&n, msg, pos);
+            if(pos < 0) {
+               fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_SWARM_DIGEST message received\n", vm->robot);
+               break;
+            }
+            /* Compare the digest with the local information */
+            buzzswarm_members_heartbeat(vm->swarmmembers, rid, hash);
+            /* Is the list of this robot requested? */
+            uint16_t i, r;
+            for(i = 0; i < n; ++i) {
+               pos = buzzmsg_deserialize_u16(&r, msg, pos);
+               if(pos < 0) {
+                  fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_SWARM_DIGEST message received\n", vm->robot);
+                  break;
+               }
+               if(r == vm->robot) vm->swarmmembers->arrived = 1;
+            }
+            break;
+         }
       }
       /* Get rid of the message */
       buzzmsg_payload_destroy(&msg);
@@ -488,18 +779,46 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
 /****************************************/
 /****************************************/
 
-void buzzvm_process_outmsgs(buzzvm_t vm) {
-   /* Must broadcast swarm list message? */
-   if(vm->swarmbroadcast > 0)
-      --vm->swarmbroadcast;
-   if(vm->swarmbroadcast == 0 &&
-      !buzzdict_isempty(vm->swarms)) {
-      vm->swarmbroadcast = SWARM_BROADCAST_PERIOD;
-      buzzoutmsg_queue_append_swarm_list(vm,
-                                         vm->swarms);
+void buzzvm_vstig_update(const void* key, void* data, void* params) {
+   buzzvstig_t vs = *(buzzvstig_t*)data;
+   buzzvm_t vm = (buzzvm_t)params;
+   /* Remove the expired entries first, so they are not in the digest */
+   buzzvstig_expire(vm, *(uint16_t*)key, vs);
+   /* Compact and sync the log */
+   buzzvstiglog_update(vs);
+   if(vs->mode != BUZZVSTIG_MODE_ANTIENTROPY) return;
+   /* Must broadcast the digest? */
+   if(vs->digesttimer > 0)
+      --vs->digesttimer;
+   if(vs->digesttimer == 0) {
+      vs->digesttimer = BUZZVSTIG_DIGEST_PERIOD;
+      uint32_t buckets[BUZZVSTIG_DIGEST_MAXBUCKETS];
+      uint16_t nbuckets = buzzvstig_digest_size(vs);
+      buzzvstig_digest(vs, buckets, nbuckets);
+      buzzoutmsg_queue_append_vstig_digest(vm,
+                                           *(uint16_t*)key,
+                                           buckets,
+                                           nbuckets);
    }
 }
 
+void buzzvm_crdt_update(const void* key, void* data, void* params) {
+   buzzcrdt_flush((buzzvm_t)params, *(uint16_t*)key, *(buzzcrdt_t*)data);
+}
+
+void buzzvm_process_outmsgs(buzzvm_t vm) {
+   /* Send the swarm list, digest and requests that are due */
+   buzzswarm_members_gossip(vm);
+   /* Advertise the routes that changed */
+   buzzroute_gossip(vm);
+   /* Expire the virtual stigmergy entries and broadcast the digests */
+   buzzdict_foreach(vm->vstigs, buzzvm_vstig_update, vm);
+   /* Send the changes to the shared structures */
+   buzzdict_foreach(vm->crdts, buzzvm_crdt_update, vm);
+   /* Send the aggregates the bandwidth budget allows */
+   buzzaggregate_update(vm);
+}
+
 /****************************************/
 /****************************************/
 
@@ -507,7 +826,8 @@ void buzzvm_darray_destroy(uint32_t pos,
                            void* data,
                            void* params) {
    buzzdarray_t* s = (buzzdarray_t*)data;
-   buzzdarray_destroy(s);
+   /* NULL for a stack moved to the pool */
+   if(*s) buzzdarray_destroy(s);
 }
 
 buzzvm_t buzzvm_new(uint16_t robot) {
@@ -526,6 +846,13 @@ buzzvm_t buzzvm_new(uint16_t robot) {
                                sizeof(buzzvm_lsyms_t),
                                buzzvm_lsyms_destroy);
    vm->lsyms = NULL;
+   /* Create the pools of stacks and local variable tables */
+   vm->freestacks = buzzdarray_new(BUZZVM_FRAMES_POOL_MAX,
+                                   sizeof(buzzdarray_t),
+                                   buzzvm_darray_destroy);
+   vm->freelsyms = buzzdarray_new(BUZZVM_FRAMES_POOL_MAX,
+                                  sizeof(buzzvm_lsyms_t),
+                                  buzzvm_lsyms_destroy);
    /* Create global variable tables */
    vm->gsyms = buzzdict_new(BUZZVM_SYMS_INIT_CAPACITY,
                             sizeof(int32_t),
@@ -539,20 +866,18 @@ buzzvm_t buzzvm_new(uint16_t robot) {
    vm->heap = buzzheap_new();
    /* Create function list */
    vm->flist = buzzdarray_new(20, sizeof(buzzvm_funp), NULL);
-   /* Create swarm list */
-   vm->swarms = buzzdict_new(10,
-                             sizeof(uint16_t),
-                             sizeof(uint8_t),
-                             buzzdict_uint16keyhash,
-                             buzzdict_uint16keycmp,
-                             NULL);
    /* Create swarm stack */
    vm->swarmstack = buzzdarray_new(10,
                                    sizeof(uint16_t),
                                    NULL);
    /* Create swarm member structure */
    vm->swarmmembers = buzzswarm_members_new();
-   vm->swarmbroadcast = SWARM_BROADCAST_PERIOD;
+   /* Create neighbor data */
+   vm->neighbors = buzzneighbors_data_new();
+   /* Create distance-vector table */
+   vm->route = buzzroute_new();
+   /* Create aggregates */
+   vm->aggregates = buzzaggregates_new();
    /* Create message queues */
    vm->inmsgs = buzzinmsg_queue_new();
    vm->outmsgs = buzzoutmsg_queue_new();
@@ -563,6 +888,20 @@ buzzvm_t buzzvm_new(uint16_t robot) {
                              buzzdict_uint16keyhash,
                              buzzdict_uint16keycmp,
                              buzzvm_vstig_destroy);
+   /* Create the paths of the virtual stigmergy logs */
+   vm->vstiglogs = buzzdict_new(10,
+                                sizeof(uint16_t),
+                                sizeof(char*),
+                                buzzdict_uint16keyhash,
+                                buzzdict_uint16keycmp,
+                                buzzvm_vstiglog_destroy);
+   /* Create shared structures */
+   vm->crdts = buzzdict_new(10,
+                            sizeof(uint16_t),
+                            sizeof(buzzcrdt_t),
+                            buzzdict_uint16keyhash,
+                            buzzdict_uint16keycmp,
+                            buzzvm_crdt_destroy);
    /* Create virtual stigmergy */
    vm->listeners = buzzdict_new(10,
                                 sizeof(uint16_t),
@@ -593,21 +932,31 @@ void buzzvm_destroy(buzzvm_t* vm) {
    buzzdarray_destroy(&(*vm)->lsymts);
    /* Get rid of the stack */
    buzzdarray_destroy(&(*vm)->stacks);
+   /* Get rid of the pools of stacks and local variable tables */
+   buzzdarray_destroy(&(*vm)->freestacks);
+   buzzdarray_destroy(&(*vm)->freelsyms);
    /* Get rid of the heap */
    buzzheap_destroy(&(*vm)->heap);
    /* Get rid of the function list */
    buzzdarray_destroy(&(*vm)->flist);
    /* Get rid of the swarm list */
-   buzzdict_destroy(&(*vm)->swarms);
    buzzdarray_destroy(&(*vm)->swarmstack);
    buzzswarm_members_destroy(&((*vm)->swarmmembers));
+   buzzneighbors_data_destroy(&((*vm)->neighbors));
+   buzzroute_destroy(&((*vm)->route));
+   buzzaggregates_destroy(&((*vm)->aggregates));
    /* Get rid of the message queues */
    buzzinmsg_queue_destroy(&(*vm)->inmsgs);
    buzzoutmsg_queue_destroy(&(*vm)->outmsgs);
    /* Get rid of the virtual stigmergy structures */
    buzzdict_destroy(&(*vm)->vstigs);
+   buzzdict_destroy(&(*vm)->vstiglogs);
+   /* Get rid of the shared structures */
+   buzzdict_destroy(&(*vm)->crdts);
    /* Get rid of neighbor value listeners */
    buzzdict_destroy(&(*vm)->listeners);
+   /* Get rid of the code of the loaded modules */
+   free((*vm)->mcode);
    free(*vm);
    *vm = 0;
 }
@@ -669,6 +1018,9 @@ int buzzvm_set_bcode(buzzvm_t vm,
    /* Initialize VM state */
    vm->state = BUZZVM_STATE_READY;
    vm->error = BUZZVM_ERROR_NONE;
+   /* Forget the loaded modules */
+   free(vm->mcode);
+   vm->mcode = NULL;
    /* Initialize bytecode data */
    vm->bcode_size = bcode_size;
    vm->bcode = bcode;
@@ -692,8 +1044,13 @@ int buzzvm_set_bcode(buzzvm_t vm,
    buzzobj_register(vm);
    /* Register stigmergy methods */
    buzzvstig_register(vm);
+   buzzcrdt_register(vm);
    /* Register swarm methods */
    buzzswarm_register(vm);
+   /* Register gradient and routing methods */
+   buzzroute_register(vm);
+   /* Register aggregation methods */
+   buzzaggregate_register(vm);
    /* Register math methods */
    buzzmath_register(vm);
    /* Register io methods */
@@ -707,6 +1064,116 @@ int buzzvm_set_bcode(buzzvm_t vm,
 /****************************************/
 /****************************************/
 
+/*
+ * Returns 1 if the argument of an instruction is a code offset
+ */
+static int buzzvm_instr_iscodearg(uint8_t instr) {
+   return
+      instr == BUZZVM_INSTR_PUSHCN ||
+      instr == BUZZVM_INSTR_PUSHL  ||
+      instr == BUZZVM_INSTR_JUMP   ||
+      instr == BUZZVM_INSTR_JUMPZ  ||
+      instr == BUZZVM_INSTR_JUMPNZ;
+}
+
+int buzzvm_load_module(buzzvm_t vm,
+                       const uint8_t* bcode,
+                       uint32_t bcode_size) {
+   if(vm->state == BUZZVM_STATE_NOCODE) return 1;
+   if(vm->state == BUZZVM_STATE_ERROR) return 2;
+   /* Skip the strings */
+   if(bcode_size < sizeof(uint16_t)) return 1;
+   uint16_t count, c;
+   memcpy(&count, bcode, sizeof(uint16_t));
+   uint32_t start = sizeof(uint16_t);
+   for(c = 0; c < count; ++c) {
+      while(start < bcode_size && bcode[start] != 0) ++start;
+      if(start >= bcode_size) return 1;
+      ++start;
+   }
+   /*
+    * Check the code before touching the VM: the instructions must be
+    * known, the string ids and code offsets in range, and the function
+    * definitions must end with a 'nop'
+    */
+   uint32_t i = start;
+   int32_t arg;
+   int nop = 0;
+   while(i < bcode_size) {
+      if(bcode[i] >= BUZZVM_INSTR_COUNT) return 1;
+      if(bcode[i] == BUZZVM_INSTR_NOP) nop = 1;
+      if(bcode[i] >= BUZZVM_INSTR_PUSHF) {
+         if(bcode_size - i <= sizeof(int32_t)) return 1;
+         memcpy(&arg, bcode + i + 1, sizeof(int32_t));
+         if(bcode[i] == BUZZVM_INSTR_PUSHS && (arg < 0 || arg >= count)) return 1;
+         if(buzzvm_instr_iscodearg(bcode[i]) &&
+            (arg < (int32_t)start || arg >= (int32_t)bcode_size)) return 1;
+         i += sizeof(int32_t);
+      }
+      ++i;
+   }
+   if(!nop) return 1;
+   /* Merge the strings, making a map from module ids to VM ids */
+   uint16_t* sids = (uint16_t*)malloc(count * sizeof(uint16_t) + 1);
+   for(c = 0, i = sizeof(uint16_t); c < count; ++c) {
+      sids[c] = buzzvm_string_register(vm, (char*)(bcode + i), 1);
+      while(bcode[i] != 0) ++i;
+      ++i;
+   }
+   /* Append the code to the code space */
+   uint32_t base = vm->bcode_size;
+   uint32_t size = base + bcode_size - start;
+   uint8_t* code;
+   if(vm->mcode) {
+      code = (uint8_t*)realloc(vm->mcode, size);
+   }
+   else {
+      code = (uint8_t*)malloc(size);
+      memcpy(code, vm->bcode, base);
+   }
+   memcpy(code + base, bcode + start, bcode_size - start);
+   /* Relocate the string ids and the code offsets */
+   for(i = base; i < size; ++i) {
+      if(code[i] >= BUZZVM_INSTR_PUSHF) {
+         memcpy(&arg, code + i + 1, sizeof(int32_t));
+         if(code[i] == BUZZVM_INSTR_PUSHS)
+            arg = sids[arg];
+         else if(buzzvm_instr_iscodearg(code[i]))
+            arg = arg - start + base;
+         memcpy(code + i + 1, &arg, sizeof(int32_t));
+         i += sizeof(int32_t);
+      }
+   }
+   free(sids);
+   vm->mcode = code;
+   vm->bcode = code;
+   vm->bcode_size = size;
+   /* Save where the VM was */
+   int32_t pc = vm->pc;
+   int32_t oldpc = vm->oldpc;
+   buzzvm_state state = vm->state;
+   vm->state = BUZZVM_STATE_READY;
+   vm->pc = base;
+   /*
+    * Bind the functions to their names
+    * Stop when you find a 'nop'
+    */
+   while(vm->bcode[vm->pc] != BUZZVM_INSTR_NOP)
+      if(buzzvm_step(vm) != BUZZVM_STATE_READY) return 2;
+   buzzvm_step(vm);
+   /* Run the top-level code of the module */
+   while(buzzvm_step(vm) == BUZZVM_STATE_READY);
+   if(vm->state != BUZZVM_STATE_DONE) return 2;
+   /* Go back to where the VM was */
+   vm->pc = pc;
+   vm->oldpc = oldpc;
+   vm->state = state;
+   return 0;
+}
+
+/****************************************/
+/****************************************/
+
 #define assert_pc(IDX) if((IDX) < 0 || (IDX) >= vm->bcode_size) { buzzvm_seterror(vm, BUZZVM_ERROR_PC, NULL); return vm->state; }
 
 #define inc_pc() vm->oldpc = vm->pc; ++vm->pc; assert_pc(vm->pc);
@@ -1005,8 +1472,10 @@ buzzvm_state buzzvm_execute_script(buzzvm_t vm) {
 
 buzzvm_state buzzvm_closure_call(buzzvm_t vm,
                                  uint32_t argc) {
-   /* Insert the self table right before the closure */
-   buzzobj_t o = buzzheap_newobj(vm, BUZZTYPE_NIL);
+   /* Insert a placeholder for the self table right before the closure.
+    * buzzvm_call() discards it, so the closure itself does the job
+    * without allocating a new object at every call. */
+   buzzobj_t o = buzzvm_stack_at(vm, argc + 1);
    buzzdarray_insert(vm->stack,
                      buzzdarray_size(vm->stack) - argc - 1,
                      &o);
@@ -1015,10 +1484,12 @@ buzzvm_state buzzvm_closure_call(buzzvm_t vm,
    /* Save the current stack depth */
    uint32_t stacks = buzzdarray_size(vm->stacks);
    /* Call the closure and keep stepping until
-    * the stack count is back to the saved value */
-   buzzvm_callc(vm);
-   do if(buzzvm_step(vm) != BUZZVM_STATE_READY) return vm->state;
-   while(stacks < buzzdarray_size(vm->stacks));
+    * the stack count is back to the saved value.
+    * A C closure has already returned at this point: stepping
+    * would execute the instruction after the current call. */
+   if(buzzvm_callc(vm) != BUZZVM_STATE_READY) return vm->state;
+   while(stacks < buzzdarray_size(vm->stacks))
+      if(buzzvm_step(vm) != BUZZVM_STATE_READY) return vm->state;
    return vm->state;
 }
 
@@ -1107,9 +1578,7 @@ buzzvm_state buzzvm_call(buzzvm_t vm, int isswrm) {
       return vm->state;
    }
    /* Create a new local symbol list copying the parent's */
-   vm->lsyms =
-      buzzvm_lsyms_new(isswrm,
-                       buzzdarray_clone(c->c.value.actrec));
+   vm->lsyms = buzzvm_lsyms_get(vm, isswrm, c->c.value.actrec);
    buzzdarray_push(vm->lsymts, &(vm->lsyms));
    /* Add function arguments to the local symbols */
    int32_t i;
@@ -1126,7 +1595,7 @@ buzzvm_state buzzvm_call(buzzvm_t vm, int isswrm) {
    /* Push return address */
    buzzvm_pushi((vm), vm->pc);
    /* Make a new stack for the function */
-   vm->stack = buzzdarray_new(1, sizeof(buzzobj_t), NULL);
+   vm->stack = buzzvm_stack_get(vm);
    buzzdarray_push(vm->stacks, &(vm->stack));
    /* Jump to/execute the function */
    if(c->c.value.isnative) {
@@ -1367,13 +1836,13 @@ buzzvm_state buzzvm_ret0(buzzvm_t vm) {
    if(vm->lsyms->isswarm)
       buzzdarray_pop(vm->swarmstack);
    /* Pop local symbol table */
-   buzzdarray_pop(vm->lsymts);
+   buzzvm_lsyms_release(vm);
    /* Set local symbol table pointer */
    vm->lsyms = !buzzdarray_isempty(vm->lsymts) ?
       buzzdarray_last(vm->lsymts, buzzvm_lsyms_t) :
       NULL;
    /* Pop stack */
-   buzzdarray_pop(vm->stacks);
+   buzzvm_stack_release(vm);
    /* Set stack pointer */
    vm->stack = buzzdarray_last(vm->stacks, buzzdarray_t);
    /* Make sure the stack contains at least one element */
@@ -1397,7 +1866,7 @@ buzzvm_state buzzvm_ret1(buzzvm_t vm) {
    if(vm->lsyms->isswarm)
       buzzdarray_pop(vm->swarmstack);
    /* Pop local symbol table */
-   buzzdarray_pop(vm->lsymts);
+   buzzvm_lsyms_release(vm);
    /* Set local symbol table pointer */
    vm->lsyms = !buzzdarray_isempty(vm->lsymts) ?
       buzzdarray_last(vm->lsymts, buzzvm_lsyms_t) :
@@ -1407,7 +1876,7 @@ buzzvm_state buzzvm_ret1(buzzvm_t vm) {
    /* Save it, it's the return value to pass to the lower stack */
    buzzobj_t ret = buzzvm_stack_at(vm, 1);
    /* Pop stack */
-   buzzdarray_pop(vm->stacks);
+   buzzvm_stack_release(vm);
    /* Set stack pointer */
    vm->stack = buzzdarray_last(vm->stacks, buzzdarray_t);
    /* Make sure the stack contains at least one element */
@@ -6,8 +6,11 @@
 #include <buzz/buzzinmsg.h>
 #include <buzz/buzzoutmsg.h>
 #include <buzz/buzzvstig.h>
+#include <buzz/buzzcrdt.h>
 #include <buzz/buzzswarm.h>
 #include <buzz/buzzneighbors.h>
+#include <buzz/buzzroute.h>
+#include <buzz/buzzaggregate.h>
 
 #include <stdlib.h>
 #include <math.h>
@@ -30,7 +33,7 @@ extern "C" {
       BUZZVM_STATE_ERROR,      // Error occurred
       BUZZVM_STATE_STOPPED     // Stopped due to a breakpoint
    } buzzvm_state;
-   extern const char *buzzvm_state_desc[];
+   extern const char* const buzzvm_state_desc[];
 
    /*
     * VM error codes
@@ -46,7 +49,7 @@ extern "C" {
       BUZZVM_ERROR_STRING,   // Unknown string id
       BUZZVM_ERROR_SWARM     // Unknown swarm id
    } buzzvm_error;
-   extern const char *buzzvm_error_desc[];
+   extern const char* const buzzvm_error_desc[];
 
    /*
     * VM instructions
@@ -109,7 +112,7 @@ extern "C" {
       BUZZVM_INSTR_JUMPNZ,   // Set PC to argument if stack top is not zero, pop operand
       BUZZVM_INSTR_COUNT     // Used to count how many instructions have been defined
    } buzzvm_instr;
-   extern const char *buzzvm_instr_desc[];
+   extern const char* const buzzvm_instr_desc[];
 
    /*
     * Function pointer for BUZZVM_INSTR_CALL.
@@ -141,12 +144,21 @@ extern "C" {
 
    /*
     * VM data
+    *
+    * Thread safety: a VM owns all of its state, and libbuzz keeps no
+    * mutable globals (the only statics are constants and the *_desc
+    * tables, which are read-only). Different VMs can therefore be used
+    * from different threads at the same time, as long as each VM is used
+    * by one thread at a time. Objects taken from a VM (buzzobj_t, message
+    * payloads, etc.) belong to that VM and must not be passed to another.
     */
    struct buzzvm_s {
       /* Bytecode content */
       const uint8_t* bcode;
       /* Size of the loaded bytecode */
       uint32_t bcode_size;
+      /* Code space owned by the VM once modules are loaded, NULL before */
+      uint8_t* mcode;
       /* Program counter */
       int32_t pc;
       /* Old program counter (for error reporting) */
@@ -159,6 +171,10 @@ extern "C" {
       buzzvm_lsyms_t lsyms;
       /* Local variable table list */
       buzzdarray_t lsymts;
+      /* Stacks of returned calls, kept for reuse */
+      buzzdarray_t freestacks;
+      /* Local variable tables of returned calls, kept for reuse */
+      buzzdarray_t freelsyms;
       /* Global symbols */
       buzzdict_t gsyms;
       /* Strings */
@@ -168,19 +184,29 @@ extern "C" {
       /* Registered functions */
       buzzdarray_t flist;
       /* List of known swarms */
-      buzzdict_t swarms;
-      /* List of known swarms */
       buzzdarray_t swarmstack;
-      /* Swarm members */
+      /* Swarm membership of this robot and of its neighbors */
       buzzswarm_members_t swarmmembers;
-      /* Counter for swarm membership broadcasting */
-      uint16_t swarmbroadcast;
+      /* Neighbor data, set by the host at every step */
+      buzzneighbors_t neighbors;
+      /* Distance-vector table of the gradients and routed messages */
+      buzzroute_t route;
+      /* Swarm-wide aggregates */
+      buzzaggregates_t aggregates;
       /* Input message FIFO */
       buzzinmsg_queue_t inmsgs;
       /* Output message FIFO */
       buzzoutmsg_queue_t outmsgs;
       /* Virtual stigmergy maps */
       buzzdict_t vstigs;
+      /* Hybrid logical clock of the virtual stigmergy, as (time << 16 | counter) */
+      uint64_t vstigclock;
+      /* Physical time in ms, set by the host (0 = logical clock only) */
+      uint64_t vstigtime;
+      /* Paths of the virtual stigmergy logs, as id -> char*, set by the host */
+      buzzdict_t vstiglogs;
+      /* Shared structures (counters, sets, ...), as id -> buzzcrdt_t */
+      buzzdict_t crdts;
       /* Neighbor value listeners */
       buzzdict_t listeners;
       /* Current VM state */
@@ -254,6 +280,35 @@ extern "C" {
                                const uint8_t* bcode,
                                uint32_t bcode_size);
 
+   /*
+    * Loads a module into a VM that is already running a script.
+    * A module is bytecode made by bzzc, typically from a script that
+    * only defines the functions to add or replace. Its code is
+    * appended to the code space of the VM, its strings are merged with
+    * those of the VM, and its functions are bound to their global
+    * names, replacing the previous definitions, before anything else
+    * runs. Then, the top-level code of the module runs to completion,
+    * and the VM goes back to where it was. The heap, the global
+    * variables, the virtual stigmergy, the swarm and the neighbor data
+    * are left as they are. The closures stored elsewhere than in their
+    * global name, such as in tables or listeners, keep the old code.
+    * Call this function between two steps, not from a closure.
+    * The module is copied: the buffer can be deleted on return. The
+    * string table of the module is not copied, so a module offset o
+    * becomes o - s + b in the VM, where s is the size of the string
+    * table of the module and b the code size the VM had before the
+    * call. See buzzdebug_merge_module() to merge the debug data.
+    * @param vm The VM data.
+    * @param bcode The module bytecode.
+    * @param bcode_size The size (in bytes) of the module bytecode.
+    * @return 0 if everything OK, 1 if the module is malformed or the VM
+    *         has no code (the VM is left untouched), 2 if the VM is in
+    *         error or the module code raised one (see vm->state).
+    */
+   extern int buzzvm_load_module(buzzvm_t vm,
+                                 const uint8_t* bcode,
+                                 uint32_t bcode_size);
+
    /*
     * Processes the input message queue.
     * @param vm The VM data.
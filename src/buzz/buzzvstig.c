@@ -3,6 +3,8 @@
 #include "buzzvm.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
 
 /****************************************/
 /****************************************/
@@ -37,6 +39,40 @@ int buzzvstig_register(struct buzzvm_s* vm) {
    buzzvm_pushs(vm, buzzvm_string_register(vm, "create", 1));
    buzzvm_pushcc(vm, buzzvm_function_register(vm, buzzvstig_create));
    buzzvm_tput(vm);
+   /* Add 'spatial' function */
+   buzzvm_dup(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "spatial", 1));
+   buzzvm_pushcc(vm, buzzvm_function_register(vm, buzzvstig_spatial));
+   buzzvm_tput(vm);
+   /* Add the propagation modes */
+   buzzvm_dup(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "FLOOD", 1));
+   buzzvm_pushi(vm, BUZZVSTIG_MODE_FLOOD);
+   buzzvm_tput(vm);
+   buzzvm_dup(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "ANTIENTROPY", 1));
+   buzzvm_pushi(vm, BUZZVSTIG_MODE_ANTIENTROPY);
+   buzzvm_tput(vm);
+   /* Add the eviction policies */
+   buzzvm_dup(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "LRU", 1));
+   buzzvm_pushi(vm, BUZZVSTIG_EVICT_LRU);
+   buzzvm_tput(vm);
+   buzzvm_dup(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "OLDEST", 1));
+   buzzvm_pushi(vm, BUZZVSTIG_EVICT_OLDEST);
+   buzzvm_tput(vm);
+   /* Add the aggregates */
+   static const char* AGGS[BUZZVSTIG_AGG_COUNT_OPS] = {
+      "SUM", "MIN", "MAX", "COUNT", "ARGMIN", "ARGMAX"
+   };
+   int i;
+   for(i = 0; i < BUZZVSTIG_AGG_COUNT_OPS; ++i) {
+      buzzvm_dup(vm);
+      buzzvm_pushs(vm, buzzvm_string_register(vm, AGGS[i], 1));
+      buzzvm_pushi(vm, i);
+      buzzvm_tput(vm);
+   }
    /* Register the 'stigmergy' table */
    buzzvm_gstore(vm);
    return vm->state;
@@ -53,16 +89,28 @@ int buzzvstig_key_cmp(const void* a, const void* b) {
    return buzzobj_cmp(*(buzzobj_t*)a, *(buzzobj_t*)b);
 }
 
+/*
+ * A recently expired or evicted entry.
+ */
+struct buzzvstig_expired_s {
+   /* The timestamp of the entry when it was removed */
+   uint64_t timestamp;
+   /* The step at which it was removed */
+   uint32_t step;
+};
+
 /****************************************/
 /****************************************/
 
 buzzvstig_elem_t buzzvstig_elem_new(buzzobj_t data,
-                                    uint16_t timestamp,
+                                    uint64_t timestamp,
                                     uint16_t robot) {
    buzzvstig_elem_t e = (buzzvstig_elem_t)malloc(sizeof(struct buzzvstig_elem_s));
    e->data = data;
    e->timestamp = timestamp;
    e->robot = robot;
+   e->updated = 0;
+   e->used = 0;
    return e;
 }
 
@@ -74,6 +122,8 @@ buzzvstig_elem_t buzzvstig_elem_clone(buzzvm_t vm, const buzzvstig_elem_t e) {
    x->data      = buzzheap_clone(vm, e->data);
    x->timestamp = e->timestamp;
    x->robot     = e->robot;
+   x->updated   = e->updated;
+   x->used      = e->used;
    return x;
 }
 
@@ -89,10 +139,19 @@ void buzzvstig_elem_destroy(const void* key, void* data, void* params) {
 /****************************************/
 /****************************************/
 
-buzzvstig_t buzzvstig_new() {
+/*
+ * Number of buckets of the data of a spatial stigmergy.
+ * A prime, so that the packed cell coordinates spread over the buckets.
+ */
+#define BUZZVSTIG_SPATIAL_BUCKETS 1021
+
+/*
+ * Creates a virtual stigmergy whose data has the given number of buckets.
+ */
+static buzzvstig_t buzzvstig_new_buckets(uint32_t buckets) {
    buzzvstig_t x = (buzzvstig_t)malloc(sizeof(struct buzzvstig_s));
    x->data = buzzdict_new(
-      10,
+      buckets,
       sizeof(buzzobj_t),
       sizeof(buzzvstig_elem_t),
       buzzvstig_key_hash,
@@ -100,26 +159,145 @@ buzzvstig_t buzzvstig_new() {
       buzzvstig_elem_destroy);
    x->onconflict = NULL;
    x->onconflictlost = NULL;
+   x->mode = BUZZVSTIG_MODE_FLOOD;
+   /* Send the first digest at the next step */
+   x->digesttimer = 1;
+   x->ttl = 0;
+   x->capacity = 0;
+   x->evict = BUZZVSTIG_EVICT_LRU;
+   x->tombstones = 0;
+   x->step = 0;
+   x->expired = buzzdict_new(10,
+                             sizeof(buzzobj_t),
+                             sizeof(struct buzzvstig_expired_s),
+                             buzzvstig_key_hash,
+                             buzzvstig_key_cmp,
+                             NULL);
+   x->cell = 0.0f;
+   x->pos[0] = x->pos[1] = x->pos[2] = 0.0f;
+   x->range = 0.0f;
+   x->log = NULL;
    return x;
 }
 
+buzzvstig_t buzzvstig_new() {
+   return buzzvstig_new_buckets(10);
+}
+
+buzzvstig_t buzzvstig_spatial_new(float cell) {
+   buzzvstig_t x = buzzvstig_new_buckets(BUZZVSTIG_SPATIAL_BUCKETS);
+   x->cell = cell;
+   return x;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Limits of the cell coordinates.
+ */
+#define BUZZVSTIG_CELL_XY_MAX 2047
+#define BUZZVSTIG_CELL_Z_MAX  127
+
+/*
+ * Packs cell coordinates into a key.
+ */
+static int32_t buzzvstig_cell_pack(int32_t cx,
+                                   int32_t cy,
+                                   int32_t cz) {
+   return (int32_t)(((uint32_t)cx & 0xFFF) |
+                    (((uint32_t)cy & 0xFFF) << 12) |
+                    (((uint32_t)cz & 0xFF) << 24));
+}
+
+int buzzvstig_cell_key(const buzzvstig_t vs,
+                       float x,
+                       float y,
+                       float z,
+                       int32_t* key) {
+   /* Cell i spans [(i-0.5)*cell, (i+0.5)*cell), so that 0 is a center */
+   float cx = floorf(x / vs->cell + 0.5f);
+   float cy = floorf(y / vs->cell + 0.5f);
+   float cz = floorf(z / vs->cell + 0.5f);
+   if(cx < -BUZZVSTIG_CELL_XY_MAX-1 || cx > BUZZVSTIG_CELL_XY_MAX ||
+      cy < -BUZZVSTIG_CELL_XY_MAX-1 || cy > BUZZVSTIG_CELL_XY_MAX ||
+      cz < -BUZZVSTIG_CELL_Z_MAX-1  || cz > BUZZVSTIG_CELL_Z_MAX)
+      return 0;
+   *key = buzzvstig_cell_pack(cx, cy, cz);
+   return 1;
+}
+
+void buzzvstig_cell_center(const buzzvstig_t vs,
+                           int32_t key,
+                           float pos[3]) {
+   /* Sign-extend the packed coordinates */
+   uint32_t k = key;
+   pos[0] = ((int32_t)(k << 20) >> 20) * vs->cell;
+   pos[1] = ((int32_t)(k << 8) >> 20) * vs->cell;
+   pos[2] = ((int32_t)k >> 24) * vs->cell;
+}
+
+int buzzvstig_inrange(const buzzvstig_t vs,
+                      const buzzobj_t key) {
+   if(vs->cell == 0.0f || vs->range == 0.0f) return 1;
+   if(key->o.type != BUZZTYPE_INT) return 1;
+   float c[3];
+   buzzvstig_cell_center(vs, key->i.value, c);
+   float dx = c[0] - vs->pos[0];
+   float dy = c[1] - vs->pos[1];
+   float dz = c[2] - vs->pos[2];
+   return dx*dx + dy*dy + dz*dz <= vs->range * vs->range;
+}
+
 /****************************************/
 /****************************************/
 
 void buzzvstig_destroy(buzzvstig_t* vs) {
+   if((*vs)->log) buzzvstiglog_close(&((*vs)->log));
    buzzdict_destroy(&((*vs)->data));
+   buzzdict_destroy(&((*vs)->expired));
    free(*vs);
 }
 
 /****************************************/
 /****************************************/
 
+uint64_t buzzvstig_clock_tick(buzzvm_t vm,
+                              uint64_t prev) {
+   /* Lamport clock */
+   if(vm->vstigtime == 0) return prev + 1;
+   /* Hybrid logical clock */
+   uint64_t ts = vm->vstigclock + 1;
+   if(buzzvstig_ts_newer(vm->vstigtime << 16, ts)) ts = vm->vstigtime << 16;
+   if(!buzzvstig_ts_newer(ts, prev)) ts = prev + 1;
+   vm->vstigclock = ts;
+   return ts;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvstig_clock_update(buzzvm_t vm,
+                            uint64_t ts) {
+   if(buzzvstig_ts_newer(ts, vm->vstigclock)) vm->vstigclock = ts;
+}
+
+/****************************************/
+/****************************************/
+
 void buzzvstig_elem_serialize(buzzmsg_payload_t buf,
                               const buzzobj_t key,
-                              const buzzvstig_elem_t data) {
+                              const buzzvstig_elem_t data,
+                              int wide) {
    buzzobj_serialize    (buf, key);
    buzzobj_serialize    (buf, data->data);
-   buzzmsg_serialize_u16(buf, data->timestamp);
+   if(wide) {
+      buzzmsg_serialize_u32(buf, data->timestamp >> 32);
+      buzzmsg_serialize_u32(buf, data->timestamp);
+   }
+   else {
+      buzzmsg_serialize_u16(buf, data->timestamp);
+   }
    buzzmsg_serialize_u16(buf, data->robot);
 }
 
@@ -130,6 +308,7 @@ int64_t buzzvstig_elem_deserialize(buzzobj_t* key,
                                    buzzvstig_elem_t* data,
                                    buzzmsg_payload_t buf,
                                    uint32_t pos,
+                                   int wide,
                                    struct buzzvm_s* vm) {
    /* Initialize the position */
    int64_t p = pos;
@@ -141,8 +320,20 @@ int64_t buzzvstig_elem_deserialize(buzzobj_t* key,
    p = buzzobj_deserialize(&((*data)->data), buf, p, vm);
    if(p < 0) return -1;
    /* Deserialize the timestamp */
-   p = buzzmsg_deserialize_u16(&((*data)->timestamp), buf, p);
-   if(p < 0) return -1;
+   if(wide) {
+      uint32_t hi, lo;
+      p = buzzmsg_deserialize_u32(&hi, buf, p);
+      if(p < 0) return -1;
+      p = buzzmsg_deserialize_u32(&lo, buf, p);
+      if(p < 0) return -1;
+      (*data)->timestamp = ((uint64_t)hi << 32) | lo;
+   }
+   else {
+      uint16_t ts;
+      p = buzzmsg_deserialize_u16(&ts, buf, p);
+      if(p < 0) return -1;
+      (*data)->timestamp = ts;
+   }
    /* Deserialize the robot */
    p = buzzmsg_deserialize_u16(&((*data)->robot), buf, p);
    if(p < 0) return -1;
@@ -152,22 +343,22 @@ int64_t buzzvstig_elem_deserialize(buzzobj_t* key,
 /****************************************/
 /****************************************/
 
-int buzzvstig_create(buzzvm_t vm) {
-   buzzvm_lnum_assert(vm, 1);
-   /* Get vstig id */
-   buzzvm_lload(vm, 1);
-   buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
-   uint16_t id = buzzvm_stack_at(vm, 1)->i.value;
-   buzzvm_pop(vm);
+/*
+ * Registers a new virtual stigmergy, replacing the one with the same
+ * id if any, and pushes the table that represents it.
+ */
+static void buzzvstig_table_new(buzzvm_t vm,
+                                uint16_t id,
+                                buzzvstig_t nvs) {
    /* Look for virtual stigmergy */
    const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
    if(vs) {
       /* Found, destroy it */
       buzzdict_remove(vm->vstigs, &id);
    }
-   /* Create a new virtual stigmergy */
-   buzzvstig_t nvs = buzzvstig_new();
    buzzdict_set(vm->vstigs, &id, &nvs);
+   /* Restore the entries saved by the host, if any */
+   buzzvstiglog_restore(vm, id, nvs);
    /* Create a table */
    buzzvm_pusht(vm);
    /* Add data and methods */
@@ -182,11 +373,57 @@ int buzzvstig_create(buzzvm_t vm) {
    function_register(foreach);
    function_register(reduce);
    function_register(map);
+   function_register(aggregate);
    function_register(size);
    function_register(put);
    function_register(get);
+   function_register(putmany);
+   function_register(getmany);
+   function_register(keys);
+   function_register(setttl);
+   function_register(setcapacity);
+   function_register(settombstones);
    function_register(onconflict);
    function_register(onconflictlost);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzvstig_create(buzzvm_t vm) {
+   /* Expected parameters: id and, optionally, the propagation mode */
+   if(buzzvm_lnum(vm) != 1 && buzzvm_lnum(vm) != 2) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_LNUM,
+                      "expected 1 or 2 parameters, got %" PRId64,
+                      buzzvm_lnum(vm));
+      return vm->state;
+   }
+   /* Get vstig id */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
+   uint16_t id = buzzvm_stack_at(vm, 1)->i.value;
+   buzzvm_pop(vm);
+   /* Get propagation mode */
+   uint8_t mode = BUZZVSTIG_MODE_FLOOD;
+   if(buzzvm_lnum(vm) == 2) {
+      buzzvm_lload(vm, 2);
+      buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
+      int32_t m = buzzvm_stack_at(vm, 1)->i.value;
+      buzzvm_pop(vm);
+      if(m != BUZZVSTIG_MODE_FLOOD && m != BUZZVSTIG_MODE_ANTIENTROPY) {
+         buzzvm_seterror(vm,
+                         BUZZVM_ERROR_TYPE,
+                         "stigmergy.create(): unknown propagation mode %d",
+                         m);
+         return vm->state;
+      }
+      mode = m;
+   }
+   /* Create a new virtual stigmergy */
+   buzzvstig_t nvs = buzzvstig_new();
+   nvs->mode = mode;
+   buzzvstig_table_new(vm, id, nvs);
    /* Return the table */
    return buzzvm_ret1(vm);
 }
@@ -194,6 +431,137 @@ int buzzvstig_create(buzzvm_t vm) {
 /****************************************/
 /****************************************/
 
+/*
+ * Reads the numeric parameters first..first+n-1 into xs.
+ */
+static buzzvm_state buzzvstig_floats_get(buzzvm_t vm,
+                                         int first,
+                                         int n,
+                                         float* xs) {
+   int i;
+   for(i = 0; i < n; ++i) {
+      buzzvm_lload(vm, first + i);
+      buzzvm_type_assert_number(vm, 1);
+      xs[i] = buzzvm_stack_number_to_float(vm, 1);
+      buzzvm_pop(vm);
+   }
+   return vm->state;
+}
+
+int buzzvstig_spatial(buzzvm_t vm) {
+   /* Expected parameters: id, cell size and, optionally, the propagation mode */
+   if(buzzvm_lnum(vm) != 2 && buzzvm_lnum(vm) != 3) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_LNUM,
+                      "expected 2 or 3 parameters, got %" PRId64,
+                      buzzvm_lnum(vm));
+      return vm->state;
+   }
+   /* Get vstig id */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
+   uint16_t id = buzzvm_stack_at(vm, 1)->i.value;
+   buzzvm_pop(vm);
+   /* Get cell size */
+   float cell;
+   if(buzzvstig_floats_get(vm, 2, 1, &cell) != BUZZVM_STATE_READY) return vm->state;
+   if(cell <= 0.0f) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_TYPE,
+                      "stigmergy.spatial(): the cell size must be positive");
+      return vm->state;
+   }
+   /* Get propagation mode */
+   uint8_t mode = BUZZVSTIG_MODE_FLOOD;
+   if(buzzvm_lnum(vm) == 3) {
+      buzzvm_lload(vm, 3);
+      buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
+      int32_t m = buzzvm_stack_at(vm, 1)->i.value;
+      buzzvm_pop(vm);
+      if(m != BUZZVSTIG_MODE_FLOOD && m != BUZZVSTIG_MODE_ANTIENTROPY) {
+         buzzvm_seterror(vm,
+                         BUZZVM_ERROR_TYPE,
+                         "stigmergy.spatial(): unknown propagation mode %d",
+                         m);
+         return vm->state;
+      }
+      mode = m;
+   }
+   /* Create a new virtual stigmergy */
+   buzzvstig_t nvs = buzzvstig_spatial_new(cell);
+   nvs->mode = mode;
+   buzzvstig_table_new(vm, id, nvs);
+   /* Add the spatial methods */
+   function_register(putat);
+   function_register(getat);
+   function_register(near);
+   function_register(box);
+   function_register(setposition);
+   function_register(setrange);
+   /* Return the table */
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Writes an entry and queues the PUT message for the neighbors.
+ */
+static void buzzvstig_put_entry(buzzvm_t vm,
+                                uint16_t id,
+                                buzzvstig_t vs,
+                                buzzobj_t k,
+                                buzzobj_t v,
+                                int batch) {
+   /* Look for the element */
+   const buzzvstig_elem_t* x = buzzvstig_fetch(vs, &k);
+   buzzvstig_elem_t y;
+   if(x) {
+      /* Element found */
+      if(v->o.type != BUZZTYPE_NIL) {
+         /* New value is not nil, update the existing element */
+         (*x)->data = v;
+         (*x)->timestamp = buzzvstig_clock_tick(vm, (*x)->timestamp);
+         (*x)->robot = vm->robot;
+         (*x)->updated = (*x)->used = vs->step;
+         y = *x;
+         if(vs->log) buzzvstiglog_put(vs->log, k, y);
+      }
+      else {
+         /* New value is nil, must delete the existing element */
+         /* Make a new element with nil as value to update neighbors */
+         y = buzzvstig_elem_new(
+            buzzheap_newobj(vm, BUZZTYPE_NIL),          // nil value
+            buzzvstig_clock_tick(vm, (*x)->timestamp),  // new timestamp
+            vm->robot);                                 // robot id
+      }
+   }
+   else if(v->o.type != BUZZTYPE_NIL) {
+      /* Element not found and new value is not nil, store it */
+      y = buzzvstig_elem_new(v, buzzvstig_clock_tick(vm, 0), vm->robot);
+      buzzvstig_store(vs, &k, &y);
+   }
+   else {
+      /* Element not found and new value is nil, nothing to do */
+      return;
+   }
+   /* Append a PUT message to the out message queue */
+   if(batch) buzzoutmsg_queue_append_vstig_batch(vm, id, k, y);
+   else buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, y);
+   if(x && v->o.type == BUZZTYPE_NIL) {
+      if(vs->mode == BUZZVSTIG_MODE_ANTIENTROPY) {
+         /* Keep the nil element, or the digests would bring the old one back */
+         buzzvstig_store(vs, &k, &y);
+      }
+      else {
+         /* Delete the existing element */
+         buzzvstig_remove(vs, &k);
+         free(y);
+      }
+   }
+}
+
 int buzzvstig_put(buzzvm_t vm) {
    buzzvm_lnum_assert(vm, 2);
    /* Get vstig id */
@@ -206,39 +574,39 @@ int buzzvstig_put(buzzvm_t vm) {
    buzzobj_t v = buzzvm_stack_at(vm, 1);
    /* Look for virtual stigmergy */
    const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+   if(vs) buzzvstig_put_entry(vm, id, *vs, k, v, 0);
+   /* Return */
+   return buzzvm_ret0(vm);
+}
+
+/****************************************/
+/****************************************/
+
+struct buzzvstig_putmany_params {
+   buzzvm_t vm;
+   uint16_t id;
+   buzzvstig_t vs;
+};
+
+void buzzvstig_putmany_entry(const void* key, void* data, void* params) {
+   struct buzzvstig_putmany_params* p = (struct buzzvstig_putmany_params*)params;
+   buzzvstig_put_entry(p->vm, p->id, p->vs, *(buzzobj_t*)key, *(buzzobj_t*)data, 1);
+}
+
+int buzzvstig_putmany(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 1);
+   /* Get vstig id */
+   id_get();
+   /* Get the table of (key, value) pairs */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_TABLE);
+   buzzobj_t t = buzzvm_stack_at(vm, 1);
+   /* Look for virtual stigmergy */
+   const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
    if(vs) {
-      /* Look for the element */
-      const buzzvstig_elem_t* x = buzzvstig_fetch(*vs, &k);
-      if(x) {
-         /* Element found */
-         if(v->o.type != BUZZTYPE_NIL) {
-            /* New value is not nil, update the existing element */
-            (*x)->data = v;
-            ++((*x)->timestamp);
-            (*x)->robot = vm->robot;
-            /* Append a PUT message to the out message queue */
-            buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, *x);
-         }
-         else {
-            /* New value is nil, must delete the existing element */
-            /* Make a new element with nil as value to update neighbors */
-            buzzvstig_elem_t y = buzzvstig_elem_new(
-               buzzobj_new(BUZZTYPE_NIL), // nil value
-               (*x)->timestamp + 1,       // new timestamp
-               vm->robot);                // robot id
-            /* Append a PUT message to the out message queue with nil in it */
-            buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, y);
-            /* Delete the existing element */
-            buzzvstig_remove(*vs, &k);
-         }
-      }
-      else if(v->o.type != BUZZTYPE_NIL) {
-         /* Element not found and new value is not nil, store it */
-         buzzvstig_elem_t y = buzzvstig_elem_new(v, 1, vm->robot);
-         buzzvstig_store(*vs, &k, &y);
-         /* Append a PUT message to the out message queue */
-         buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, y);
-      }
+      /* Write the entries; the PUT messages are packed together */
+      struct buzzvstig_putmany_params p = { .vm = vm, .id = id, .vs = *vs };
+      buzzdict_foreach(t->t.value, buzzvstig_putmany_entry, &p);
    }
    /* Return */
    return buzzvm_ret0(vm);
@@ -263,6 +631,8 @@ void buzzvstig_foreach_entry(const void* key, void* data, void* params) {
    buzzvm_pushi(p->vm, (*(buzzvstig_elem_t*)data)->robot);
    /* Call closure */
    p->vm->state = buzzvm_closure_call(p->vm, 3);
+   /* Get rid of the return value */
+   if(p->vm->state == BUZZVM_STATE_READY) buzzvm_pop(p->vm);
 }
 
 int buzzvstig_foreach(struct buzzvm_s* vm) {
@@ -421,6 +791,151 @@ int buzzvstig_map(struct buzzvm_s* vm) {
 /****************************************/
 /****************************************/
 
+struct buzzvstig_aggregate_params {
+   uint8_t op;
+   buzzobj_t field;
+   /* Number of numeric values seen */
+   uint32_t count;
+   /* Sum of the values, as integer while possible */
+   int64_t isum;
+   float fsum;
+   int isfloat;
+   /* Best value so far and its key, for min/max/argmin/argmax */
+   buzzobj_t best;
+   buzzobj_t bestkey;
+};
+
+/*
+ * Returns the value of a numeric object as a float.
+ */
+static float buzzvstig_num(const buzzobj_t o) {
+   return o->o.type == BUZZTYPE_INT ? (float)o->i.value : o->f.value;
+}
+
+void buzzvstig_aggregate_entry(const void* key, void* data, void* params) {
+   struct buzzvstig_aggregate_params* p = (struct buzzvstig_aggregate_params*)params;
+   buzzobj_t v = (*(buzzvstig_elem_t*)data)->data;
+   /* Get the field to aggregate */
+   if(p->field) {
+      if(v->o.type != BUZZTYPE_TABLE) return;
+      const buzzobj_t* f = buzzdict_get(v->t.value, &p->field, buzzobj_t);
+      if(!f) return;
+      v = *f;
+   }
+   if(v->o.type != BUZZTYPE_INT && v->o.type != BUZZTYPE_FLOAT) return;
+   ++p->count;
+   switch(p->op) {
+      case BUZZVSTIG_AGG_SUM:
+         if(v->o.type == BUZZTYPE_INT) p->isum += v->i.value;
+         else {
+            p->fsum += v->f.value;
+            p->isfloat = 1;
+         }
+         break;
+      case BUZZVSTIG_AGG_MIN:
+      case BUZZVSTIG_AGG_ARGMIN:
+         if(!p->best || buzzvstig_num(v) < buzzvstig_num(p->best)) {
+            p->best = v;
+            p->bestkey = *(buzzobj_t*)key;
+         }
+         break;
+      case BUZZVSTIG_AGG_MAX:
+      case BUZZVSTIG_AGG_ARGMAX:
+         if(!p->best || buzzvstig_num(v) > buzzvstig_num(p->best)) {
+            p->best = v;
+            p->bestkey = *(buzzobj_t*)key;
+         }
+         break;
+   }
+}
+
+buzzobj_t buzzvstig_aggregate_elems(struct buzzvm_s* vm,
+                                    const buzzvstig_t vs,
+                                    uint8_t op,
+                                    const buzzobj_t field) {
+   struct buzzvstig_aggregate_params p = {
+      .op = op,
+      .field = field
+   };
+   buzzvstig_foreach_elem(vs, buzzvstig_aggregate_entry, &p);
+   buzzobj_t r;
+   switch(op) {
+      case BUZZVSTIG_AGG_SUM:
+         if(p.isfloat || p.isum < INT32_MIN || p.isum > INT32_MAX) {
+            r = buzzheap_newobj(vm, BUZZTYPE_FLOAT);
+            r->f.value = (float)p.isum + p.fsum;
+         }
+         else {
+            r = buzzheap_newobj(vm, BUZZTYPE_INT);
+            r->i.value = (int32_t)p.isum;
+         }
+         return r;
+      case BUZZVSTIG_AGG_COUNT:
+         r = buzzheap_newobj(vm, BUZZTYPE_INT);
+         r->i.value = p.count;
+         return r;
+      case BUZZVSTIG_AGG_MIN:
+      case BUZZVSTIG_AGG_MAX:
+         if(p.best) return p.best;
+         break;
+      case BUZZVSTIG_AGG_ARGMIN:
+      case BUZZVSTIG_AGG_ARGMAX:
+         if(p.bestkey) return p.bestkey;
+         break;
+   }
+   return buzzheap_newobj(vm, BUZZTYPE_NIL);
+}
+
+int buzzvstig_aggregate(struct buzzvm_s* vm) {
+   /* Aggregate and, optionally, field expected */
+   if(buzzvm_lnum(vm) != 1 && buzzvm_lnum(vm) != 2) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_LNUM,
+                      "expected 1 or 2 parameters, got %" PRId64,
+                      buzzvm_lnum(vm));
+      return vm->state;
+   }
+   /* Get the aggregate */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
+   int32_t op = buzzvm_stack_at(vm, 1)->i.value;
+   buzzvm_pop(vm);
+   if(op < 0 || op >= BUZZVSTIG_AGG_COUNT_OPS) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_TYPE,
+                      "stigmergy.aggregate(): unknown aggregate %d",
+                      op);
+      return vm->state;
+   }
+   /* Get the field, if any */
+   buzzobj_t field = NULL;
+   if(buzzvm_lnum(vm) == 2) {
+      buzzvm_lload(vm, 2);
+      field = buzzvm_stack_at(vm, 1);
+      buzzvm_pop(vm);
+      if(field->o.type != BUZZTYPE_INT &&
+         field->o.type != BUZZTYPE_FLOAT &&
+         field->o.type != BUZZTYPE_STRING) {
+         buzzvm_seterror(vm,
+                         BUZZVM_ERROR_TYPE,
+                         "stigmergy.aggregate(): expected int, float or string field, got %s",
+                         buzztype_desc[field->o.type]);
+         return vm->state;
+      }
+   }
+   /* Get vstig id */
+   id_get();
+   /* Look for virtual stigmergy */
+   const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+   if(vs) buzzvm_push(vm, buzzvstig_aggregate_elems(vm, *vs, op, field));
+   else buzzvm_pushnil(vm);
+   /* Return */
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
 int buzzvstig_size(buzzvm_t vm) {
    buzzvm_lnum_assert(vm, 0);
    /* Get vstig id */
@@ -442,6 +957,38 @@ int buzzvstig_size(buzzvm_t vm) {
 /****************************************/
 /****************************************/
 
+/*
+ * Reads an entry, querying the neighbors in flood mode.
+ * Returns the value of the entry, or nil if not found.
+ */
+static buzzobj_t buzzvstig_get_entry(buzzvm_t vm,
+                                     uint16_t id,
+                                     buzzvstig_t vs,
+                                     buzzobj_t k) {
+   /* Look for key */
+   const buzzvstig_elem_t* e = buzzvstig_fetch(vs, &k);
+   if(vs->mode == BUZZVSTIG_MODE_ANTIENTROPY) {
+      /* No query in anti-entropy mode, the digests keep the data fresh */
+      return e ? (*e)->data : buzzheap_newobj(vm, BUZZTYPE_NIL);
+   }
+   if(e) (*e)->used = vs->step;
+   if(e) {
+      /* Key found, append the message to the out message queue */
+      buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_QUERY, id, k, *e);
+      return (*e)->data;
+   }
+   /* Key not found, make a new one containing nil */
+   buzzobj_t nil = buzzheap_newobj(vm, BUZZTYPE_NIL);
+   buzzvstig_elem_t x =
+      buzzvstig_elem_new(nil,        // nil value
+                         0,          // timestamp
+                         vm->robot); // robot id
+   /* Append the message to the out message queue */
+   buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_QUERY, id, k, x);
+   free(x);
+   return nil;
+}
+
 int buzzvstig_get(buzzvm_t vm) {
    buzzvm_lnum_assert(vm, 1);
    /* Get vstig id */
@@ -452,26 +999,8 @@ int buzzvstig_get(buzzvm_t vm) {
    /* Look for virtual stigmergy */
    const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
    if(vs) {
-      /* Virtual stigmergy found */
-      /* Look for key and push result */
-      const buzzvstig_elem_t* e = buzzvstig_fetch(*vs, &k);
-      if(e) {
-         /* Key found */
-         buzzvm_push(vm, (*e)->data);
-         /* Append the message to the out message queue */
-         buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_QUERY, id, k, *e);
-      }
-      else {
-         /* Key not found, make a new one containing nil */
-         buzzvm_pushnil(vm);
-         buzzvstig_elem_t x =
-            buzzvstig_elem_new(buzzvm_stack_at(vm, 1), // nil value
-                               0,                      // timestamp
-                               vm->robot);             // robot id
-         /* Append the message to the out message queue */
-         buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_QUERY, id, k, x);
-         free(x);
-      }
+      /* Virtual stigmergy found, push the value */
+      buzzvm_push(vm, buzzvstig_get_entry(vm, id, *vs, k));
    }
    else {
       /* No virtual stigmergy found, just push false */
@@ -485,6 +1014,646 @@ int buzzvstig_get(buzzvm_t vm) {
 /****************************************/
 /****************************************/
 
+struct buzzvstig_getmany_params {
+   buzzvm_t vm;
+   uint16_t id;
+   buzzvstig_t vs;
+   buzzdict_t result;
+};
+
+void buzzvstig_getmany_entry(const void* key, void* data, void* params) {
+   struct buzzvstig_getmany_params* p = (struct buzzvstig_getmany_params*)params;
+   buzzobj_t k = *(buzzobj_t*)data;
+   buzzobj_t v = buzzvstig_get_entry(p->vm, p->id, p->vs, k);
+   if(v->o.type != BUZZTYPE_NIL) buzzdict_set(p->result, &k, &v);
+}
+
+int buzzvstig_getmany(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 1);
+   /* Get vstig id */
+   id_get();
+   /* Get the table of keys */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_TABLE);
+   buzzobj_t t = buzzvm_stack_at(vm, 1);
+   /* Create a table as the return value */
+   buzzobj_t r = buzzheap_newobj(vm, BUZZTYPE_TABLE);
+   buzzvm_push(vm, r);
+   /* Look for virtual stigmergy */
+   const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+   if(vs) {
+      /* Collect the (key, value) pairs of the entries found */
+      struct buzzvstig_getmany_params p = {
+         .vm = vm,
+         .id = id,
+         .vs = *vs,
+         .result = r->t.value
+      };
+      buzzdict_foreach(t->t.value, buzzvstig_getmany_entry, &p);
+   }
+   /* Return the table */
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+struct buzzvstig_keys_params {
+   buzzdarray_t keys;
+   buzzobj_t prefix;
+};
+
+void buzzvstig_keys_entry(const void* key, void* data, void* params) {
+   struct buzzvstig_keys_params* p = (struct buzzvstig_keys_params*)params;
+   buzzobj_t k = *(buzzobj_t*)key;
+   /* Skip deleted entries */
+   if((*(buzzvstig_elem_t*)data)->data->o.type == BUZZTYPE_NIL) return;
+   /* Skip the keys that do not start with the prefix */
+   if(p->prefix &&
+      (k->o.type != BUZZTYPE_STRING ||
+       strncmp(k->s.value.str, p->prefix->s.value.str, strlen(p->prefix->s.value.str)) != 0))
+      return;
+   buzzdarray_push(p->keys, &k);
+}
+
+/*
+ * Orders the keys: numbers first, then strings, then the rest.
+ */
+static int buzzvstig_keys_cmp(const void* a, const void* b) {
+   buzzobj_t ka = *(buzzobj_t*)a, kb = *(buzzobj_t*)b;
+   int ra = (ka->o.type == BUZZTYPE_INT || ka->o.type == BUZZTYPE_FLOAT) ? 0 : ka->o.type == BUZZTYPE_STRING ? 1 : 2;
+   int rb = (kb->o.type == BUZZTYPE_INT || kb->o.type == BUZZTYPE_FLOAT) ? 0 : kb->o.type == BUZZTYPE_STRING ? 1 : 2;
+   if(ra != rb) return ra - rb;
+   if(ra == 1) return strcmp(ka->s.value.str, kb->s.value.str);
+   return buzzobj_cmp(ka, kb);
+}
+
+int buzzvstig_keys(buzzvm_t vm) {
+   /* Expected parameters: optionally, a key prefix */
+   if(buzzvm_lnum(vm) > 1) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_LNUM,
+                      "expected 0 or 1 parameters, got %" PRId64,
+                      buzzvm_lnum(vm));
+      return vm->state;
+   }
+   /* Get vstig id */
+   id_get();
+   /* Get prefix */
+   struct buzzvstig_keys_params p = {
+      .keys = buzzdarray_new(16, sizeof(buzzobj_t), NULL),
+      .prefix = NULL
+   };
+   if(buzzvm_lnum(vm) == 1) {
+      buzzvm_lload(vm, 1);
+      buzzvm_type_assert(vm, 1, BUZZTYPE_STRING);
+      p.prefix = buzzvm_stack_at(vm, 1);
+   }
+   /* Create a table as the return value */
+   buzzobj_t r = buzzheap_newobj(vm, BUZZTYPE_TABLE);
+   buzzvm_push(vm, r);
+   /* Look for virtual stigmergy */
+   const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+   if(vs) {
+      /* Collect and sort the keys */
+      buzzdict_foreach((*vs)->data, buzzvstig_keys_entry, &p);
+      qsort(p.keys->data, buzzdarray_size(p.keys), sizeof(buzzobj_t), buzzvstig_keys_cmp);
+      /* Put them in the table as 0, 1, 2, ... */
+      uint32_t i;
+      for(i = 0; i < buzzdarray_size(p.keys); ++i) {
+         buzzvm_dup(vm);
+         buzzvm_pushi(vm, i);
+         buzzvm_push(vm, buzzdarray_get(p.keys, i, buzzobj_t));
+         buzzvm_tput(vm);
+      }
+   }
+   buzzdarray_destroy(&p.keys);
+   /* Return the table */
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzvstig_setttl(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 1);
+   /* Get vstig id */
+   id_get();
+   /* Get the time to live */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
+   int32_t ttl = buzzvm_stack_at(vm, 1)->i.value;
+   /* Look for virtual stigmergy */
+   const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+   if(vs) (*vs)->ttl = ttl > 0 ? ttl : 0;
+   return buzzvm_ret0(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzvstig_setcapacity(buzzvm_t vm) {
+   /* Expected parameters: capacity and, optionally, the eviction policy */
+   if(buzzvm_lnum(vm) != 1 && buzzvm_lnum(vm) != 2) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_LNUM,
+                      "expected 1 or 2 parameters, got %" PRId64,
+                      buzzvm_lnum(vm));
+      return vm->state;
+   }
+   /* Get vstig id */
+   id_get();
+   /* Get the capacity */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
+   int32_t capacity = buzzvm_stack_at(vm, 1)->i.value;
+   buzzvm_pop(vm);
+   /* Get the eviction policy */
+   uint8_t evict = BUZZVSTIG_EVICT_LRU;
+   if(buzzvm_lnum(vm) == 2) {
+      buzzvm_lload(vm, 2);
+      buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
+      int32_t e = buzzvm_stack_at(vm, 1)->i.value;
+      buzzvm_pop(vm);
+      if(e != BUZZVSTIG_EVICT_LRU && e != BUZZVSTIG_EVICT_OLDEST) {
+         buzzvm_seterror(vm,
+                         BUZZVM_ERROR_TYPE,
+                         "stigmergy.setcapacity(): unknown eviction policy %d",
+                         e);
+         return vm->state;
+      }
+      evict = e;
+   }
+   /* Look for virtual stigmergy */
+   const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+   if(vs) {
+      (*vs)->capacity = capacity > 0 ? capacity : 0;
+      (*vs)->evict = evict;
+   }
+   return buzzvm_ret0(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzvstig_settombstones(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 1);
+   /* Get vstig id */
+   id_get();
+   /* Get the flag */
+   buzzvm_lload(vm, 1);
+   buzzobj_t f = buzzvm_stack_at(vm, 1);
+   /* Look for virtual stigmergy */
+   const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+   if(vs) (*vs)->tombstones =
+             f->o.type != BUZZTYPE_NIL &&
+             !(f->o.type == BUZZTYPE_INT && f->i.value == 0);
+   return buzzvm_ret0(vm);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Reads the position given as the first 2 or 3 parameters and
+ * returns the key of its cell in the last parameter.
+ */
+static buzzvm_state buzzvstig_cell_get(buzzvm_t vm,
+                                       buzzvstig_t vs,
+                                       int dims,
+                                       int32_t* key) {
+   float p[3] = { 0.0f, 0.0f, 0.0f };
+   if(buzzvstig_floats_get(vm, 1, dims, p) != BUZZVM_STATE_READY) return vm->state;
+   if(!buzzvstig_cell_key(vs, p[0], p[1], p[2], key)) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_TYPE,
+                      "stigmergy: position (%f,%f,%f) out of the spatial stigmergy bounds",
+                      p[0], p[1], p[2]);
+   }
+   return vm->state;
+}
+
+int buzzvstig_putat(buzzvm_t vm) {
+   /* Expected parameters: x, y, (z,) value */
+   if(buzzvm_lnum(vm) != 3 && buzzvm_lnum(vm) != 4) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_LNUM,
+                      "expected 3 or 4 parameters, got %" PRId64,
+                      buzzvm_lnum(vm));
+      return vm->state;
+   }
+   int dims = buzzvm_lnum(vm) - 1;
+   /* Get vstig id */
+   id_get();
+   /* Look for virtual stigmergy */
+   const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+   if(!vs) return buzzvm_ret0(vm);
+   /* Get the cell */
+   int32_t cell;
+   if(buzzvstig_cell_get(vm, *vs, dims, &cell) != BUZZVM_STATE_READY) return vm->state;
+   buzzobj_t k = buzzheap_newobj(vm, BUZZTYPE_INT);
+   k->i.value = cell;
+   /* Get value */
+   buzzvm_lload(vm, dims + 1);
+   buzzobj_t v = buzzvm_stack_at(vm, 1);
+   buzzvstig_put_entry(vm, id, *vs, k, v, 0);
+   /* Return */
+   return buzzvm_ret0(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzvstig_getat(buzzvm_t vm) {
+   /* Expected parameters: x, y, (z) */
+   if(buzzvm_lnum(vm) != 2 && buzzvm_lnum(vm) != 3) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_LNUM,
+                      "expected 2 or 3 parameters, got %" PRId64,
+                      buzzvm_lnum(vm));
+      return vm->state;
+   }
+   /* Get vstig id */
+   id_get();
+   /* Look for virtual stigmergy */
+   const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+   if(!vs) {
+      buzzvm_pushnil(vm);
+      return buzzvm_ret1(vm);
+   }
+   /* Get the cell */
+   int32_t cell;
+   if(buzzvstig_cell_get(vm, *vs, buzzvm_lnum(vm), &cell) != BUZZVM_STATE_READY) return vm->state;
+   buzzobj_t k = buzzheap_newobj(vm, BUZZTYPE_INT);
+   k->i.value = cell;
+   /* Push the value */
+   buzzvm_push(vm, buzzvstig_get_entry(vm, id, *vs, k));
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * A spatial query.
+ */
+struct buzzvstig_query_s {
+   buzzvm_t vm;
+   buzzvstig_t vs;
+   /* The bounding box of the query */
+   float lo[3];
+   float hi[3];
+   /* The center and the squared radius of a radius query (radius < 0 for a box query) */
+   float c[3];
+   float r2;
+   /* The result table and the number of entries in it */
+   buzzobj_t result;
+   int32_t n;
+};
+
+/*
+ * Adds a float field to the table on top of the stack.
+ */
+static void buzzvstig_field_put(buzzvm_t vm,
+                                const char* name,
+                                float x) {
+   buzzvm_dup(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, name, 1));
+   buzzvm_pushf(vm, x);
+   buzzvm_tput(vm);
+}
+
+/*
+ * Adds an entry to the result of a query if it matches.
+ */
+static void buzzvstig_query_match(struct buzzvstig_query_s* q,
+                                  buzzobj_t k,
+                                  buzzvstig_elem_t e) {
+   if(k->o.type != BUZZTYPE_INT || e->data->o.type == BUZZTYPE_NIL) return;
+   float p[3];
+   buzzvstig_cell_center(q->vs, k->i.value, p);
+   int i;
+   for(i = 0; i < 3; ++i)
+      if(p[i] < q->lo[i] || p[i] > q->hi[i]) return;
+   if(q->r2 >= 0.0f) {
+      float dx = p[0] - q->c[0];
+      float dy = p[1] - q->c[1];
+      float dz = p[2] - q->c[2];
+      if(dx*dx + dy*dy + dz*dz > q->r2) return;
+   }
+   e->used = q->vs->step;
+   /* Append { .x, .y, .z, .value } to the result */
+   buzzvm_t vm = q->vm;
+   buzzvm_push(vm, q->result);
+   buzzvm_pushi(vm, q->n++);
+   buzzvm_pusht(vm);
+   buzzvstig_field_put(vm, "x", p[0]);
+   buzzvstig_field_put(vm, "y", p[1]);
+   buzzvstig_field_put(vm, "z", p[2]);
+   buzzvm_dup(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "value", 1));
+   buzzvm_push(vm, e->data);
+   buzzvm_tput(vm);
+   buzzvm_tput(vm);
+}
+
+void buzzvstig_query_entry(const void* key, void* data, void* params) {
+   buzzvstig_query_match((struct buzzvstig_query_s*)params,
+                         *(buzzobj_t*)key,
+                         *(buzzvstig_elem_t*)data);
+}
+
+/*
+ * Runs a query and pushes the result.
+ * The cells in the bounding box are looked up one by one, unless they
+ * outnumber the entries, in which case all the entries are checked.
+ */
+static void buzzvstig_query(struct buzzvstig_query_s* q) {
+   buzzvm_t vm = q->vm;
+   q->result = buzzheap_newobj(vm, BUZZTYPE_TABLE);
+   q->n = 0;
+   /* Cell ranges of the bounding box */
+   static const int32_t MAX[3] = {
+      BUZZVSTIG_CELL_XY_MAX, BUZZVSTIG_CELL_XY_MAX, BUZZVSTIG_CELL_Z_MAX
+   };
+   int32_t lo[3], hi[3];
+   double cells = 1.0;
+   int i;
+   for(i = 0; i < 3; ++i) {
+      float l = floorf(q->lo[i] / q->vs->cell + 0.5f);
+      float h = floorf(q->hi[i] / q->vs->cell + 0.5f);
+      lo[i] = l < -MAX[i]-1 ? -MAX[i]-1 : (l > MAX[i] ? MAX[i] : l);
+      hi[i] = h < -MAX[i]-1 ? -MAX[i]-1 : (h > MAX[i] ? MAX[i] : h);
+      cells *= (hi[i] >= lo[i]) ? (hi[i] - lo[i] + 1) : 0;
+   }
+   if(cells > buzzdict_size(q->vs->data)) {
+      /* Check all the entries */
+      buzzvstig_foreach_elem(q->vs, buzzvstig_query_entry, q);
+   }
+   else {
+      /* Look up the cells */
+      buzzobj_t k = buzzheap_newobj(vm, BUZZTYPE_INT);
+      int32_t x, y, z;
+      for(z = lo[2]; z <= hi[2]; ++z)
+         for(y = lo[1]; y <= hi[1]; ++y)
+            for(x = lo[0]; x <= hi[0]; ++x) {
+               k->i.value = buzzvstig_cell_pack(x, y, z);
+               const buzzvstig_elem_t* e = buzzvstig_fetch(q->vs, &k);
+               if(e) buzzvstig_query_match(q, k, *e);
+            }
+   }
+   buzzvm_push(vm, q->result);
+}
+
+int buzzvstig_near(buzzvm_t vm) {
+   /* Expected parameters: x, y, (z,) radius */
+   if(buzzvm_lnum(vm) != 3 && buzzvm_lnum(vm) != 4) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_LNUM,
+                      "expected 3 or 4 parameters, got %" PRId64,
+                      buzzvm_lnum(vm));
+      return vm->state;
+   }
+   int dims = buzzvm_lnum(vm) - 1;
+   /* Get the center and the radius */
+   float c[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+   if(buzzvstig_floats_get(vm, 1, dims, c) != BUZZVM_STATE_READY) return vm->state;
+   float r;
+   if(buzzvstig_floats_get(vm, dims + 1, 1, &r) != BUZZVM_STATE_READY) return vm->state;
+   /* Get vstig id */
+   id_get();
+   /* Look for virtual stigmergy */
+   const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+   if(!vs) {
+      buzzvm_pushnil(vm);
+      return buzzvm_ret1(vm);
+   }
+   struct buzzvstig_query_s q = { .vm = vm, .vs = *vs, .r2 = r * r };
+   int i;
+   for(i = 0; i < 3; ++i) {
+      q.c[i] = c[i];
+      q.lo[i] = c[i] - r;
+      q.hi[i] = c[i] + r;
+   }
+   buzzvstig_query(&q);
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzvstig_box(buzzvm_t vm) {
+   /* Expected parameters: x0, y0, (z0,) x1, y1, (z1) */
+   if(buzzvm_lnum(vm) != 4 && buzzvm_lnum(vm) != 6) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_LNUM,
+                      "expected 4 or 6 parameters, got %" PRId64,
+                      buzzvm_lnum(vm));
+      return vm->state;
+   }
+   int dims = buzzvm_lnum(vm) / 2;
+   /* Get the corners */
+   float p0[3] = { 0.0f, 0.0f, 0.0f };
+   float p1[3] = { 0.0f, 0.0f, 0.0f };
+   if(buzzvstig_floats_get(vm, 1, dims, p0) != BUZZVM_STATE_READY) return vm->state;
+   if(buzzvstig_floats_get(vm, dims + 1, dims, p1) != BUZZVM_STATE_READY) return vm->state;
+   /* Get vstig id */
+   id_get();
+   /* Look for virtual stigmergy */
+   const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+   if(!vs) {
+      buzzvm_pushnil(vm);
+      return buzzvm_ret1(vm);
+   }
+   struct buzzvstig_query_s q = { .vm = vm, .vs = *vs, .r2 = -1.0f };
+   int i;
+   for(i = 0; i < 3; ++i) {
+      q.lo[i] = p0[i] < p1[i] ? p0[i] : p1[i];
+      q.hi[i] = p0[i] < p1[i] ? p1[i] : p0[i];
+   }
+   buzzvstig_query(&q);
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzvstig_setposition(buzzvm_t vm) {
+   /* Expected parameters: x, y, (z) */
+   if(buzzvm_lnum(vm) != 2 && buzzvm_lnum(vm) != 3) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_LNUM,
+                      "expected 2 or 3 parameters, got %" PRId64,
+                      buzzvm_lnum(vm));
+      return vm->state;
+   }
+   float p[3] = { 0.0f, 0.0f, 0.0f };
+   if(buzzvstig_floats_get(vm, 1, buzzvm_lnum(vm), p) != BUZZVM_STATE_READY) return vm->state;
+   /* Get vstig id */
+   id_get();
+   /* Look for virtual stigmergy */
+   const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+   if(vs) {
+      (*vs)->pos[0] = p[0];
+      (*vs)->pos[1] = p[1];
+      (*vs)->pos[2] = p[2];
+   }
+   return buzzvm_ret0(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzvstig_setrange(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 1);
+   float r;
+   if(buzzvstig_floats_get(vm, 1, 1, &r) != BUZZVM_STATE_READY) return vm->state;
+   /* Get vstig id */
+   id_get();
+   /* Look for virtual stigmergy */
+   const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+   if(vs) (*vs)->range = r > 0.0f ? r : 0.0f;
+   return buzzvm_ret0(vm);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * An entry to remove from the virtual stigmergy.
+ */
+struct buzzvstig_victim_s {
+   buzzobj_t key;
+   buzzvstig_elem_t elem;
+};
+
+struct buzzvstig_expire_params {
+   buzzvstig_t vs;
+   /* Entries to remove */
+   buzzdarray_t victims;
+   /* Entries that can be evicted */
+   buzzdarray_t candidates;
+};
+
+void buzzvstig_expire_entry(const void* key, void* data, void* params) {
+   struct buzzvstig_expire_params* p = (struct buzzvstig_expire_params*)params;
+   struct buzzvstig_victim_s v = {
+      .key = *(buzzobj_t*)key,
+      .elem = *(buzzvstig_elem_t*)data
+   };
+   if(p->vs->ttl > 0 && p->vs->step - v.elem->updated >= p->vs->ttl)
+      buzzdarray_push(p->victims, &v);
+   else if(p->candidates)
+      buzzdarray_push(p->candidates, &v);
+}
+
+struct buzzvstig_forget_params {
+   buzzvstig_t vs;
+   /* Keys to forget */
+   buzzdarray_t keys;
+};
+
+void buzzvstig_expire_forget(const void* key, void* data, void* params) {
+   struct buzzvstig_forget_params* p = (struct buzzvstig_forget_params*)params;
+   uint32_t keep = p->vs->ttl > BUZZVSTIG_EXPIRED_KEEP ? p->vs->ttl : BUZZVSTIG_EXPIRED_KEEP;
+   if(p->vs->step - ((struct buzzvstig_expired_s*)data)->step >= keep)
+      buzzdarray_push(p->keys, key);
+}
+
+static int buzzvstig_victim_lru_cmp(const void* a, const void* b) {
+   const struct buzzvstig_victim_s* va = (const struct buzzvstig_victim_s*)a;
+   const struct buzzvstig_victim_s* vb = (const struct buzzvstig_victim_s*)b;
+   if(va->elem->used < vb->elem->used) return -1;
+   if(va->elem->used > vb->elem->used) return  1;
+   return 0;
+}
+
+static int buzzvstig_victim_oldest_cmp(const void* a, const void* b) {
+   const struct buzzvstig_victim_s* va = (const struct buzzvstig_victim_s*)a;
+   const struct buzzvstig_victim_s* vb = (const struct buzzvstig_victim_s*)b;
+   if(va->elem->updated < vb->elem->updated) return -1;
+   if(va->elem->updated > vb->elem->updated) return  1;
+   return 0;
+}
+
+void buzzvstig_expire(buzzvm_t vm,
+                      uint16_t id,
+                      buzzvstig_t vs) {
+   ++vs->step;
+   uint32_t i;
+   /* Forget the keys removed long ago */
+   if(!buzzdict_isempty(vs->expired)) {
+      struct buzzvstig_forget_params f = {
+         .vs = vs,
+         .keys = buzzdarray_new(10, sizeof(buzzobj_t), NULL)
+      };
+      buzzdict_foreach(vs->expired, buzzvstig_expire_forget, &f);
+      for(i = 0; i < buzzdarray_size(f.keys); ++i)
+         buzzdict_remove(vs->expired, &buzzdarray_get(f.keys, i, buzzobj_t));
+      buzzdarray_destroy(&f.keys);
+   }
+   /* Anything to do? */
+   int evict = vs->capacity > 0 && buzzdict_size(vs->data) > vs->capacity;
+   if(vs->ttl == 0 && !evict) return;
+   /* Collect the expired entries, and the others if eviction is necessary */
+   struct buzzvstig_expire_params p = {
+      .vs = vs,
+      .victims = buzzdarray_new(10, sizeof(struct buzzvstig_victim_s), NULL),
+      .candidates = evict ? buzzdarray_new(buzzdict_size(vs->data), sizeof(struct buzzvstig_victim_s), NULL) : NULL
+   };
+   buzzvstig_foreach_elem(vs, buzzvstig_expire_entry, &p);
+   /* Evict the entries beyond the capacity */
+   if(evict) {
+      uint32_t left = buzzdict_size(vs->data) - buzzdarray_size(p.victims);
+      if(left > vs->capacity) {
+         qsort(p.candidates->data,
+               buzzdarray_size(p.candidates),
+               sizeof(struct buzzvstig_victim_s),
+               vs->evict == BUZZVSTIG_EVICT_OLDEST ?
+               buzzvstig_victim_oldest_cmp :
+               buzzvstig_victim_lru_cmp);
+         for(i = 0; i < left - vs->capacity; ++i)
+            buzzdarray_push(p.victims, &buzzdarray_get(p.candidates, i, struct buzzvstig_victim_s));
+      }
+      buzzdarray_destroy(&p.candidates);
+   }
+   /* Remove the entries */
+   for(i = 0; i < buzzdarray_size(p.victims); ++i) {
+      const struct buzzvstig_victim_s* v = &buzzdarray_get(p.victims, i, struct buzzvstig_victim_s);
+      struct buzzvstig_expired_s x = {
+         .timestamp = v->elem->timestamp,
+         .step = vs->step
+      };
+      if(vs->tombstones && v->elem->data->o.type != BUZZTYPE_NIL) {
+         /* Tell the neighbors to delete the entry too */
+         buzzvstig_elem_t t = buzzvstig_elem_new(
+            buzzheap_newobj(vm, BUZZTYPE_NIL),
+            buzzvstig_clock_tick(vm, v->elem->timestamp),
+            vm->robot);
+         buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, v->key, t);
+         x.timestamp = t->timestamp;
+         free(t);
+      }
+      buzzdict_set(vs->expired, &v->key, &x);
+      buzzvstig_remove(vs, &v->key);
+   }
+   buzzdarray_destroy(&p.victims);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzvstig_isexpired(const buzzvstig_t vs,
+                        const buzzobj_t key,
+                        uint64_t timestamp) {
+   const struct buzzvstig_expired_s* x =
+      buzzdict_get(vs->expired, &key, struct buzzvstig_expired_s);
+   return x && !buzzvstig_ts_newer(timestamp, x->timestamp);
+}
+
+/****************************************/
+/****************************************/
+
 int buzzvstig_onconflict(struct buzzvm_s* vm) {
    buzzvm_lnum_assert(vm, 1);
    /* Get vstig id */
@@ -541,6 +1710,32 @@ int buzzvstig_onconflictlost(struct buzzvm_s* vm) {
 /****************************************/
 /****************************************/
 
+/*
+ * Pushes a table describing an entry, for the conflict managers.
+ * The timestamp is 64-bit, wider than a Buzz int: 'timestamp' is an int
+ * when it fits and an approximate float otherwise; 'timestamp_hi' and
+ * 'timestamp_lo' give it exactly, as timestamp_hi * 2^31 + timestamp_lo.
+ */
+static void buzzvstig_push_elem(buzzvm_t vm,
+                                buzzvstig_elem_t e) {
+   buzzvm_pusht(vm);
+   add_field(robot, e, pushi);
+   add_field(data, e, push);
+   buzzvm_dup(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "timestamp", 1));
+   if(e->timestamp <= INT32_MAX) buzzvm_pushi(vm, e->timestamp);
+   else buzzvm_pushf(vm, e->timestamp);
+   buzzvm_tput(vm);
+   buzzvm_dup(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "timestamp_hi", 1));
+   buzzvm_pushi(vm, e->timestamp >> 31);
+   buzzvm_tput(vm);
+   buzzvm_dup(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "timestamp_lo", 1));
+   buzzvm_pushi(vm, e->timestamp & INT32_MAX);
+   buzzvm_tput(vm);
+}
+
 buzzvstig_elem_t buzzvstig_onconflict_call(buzzvm_t vm,
                                            buzzvstig_t vs,
                                            buzzobj_t k,
@@ -553,15 +1748,9 @@ buzzvstig_elem_t buzzvstig_onconflict_call(buzzvm_t vm,
       /* Push key */
       buzzvm_push(vm, k);
       /* Make table for local value */
-      buzzvm_pusht(vm);
-      add_field(robot, lv, pushi);
-      add_field(data, lv, push);
-      add_field(timestamp, lv, pushi);
+      buzzvstig_push_elem(vm, lv);
       /* Make table for remote value */
-      buzzvm_pusht(vm);
-      add_field(robot, rv, pushi);
-      add_field(data, rv, push);
-      add_field(timestamp, rv, pushi);
+      buzzvstig_push_elem(vm, rv);
       /* Call closure (key, lv, rv on the stack) */
       buzzvm_closure_call(vm, 3);
       /* Make new entry with return value */
@@ -622,10 +1811,7 @@ void buzzvstig_onconflictlost_call(buzzvm_t vm,
       /* Push key */
       buzzvm_push(vm, k);
       /* Make table for local value */
-      buzzvm_pusht(vm);
-      add_field(robot, lv, pushi);
-      add_field(data, lv, push);
-      add_field(timestamp, lv, pushi);
+      buzzvstig_push_elem(vm, lv);
       /* Call closure (key and table are on the stack) */
       buzzvm_closure_call(vm, 2);
    }
@@ -633,3 +1819,231 @@ void buzzvstig_onconflictlost_call(buzzvm_t vm,
 
 /****************************************/
 /****************************************/
+
+/*
+ * Scrambles the bits of a hash (MurmurHash3 finalizer).
+ */
+static uint32_t buzzvstig_digest_mix(uint32_t h) {
+   h ^= h >> 16;
+   h *= 0x85ebca6b;
+   h ^= h >> 13;
+   h *= 0xc2b2ae35;
+   h ^= h >> 16;
+   return h;
+}
+
+/*
+ * Returns the fingerprint of a key.
+ * The lowest bits of the fingerprint give the bucket of the key.
+ */
+static uint32_t buzzvstig_digest_key(const buzzobj_t key) {
+   return buzzvstig_digest_mix(buzzobj_hash(key));
+}
+
+/*
+ * Returns a hash of the timestamp and robot id of an entry.
+ */
+static uint32_t buzzvstig_digest_version(const buzzvstig_elem_t e) {
+   return buzzvstig_digest_mix(
+      buzzvstig_digest_mix(e->timestamp >> 32) + (uint32_t)e->timestamp) * 31 +
+      e->robot;
+}
+
+/****************************************/
+/****************************************/
+
+uint16_t buzzvstig_digest_size(const buzzvstig_t vs) {
+   /* Aim for about 8 entries per bucket */
+   uint32_t n = 1;
+   while(n < BUZZVSTIG_DIGEST_MAXBUCKETS &&
+         n * 8 < buzzdict_size(vs->data))
+      n <<= 1;
+   return n;
+}
+
+/****************************************/
+/****************************************/
+
+struct buzzvstig_digest_params {
+   uint32_t* buckets;
+   uint16_t nbuckets;
+};
+
+void buzzvstig_digest_entry(const void* key, void* data, void* params) {
+   struct buzzvstig_digest_params* p = (struct buzzvstig_digest_params*)params;
+   uint32_t k = buzzvstig_digest_key(*(buzzobj_t*)key);
+   /* Sum rather than xor, so that equal contributions do not cancel out */
+   p->buckets[k & (p->nbuckets - 1)] +=
+      buzzvstig_digest_mix(k * 31 + buzzvstig_digest_version(*(buzzvstig_elem_t*)data));
+}
+
+void buzzvstig_digest(const buzzvstig_t vs,
+                      uint32_t* buckets,
+                      uint16_t nbuckets) {
+   memset(buckets, 0, nbuckets * sizeof(uint32_t));
+   struct buzzvstig_digest_params p = {
+      .buckets = buckets,
+      .nbuckets = nbuckets
+   };
+   buzzvstig_foreach_elem(vs, buzzvstig_digest_entry, &p);
+}
+
+/****************************************/
+/****************************************/
+
+struct buzzvstig_digest_compare_params {
+   const uint32_t* local;
+   const uint32_t* remote;
+   uint16_t nbuckets;
+   /* For each differing bucket, the entry descriptions */
+   buzzdarray_t* entries;
+};
+
+void buzzvstig_digest_compare_entry(const void* key, void* data, void* params) {
+   struct buzzvstig_digest_compare_params* p =
+      (struct buzzvstig_digest_compare_params*)params;
+   uint32_t k = buzzvstig_digest_key(*(buzzobj_t*)key);
+   uint32_t b = k & (p->nbuckets - 1);
+   if(p->local[b] == p->remote[b]) return;
+   buzzvstig_elem_t e = *(buzzvstig_elem_t*)data;
+   uint32_t d[BUZZVSTIG_DIGEST_ENTRY_SIZE] = {
+      k, e->timestamp >> 32, e->timestamp, e->robot
+   };
+   uint32_t i;
+   for(i = 0; i < BUZZVSTIG_DIGEST_ENTRY_SIZE; ++i)
+      buzzdarray_push(p->entries[b], d + i);
+}
+
+void buzzvstig_digest_compare(buzzvm_t vm,
+                              uint16_t id,
+                              const buzzvstig_t vs,
+                              const uint32_t* buckets,
+                              uint16_t nbuckets) {
+   uint16_t i;
+   /* Calculate the local digest with the same number of buckets */
+   uint32_t local[BUZZVSTIG_DIGEST_MAXBUCKETS];
+   buzzvstig_digest(vs, local, nbuckets);
+   /* Collect the entries of the buckets that differ */
+   buzzdarray_t entries[BUZZVSTIG_DIGEST_MAXBUCKETS];
+   for(i = 0; i < nbuckets; ++i)
+      entries[i] = local[i] != buckets[i] ?
+         buzzdarray_new(16, sizeof(uint32_t), NULL) :
+         NULL;
+   struct buzzvstig_digest_compare_params p = {
+      .local = local,
+      .remote = buckets,
+      .nbuckets = nbuckets,
+      .entries = entries
+   };
+   buzzvstig_foreach_elem(vs, buzzvstig_digest_compare_entry, &p);
+   /* Describe the differing buckets to the neighbors */
+   for(i = 0; i < nbuckets; ++i) {
+      if(!entries[i]) continue;
+      buzzoutmsg_queue_append_vstig_bucket(vm, id, nbuckets, i,
+                                           (uint32_t*)entries[i]->data,
+                                           buzzdarray_size(entries[i]) / BUZZVSTIG_DIGEST_ENTRY_SIZE);
+      buzzdarray_destroy(&entries[i]);
+   }
+}
+
+/****************************************/
+/****************************************/
+
+struct buzzvstig_digest_repair_params {
+   buzzvm_t vm;
+   uint16_t id;
+   uint16_t nbuckets;
+   uint16_t bucket;
+   /* The remote entry descriptions, sorted by key */
+   const uint32_t* entries;
+   uint16_t count;
+   /* The fingerprints of the local entries in the bucket, sorted */
+   buzzdarray_t local;
+};
+
+static int buzzvstig_digest_entry_cmp(const void* a, const void* b) {
+   uint32_t ka = *(const uint32_t*)a, kb = *(const uint32_t*)b;
+   if(ka < kb) return -1;
+   if(ka > kb) return  1;
+   return 0;
+}
+
+/*
+ * Returns 1 if a fingerprint appears more than once in a sorted array.
+ * @param x The position of the fingerprint in the array.
+ * @param first The first element of the array.
+ * @param count The number of elements.
+ * @param stride The number of values per element.
+ */
+static int buzzvstig_digest_isdup(const uint32_t* x,
+                                  const uint32_t* first,
+                                  uint32_t count,
+                                  uint32_t stride) {
+   return
+      (x > first && *(x - stride) == *x) ||
+      (x + stride < first + count * stride && *(x + stride) == *x);
+}
+
+void buzzvstig_digest_repair_collect(const void* key, void* data, void* params) {
+   struct buzzvstig_digest_repair_params* p =
+      (struct buzzvstig_digest_repair_params*)params;
+   uint32_t fk = buzzvstig_digest_key(*(buzzobj_t*)key);
+   if((fk & (p->nbuckets - 1)) == p->bucket) buzzdarray_push(p->local, &fk);
+}
+
+void buzzvstig_digest_repair_entry(const void* key, void* data, void* params) {
+   struct buzzvstig_digest_repair_params* p =
+      (struct buzzvstig_digest_repair_params*)params;
+   buzzobj_t k = *(buzzobj_t*)key;
+   buzzvstig_elem_t e = *(buzzvstig_elem_t*)data;
+   uint32_t fk = buzzvstig_digest_key(k);
+   if((fk & (p->nbuckets - 1)) != p->bucket) return;
+   /* Does the neighbor know this entry? */
+   const uint32_t* r = (const uint32_t*)bsearch(&fk, p->entries, p->count,
+                                                BUZZVSTIG_DIGEST_ENTRY_SIZE * sizeof(uint32_t),
+                                                buzzvstig_digest_entry_cmp);
+   /*
+    * The fingerprint of another key might match: in that case, the
+    * versions cannot be compared, so the entry is always sent
+    */
+   const uint32_t* l = (const uint32_t*)bsearch(&fk, p->local->data, buzzdarray_size(p->local),
+                                                sizeof(uint32_t),
+                                                buzzvstig_digest_entry_cmp);
+   if(r &&
+      !buzzvstig_digest_isdup(r, p->entries, p->count, BUZZVSTIG_DIGEST_ENTRY_SIZE) &&
+      !buzzvstig_digest_isdup(l, (const uint32_t*)p->local->data, buzzdarray_size(p->local), 1)) {
+      /* Yes; nothing to do unless the local entry is newer or in conflict */
+      uint64_t rts = ((uint64_t)r[1] << 32) | r[2];
+      if(buzzvstig_ts_newer(rts, e->timestamp)) return;
+      if(rts == e->timestamp && r[3] == e->robot) return;
+   }
+   buzzoutmsg_queue_append_vstig(p->vm, BUZZMSG_VSTIG_PUT, p->id, k, e);
+}
+
+void buzzvstig_digest_repair(buzzvm_t vm,
+                             uint16_t id,
+                             const buzzvstig_t vs,
+                             uint16_t nbuckets,
+                             uint16_t bucket,
+                             uint32_t* entries,
+                             uint16_t count) {
+   /* Sort the remote entries by key for fast lookup */
+   qsort(entries, count, BUZZVSTIG_DIGEST_ENTRY_SIZE * sizeof(uint32_t), buzzvstig_digest_entry_cmp);
+   /* Send the local entries the neighbor is missing */
+   struct buzzvstig_digest_repair_params p = {
+      .vm = vm,
+      .id = id,
+      .nbuckets = nbuckets,
+      .bucket = bucket,
+      .entries = entries,
+      .count = count,
+      .local = buzzdarray_new(16, sizeof(uint32_t), NULL)
+   };
+   buzzvstig_foreach_elem(vs, buzzvstig_digest_repair_collect, &p);
+   qsort(p.local->data, buzzdarray_size(p.local), sizeof(uint32_t), buzzvstig_digest_entry_cmp);
+   buzzvstig_foreach_elem(vs, buzzvstig_digest_repair_entry, &p);
+   buzzdarray_destroy(&p.local);
+}
+
+/****************************************/
+/****************************************/
@@ -3,6 +3,7 @@
 
 #include <buzz/buzztype.h>
 #include <buzz/buzzdict.h>
+#include <buzz/buzzvstiglog.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -14,13 +15,51 @@ extern "C" {
    struct buzzvstig_elem_s {
       /* The data associated to the entry */
       buzzobj_t data;
-      /* The timestamp (Lamport clock) */
-      uint16_t timestamp;
+      /* The timestamp (Lamport or hybrid logical clock) */
+      uint64_t timestamp;
       /* The robot id */
       uint16_t robot;
+      /* The local step of the last update, for expiry */
+      uint32_t updated;
+      /* The local step of the last access, for eviction */
+      uint32_t used;
    };
    typedef struct buzzvstig_elem_s* buzzvstig_elem_t;
 
+   /*
+    * Virtual stigmergy propagation modes.
+    */
+   typedef enum {
+      /* Every update is flooded through the swarm */
+      BUZZVSTIG_MODE_FLOOD = 0,
+      /* Updates are sent to the neighbors only, and the robots
+       * periodically exchange digests to repair the differences */
+      BUZZVSTIG_MODE_ANTIENTROPY
+   } buzzvstig_mode_e;
+
+   /*
+    * Virtual stigmergy eviction policies.
+    */
+   typedef enum {
+      /* Evict the least recently used entries */
+      BUZZVSTIG_EVICT_LRU = 0,
+      /* Evict the least recently updated entries */
+      BUZZVSTIG_EVICT_OLDEST
+   } buzzvstig_evict_e;
+
+   /*
+    * Virtual stigmergy native aggregates.
+    */
+   typedef enum {
+      BUZZVSTIG_AGG_SUM = 0, // Sum of the values
+      BUZZVSTIG_AGG_MIN,     // Smallest value
+      BUZZVSTIG_AGG_MAX,     // Largest value
+      BUZZVSTIG_AGG_COUNT,   // Number of values
+      BUZZVSTIG_AGG_ARGMIN,  // Key of the smallest value
+      BUZZVSTIG_AGG_ARGMAX,  // Key of the largest value
+      BUZZVSTIG_AGG_COUNT_OPS
+   } buzzvstig_agg_e;
+
    /*
     * The virtual stigmergy data.
     */
@@ -28,6 +67,30 @@ extern "C" {
       buzzdict_t data;
       buzzobj_t onconflict;
       buzzobj_t onconflictlost;
+      /* The propagation mode */
+      uint8_t mode;
+      /* Steps left before the next digest (anti-entropy mode only) */
+      uint16_t digesttimer;
+      /* Steps without updates before an entry expires (0 = never) */
+      uint32_t ttl;
+      /* Maximum number of entries (0 = unlimited) */
+      uint32_t capacity;
+      /* The eviction policy */
+      uint8_t evict;
+      /* Whether expired and evicted entries are deleted on the neighbors too */
+      uint8_t tombstones;
+      /* Step counter */
+      uint32_t step;
+      /* Recently expired and evicted keys, as key (buzzobj_t) -> buzzvstig_expired_s */
+      buzzdict_t expired;
+      /* Cell size of a spatial stigmergy (0 = not spatial) */
+      float cell;
+      /* Position of this robot, for the propagation range */
+      float pos[3];
+      /* Distance beyond which received entries are not relayed (0 = unlimited) */
+      float range;
+      /* The on-disk log, or NULL if the stigmergy is in memory only */
+      buzzvstiglog_t log;
    };
    typedef struct buzzvstig_s* buzzvstig_t;
 
@@ -47,12 +110,12 @@ extern "C" {
    /*
     * Creates a new virtual stigmergy entry.
     * @param data The data associated to the entry.
-    * @param timestamp The timestamp (Lamport clock).
+    * @param timestamp The timestamp.
     * @param robot The robot id.
     * @return The new virtual stigmergy entry.
     */
    extern buzzvstig_elem_t buzzvstig_elem_new(buzzobj_t data,
-                                              uint16_t timestamp,
+                                              uint64_t timestamp,
                                               uint16_t robot);
 
    /*
@@ -70,23 +133,95 @@ extern "C" {
     */
    extern buzzvstig_t buzzvstig_new();
 
+   /*
+    * Creates a new spatial virtual stigmergy structure.
+    * The keys are the cells of a grid, as returned by buzzvstig_cell_key().
+    * @param cell The cell size.
+    * @return The new virtual stigmergy structure.
+    */
+   extern buzzvstig_t buzzvstig_spatial_new(float cell);
+
+   /*
+    * Returns the key of the cell that contains the given position.
+    * The cell coordinates are packed in the key: 12 bits for x and y,
+    * 8 bits for z, so a spatial stigmergy spans 4096x4096x256 cells.
+    * @param vs The virtual stigmergy structure.
+    * @param x The x coordinate.
+    * @param y The y coordinate.
+    * @param z The z coordinate.
+    * @param key The key of the cell.
+    * @return 1 if the position is within the bounds, 0 otherwise.
+    */
+   extern int buzzvstig_cell_key(const buzzvstig_t vs,
+                                 float x,
+                                 float y,
+                                 float z,
+                                 int32_t* key);
+
+   /*
+    * Returns the position of the center of a cell.
+    * @param vs The virtual stigmergy structure.
+    * @param key The key of the cell.
+    * @param pos The position.
+    */
+   extern void buzzvstig_cell_center(const buzzvstig_t vs,
+                                     int32_t key,
+                                     float pos[3]);
+
+   /*
+    * Returns 1 if an entry received from a neighbor must be relayed.
+    * In a spatial stigmergy with a range, only the cells within the range
+    * of this robot are relayed; otherwise, all the entries are.
+    * @param vs The virtual stigmergy structure.
+    * @param key The key of the entry.
+    * @return 1 if the entry must be relayed, 0 otherwise.
+    */
+   extern int buzzvstig_inrange(const buzzvstig_t vs,
+                                const buzzobj_t key);
+
    /*
     * Destroys a virtual stigmergy structure.
     * @param vs The virtual stigmergy structure.
     */
    extern void buzzvstig_destroy(buzzvstig_t* vs);
 
+   /*
+    * Returns the timestamp of a new local write.
+    * Without physical time (vm->vstigtime is 0), this is the previous
+    * timestamp of the entry plus one (Lamport clock). Otherwise, this is a
+    * hybrid logical clock: the physical time in the upper 48 bits and a
+    * counter in the lower 16 bits, always newer than the previous timestamp
+    * and than any timestamp the robot has seen.
+    * @param vm The Buzz VM state.
+    * @param prev The previous timestamp of the entry (0 if none).
+    * @return The new timestamp.
+    */
+   extern uint64_t buzzvstig_clock_tick(struct buzzvm_s* vm,
+                                        uint64_t prev);
+
+   /*
+    * Updates the hybrid logical clock with a received timestamp.
+    * @param vm The Buzz VM state.
+    * @param ts The received timestamp.
+    */
+   extern void buzzvstig_clock_update(struct buzzvm_s* vm,
+                                      uint64_t ts);
+
    /*
     * Serializes an element in the virtual stigmergy.
+    * The timestamp must be wide if buzzvstig_elem_iswide() is true. Set
+    * BUZZMSG_FLAG_WIDE in the message type when the timestamps are wide.
     * The data is appended to the given buffer. The buffer is treated as a
     * dynamic array of uint8_t.
     * @param buf The output buffer where the serialized data is appended.
     * @param key The key of the element to serialize.
     * @param data The data of the element to serialize.
+    * @param wide 1 to make the timestamp 64-bit wide, 0 for 16-bit wide.
     */
    extern void buzzvstig_elem_serialize(buzzmsg_payload_t buf,
                                         const buzzobj_t key,
-                                        const buzzvstig_elem_t data);
+                                        const buzzvstig_elem_t data,
+                                        int wide);
 
    /*
     * Deserializes a virtual stigmergy element.
@@ -96,6 +231,7 @@ extern "C" {
     * @param data The deserialized data of the element.
     * @param buf The input buffer where the serialized data is stored.
     * @param pos The position at which the data starts.
+    * @param wide 1 if the timestamp is 64-bit wide, 0 if it is 16-bit wide.
     * @param vm The Buzz VM data.
     * @return The new position in the buffer, of -1 in case of error.
     */
@@ -103,8 +239,70 @@ extern "C" {
                                              buzzvstig_elem_t* data,
                                              buzzmsg_payload_t buf,
                                              uint32_t pos,
+                                             int wide,
                                              struct buzzvm_s* vm);
 
+   /*
+    * Returns the number of digest buckets to use for a virtual stigmergy.
+    * The number is a power of two that grows with the number of entries.
+    * @param vs The virtual stigmergy structure.
+    * @return The number of digest buckets.
+    */
+   extern uint16_t buzzvstig_digest_size(const buzzvstig_t vs);
+
+   /*
+    * Calculates the digest of a virtual stigmergy.
+    * The entries are spread into buckets by key. The value of a bucket
+    * combines the keys, timestamps and robot ids of its entries, but not
+    * the data.
+    * @param vs The virtual stigmergy structure.
+    * @param buckets The buffer where the digest is written.
+    * @param nbuckets The number of buckets (a power of two).
+    */
+   extern void buzzvstig_digest(const buzzvstig_t vs,
+                                uint32_t* buckets,
+                                uint16_t nbuckets);
+
+   /*
+    * Compares a digest received from a neighbor with the local one.
+    * For each bucket that differs, a BUZZMSG_VSTIG_BUCKET message describing
+    * the local entries in the bucket is queued. Each entry is described by
+    * BUZZVSTIG_DIGEST_ENTRY_SIZE values: the key fingerprint, the high and
+    * low halves of the timestamp, and the robot id.
+    * @param vm The Buzz VM state.
+    * @param id The id of the virtual stigmergy.
+    * @param vs The virtual stigmergy structure.
+    * @param buckets The received digest.
+    * @param nbuckets The number of buckets in the digest (a power of two).
+    */
+   extern void buzzvstig_digest_compare(struct buzzvm_s* vm,
+                                        uint16_t id,
+                                        const buzzvstig_t vs,
+                                        const uint32_t* buckets,
+                                        uint16_t nbuckets);
+
+   /*
+    * Sends a neighbor the entries of a bucket it is missing.
+    * A PUT message is queued for each local entry in the bucket that is
+    * unknown to the neighbor, or newer than what the neighbor has. The
+    * entries are matched by key fingerprint; an entry whose fingerprint
+    * is shared by another key, locally or at the neighbor, is always sent.
+    * @param vm The Buzz VM state.
+    * @param id The id of the virtual stigmergy.
+    * @param vs The virtual stigmergy structure.
+    * @param nbuckets The number of buckets (a power of two).
+    * @param bucket The bucket.
+    * @param entries The entry descriptions of the neighbor. The buffer is sorted in place.
+    * @param count The number of entries.
+    */
+   extern void buzzvstig_digest_repair(struct buzzvm_s* vm,
+                                       uint16_t id,
+                                       const buzzvstig_t vs,
+                                       uint16_t nbuckets,
+                                       uint16_t bucket,
+                                       uint32_t* entries,
+                                       uint16_t count);
+
    /*
     * Buzz C closure to create a new stigmergy object.
     * @param vm The Buzz VM state.
@@ -112,6 +310,13 @@ extern "C" {
     */
    extern int buzzvstig_create(struct buzzvm_s* vm);
 
+   /*
+    * Buzz C closure to create a new spatial stigmergy object.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzvstig_spatial(struct buzzvm_s* vm);
+
    /*
     * Buzz C closure to get the number of elements in a virtual stigmergy structure.
     * @param vm The Buzz VM state.
@@ -133,6 +338,33 @@ extern "C" {
     */
    extern int buzzvstig_get(struct buzzvm_s* vm);
 
+   /*
+    * Buzz C closure to put many elements in a stigmergy object.
+    * The elements are given as a table of (key, value) pairs, and their
+    * PUT messages are packed together.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzvstig_putmany(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to get many elements from a stigmergy object.
+    * The keys are given as the values of a table. The result is a table
+    * of (key, value) pairs for the keys that were found.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzvstig_getmany(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to list the keys of a stigmergy object, in order.
+    * Numeric keys come first, then string keys in lexicographic order.
+    * An optional string restricts the list to the keys with that prefix.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzvstig_keys(struct buzzvm_s* vm);
+
    /*
     * Buzz C closure to loop through the elements of a stigmergy object.
     * @param vm The Buzz VM state.
@@ -155,6 +387,15 @@ extern "C" {
     */
    extern int buzzvstig_map(struct buzzvm_s* vm);
 
+   /*
+    * Buzz C closure to compute an aggregate over the elements of a stigmergy object.
+    * The aggregate is computed natively, without calling a Buzz function per element.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    * @see buzzvstig_aggregate_elems()
+    */
+   extern int buzzvstig_aggregate(struct buzzvm_s* vm);
+
    /*
     * Buzz C closure to set the function to call on write conflict.
     * @param vm The Buzz VM state.
@@ -169,6 +410,119 @@ extern "C" {
     */
    extern int buzzvstig_onconflictlost(struct buzzvm_s* vm);
 
+   /*
+    * Buzz C closure to set the time to live of the entries.
+    * An entry that is not updated for the given number of steps is removed.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzvstig_setttl(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to set the maximum number of entries and, optionally,
+    * the eviction policy.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzvstig_setcapacity(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to choose whether expired and evicted entries are
+    * deleted on the neighbors too.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzvstig_settombstones(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to write the cell that contains a position in a spatial stigmergy.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzvstig_putat(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to read the cell that contains a position in a spatial stigmergy.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzvstig_getat(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to list the cells of a spatial stigmergy within a radius.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzvstig_near(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to list the cells of a spatial stigmergy within a box.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzvstig_box(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to set the position of this robot in a spatial stigmergy.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzvstig_setposition(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to set the distance beyond which received entries are not relayed.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzvstig_setrange(struct buzzvm_s* vm);
+
+   /*
+    * Advances the step counter of a virtual stigmergy, removes the expired
+    * entries and evicts the entries beyond the capacity.
+    * If tombstones are enabled, a nil PUT is queued for each removed entry.
+    * Called at every step by buzzvm_process_outmsgs().
+    * @param vm The Buzz VM state.
+    * @param id The id of the virtual stigmergy.
+    * @param vs The virtual stigmergy structure.
+    */
+   extern void buzzvstig_expire(struct buzzvm_s* vm,
+                                uint16_t id,
+                                buzzvstig_t vs);
+
+   /*
+    * Computes an aggregate over the elements of a virtual stigmergy.
+    * Only the numeric values are taken into account. If a field is given,
+    * the values must be tables, and the aggregate is computed over the
+    * given field of each table.
+    * The sum is an integer if all the values are integers, a float otherwise.
+    * Min and max return the value, argmin and argmax return its key.
+    * When there are no numeric values, the sum and the count are 0, and
+    * the other aggregates are nil.
+    * @param vm The Buzz VM state.
+    * @param vs The virtual stigmergy structure.
+    * @param op The aggregate.
+    * @param field The field to aggregate, or NULL to aggregate the values.
+    * @return The result.
+    * @see buzzvstig_agg_e
+    */
+   extern buzzobj_t buzzvstig_aggregate_elems(struct buzzvm_s* vm,
+                                              const buzzvstig_t vs,
+                                              uint8_t op,
+                                              const buzzobj_t field);
+
+   /*
+    * Returns 1 if an entry was recently removed by buzzvstig_expire() and
+    * the given timestamp is not newer than the removed entry.
+    * Such entries must not be stored again, or they would be flooded back.
+    * @param vs The virtual stigmergy structure.
+    * @param key The key of the entry.
+    * @param timestamp The timestamp of the received entry.
+    * @return 1 if the entry was removed, 0 otherwise.
+    */
+   extern int buzzvstig_isexpired(const buzzvstig_t vs,
+                                  const buzzobj_t key,
+                                  uint64_t timestamp);
+
    /*
     * Calls the write conflict manager.
     * @param vm The Buzz VM state.
@@ -203,18 +557,21 @@ extern "C" {
 
 /*
  * Puts data into a virtual stigmergy structure.
+ * The element is marked as updated and used at the current step, and
+ * appended to the log if the structure has one.
  * @param vs The virtual stigmergy structure.
  * @param key The key.
  * @param el The element.
  */
-#define buzzvstig_store(vs, key, el) buzzdict_set((vs)->data, (key), (el));
+#define buzzvstig_store(vs, key, el) ((*(el))->updated = (*(el))->used = (vs)->step, buzzdict_set((vs)->data, (key), (el)), ((vs)->log ? buzzvstiglog_put((vs)->log, *(key), *(el)) : (void)0));
 
 /*
  * Deletes data from a virtual stigmergy structure.
+ * The removal is appended to the log if the structure has one.
  * @param vs The virtual stigmergy structure.
  * @param key The key.
  */
-#define buzzvstig_remove(vs, key) buzzdict_remove((vs)->data, (key));
+#define buzzvstig_remove(vs, key) (((vs)->log ? buzzvstiglog_remove((vs)->log, *(key)) : (void)0), buzzdict_remove((vs)->data, (key)));
 
 /*
  * Applies the given function to each element in the virtual stigmergy structure.
@@ -225,4 +582,48 @@ extern "C" {
  */
 #define buzzvstig_foreach_elem(vs, fun, params) buzzdict_foreach((vs)->data, fun, params);
 
+/*
+ * Returns <tt>true</tt> if timestamp a is newer than timestamp b.
+ * The comparison is wrap-safe: a is newer if it is less than 2^63 ahead.
+ * @param a A timestamp.
+ * @param b A timestamp.
+ */
+#define buzzvstig_ts_newer(a, b) ((int64_t)((uint64_t)(a) - (uint64_t)(b)) > 0)
+
+/*
+ * Extends a 16-bit timestamp to the 64-bit timestamp closest to a reference.
+ * Used for the timestamps received in the 16-bit format. While the reference
+ * fits in 16 bits, the timestamp is taken as it is.
+ * @param ref The reference timestamp.
+ * @param ts The 16-bit timestamp.
+ */
+#define buzzvstig_ts_extend(ref, ts) ((uint64_t)(ref) <= UINT16_MAX ? (uint64_t)(uint16_t)(ts) : (uint64_t)(ref) + (int16_t)((uint16_t)(ts) - (uint16_t)(ref)))
+
+/*
+ * Returns <tt>true</tt> if an entry must be serialized with a 64-bit timestamp.
+ * @param e The entry.
+ */
+#define buzzvstig_elem_iswide(e) ((e)->timestamp > UINT16_MAX)
+
+/*
+ * Number of control steps between two digests in anti-entropy mode.
+ */
+#define BUZZVSTIG_DIGEST_PERIOD 10
+
+/*
+ * Maximum number of buckets in a digest.
+ */
+#define BUZZVSTIG_DIGEST_MAXBUCKETS 256
+
+/*
+ * Minimum number of steps a robot remembers the expired and evicted keys.
+ */
+#define BUZZVSTIG_EXPIRED_KEEP 100
+
+/*
+ * Number of 32-bit values that describe an entry in a bucket message.
+ * @see buzzvstig_digest_compare
+ */
+#define BUZZVSTIG_DIGEST_ENTRY_SIZE 4
+
 #endif
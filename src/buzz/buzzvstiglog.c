@@ -0,0 +1,361 @@
+#include "buzzvstiglog.h"
+#include "buzzvstig.h"
+#include "buzzvm.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/****************************************/
+/****************************************/
+
+/*
+ * The header of a log file.
+ */
+struct buzzvstiglog_header_s {
+   /* BUZZVSTIGLOG_MAGIC */
+   uint32_t magic;
+   /* BUZZVSTIGLOG_VERSION */
+   uint32_t version;
+   /* The end of the valid data */
+   uint64_t tail;
+};
+
+#define BUZZVSTIGLOG_MAGIC   0x4c565a42 /* "BZVL" */
+#define BUZZVSTIGLOG_VERSION 1
+
+#define BUZZVSTIGLOG_HEADER ((uint64_t)sizeof(struct buzzvstiglog_header_s))
+
+/*
+ * Record operations.
+ */
+#define BUZZVSTIGLOG_OP_PUT    0
+#define BUZZVSTIGLOG_OP_REMOVE 1
+
+#define header(LOG) ((struct buzzvstiglog_header_s*)(LOG)->map)
+
+/****************************************/
+/****************************************/
+
+/*
+ * Resizes the file and maps it.
+ */
+static int buzzvstiglog_map(buzzvstiglog_t log,
+                            uint64_t size) {
+   if(log->map) {
+      munmap(log->map, log->size);
+      log->map = NULL;
+   }
+   if(ftruncate(log->fd, size) < 0) return -1;
+   void* m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, log->fd, 0);
+   if(m == MAP_FAILED) return -1;
+   log->map = (uint8_t*)m;
+   log->size = size;
+   return 0;
+}
+
+/****************************************/
+/****************************************/
+
+buzzvstiglog_t buzzvstiglog_open(const char* path) {
+   int fd = open(path, O_RDWR | O_CREAT, 0644);
+   if(fd < 0) return NULL;
+   struct stat st;
+   if(fstat(fd, &st) < 0) {
+      int err = errno;
+      close(fd);
+      errno = err;
+      return NULL;
+   }
+   /* Check the header of an existing log before touching the file */
+   int fresh = st.st_size < BUZZVSTIGLOG_HEADER;
+   if(!fresh) {
+      struct buzzvstiglog_header_s h;
+      if(pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+         h.magic != BUZZVSTIGLOG_MAGIC ||
+         h.version != BUZZVSTIGLOG_VERSION ||
+         h.tail < BUZZVSTIGLOG_HEADER ||
+         h.tail > st.st_size) {
+         close(fd);
+         errno = EINVAL;
+         return NULL;
+      }
+   }
+   buzzvstiglog_t log = (buzzvstiglog_t)calloc(1, sizeof(struct buzzvstiglog_s));
+   log->fd = fd;
+   uint64_t size = st.st_size;
+   if(size < BUZZVSTIGLOG_INITIAL_SIZE) size = BUZZVSTIGLOG_INITIAL_SIZE;
+   if(buzzvstiglog_map(log, size) < 0) {
+      int err = errno;
+      close(fd);
+      free(log);
+      errno = err;
+      return NULL;
+   }
+   if(fresh) {
+      header(log)->magic = BUZZVSTIGLOG_MAGIC;
+      header(log)->version = BUZZVSTIGLOG_VERSION;
+      header(log)->tail = BUZZVSTIGLOG_HEADER;
+   }
+   log->tail = header(log)->tail;
+   log->path = strdup(path);
+   log->buf = buzzdarray_new(64, sizeof(uint8_t), NULL);
+   return log;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvstiglog_close(buzzvstiglog_t* log) {
+   if((*log)->map) {
+      msync((*log)->map, (*log)->size, MS_SYNC);
+      munmap((*log)->map, (*log)->size);
+      /* Drop the unused space at the end of the file */
+      if(ftruncate((*log)->fd, (*log)->tail) < 0) {}
+   }
+   close((*log)->fd);
+   buzzdarray_destroy(&(*log)->buf);
+   free((*log)->path);
+   free(*log);
+   *log = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Appends the record in log->buf.
+ */
+static void buzzvstiglog_append(buzzvstiglog_t log) {
+   if(!log->map) return;
+   uint32_t len = buzzdarray_size(log->buf);
+   uint64_t end = log->tail + sizeof(uint32_t) + len;
+   if(end > log->size) {
+      uint64_t size = log->size;
+      while(size < end) size *= 2;
+      if(buzzvstiglog_map(log, size) < 0) {
+         fprintf(stderr, "[WARNING] Can't grow the stigmergy log %s: %s\n",
+                 log->path, strerror(errno));
+         return;
+      }
+   }
+   memcpy(log->map + log->tail, &len, sizeof(uint32_t));
+   memcpy(log->map + log->tail + sizeof(uint32_t), log->buf->data, len);
+   /* Mark the record as valid only once it is complete */
+   log->tail = end;
+   header(log)->tail = end;
+   ++log->records;
+   log->dirty = 1;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvstiglog_put(buzzvstiglog_t log,
+                      const buzzobj_t key,
+                      const struct buzzvstig_elem_s* e) {
+   buzzdarray_clear(log->buf, 64);
+   buzzmsg_serialize_u8(log->buf, BUZZVSTIGLOG_OP_PUT);
+   buzzvstig_elem_serialize(log->buf, key, (buzzvstig_elem_t)e, 1);
+   buzzvstiglog_append(log);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvstiglog_remove(buzzvstiglog_t log,
+                         const buzzobj_t key) {
+   buzzdarray_clear(log->buf, 64);
+   buzzmsg_serialize_u8(log->buf, BUZZVSTIGLOG_OP_REMOVE);
+   buzzobj_serialize(log->buf, key);
+   buzzvstiglog_append(log);
+}
+
+/****************************************/
+/****************************************/
+
+uint32_t buzzvstiglog_load(buzzvstiglog_t log,
+                           buzzvm_t vm,
+                           buzzvstig_t vs) {
+   uint32_t n = 0;
+   uint64_t pos = BUZZVSTIGLOG_HEADER;
+   while(pos + sizeof(uint32_t) <= log->tail) {
+      uint32_t len;
+      memcpy(&len, log->map + pos, sizeof(uint32_t));
+      if(len == 0 || pos + sizeof(uint32_t) + len > log->tail) break;
+      buzzmsg_payload_t buf =
+         buzzdarray_frombuffer(log->map + pos + sizeof(uint32_t), len, sizeof(uint8_t), NULL);
+      uint8_t op;
+      buzzobj_t k;
+      int64_t p = buzzmsg_deserialize_u8(&op, buf, 0);
+      if(p >= 0 && op == BUZZVSTIGLOG_OP_PUT) {
+         buzzvstig_elem_t e = buzzvstig_elem_new(NULL, 0, 0);
+         p = buzzvstig_elem_deserialize(&k, &e, buf, p, 1, vm);
+         if(p >= 0) {
+            const buzzvstig_elem_t* l = buzzvstig_fetch(vs, &k);
+            buzzvstig_clock_update(vm, e->timestamp);
+            if(!l || buzzvstig_ts_newer(e->timestamp, (*l)->timestamp)) {
+               e->updated = e->used = vs->step;
+               buzzdict_set(vs->data, &k, &e);
+            }
+            else free(e);
+         }
+         else free(e);
+      }
+      else if(p >= 0 && op == BUZZVSTIGLOG_OP_REMOVE) {
+         p = buzzobj_deserialize(&k, buf, p, vm);
+         if(p >= 0) buzzdict_remove(vs->data, &k);
+      }
+      else p = -1;
+      buzzdarray_destroy(&buf);
+      if(p < 0) break;
+      pos += sizeof(uint32_t) + len;
+      ++n;
+   }
+   if(pos != log->tail) {
+      fprintf(stderr, "[WARNING] [ROBOT %u] Discarding %" PRIu64 " corrupted bytes at the end of the stigmergy log %s\n",
+              vm->robot, log->tail - pos, log->path);
+      log->tail = pos;
+      header(log)->tail = pos;
+   }
+   log->records = n;
+   return n;
+}
+
+/****************************************/
+/****************************************/
+
+static void buzzvstiglog_compact_entry(const void* key, void* data, void* params) {
+   buzzvstiglog_put((buzzvstiglog_t)params,
+                    *(buzzobj_t*)key,
+                    *(buzzvstig_elem_t*)data);
+}
+
+int buzzvstiglog_compact(buzzvstiglog_t log,
+                         buzzvstig_t vs) {
+   /* Write the live entries in a new log */
+   char* tmp;
+   if(asprintf(&tmp, "%s.tmp", log->path) < 0) return -1;
+   unlink(tmp);
+   buzzvstiglog_t nlog = buzzvstiglog_open(tmp);
+   if(!nlog) {
+      int err = errno;
+      free(tmp);
+      errno = err;
+      return -1;
+   }
+   buzzdict_foreach(vs->data, buzzvstiglog_compact_entry, nlog);
+   if(!nlog->map ||
+      msync(nlog->map, nlog->size, MS_SYNC) < 0 ||
+      rename(tmp, log->path) < 0) {
+      int err = errno;
+      buzzvstiglog_close(&nlog);
+      unlink(tmp);
+      free(tmp);
+      errno = err;
+      return -1;
+   }
+   free(tmp);
+   /* Replace the old log with the new one */
+   if(log->map) munmap(log->map, log->size);
+   close(log->fd);
+   log->fd      = nlog->fd;
+   log->map     = nlog->map;
+   log->size    = nlog->size;
+   log->tail    = nlog->tail;
+   log->records = nlog->records;
+   log->dirty   = 0;
+   buzzdarray_destroy(&nlog->buf);
+   free(nlog->path);
+   free(nlog);
+   return 0;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvstiglog_update(buzzvstig_t vs) {
+   buzzvstiglog_t log = vs->log;
+   if(!log || !log->map) return;
+   if(log->records >= BUZZVSTIGLOG_COMPACT_MIN &&
+      log->records > 2 * buzzdict_size(vs->data)) {
+      if(buzzvstiglog_compact(log, vs) < 0) {
+         fprintf(stderr, "[WARNING] Can't compact the stigmergy log %s: %s\n",
+                 log->path, strerror(errno));
+         /* Try again after as many new records */
+         log->records = 0;
+      }
+   }
+   if(log->dirty) {
+      /* Let the OS write the new records without waiting */
+      msync(log->map, log->size, MS_ASYNC);
+      log->dirty = 0;
+   }
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Opens the log at the given path and restores its entries.
+ */
+static int buzzvstiglog_open_for(buzzvm_t vm,
+                                 buzzvstig_t vs,
+                                 const char* path) {
+   buzzvstiglog_t log = buzzvstiglog_open(path);
+   if(!log) return -1;
+   buzzvstiglog_load(log, vm, vs);
+   vs->log = log;
+   return 0;
+}
+
+/****************************************/
+/****************************************/
+
+int buzzvstiglog_attach(buzzvm_t vm,
+                        uint16_t id,
+                        const char* path) {
+   /* Remember the path for the next stigmergy.create(id) */
+   if(path) {
+      char* p = strdup(path);
+      buzzdict_set(vm->vstiglogs, &id, &p);
+   }
+   else {
+      buzzdict_remove(vm->vstiglogs, &id);
+   }
+   /* Apply it to the existing virtual stigmergy, if any */
+   const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+   if(!vs) return 0;
+   if((*vs)->log) buzzvstiglog_close(&(*vs)->log);
+   if(!path) return 0;
+   if(buzzvstiglog_open_for(vm, *vs, path) < 0) return -1;
+   /* Write the entries that were only in memory */
+   if(buzzvstiglog_compact((*vs)->log, *vs) < 0) {
+      int err = errno;
+      buzzvstiglog_close(&(*vs)->log);
+      errno = err;
+      return -1;
+   }
+   return 0;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvstiglog_restore(buzzvm_t vm,
+                          uint16_t id,
+                          buzzvstig_t vs) {
+   const char** path = buzzdict_get(vm->vstiglogs, &id, char*);
+   if(!path) return;
+   if(buzzvstiglog_open_for(vm, vs, *path) < 0)
+      fprintf(stderr, "[WARNING] [ROBOT %u] Can't open the stigmergy log %s, keeping stigmergy %u in memory: %s\n",
+              vm->robot, *path, id, strerror(errno));
+}
+
+/****************************************/
+/****************************************/
@@ -0,0 +1,160 @@
+#ifndef BUZZVSTIGLOG_H
+#define BUZZVSTIGLOG_H
+
+#include <buzz/buzztype.h>
+#include <buzz/buzzmsg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /*
+    * An on-disk log of the changes to a virtual stigmergy.
+    *
+    * The log is a file mapped in memory. Every store and removal of an
+    * entry appends a record; when the virtual stigmergy is created again
+    * (e.g., after a reboot), the records are replayed to restore it. When
+    * most of the records are outdated, the log is rewritten with the live
+    * entries only.
+    *
+    * The file starts with a header (magic, version, length of the valid
+    * data), followed by records made of a 32-bit length, an operation
+    * and the serialized entry. The header is in host byte order, so a
+    * log must be read on the machine that wrote it.
+    */
+   struct buzzvstiglog_s {
+      /* The file path */
+      char* path;
+      /* The file descriptor */
+      int fd;
+      /* The mapped file, or NULL if the log is unusable */
+      uint8_t* map;
+      /* The size of the mapped file */
+      uint64_t size;
+      /* The end of the valid data */
+      uint64_t tail;
+      /* The number of records */
+      uint32_t records;
+      /* Whether records were appended since the last sync */
+      uint8_t dirty;
+      /* Buffer to serialize the records */
+      buzzmsg_payload_t buf;
+   };
+   typedef struct buzzvstiglog_s* buzzvstiglog_t;
+
+   /*
+    * Forward declarations.
+    */
+   struct buzzvm_s;
+   struct buzzvstig_s;
+   struct buzzvstig_elem_s;
+
+   /*
+    * Makes a virtual stigmergy persistent.
+    * The virtual stigmergy with the given id is stored in a log at the
+    * given path. When the script creates it with stigmergy.create(id),
+    * the entries in the log are restored. If the virtual stigmergy already
+    * exists, the log is opened immediately, and its entries are merged
+    * with the current ones.
+    * Call this function from the host, typically after buzzvm_set_bcode()
+    * and before running the script.
+    * @param vm The Buzz VM state.
+    * @param id The id of the virtual stigmergy.
+    * @param path The path of the log, or NULL to keep the virtual stigmergy in memory only.
+    * @return 0 on success, -1 if the log could not be opened (errno is set).
+    */
+   extern int buzzvstiglog_attach(struct buzzvm_s* vm,
+                                  uint16_t id,
+                                  const char* path);
+
+   /*
+    * Opens the log of a new virtual stigmergy, if one was attached to its id.
+    * The entries in the log are restored in the virtual stigmergy.
+    * Called by stigmergy.create() and stigmergy.spatial().
+    * @param vm The Buzz VM state.
+    * @param id The id of the virtual stigmergy.
+    * @param vs The virtual stigmergy structure.
+    */
+   extern void buzzvstiglog_restore(struct buzzvm_s* vm,
+                                    uint16_t id,
+                                    struct buzzvstig_s* vs);
+
+   /*
+    * Opens a log, creating it if necessary.
+    * @param path The file path.
+    * @return The log, or NULL in case of error (errno is set).
+    */
+   extern buzzvstiglog_t buzzvstiglog_open(const char* path);
+
+   /*
+    * Syncs and closes a log.
+    * @param log The log.
+    */
+   extern void buzzvstiglog_close(buzzvstiglog_t* log);
+
+   /*
+    * Replays the records of a log into a virtual stigmergy.
+    * An entry of the log is stored unless the virtual stigmergy holds a
+    * newer one. A truncated or corrupted record ends the replay, and the
+    * records after it are discarded.
+    * @param log The log.
+    * @param vm The Buzz VM state.
+    * @param vs The virtual stigmergy structure.
+    * @return The number of records replayed.
+    */
+   extern uint32_t buzzvstiglog_load(buzzvstiglog_t log,
+                                     struct buzzvm_s* vm,
+                                     struct buzzvstig_s* vs);
+
+   /*
+    * Appends the store of an entry to a log.
+    * @param log The log.
+    * @param key The key of the entry.
+    * @param e The entry.
+    */
+   extern void buzzvstiglog_put(buzzvstiglog_t log,
+                                const buzzobj_t key,
+                                const struct buzzvstig_elem_s* e);
+
+   /*
+    * Appends the removal of an entry to a log.
+    * @param log The log.
+    * @param key The key of the entry.
+    */
+   extern void buzzvstiglog_remove(buzzvstiglog_t log,
+                                   const buzzobj_t key);
+
+   /*
+    * Rewrites a log with the live entries of a virtual stigmergy only.
+    * The new log is written next to the old one and renamed over it, so
+    * the old log is intact if the compaction fails.
+    * @param log The log.
+    * @param vs The virtual stigmergy structure.
+    * @return 0 on success, -1 in case of error (errno is set).
+    */
+   extern int buzzvstiglog_compact(buzzvstiglog_t log,
+                                   struct buzzvstig_s* vs);
+
+   /*
+    * Compacts the log of a virtual stigmergy if most of its records are
+    * outdated, and schedules the write of the new records to disk.
+    * Called at every step by buzzvm_process_outmsgs().
+    * @param vs The virtual stigmergy structure.
+    */
+   extern void buzzvstiglog_update(struct buzzvstig_s* vs);
+
+#ifdef __cplusplus
+}
+#endif
+
+/*
+ * Initial size of the log file.
+ */
+#define BUZZVSTIGLOG_INITIAL_SIZE 65536
+
+/*
+ * Minimum number of records before a log is compacted.
+ */
+#define BUZZVSTIGLOG_COMPACT_MIN 1024
+
+#endif
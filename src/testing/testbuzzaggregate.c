@@ -0,0 +1,104 @@
+#include "testbuzzutil.h"
+#include <stdio.h>
+
+/* The robots, in a line: each one hears the previous and the next */
+#define N 5
+static buzzvm_t vms[N];
+
+/* Calls aggregate.create(id, op) and keeps the table on the stack */
+buzzobj_t create(buzzvm_t vm, int32_t id, const char* op) {
+   buzzvm_pushs(vm, buzzvm_string_register(vm, op, 1));
+   buzzobj_t t = call(vm, global(vm, "aggregate"), "create", 2,
+                      integer(vm, id), buzzvm_stack_at(vm, 1));
+   buzzvm_pop(vm);
+   buzzvm_push(vm, t);
+   return t;
+}
+
+/* Calls contribute(v) */
+void contribute(buzzvm_t vm, buzzobj_t t, int32_t v) {
+   calli(vm, t, "contribute", 1, v);
+}
+
+/* Calls value(), -1 for nil */
+float value(buzzvm_t vm, buzzobj_t t) {
+   buzzobj_t v = call(vm, t, "value", 0);
+   return v->o.type == BUZZTYPE_FLOAT ? v->f.value : -1;
+}
+
+/* Returns 1 if two floats are within a tolerance */
+int near(float a, float b, float tol) {
+   return a - b < tol && b - a < tol;
+}
+
+/* Runs steps: every robot sends its messages to its neighbors in the line */
+void run(int steps) {
+   while(steps-- > 0) step_line(vms, N);
+}
+
+int main() {
+   int err = 0;
+   int i, ok;
+   buzzobj_t avg[N], mx[N], cnt[N], sum[N];
+   for(i = 0; i < N; ++i) {
+      vms[i] = robot(i + 1);
+      avg[i] = create(vms[i], 1, "avg");
+      mx[i]  = create(vms[i], 2, "max");
+      cnt[i] = create(vms[i], 3, "count");
+      sum[i] = create(vms[i], 4, "sum");
+      buzzaggregate_budget(vms[i], 1000);
+   }
+   err |= check("no value yet", value(vms[0], avg[0]) == -1 && value(vms[0], mx[0]) == -1);
+   for(i = 0; i < N; ++i) {
+      contribute(vms[i], avg[i], i + 1);
+      contribute(vms[i], mx[i], i + 1);
+      contribute(vms[i], cnt[i], 1);
+      contribute(vms[i], sum[i], i + 1);
+   }
+   run(200);
+   /*
+    * Values
+    */
+   for(i = 0, ok = 1; i < N; ++i)
+      ok &= near(value(vms[i], avg[i]), 3, 0.01);
+   err |= check("avg", ok);
+   for(i = 0, ok = 1; i < N; ++i)
+      ok &= value(vms[i], mx[i]) == 5;
+   err |= check("max", ok);
+   /* The count is an estimate, but the same on all the robots */
+   float c = value(vms[0], cnt[0]);
+   for(i = 0, ok = c > 2.5 && c < 10; i < N; ++i)
+      ok &= value(vms[i], cnt[i]) == c;
+   err |= check("count", ok);
+   /* The sum has its own count estimate */
+   err |= check("sum", near(value(vms[N-1], sum[N-1]), 15, 7.5));
+   /*
+    * Changes
+    */
+   contribute(vms[0], avg[0], 11);
+   contribute(vms[4], mx[4], 2);
+   run(BUZZAGGREGATE_MAXAGE + 50);
+   for(i = 0, ok = 1; i < N; ++i)
+      ok &= near(value(vms[i], avg[i]), 5, 0.01) && value(vms[i], mx[i]) == 4;
+   err |= check("changed contributions", ok);
+   call(vms[3], mx[3], "contribute", 1, buzzheap_newobj(vms[3], BUZZTYPE_NIL));
+   call(vms[2], avg[2], "contribute", 1, buzzheap_newobj(vms[2], BUZZTYPE_NIL));
+   run(BUZZAGGREGATE_MAXAGE + 50);
+   for(i = 0, ok = 1; i < N; ++i)
+      ok &= near(value(vms[i], avg[i]), (11 + 2 + 4 + 5) / 4.0, 0.01) && value(vms[i], mx[i]) == 3;
+   err |= check("withdrawn contributions", ok);
+   for(i = 0; i < N; ++i) buzzheap_gc(vms[i]);
+   err |= check("gc", near(value(vms[0], avg[0]), 5.5, 0.01));
+   /*
+    * Bandwidth budget
+    */
+   for(i = 0; i < N; ++i) buzzaggregate_budget(vms[i], 20);
+   run(1);
+   uint32_t sent = vms[2]->aggregates->sent;
+   run(100);
+   sent = vms[2]->aggregates->sent - sent;
+   /* 14 bytes for avg, 9 for max, 84 for count, 94 for sum */
+   err |= check("budget", sent > 0 && sent * (14 + 9 + 84 + 94) / 4 <= 100 * 20 + 94);
+   for(i = 0; i < N; ++i) buzzvm_destroy(&vms[i]);
+   return err;
+}
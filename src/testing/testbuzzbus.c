@@ -0,0 +1,97 @@
+#include "testbuzzutil.h"
+#include <buzz/buzzbus.h>
+#include <math.h>
+#include <stdio.h>
+
+/* Counts the packets a transport receives at this step, and their bytes */
+uint32_t drain(buzztransport_t t, uint32_t* bytes) {
+   uint8_t buf[256];
+   uint32_t n = 0;
+   int64_t sz;
+   while((sz = t->recv(t, buf, sizeof(buf))) > 0) {
+      ++n;
+      if(bytes) *bytes += sz;
+   }
+   return n;
+}
+
+int main() {
+   int err = 0;
+   int i, s;
+   uint8_t pkt[8] = { 0 };
+   /*
+    * Range validation
+    */
+   err |= check("negative range", buzzbus_new(-1.0f) == NULL);
+   err |= check("nan range", buzzbus_new(NAN) == NULL);
+   /*
+    * Packet loss
+    */
+   buzzbus_t bus = buzzbus_new(0.0f);
+   bus->loss = 0.25f;
+   buzzbus_seed(bus, 42);
+   buzztransport_t a = buzzbus_transport_new(bus, 1, 64);
+   buzztransport_t b = buzzbus_transport_new(bus, 65535, 64);
+   uint32_t recvd = 0;
+   for(s = 0; s < 4000; ++s) {
+      a->send(a, pkt, sizeof(pkt));
+      buzzbus_tick(bus);
+      recvd += drain(b, NULL);
+   }
+   err |= check("loss rate", fabs(1.0 - recvd / 4000.0 - 0.25) < 0.03);
+   err |= check("loss counters", bus->dropped + bus->delivered == 4000 && bus->delivered == recvd);
+   /* The same seed drops the same packets */
+   buzzbus_seed(bus, 42);
+   uint32_t again = 0;
+   for(s = 0; s < 4000; ++s) {
+      a->send(a, pkt, sizeof(pkt));
+      buzzbus_tick(bus);
+      again += drain(b, NULL);
+   }
+   err |= check("loss seed", again == recvd);
+   buzztransport_destroy(&b);
+   err |= check("id reuse", (b = buzzbus_transport_new(bus, 65535, 64)) != NULL);
+   buzztransport_destroy(&a);
+   buzztransport_destroy(&b);
+   buzzbus_destroy(&bus);
+   /*
+    * Bandwidth: three robots send ten packets each to a fourth per step
+    */
+   bus = buzzbus_new(0.0f);
+   bus->bandwidth = 50;
+   buzztransport_t t[4];
+   for(i = 0; i < 4; ++i) t[i] = buzzbus_transport_new(bus, i + 1, 64);
+   int ok = 1;
+   for(s = 0; s < 10; ++s) {
+      for(i = 1; i < 4; ++i) {
+         int p;
+         for(p = 0; p < 10; ++p) t[i]->send(t[i], pkt, sizeof(pkt));
+      }
+      buzzbus_tick(bus);
+      uint32_t bytes = 0;
+      /* 6 packets of 8 bytes fit 50 bytes */
+      ok &= drain(t[0], &bytes) == 6 && bytes <= 50;
+      for(i = 1; i < 4; ++i) drain(t[i], NULL);
+   }
+   err |= check("bandwidth", ok);
+   for(i = 0; i < 4; ++i) buzztransport_destroy(&t[i]);
+   buzzbus_destroy(&bus);
+   /*
+    * A tiny range with far positions
+    */
+   bus = buzzbus_new(1e-30f);
+   a = buzzbus_transport_new(bus, 1, 64);
+   b = buzzbus_transport_new(bus, 2, 64);
+   buzztransport_t c = buzzbus_transport_new(bus, 3, 64);
+   buzzbus_set_position(a, 1e6f, 1e6f, 0, 0);
+   buzzbus_set_position(b, 1e6f, 1e6f, 0, 0);
+   buzzbus_set_position(c, -1e6f, 1e6f, 0, 0);
+   a->send(a, pkt, sizeof(pkt));
+   buzzbus_tick(bus);
+   err |= check("tiny range", drain(b, NULL) == 1 && drain(c, NULL) == 0);
+   buzztransport_destroy(&a);
+   buzztransport_destroy(&b);
+   buzztransport_destroy(&c);
+   buzzbus_destroy(&bus);
+   return err;
+}
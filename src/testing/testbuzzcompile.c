@@ -0,0 +1,159 @@
+#include "testbuzzutil.h"
+#include <buzz/buzzcompile.h>
+#include <buzz/buzzparser.h>
+#include <buzz/buzzasm.h>
+#include <buzz/buzzopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Included by the script */
+static const char* INC =
+   "function sq(a) {\n"
+   "  return a * a\n"
+   "}\n";
+
+/* The script, with the include file name to fill in */
+static const char* SCRIPT =
+   "include \"%s\"\n"
+   "x = sq(6) + 6\n"
+   "function f(a) {\n"
+   "  var s = 0\n"
+   "  var i = 0\n"
+   "  while(i < a) {\n"
+   "    s = s + sq(i)\n"
+   "    i = i + 1\n"
+   "  }\n"
+   "  return s\n"
+   "}\n"
+   "t = { .name = \"buzz\" }\n";
+
+/* Replaces the content of a file */
+int file_write(const char* fname, const char* str) {
+   FILE* fd = fopen(fname, "w");
+   if(!fd) return 1;
+   fputs(str, fd);
+   fclose(fd);
+   return 0;
+}
+
+/* Compiles with and without a cache; returns 1 if the results are the same */
+int compile_cached(const char* src, buzzparser_cache_t cache, uint32_t* size) {
+   uint8_t *buf, *cbuf;
+   uint32_t csize;
+   buzzdebug_t dbg, cdbg;
+   if(buzz_compile(src, "cached.bzz", 1, NULL, &buf, size, &dbg) != 0) return 0;
+   int ok = buzz_compile(src, "cached.bzz", 1, cache, &cbuf, &csize, &cdbg) == 0;
+   if(ok) {
+      ok = *size == csize && memcmp(buf, cbuf, *size) == 0;
+      free(cbuf);
+      buzzdebug_destroy(&cdbg);
+   }
+   free(buf);
+   buzzdebug_destroy(&dbg);
+   return ok;
+}
+
+/* Compiles a script file the way bzzc does, through files */
+int compile_files(const char* bzz, uint8_t** buf, uint32_t* size, buzzdebug_t* dbg) {
+   char basm[] = "/tmp/testbuzzcompileXXXXXX";
+   if(tmpfile_write(basm, "")) return 1;
+   char* argv[] = { "bzzparse", (char*)bzz, basm };
+   buzzparser_t par = buzzparser_new(3, argv);
+   if(!par) return 1;
+   int ok = buzzparser_parse(par);
+   buzzparser_destroy(&par);
+   int err = ok ? buzz_asm(basm, buf, size, dbg) : 2;
+   unlink(basm);
+   if(err == 0) err = buzz_optimize(*buf, size, dbg);
+   return err;
+}
+
+/* Runs the script and calls f(4); returns 1 if all is as expected */
+int run(const uint8_t* buf, uint32_t size) {
+   int ok = 1;
+   buzzvm_t vm = buzzvm_new(1);
+   buzzvm_set_bcode(vm, buf, size);
+   buzzvm_execute_script(vm);
+   ok &= vm->state == BUZZVM_STATE_DONE;
+   ok &= intof(global(vm, "x")) == 42;
+   buzzvm_pushi(vm, 4);
+   buzzvm_function_call(vm, "f", 1);
+   ok &= buzzvm_stack_at(vm, 1)->o.type == BUZZTYPE_INT && buzzvm_stack_at(vm, 1)->i.value == 14;
+   buzzvm_pop(vm);
+   ok &= vm->state == BUZZVM_STATE_READY;
+   buzzvm_destroy(&vm);
+   return ok;
+}
+
+int main() {
+   int err = 0;
+   uint8_t *buf, *fbuf;
+   uint32_t size, fsize;
+   buzzdebug_t dbg, fdbg;
+   /* Make the script and its include file */
+   char inc[] = "/tmp/testbuzzcompileXXXXXX";
+   if(tmpfile_write(inc, INC)) return 1;
+   char* src;
+   if(asprintf(&src, SCRIPT, inc) < 0) return 1;
+   char bzz[] = "/tmp/testbuzzcompileXXXXXX";
+   if(tmpfile_write(bzz, src)) return 1;
+   /* Compile in memory */
+   err |= check("compile", buzz_compile(src, bzz, 1, NULL, &buf, &size, &dbg) == 0);
+   err |= check("run", run(buf, size));
+   /* The result is that of the file-based tool chain */
+   err |= check("compile files", compile_files(bzz, &fbuf, &fsize, &fdbg) == 0);
+   err |= check("same bytecode", size == fsize && memcmp(buf, fbuf, size) == 0);
+   const int32_t* off = buzzdebug_info_get_fromscript(dbg, 7, 10, bzz);
+   const int32_t* foff = buzzdebug_info_get_fromscript(fdbg, 7, 10, bzz);
+   err |= check("same debug data", off && foff && *off == *foff &&
+                buzzdebug_info_get_fromscript(dbg, 2, 11, inc));
+   free(fbuf);
+   buzzdebug_destroy(&fdbg);
+   /* Unoptimized */
+   uint32_t optsize = size;
+   free(buf);
+   buzzdebug_destroy(&dbg);
+   err |= check("compile -O0", buzz_compile(src, bzz, 0, NULL, &buf, &size, &dbg) == 0);
+   err |= check("run -O0", run(buf, size) && size > optsize);
+   free(buf);
+   buzzdebug_destroy(&dbg);
+   /* The script needs not exist on disk */
+   unlink(bzz);
+   err |= check("no file", buzz_compile(src, "nofile.bzz", 1, NULL, &buf, &size, &dbg) == 0 &&
+                run(buf, size) && buzzdebug_info_get_fromscript(dbg, 7, 10, "nofile.bzz"));
+   free(buf);
+   buzzdebug_destroy(&dbg);
+   /* Errors */
+   err |= check("syntax error", buzz_compile("x = (1 +\n", "err.bzz", 1, NULL, &buf, &size, &dbg) == 2);
+   err |= check("missing include", buzz_compile("include \"/nonexistent.bzz\"\n", "err.bzz", 1, NULL, &buf, &size, &dbg) == 2);
+   /* Many compilations in one process */
+   int i, ok = 1;
+   for(i = 0; i < 100 && ok; ++i) {
+      ok = buzz_compile(src, "loop.bzz", 1, NULL, &buf, &size, &dbg) == 0 && size == optsize;
+      free(buf);
+      buzzdebug_destroy(&dbg);
+   }
+   err |= check("repeated", ok);
+   /* Cached include files */
+   buzzparser_cache_t cache = buzzparser_cache_new();
+   uint32_t csize;
+   err |= check("cache cold", compile_cached(src, cache, &csize) && csize == optsize);
+   err |= check("cache warm", compile_cached(src, cache, &csize) && csize == optsize);
+   file_write(inc, "function sq(a) {\n  return a * a + 1\n}\n");
+   err |= check("cache changed include", compile_cached(src, cache, &csize) && csize != optsize);
+   char nest[] = "/tmp/testbuzzcompileXXXXXX";
+   char* mid;
+   if(tmpfile_write(nest, INC) || asprintf(&mid, "include \"%s\"\ny = 1\n", nest) < 0) return 1;
+   file_write(inc, mid);
+   err |= check("cache nested include", compile_cached(src, cache, &csize) && csize > optsize);
+   file_write(nest, "function sq(a) {\n  return a + a\n}\n");
+   err |= check("cache changed nested include", compile_cached(src, cache, &csize));
+   buzzparser_cache_destroy(&cache);
+   unlink(nest);
+   free(mid);
+   unlink(inc);
+   free(src);
+   return err;
+}
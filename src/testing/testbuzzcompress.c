@@ -0,0 +1,61 @@
+#include <buzz/buzzcompress.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+int roundtrip(const char* name, buzzmsg_payload_t m) {
+   fprintf(stdout, "%s: %" PRId64 " bytes", name, buzzmsg_payload_size(m));
+   buzzmsg_payload_t c = buzzcompress_payload_encode(m);
+   if(!c) {
+      fprintf(stdout, " -> not compressible\n");
+      return 0;
+   }
+   fprintf(stdout, " -> %" PRId64 " bytes", buzzmsg_payload_size(c));
+   buzzmsg_payload_t d = buzzcompress_payload_decode(c);
+   int ok =
+      d &&
+      buzzmsg_payload_size(d) == buzzmsg_payload_size(m) &&
+      memcmp(d->data, m->data, buzzmsg_payload_size(m)) == 0;
+   fprintf(stdout, " -> %s\n", ok ? "OK" : "MISMATCH");
+   buzzmsg_payload_destroy(&c);
+   if(d) buzzmsg_payload_destroy(&d);
+   return !ok;
+}
+
+int main() {
+   int err = 0;
+   int i;
+   /* A grid-like table, highly repetitive */
+   buzzmsg_payload_t m = buzzmsg_payload_new(10);
+   buzzmsg_serialize_u8(m, BUZZMSG_VSTIG_PUT);
+   for(i = 0; i < 400; ++i) {
+      buzzmsg_serialize_u16(m, i % 20);
+      buzzmsg_serialize_float(m, 0.5f);
+   }
+   err |= roundtrip("grid", m);
+   buzzmsg_payload_destroy(&m);
+   /* A long run of the same byte */
+   m = buzzmsg_payload_new(10);
+   buzzmsg_serialize_u8(m, BUZZMSG_BROADCAST);
+   for(i = 0; i < 5000; ++i) buzzmsg_serialize_u8(m, 7);
+   err |= roundtrip("run", m);
+   buzzmsg_payload_destroy(&m);
+   /* Random data */
+   m = buzzmsg_payload_new(10);
+   buzzmsg_serialize_u8(m, BUZZMSG_BROADCAST);
+   srand(42);
+   for(i = 0; i < 300; ++i) buzzmsg_serialize_u8(m, rand());
+   err |= roundtrip("random", m);
+   buzzmsg_payload_destroy(&m);
+   /* Truncated compressed data must be rejected */
+   m = buzzmsg_payload_new(10);
+   buzzmsg_serialize_u8(m, BUZZMSG_BROADCAST | BUZZMSG_FLAG_COMPRESSED);
+   buzzmsg_serialize_u32(m, 1000);
+   buzzmsg_serialize_u8(m, 0xF0);
+   buzzmsg_payload_t d = buzzcompress_payload_decode(m);
+   fprintf(stdout, "truncated: %s\n", d ? "ACCEPTED" : "rejected");
+   err |= (d != NULL);
+   buzzmsg_payload_destroy(&m);
+   return err;
+}
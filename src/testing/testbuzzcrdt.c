@@ -0,0 +1,135 @@
+#include "testbuzzutil.h"
+#include <stdio.h>
+#include <inttypes.h>
+
+/* Creates a shared structure the way stigmergy.<type>(id) does */
+buzzobj_t create(buzzvm_t vm, const char* type, int32_t id) {
+   return calli(vm, global(vm, "stigmergy"), type, 1, id);
+}
+
+/* Like deliver(), but to two robots */
+void deliver2(buzzvm_t src, buzzvm_t dst1, buzzvm_t dst2) {
+   buzzvm_process_outmsgs(src);
+   while(!buzzoutmsg_queue_isempty(src)) {
+      buzzmsg_payload_t m = buzzoutmsg_queue_first(src);
+      buzzinmsg_queue_append(dst1, src->robot, buzzdarray_clone(m));
+      buzzinmsg_queue_append(dst2, src->robot, m);
+      buzzoutmsg_queue_next(src);
+   }
+   buzzvm_process_inmsgs(dst1);
+   buzzvm_process_inmsgs(dst2);
+}
+
+int main() {
+   int err = 0;
+   /*
+    * Counter: concurrent changes converge, relayed through a middle robot
+    */
+   buzzvm_t a = robot(1);
+   buzzvm_t b = robot(2);
+   buzzvm_t c = robot(3);
+   buzzobj_t ca = create(a, "counter", 1);
+   buzzobj_t cb = create(b, "counter", 1);
+   buzzobj_t cc = create(c, "counter", 1);
+   calli(a, ca, "increment", 1, 5);
+   call(b, cb, "increment", 0);
+   calli(c, cc, "decrement", 1, 2);
+   /* a <-> b <-> c */
+   deliver(a, b);
+   deliver2(b, a, c);
+   deliver(c, b);
+   deliver2(b, a, c);
+   err |= check("counter converges on a", intof(call(a, ca, "value", 0)) == 4);
+   err |= check("counter converges on b", intof(call(b, cb, "value", 0)) == 4);
+   err |= check("counter converges on c", intof(call(c, cc, "value", 0)) == 4);
+   /* A single change produces a single small delta */
+   deliver(a, b); deliver(b, c); deliver(c, b); deliver(b, a);
+   call(a, ca, "increment", 0);
+   int n = deliver(a, b);
+   err |= check("one change sends one message", n == 1);
+   err |= check("delta applied", intof(call(b, cb, "value", 0)) == 5);
+   /* Receiving the same delta again changes nothing */
+   buzzvm_process_outmsgs(b);
+   while(!buzzoutmsg_queue_isempty(b)) {
+      buzzmsg_payload_t m = buzzoutmsg_queue_first(b);
+      buzzinmsg_queue_append(c, b->robot, buzzdarray_clone(m));
+      buzzinmsg_queue_append(c, b->robot, m);
+      buzzoutmsg_queue_next(b);
+   }
+   buzzvm_process_inmsgs(c);
+   err |= check("duplicate delta is idempotent", intof(call(c, cc, "value", 0)) == 5);
+   buzzvm_destroy(&a);
+   buzzvm_destroy(&b);
+   buzzvm_destroy(&c);
+   /*
+    * Grow-only counter: decrements are not available
+    */
+   a = robot(1);
+   ca = create(a, "gcounter", 2);
+   calli(a, ca, "increment", 1, 3);
+   err |= check("grow-only counter", intof(call(a, ca, "value", 0)) == 3);
+   buzzvm_push(a, ca);
+   buzzvm_pushs(a, buzzvm_string_register(a, "decrement", 1));
+   buzzvm_tget(a);
+   err |= check("grow-only counter has no decrement", buzzvm_stack_at(a, 1)->o.type == BUZZTYPE_NIL);
+   buzzvm_pop(a);
+   buzzvm_destroy(&a);
+   /*
+    * Set: a concurrent add wins over a remove
+    */
+   a = robot(1);
+   b = robot(2);
+   buzzobj_t sa = create(a, "set", 3);
+   buzzobj_t sb = create(b, "set", 3);
+   calli(a, sa, "add", 1, 7);
+   calli(a, sa, "add", 1, 8);
+   deliver(a, b);
+   err |= check("set members received", intof(calli(b, sb, "has", 1, 7)) && intof(calli(b, sb, "has", 1, 8)));
+   /* b removes 7 while a adds it again; b removes 8 alone */
+   calli(b, sb, "remove", 1, 7);
+   calli(b, sb, "remove", 1, 8);
+   calli(a, sa, "add", 1, 7);
+   deliver(a, b);
+   deliver(b, a);
+   err |= check("concurrent add wins on a", intof(calli(a, sa, "has", 1, 7)));
+   err |= check("concurrent add wins on b", intof(calli(b, sb, "has", 1, 7)));
+   err |= check("remove applied on a", !intof(calli(a, sa, "has", 1, 8)));
+   err |= check("set size", intof(call(a, sa, "size", 0)) == 1 && intof(call(b, sb, "size", 0)) == 1);
+   buzzvm_destroy(&a);
+   buzzvm_destroy(&b);
+   /*
+    * Map: the last write wins, nil deletes
+    */
+   a = robot(1);
+   b = robot(2);
+   buzzobj_t ma = create(a, "lwwmap", 4);
+   buzzobj_t mb = create(b, "lwwmap", 4);
+   calli(a, ma, "put", 2, 1, 10);
+   calli(a, ma, "put", 2, 2, 20);
+   deliver(a, b);
+   calli(b, mb, "put", 2, 1, 11);
+   deliver(b, a);
+   err |= check("later write wins", intof(calli(a, ma, "get", 1, 1)) == 11);
+   call(a, ma, "put", 2, integer(a, 2), buzzheap_newobj(a, BUZZTYPE_NIL));
+   deliver(a, b);
+   err |= check("nil deletes", intof(call(b, mb, "size", 0)) == 1 &&
+                calli(b, mb, "get", 1, 2)->o.type == BUZZTYPE_NIL);
+   buzzvm_destroy(&a);
+   buzzvm_destroy(&b);
+   /*
+    * Max-register
+    */
+   a = robot(1);
+   b = robot(2);
+   buzzobj_t ra = create(a, "maxreg", 5);
+   buzzobj_t rb = create(b, "maxreg", 5);
+   calli(a, ra, "put", 1, 12);
+   calli(b, rb, "put", 1, 30);
+   calli(b, rb, "put", 1, 4);
+   deliver(a, b);
+   deliver(b, a);
+   err |= check("register keeps the maximum", intof(call(a, ra, "get", 0)) == 30 && intof(call(b, rb, "get", 0)) == 30);
+   buzzvm_destroy(&a);
+   buzzvm_destroy(&b);
+   return err;
+}
@@ -0,0 +1,174 @@
+#include <buzz/buzzvm.h>
+#include <buzz/buzzfrag.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+/* Queues a broadcast whose value is a table with n entries */
+void queue_table(buzzvm_t vm, int n) {
+   int i;
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "map", 1));
+   buzzobj_t topic = buzzvm_stack_at(vm, 1);
+   buzzvm_pusht(vm);
+   for(i = 0; i < n; ++i) {
+      buzzvm_dup(vm);
+      buzzvm_pushi(vm, i);
+      buzzvm_pushi(vm, i * i);
+      buzzvm_tput(vm);
+   }
+   buzzoutmsg_queue_append_broadcast(vm, topic, buzzvm_stack_at(vm, 1));
+   buzzvm_pop(vm);
+   buzzvm_pop(vm);
+}
+
+void payload_destroy(uint32_t pos, void* data, void* params) {
+   buzzmsg_payload_destroy((buzzmsg_payload_t*)data);
+}
+
+/* Queues a table with n entries and returns its frames */
+buzzdarray_t fragment(buzzfrag_t f, buzzvm_t vm, int n) {
+   buzzdarray_t frames = buzzdarray_new(1, sizeof(buzzmsg_payload_t), payload_destroy);
+   buzzmsg_payload_t m;
+   queue_table(vm, n);
+   while((m = buzzfrag_out_first(f, vm))) {
+      buzzdarray_push(frames, &m);
+      buzzfrag_out_next(f, vm);
+   }
+   return frames;
+}
+
+/* Passes a copy of the given frames to the receiver */
+void deliver(buzzfrag_t f, buzzvm_t vm, buzzdarray_t frames, int64_t from, int64_t to) {
+   int64_t i;
+   for(i = from; i < to; ++i)
+      buzzfrag_in(f, vm, 1, buzzdarray_clone(buzzdarray_get(frames, i, buzzmsg_payload_t)));
+}
+
+/* Returns the number of messages received, and drops them */
+int received(buzzvm_t vm) {
+   int n = 0;
+   uint16_t rid;
+   buzzmsg_payload_t m;
+   while(buzzinmsg_queue_extract(vm, &rid, &m)) {
+      buzzmsg_payload_destroy(&m);
+      ++n;
+   }
+   return n;
+}
+
+int main() {
+   int err = 0;
+   buzzvm_t tx = buzzvm_new(1);
+   buzzvm_t rx = buzzvm_new(2);
+   buzzfrag_t ftx = buzzfrag_new(32, 5, 4096);
+   buzzfrag_t frx = buzzfrag_new(32, 5, 4096);
+   /* Keep a copy of the serialized message for comparison */
+   queue_table(tx, 50);
+   buzzmsg_payload_t orig = buzzoutmsg_queue_first(tx);
+   fprintf(stdout, "message: %" PRId64 " bytes\n", buzzmsg_payload_size(orig));
+   /* Send all the frames, delivering each one twice and in reverse order */
+   buzzdarray_t frames = buzzdarray_new(1, sizeof(buzzmsg_payload_t), NULL);
+   buzzmsg_payload_t m;
+   while((m = buzzfrag_out_first(ftx, tx))) {
+      if(buzzmsg_payload_size(m) > 32) {
+         fprintf(stdout, "frame too large: %" PRId64 " bytes\n", buzzmsg_payload_size(m));
+         err = 1;
+      }
+      buzzdarray_push(frames, &m);
+      buzzfrag_out_next(ftx, tx);
+   }
+   fprintf(stdout, "frames: %" PRId64 "\n", buzzdarray_size(frames));
+   int64_t i;
+   for(i = buzzdarray_size(frames) - 1; i >= 0; --i) {
+      m = buzzdarray_get(frames, i, buzzmsg_payload_t);
+      buzzfrag_in(frx, rx, 1, buzzdarray_clone(m));
+      buzzfrag_in(frx, rx, 1, m);
+   }
+   buzzdarray_destroy(&frames);
+   /* Check the reassembled message */
+   uint16_t rid;
+   if(buzzinmsg_queue_extract(rx, &rid, &m)) {
+      int ok =
+         rid == 1 &&
+         buzzmsg_payload_size(m) == buzzmsg_payload_size(orig) &&
+         memcmp(m->data, orig->data, buzzmsg_payload_size(orig)) == 0;
+      fprintf(stdout, "reassembled: %s\n", ok ? "OK" : "MISMATCH");
+      err |= !ok;
+      buzzmsg_payload_destroy(&m);
+   }
+   else {
+      fprintf(stdout, "reassembled: MISSING\n");
+      err = 1;
+   }
+   fprintf(stdout, "pending after reassembly: %u bytes\n", buzzfrag_in_size(frx));
+   err |= buzzfrag_in_size(frx) != 0;
+   /* Lose the last fragment and let the rest time out */
+   queue_table(tx, 50);
+   while((m = buzzfrag_out_first(ftx, tx))) {
+      buzzfrag_out_next(ftx, tx);
+      if(buzzfrag_out_size(ftx) > 0) buzzfrag_in(frx, rx, 1, m);
+      else buzzmsg_payload_destroy(&m);
+   }
+   fprintf(stdout, "pending with a lost fragment: %u bytes\n", buzzfrag_in_size(frx));
+   for(i = 0; i < 6; ++i) buzzfrag_update(frx);
+   fprintf(stdout, "pending after timeout: %u bytes\n", buzzfrag_in_size(frx));
+   err |= buzzfrag_in_size(frx) != 0 || !buzzinmsg_queue_isempty(rx->inmsgs);
+   /* Duplicates do not keep an incomplete message alive */
+   frames = fragment(ftx, tx, 50);
+   deliver(frx, rx, frames, 0, buzzdarray_size(frames) - 1);
+   for(i = 0; i < 6; ++i) {
+      deliver(frx, rx, frames, 0, 1);
+      buzzfrag_update(frx);
+   }
+   fprintf(stdout, "pending after timeout with duplicates: %u bytes\n", buzzfrag_in_size(frx));
+   err |= buzzfrag_in_size(frx) != 0;
+   buzzdarray_destroy(&frames);
+   /* A restarted sender reuses its sequence numbers */
+   buzzfrag_t fold = buzzfrag_new(32, 5, 4096);
+   buzzfrag_t fnew = buzzfrag_new(32, 5, 4096);
+   frames = fragment(fold, tx, 50);
+   deliver(frx, rx, frames, 0, buzzdarray_size(frames));
+   buzzdarray_destroy(&frames);
+   frames = fragment(fnew, tx, 50);
+   deliver(frx, rx, frames, 0, buzzdarray_size(frames));
+   buzzdarray_destroy(&frames);
+   int n = received(rx);
+   fprintf(stdout, "delivered across a restart: %d\n", n);
+   err |= n != 2;
+   buzzfrag_destroy(&fold);
+   buzzfrag_destroy(&fnew);
+   /* Incomplete messages over budget do not evict delivered ones */
+   buzzfrag_t fsmall = buzzfrag_new(32, 5, 1024);
+   buzzdarray_t done = fragment(ftx, tx, 50);
+   deliver(fsmall, rx, done, 0, buzzdarray_size(done));
+   for(i = 0; i < 2; ++i) {
+      frames = fragment(ftx, tx, 50);
+      deliver(fsmall, rx, frames, 0, buzzdarray_size(frames) - 1);
+      buzzdarray_destroy(&frames);
+   }
+   fprintf(stdout, "pending over budget: %u bytes\n", buzzfrag_in_size(fsmall));
+   err |= buzzfrag_in_size(fsmall) > 1024;
+   deliver(fsmall, rx, done, 0, buzzdarray_size(done));
+   n = received(rx);
+   fprintf(stdout, "delivered with a replay over budget: %d\n", n);
+   err |= n != 1;
+   /* The delivered messages remembered are bounded, the latest are kept */
+   for(i = 0; i < 2 * BUZZFRAG_DELIVERED_MAX; ++i) {
+      buzzdarray_destroy(&done);
+      done = fragment(ftx, tx, 10);
+      deliver(fsmall, rx, done, 0, buzzdarray_size(done));
+   }
+   deliver(fsmall, rx, done, 0, buzzdarray_size(done));
+   n = received(rx);
+   fprintf(stdout, "delivered with a replay of the latest: %d\n", n);
+   err |= n != 2 * BUZZFRAG_DELIVERED_MAX;
+   buzzdarray_destroy(&done);
+   buzzfrag_destroy(&fsmall);
+   /* Cleanup */
+   buzzmsg_payload_destroy(&orig);
+   buzzfrag_destroy(&ftx);
+   buzzfrag_destroy(&frx);
+   buzzvm_destroy(&tx);
+   buzzvm_destroy(&rx);
+   return err;
+}
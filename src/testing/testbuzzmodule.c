@@ -0,0 +1,151 @@
+#include "testbuzzutil.h"
+#include <buzz/buzzcompile.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The script running on the robot */
+static const char* SCRIPT =
+   "count = 0\n"
+   "v = stigmergy.create(1)\n"
+   "v.put(\"k\", 5)\n"
+   "s = swarm.create(3)\n"
+   "s.join()\n"
+   "function step() {\n"
+   "  count = count + 1\n"
+   "  return 1\n"
+   "}\n"
+   "function other() {\n"
+   "  return 7\n"
+   "}\n"
+   "t = { .f = step }\n";
+
+/* A patch: a new version of step() and a new function */
+static const char* PATCH =
+   "function step() {\n"
+   "  count = count + 10\n"
+   "  return 2\n"
+   "}\n"
+   "function state() {\n"
+   "  return v.get(\"k\") * 100 + s.in() * 10 + other()\n"
+   "}\n"
+   "patched = \"yes\"\n";
+
+/* Another patch, loaded after the first */
+static const char* PATCH2 =
+   "function step() {\n"
+   "  count = count + 100\n"
+   "  return 3\n"
+   "}\n";
+
+/* A patch whose top-level code fails */
+static const char* BADPATCH =
+   "function step() {\n"
+   "  return 4\n"
+   "}\n"
+   "x = nil + 1\n";
+
+/* Calls a function without arguments and returns the integer result, -1 on error */
+int32_t fcall(buzzvm_t vm, const char* f) {
+   if(buzzvm_function_call(vm, f, 0) != BUZZVM_STATE_READY) return -1;
+   int32_t r = intof(buzzvm_stack_at(vm, 1));
+   buzzvm_pop(vm);
+   return r;
+}
+
+struct merged_s {
+   buzzvm_t vm;
+   buzzdebug_t dbg;
+   const uint8_t* bcode;
+   int32_t shift;
+   int ok;
+   int patch;
+};
+
+/* Checks that a module debug entry was merged where its code went */
+void merged_entry(const void* key, void* data, void* params) {
+   struct merged_s* m = (struct merged_s*)params;
+   int32_t off = *(int32_t*)key;
+   buzzdebug_entry_t e = *(buzzdebug_entry_t*)data;
+   int32_t voff = off + m->shift;
+   const buzzdebug_entry_t* ve = buzzdebug_info_get_fromoffset(m->dbg, &voff);
+   if(!ve ||
+      (*ve)->line != e->line || (*ve)->col != e->col ||
+      strcmp((*ve)->fname, e->fname) != 0 ||
+      voff < 0 || voff >= (int32_t)m->vm->bcode_size ||
+      m->vm->bcode[voff] != m->bcode[off])
+      m->ok = 0;
+   if(strcmp(e->fname, "patch.bzz") == 0) ++m->patch;
+}
+
+/* Compiles a module, loads it and merges its debug data into dbg */
+int load(buzzvm_t vm, const char* src, buzzdebug_t dbg) {
+   uint8_t* buf;
+   uint32_t size;
+   buzzdebug_t mdbg;
+   if(buzz_compile(src, "patch.bzz", 1, NULL, &buf, &size, &mdbg) != 0) return -1;
+   uint32_t base = vm->bcode_size;
+   int err = buzzvm_load_module(vm, buf, size);
+   if(err == 0) {
+      if(!buzzdebug_merge_module(dbg, mdbg, vm, buf, size)) err = -1;
+      /* The code of the module starts after its string table */
+      uint16_t count;
+      uint32_t start = sizeof(uint16_t);
+      memcpy(&count, buf, sizeof(uint16_t));
+      for(; count > 0; --count) start += strlen((char*)buf + start) + 1;
+      struct merged_s m = { vm, dbg, buf, (int32_t)base - (int32_t)start, 1, 0 };
+      buzzdict_foreach(mdbg->off2script, merged_entry, &m);
+      if(!m.ok || m.patch == 0) err = -1;
+   }
+   free(buf);
+   buzzdebug_destroy(&mdbg);
+   return err;
+}
+
+int main() {
+   int err = 0;
+   uint8_t* bcode;
+   uint32_t size;
+   buzzdebug_t dbg;
+   if(buzz_compile(SCRIPT, "script.bzz", 1, NULL, &bcode, &size, &dbg) != 0) return 1;
+   buzzvm_t vm = buzzvm_new(1);
+   buzzvm_set_bcode(vm, bcode, size);
+   buzzvm_execute_script(vm);
+   err |= check("script", vm->state == BUZZVM_STATE_DONE);
+   err |= check("step", fcall(vm, "step") == 1 && fcall(vm, "step") == 1);
+   /* A module with bad code leaves the VM alone */
+   uint8_t bad[] = { 0, 0, BUZZVM_INSTR_NOP, BUZZVM_INSTR_JUMP, 0xff, 0, 0, 0, BUZZVM_INSTR_DONE };
+   err |= check("malformed", buzzvm_load_module(vm, bad, sizeof(bad)) == 1 &&
+                buzzvm_load_module(vm, bad, 5) == 1 &&
+                vm->bcode == bcode && vm->bcode_size == size && fcall(vm, "step") == 1);
+   /* Patch */
+   buzzvm_state state = vm->state;
+   int32_t pc = vm->pc;
+   err |= check("load", load(vm, PATCH, dbg) == 0);
+   err |= check("back where it was", vm->state == state && vm->pc == pc && vm->bcode_size > size);
+   err |= check("rebound", fcall(vm, "step") == 2);
+   err |= check("heap kept", global(vm, "count")->o.type == BUZZTYPE_INT && global(vm, "count")->i.value == 13);
+   err |= check("top-level code", global(vm, "patched")->o.type == BUZZTYPE_STRING &&
+                strcmp(global(vm, "patched")->s.value.str, "yes") == 0);
+   err |= check("vstig, swarm kept", fcall(vm, "state") == 517);
+   /* Closures stored elsewhere keep the old code */
+   buzzobj_t t = global(vm, "t");
+   buzzvm_push(vm, t);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "f", 1));
+   buzzvm_tget(vm);
+   buzzvm_closure_call(vm, 0);
+   err |= check("stored closure", buzzvm_stack_at(vm, 1)->i.value == 1);
+   buzzvm_pop(vm);
+   /* Patches pile up */
+   err |= check("load again", load(vm, PATCH2, dbg) == 0 && fcall(vm, "step") == 3 &&
+                fcall(vm, "state") == 517 && global(vm, "count")->i.value == 114);
+   buzzheap_gc(vm);
+   err |= check("gc", fcall(vm, "step") == 3 && fcall(vm, "state") == 517);
+   /* An error in the top-level code is a VM error */
+   err |= check("error", load(vm, BADPATCH, dbg) == 2 && vm->state == BUZZVM_STATE_ERROR);
+   err |= check("error stops", load(vm, PATCH2, dbg) == 2);
+   buzzvm_destroy(&vm);
+   free(bcode);
+   buzzdebug_destroy(&dbg);
+   return err;
+}
@@ -0,0 +1,185 @@
+#include "testbuzzutil.h"
+#include <stdio.h>
+
+/* Sum of the robot ids seen by visit() */
+static int32_t visited = 0;
+
+/* Returns the 'neighbors' table */
+buzzobj_t neighbors(buzzvm_t vm) {
+   return global(vm, "neighbors");
+}
+
+/* Calls neighbors.get(robot) */
+buzzobj_t get(buzzvm_t vm, int32_t robot) {
+   return calli(vm, neighbors(vm), "get", 1, robot);
+}
+
+/* Returns 1 if two floats are close, 0 otherwise */
+int near(float a, float b) {
+   return a - b < 1e-3 && b - a < 1e-3;
+}
+
+/* Returns a float field of a table, or -1 if absent */
+float field(buzzvm_t vm, buzzobj_t t, const char* name) {
+   buzzvm_push(vm, t);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, name, 1));
+   buzzvm_tget(vm);
+   buzzobj_t v = buzzvm_stack_at(vm, 1);
+   buzzvm_pop(vm);
+   return v->o.type == BUZZTYPE_FLOAT ? v->f.value : -1;
+}
+
+/* Closure for neighbors.foreach() */
+int visit(buzzvm_t vm) {
+   buzzvm_lload(vm, 1);
+   visited += buzzvm_stack_at(vm, 1)->i.value;
+   buzzvm_pop(vm);
+   return buzzvm_ret0(vm);
+}
+
+/* Broadcasts an int value on a topic */
+void broadcast(buzzvm_t vm, const char* topic, int32_t value) {
+   buzzvm_pushs(vm, buzzvm_string_register(vm, topic, 1));
+   buzzvm_pushi(vm, value);
+   buzzoutmsg_queue_append_broadcast(vm, buzzvm_stack_at(vm, 2), buzzvm_stack_at(vm, 1));
+   buzzvm_pop(vm);
+   buzzvm_pop(vm);
+}
+
+/* Returns the value of a robot in a table, or -1 if absent */
+int32_t value(buzzvm_t vm, buzzobj_t t, int32_t robot) {
+   buzzvm_push(vm, t);
+   buzzvm_pushi(vm, robot);
+   buzzvm_tget(vm);
+   buzzobj_t v = buzzvm_stack_at(vm, 1);
+   buzzvm_pop(vm);
+   return v->o.type == BUZZTYPE_INT ? v->i.value : -1;
+}
+
+/* Calls neighbors.age(topic, robot) */
+buzzobj_t age(buzzvm_t vm, const char* topic, int32_t robot) {
+   buzzvm_pushs(vm, buzzvm_string_register(vm, topic, 1));
+   buzzobj_t r = call(vm, neighbors(vm), "age", 2, buzzvm_stack_at(vm, 1), integer(vm, robot));
+   buzzvm_pop(vm);
+   return r;
+}
+
+int main() {
+   int err = 0;
+   uint32_t i;
+   buzzvm_t vm = robot(1);
+   /*
+    * One neighbor at a time
+    */
+   buzzneighbors_reset(vm);
+   buzzneighbors_add(vm, 2, 10, 0.5, 0);
+   buzzneighbors_add(vm, 3, 20, 1.0, 0);
+   buzzneighbors_add(vm, 2, 15, 0.5, 0);
+   err |= check("add updates a known robot", vm->neighbors->size == 2 &&
+                vm->neighbors->distance[0] == 15);
+   err |= check("count", call(vm, neighbors(vm), "count", 0)->i.value == 2);
+   err |= check("no table before use", vm->neighbors->entries[0] == NULL &&
+                vm->neighbors->entries[1] == NULL);
+   buzzobj_t e = get(vm, 3);
+   err |= check("get", field(vm, e, "distance") == 20 && field(vm, e, "azimuth") == 1.0f);
+   err |= check("table made on use", vm->neighbors->entries[0] == NULL &&
+                vm->neighbors->entries[1] == e);
+   err |= check("get unknown robot", get(vm, 4)->o.type == BUZZTYPE_NIL);
+   buzzheap_gc(vm);
+   err |= check("table survives gc", get(vm, 3) == e && field(vm, e, "distance") == 20);
+   /*
+    * All the neighbors at once
+    */
+   uint16_t ids[100];
+   float dist[100], az[100], el[100], rssi[100];
+   for(i = 0; i < 100; ++i) {
+      ids[i] = 1000 + i;
+      dist[i] = i;
+      az[i] = 0;
+      el[i] = 0;
+      rssi[i] = -(float)i;
+   }
+   buzzneighbors_set_all(vm, 100, ids, dist, az, el);
+   err |= check("set_all", vm->neighbors->size == 100 &&
+                call(vm, neighbors(vm), "count", 0)->i.value == 100 &&
+                get(vm, 2)->o.type == BUZZTYPE_NIL &&
+                field(vm, get(vm, 1042), "distance") == 42);
+   buzzneighbors_set_field(vm, "rssi", rssi);
+   err |= check("custom field", field(vm, get(vm, 1042), "rssi") == -42 &&
+                field(vm, get(vm, 1099), "rssi") == -99);
+   buzzvm_pushcc(vm, buzzvm_function_register(vm, visit));
+   buzzobj_t fn = buzzvm_stack_at(vm, 1);
+   visited = 0;
+   call(vm, neighbors(vm), "foreach", 1, fn);
+   err |= check("foreach", visited == 100 * 1000 + 99 * 100 / 2);
+   /* The closure and the kin table stay on the stack to survive gc */
+   buzzobj_t k = call(vm, neighbors(vm), "kin", 0);
+   buzzvm_push(vm, k);
+   buzzheap_gc(vm);
+   err |= check("kin", call(vm, k, "count", 0)->i.value == 100);
+   visited = 0;
+   call(vm, k, "foreach", 1, fn);
+   err |= check("foreach on kin", visited == 100 * 1000 + 99 * 100 / 2);
+   /*
+    * Native reductions
+    */
+   buzzvm_pop(vm);
+   for(i = 0; i < 100; ++i) az[i] = (i % 4) * 1.5707963f;
+   buzzneighbors_set_all(vm, 100, ids, dist, az, el);
+   buzzobj_t v = call(vm, neighbors(vm), "sumvec", 0);
+   /* Distances 0,4,8,... go to +x, 1,5,9,... to +y, 2,6,... to -x, 3,7,... to -y */
+   err |= check("sumvec", near(field(vm, v, "x"), -50) && near(field(vm, v, "y"), -50));
+   err |= check("no tables made", vm->neighbors->entries[0] == NULL);
+   v = call(vm, neighbors(vm), "centroid", 0);
+   err |= check("centroid", near(field(vm, v, "x"), -0.5) && near(field(vm, v, "y"), -0.5));
+   buzzobj_t w = callf(vm, neighbors(vm), "within", 1, 9.5);
+   err |= check("within", call(vm, w, "count", 0)->i.value == 10 &&
+                vm->neighbors->entries[9] != NULL && vm->neighbors->entries[10] == NULL);
+   v = call(vm, w, "sumvec", 0);
+   err |= check("sumvec on a derived table", near(field(vm, v, "x"), -2 + 4 - 6 + 8) &&
+                near(field(vm, v, "y"), 1 - 3 + 5 - 7 + 9));
+   buzzobj_t k3 = calli(vm, neighbors(vm), "nearest", 1, 3);
+   buzzvm_push(vm, k3);
+   visited = 0;
+   call(vm, k3, "foreach", 1, fn);
+   err |= check("nearest", call(vm, k3, "count", 0)->i.value == 3 && visited == 1000 + 1001 + 1002);
+   k3 = calli(vm, k3, "nearest", 1, 10);
+   err |= check("nearest on a derived table", call(vm, k3, "count", 0)->i.value == 3);
+   buzzneighbors_reset(vm);
+   err |= check("empty centroid", call(vm, neighbors(vm), "centroid", 0)->o.type == BUZZTYPE_NIL &&
+                near(field(vm, call(vm, neighbors(vm), "sumvec", 0), "x"), 0));
+   buzzneighbors_add(vm, 5, 1, 0, 0);
+   err |= check("reset drops the fields", field(vm, get(vm, 5), "rssi") == -1 &&
+                call(vm, neighbors(vm), "count", 0)->i.value == 1);
+   buzzneighbors_set_field(vm, "rssi", rssi);
+   buzzneighbors_add(vm, 6, 1, 0, 0);
+   buzzneighbors_add(vm, 7, 1, 0, 0);
+   err |= check("field not set for later neighbors", field(vm, get(vm, 5), "rssi") == 0 &&
+                field(vm, get(vm, 6), "rssi") == -1 && field(vm, get(vm, 7), "rssi") == -1);
+   buzzvm_destroy(&vm);
+   /*
+    * Last values on a topic
+    */
+   buzzvm_t a = robot(1);
+   buzzvm_t b = robot(2);
+   buzzvm_pushs(b, buzzvm_string_register(b, "temp", 1));
+   buzzobj_t tl = call(b, neighbors(b), "latest", 1, buzzvm_stack_at(b, 1));
+   buzzvm_pop(b);
+   broadcast(a, "temp", 20);
+   broadcast(a, "other", 5);
+   deliver(a, b);
+   err |= check("latest", value(b, tl, 1) == 20 && age(b, "temp", 1)->i.value == 0 &&
+                age(b, "other", 1)->o.type == BUZZTYPE_NIL);
+   broadcast(a, "temp", 21);
+   broadcast(a, "temp", 22);
+   deliver(a, b);
+   err |= check("newest value of the step", value(b, tl, 1) == 22);
+   for(i = 0; i < 3; ++i) deliver(a, b);
+   buzzheap_gc(b);
+   err |= check("age", value(b, tl, 1) == 22 && age(b, "temp", 1)->i.value == 3);
+   for(i = 0; i < BUZZNEIGHBORS_LATEST_MAXAGE; ++i) deliver(a, b);
+   err |= check("old values expire", value(b, tl, 1) == -1 && age(b, "temp", 1)->o.type == BUZZTYPE_NIL);
+   buzzvm_destroy(&a);
+   buzzvm_destroy(&b);
+   return err;
+}
@@ -0,0 +1,189 @@
+#include "testbuzzutil.h"
+#include <buzz/buzzasm.h>
+#include <buzz/buzzopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * x = 6 * 7 + 0
+ * if(1) y = 2.5 else y = 0
+ * function f(a) { if(!a) return 10 else return 20 }
+ */
+static const char* ASM =
+   "!3\n"
+   "'x\n"
+   "'y\n"
+   "'f\n"
+   "\tpushs 2\n"
+   "\tpushcn @f\n"
+   "\tgstore\n"
+   "\tnop\n"
+   "\tpushs 0\t|1,1,t.bzz\n"
+   "\tpushi 6\t|1,5,t.bzz\n"
+   "\tpushi 7\t|1,9,t.bzz\n"
+   "\tmul\t|1,7,t.bzz\n"
+   "\tpushi 0\t|1,11,t.bzz\n"
+   "\tadd\t|1,13,t.bzz\n"
+   "\tgstore\t|1,1,t.bzz\n"
+   "\tpushi 1\t|2,4,t.bzz\n"
+   "\tjumpz @else\t|2,4,t.bzz\n"
+   "\tpushs 1\t|3,1,t.bzz\n"
+   "\tpushf 2.5\t|3,5,t.bzz\n"
+   "\tgstore\t|3,1,t.bzz\n"
+   "\tjump @end\n"
+   "@else\n"
+   "\tpushs 1\t|5,1,t.bzz\n"
+   "\tpushi 0\t|5,5,t.bzz\n"
+   "\tgstore\t|5,1,t.bzz\n"
+   "@end\n"
+   "\tjump @a\n"
+   "@a\n"
+   "\tpushnil\n"
+   "\tdup\n"
+   "\tpop\n"
+   "\tpop\n"
+   "\tjump @b\n"
+   "@b\n"
+   "\tdone\t|6,1,t.bzz\n"
+   "@f\n"
+   "\tlload 1\t|7,16,t.bzz\n"
+   "\tlnot\t|7,15,t.bzz\n"
+   "\tjumpz @f_else\t|7,14,t.bzz\n"
+   "\tpushi 10\t|7,27,t.bzz\n"
+   "\tret1\t|7,20,t.bzz\n"
+   "@f_else\n"
+   "\tpushi 20\t|7,44,t.bzz\n"
+   "\tret1\t|7,37,t.bzz\n";
+
+/*
+ * x = nil
+ * y = x + 0
+ * w = 3
+ * z = w * 2 + 0
+ */
+static const char* IDENTITY =
+   "!4\n"
+   "'x\n"
+   "'y\n"
+   "'z\n"
+   "'w\n"
+   "\tnop\n"
+   "\tpushs 0\n"
+   "\tpushnil\n"
+   "\tgstore\n"
+   "\tpushs 1\n"
+   "\tpushs 0\n"
+   "\tgload\n"
+   "\tpushi 0\n"
+   "\tadd\n"
+   "\tgstore\n"
+   "\tpushs 3\n"
+   "\tpushi 3\n"
+   "\tgstore\n"
+   "\tpushs 2\n"
+   "\tpushs 3\n"
+   "\tgload\n"
+   "\tpushi 2\n"
+   "\tmul\n"
+   "\tpushi 0\n"
+   "\tadd\n"
+   "\tgstore\n"
+   "\tdone\n";
+
+/* Assembles the code */
+int assemble(const char* code, uint8_t** buf, uint32_t* size, buzzdebug_t* dbg) {
+   char fname[] = "/tmp/testbuzzoptXXXXXX";
+   if(tmpfile_write(fname, code)) return 1;
+   int err = buzz_asm(fname, buf, size, dbg);
+   unlink(fname);
+   return err;
+}
+
+/* Returns how many times the code contains an opcode */
+int contains(const uint8_t* buf, uint32_t size, uint8_t op) {
+   int n = 0;
+   uint32_t i = sizeof(uint16_t);
+   uint16_t count;
+   memcpy(&count, buf, sizeof(uint16_t));
+   while(count > 0) {
+      while(buf[i] != 0) ++i;
+      ++i;
+      --count;
+   }
+   while(i < size) {
+      if(buf[i] == op) ++n;
+      i += (buf[i] >= BUZZVM_INSTR_PUSHF) ? 5 : 1;
+   }
+   return n;
+}
+
+/* Runs the script and calls f(0) and f(5); returns 1 if all is as expected */
+int run(const uint8_t* buf, uint32_t size) {
+   int ok = 1;
+   buzzvm_t vm = buzzvm_new(1);
+   buzzvm_set_bcode(vm, buf, size);
+   buzzvm_execute_script(vm);
+   ok &= vm->state == BUZZVM_STATE_DONE;
+   ok &= intof(global(vm, "x")) == 42;
+   ok &= floatof(global(vm, "y")) == 2.5;
+   buzzvm_pushi(vm, 0);
+   buzzvm_function_call(vm, "f", 1);
+   ok &= buzzvm_stack_at(vm, 1)->i.value == 10;
+   buzzvm_pop(vm);
+   buzzvm_pushi(vm, 5);
+   buzzvm_function_call(vm, "f", 1);
+   ok &= buzzvm_stack_at(vm, 1)->i.value == 20;
+   buzzvm_pop(vm);
+   ok &= vm->state == BUZZVM_STATE_READY;
+   buzzvm_destroy(&vm);
+   return ok;
+}
+
+int main() {
+   int err = 0;
+   uint8_t* buf;
+   uint32_t size;
+   buzzdebug_t dbg;
+   if(assemble(ASM, &buf, &size, &dbg) != 0) return 1;
+   err |= check("unoptimized", run(buf, size));
+   uint32_t before = size;
+   err |= check("optimize", buzz_optimize(buf, &size, &dbg) == 0);
+   err |= check("optimized", run(buf, size));
+   err |= check("smaller", size < before);
+   /* Folded, threaded and dead code is gone */
+   err |= check("constant folding", !contains(buf, size, BUZZVM_INSTR_MUL) && !contains(buf, size, BUZZVM_INSTR_ADD));
+   err |= check("branch folding", !contains(buf, size, BUZZVM_INSTR_JUMPZ) && !contains(buf, size, BUZZVM_INSTR_JUMP));
+   err |= check("peephole", !contains(buf, size, BUZZVM_INSTR_LNOT) && !contains(buf, size, BUZZVM_INSTR_DUP) &&
+                contains(buf, size, BUZZVM_INSTR_JUMPNZ));
+   /* The debug information follows the code */
+   const int32_t* off = buzzdebug_info_get_fromscript(dbg, 1, 5, "t.bzz");
+   int32_t arg = 0;
+   if(off) memcpy(&arg, buf + *off + 1, sizeof(int32_t));
+   err |= check("debug folded", off && buf[*off] == BUZZVM_INSTR_PUSHI && arg == 42);
+   off = buzzdebug_info_get_fromscript(dbg, 3, 5, "t.bzz");
+   err |= check("debug kept", off && buf[*off] == BUZZVM_INSTR_PUSHF);
+   off = buzzdebug_info_get_fromscript(dbg, 7, 15, "t.bzz");
+   err |= check("debug rewritten", off && buf[*off] == BUZZVM_INSTR_JUMPNZ);
+   err |= check("debug dead code", !buzzdebug_info_get_fromscript(dbg, 5, 1, "t.bzz") &&
+                !buzzdebug_info_get_fromscript(dbg, 1, 7, "t.bzz"));
+   /* Optimizing again changes nothing */
+   before = size;
+   buzz_optimize(buf, &size, &dbg);
+   err |= check("fixed point", size == before && run(buf, size));
+   free(buf);
+   buzzdebug_destroy(&dbg);
+   /* 'nil + 0' is still a type error, 'w * 2 + 0' is just 'w * 2' */
+   if(assemble(IDENTITY, &buf, &size, &dbg) != 0) return 1;
+   buzz_optimize(buf, &size, &dbg);
+   buzzvm_t vm = buzzvm_new(1);
+   buzzvm_set_bcode(vm, buf, size);
+   buzzvm_execute_script(vm);
+   err |= check("identity type error", vm->state == BUZZVM_STATE_ERROR && vm->error == BUZZVM_ERROR_TYPE);
+   err |= check("identity", contains(buf, size, BUZZVM_INSTR_MUL) == 1 && contains(buf, size, BUZZVM_INSTR_ADD) == 1);
+   buzzvm_destroy(&vm);
+   free(buf);
+   buzzdebug_destroy(&dbg);
+   return err;
+}
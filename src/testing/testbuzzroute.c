@@ -0,0 +1,122 @@
+#include "testbuzzutil.h"
+#include <stdio.h>
+
+/* The robots, in a line: each one hears the previous and the next */
+#define N 4
+static buzzvm_t vms[N];
+
+/* The last value received by the listener, and its sender */
+static int32_t received = -1;
+static int32_t sender = -1;
+
+/* Closure for route.listen() */
+int listener(buzzvm_t vm) {
+   buzzvm_lload(vm, 1);
+   buzzvm_lload(vm, 2);
+   received = buzzvm_stack_at(vm, 2)->i.value;
+   sender = buzzvm_stack_at(vm, 1)->i.value;
+   buzzvm_pop(vm);
+   buzzvm_pop(vm);
+   return buzzvm_ret0(vm);
+}
+
+/* Runs a step: every robot sends its messages to its neighbors in the line */
+void step() {
+   step_line(vms, N);
+}
+
+int main() {
+   int err = 0;
+   int i;
+   buzzobj_t g[N];
+   for(i = 0; i < N; ++i) vms[i] = robot(i + 1);
+   /*
+    * Gradient
+    */
+   for(i = 0; i < N; ++i) {
+      g[i] = calli(vms[i], global(vms[i], "gradient"), "create", 1, 7);
+      /* Keep the table on the stack to survive gc */
+      buzzvm_push(vms[i], g[i]);
+   }
+   err |= check("no source yet", call(vms[3], g[3], "get", 0)->o.type == BUZZTYPE_NIL);
+   calli(vms[0], g[0], "source", 1, 1);
+   for(i = 0; i < N; ++i) step();
+   err |= check("gradient", floatof(call(vms[3], g[3], "get", 0)) == 3 &&
+                intof(call(vms[3], g[3], "hops", 0)) == 3 &&
+                intof(call(vms[3], g[3], "parent", 0)) == 3 &&
+                floatof(call(vms[0], g[0], "get", 0)) == 0);
+   /* The measured distance is the cost of a link */
+   buzzneighbors_reset(vms[1]);
+   buzzneighbors_add(vms[1], 1, 2.5, 0, 0);
+   for(i = 0; i < BUZZROUTE_REFRESH + N; ++i) step();
+   err |= check("distance", floatof(call(vms[3], g[3], "get", 0)) == 4.5 &&
+                intof(call(vms[3], g[3], "hops", 0)) == 3);
+   /* Once the gradient is built, each robot sends an update per refresh */
+   uint32_t v = vms[2]->route->vectors;
+   for(i = 0; i < 2 * BUZZROUTE_REFRESH; ++i) step();
+   err |= check("rate limit", vms[2]->route->vectors - v == 2);
+   /* Robots that did not create a gradient do not relay it */
+   buzzobj_t h = calli(vms[3], global(vms[3], "gradient"), "create", 1, 8);
+   buzzvm_push(vms[3], h);
+   buzzobj_t s = calli(vms[0], global(vms[0], "gradient"), "create", 1, 8);
+   calli(vms[0], s, "source", 1, 1);
+   for(i = 0; i < N; ++i) step();
+   err |= check("not relayed", call(vms[3], h, "get", 0)->o.type == BUZZTYPE_NIL);
+   /*
+    * Routing
+    */
+   buzzvm_pushcc(vms[3], buzzvm_function_register(vms[3], listener));
+   call(vms[3], global(vms[3], "route"), "listen", 1, buzzvm_stack_at(vms[3], 1));
+   buzzvm_pop(vms[3]);
+   err |= check("no route yet", intof(calli(vms[0], global(vms[0], "route"), "send", 2, 4, 42)) == 0);
+   for(i = 0; i < N; ++i) step();
+   err |= check("route", intof(calli(vms[0], global(vms[0], "route"), "hops", 1, 4)) == 3);
+   err |= check("send", intof(calli(vms[0], global(vms[0], "route"), "send", 2, 4, 42)) == 1);
+   for(i = 0; i < N; ++i) step();
+   err |= check("delivered", received == 42 && sender == 1 &&
+                vms[1]->route->forwarded == 1 && vms[2]->route->forwarded == 1 &&
+                vms[3]->route->delivered == 1);
+   err |= check("send to self", intof(calli(vms[3], global(vms[3], "route"), "send", 2, 4, 7)) == 1);
+   step();
+   err |= check("delivered to self", received == 7 && sender == 4);
+   err |= check("unknown robot", intof(calli(vms[0], global(vms[0], "route"), "send", 2, 9, 1)) == 0 &&
+                calli(vms[0], global(vms[0], "route"), "hops", 1, 9)->o.type == BUZZTYPE_NIL);
+   buzzheap_gc(vms[3]);
+   /*
+    * Two sources, at both ends of the line
+    */
+   buzzobj_t t[N];
+   buzzneighbors_reset(vms[1]);
+   for(i = 0; i < N; ++i) {
+      t[i] = calli(vms[i], global(vms[i], "gradient"), "create", 1, 9);
+      buzzvm_push(vms[i], t[i]);
+   }
+   calli(vms[0], t[0], "source", 1, 1);
+   /* The sequence numbers of the last robot get far ahead */
+   for(i = 0; i < 10; ++i) {
+      calli(vms[3], t[3], "source", 1, 1);
+      calli(vms[3], t[3], "source", 1, 0);
+   }
+   calli(vms[3], t[3], "source", 1, 1);
+   for(i = 0; i < BUZZROUTE_REFRESH + N; ++i) step();
+   err |= check("closest source", floatof(call(vms[1], t[1], "get", 0)) == 1 &&
+                intof(call(vms[1], t[1], "parent", 0)) == 1 &&
+                floatof(call(vms[2], t[2], "get", 0)) == 1 &&
+                intof(call(vms[2], t[2], "parent", 0)) == 4);
+   /* When a source stops, its robots move to the other one */
+   calli(vms[0], t[0], "source", 1, 0);
+   for(i = 0; i < (BUZZROUTE_MISSES + 2) * BUZZROUTE_REFRESH; ++i) step();
+   err |= check("other source", intof(call(vms[0], t[0], "hops", 0)) == 3 &&
+                intof(call(vms[1], t[1], "hops", 0)) == 2 &&
+                intof(call(vms[1], t[1], "parent", 0)) == 3);
+   /*
+    * Expiration
+    */
+   calli(vms[0], g[0], "source", 1, 0);
+   call(vms[3], global(vms[3], "route"), "ignore", 0);
+   for(i = 0; i < (BUZZROUTE_MISSES + 1) * BUZZROUTE_REFRESH; ++i) step();
+   err |= check("expired", call(vms[3], g[3], "get", 0)->o.type == BUZZTYPE_NIL &&
+                calli(vms[0], global(vms[0], "route"), "hops", 1, 4)->o.type == BUZZTYPE_NIL);
+   for(i = 0; i < N; ++i) buzzvm_destroy(&vms[i]);
+   return err;
+}
@@ -0,0 +1,131 @@
+#include "testbuzzutil.h"
+#include <stdio.h>
+
+/* Creates a swarm the way swarm.create(id) does */
+buzzobj_t create(buzzvm_t vm, int32_t id) {
+   return calli(vm, global(vm, "swarm"), "create", 1, id);
+}
+
+int main() {
+   int err = 0;
+   uint16_t i;
+   /*
+    * Membership of the neighbors
+    */
+   buzzswarm_members_t m = buzzswarm_members_new();
+   buzzswarm_members_join(m, 2, 7);
+   buzzswarm_members_join(m, 2, 60000);
+   buzzswarm_members_join(m, 3, 7);
+   err |= check("join", buzzswarm_members_isrobotin(m, 2, 7) &&
+                buzzswarm_members_isrobotin(m, 2, 60000) &&
+                !buzzswarm_members_isrobotin(m, 3, 60000));
+   err |= check("sparse ids get dense indices", buzzswarm_members_index(m, 60000) == 1);
+   err |= check("unknown swarm", !buzzswarm_members_isrobotin(m, 2, 8));
+   err |= check("unknown robot", !buzzswarm_members_isrobotin(m, 4, 7));
+   buzzswarm_members_leave(m, 2, 7);
+   err |= check("leave", !buzzswarm_members_isrobotin(m, 2, 7) && buzzswarm_members_isrobotin(m, 2, 60000));
+   buzzswarm_members_leave(m, 3, 7);
+   err |= check("robot without swarms is forgotten", buzzdict_size(m->robots) == 1);
+   /* Many swarms for one robot */
+   buzzdarray_t ids = buzzdarray_new(100, sizeof(uint16_t), NULL);
+   for(i = 0; i < 100; ++i) {
+      uint16_t id = i * 3;
+      buzzdarray_push(ids, &id);
+   }
+   buzzswarm_members_refresh(m, 2, ids);
+   int ok = 1;
+   for(i = 0; i < 300; ++i)
+      ok &= buzzswarm_members_isrobotin(m, 2, i) == (i % 3 == 0);
+   err |= check("refresh replaces the swarms", ok && !buzzswarm_members_isrobotin(m, 2, 60000));
+   /* Ages out */
+   for(i = 0; i < BUZZSWARM_HEARTBEAT_MISSES * BUZZSWARM_HEARTBEAT_MAX; ++i) {
+      buzzswarm_members_update(m);
+      if(i == BUZZSWARM_HEARTBEAT_MAX) buzzswarm_members_heartbeat(m, 2, buzzswarm_members_hash(m, 2));
+   }
+   err |= check("heartbeats keep the entries", buzzswarm_members_isrobotin(m, 2, 3));
+   for(i = 0; i < BUZZSWARM_HEARTBEAT_MISSES * BUZZSWARM_HEARTBEAT_MAX; ++i) buzzswarm_members_update(m);
+   err |= check("old entries expire", !buzzswarm_members_isrobotin(m, 2, 3));
+   buzzswarm_members_destroy(&m);
+   /*
+    * Membership of this robot, exchanged with a neighbor
+    */
+   buzzvm_t a = robot(1);
+   buzzvm_t b = robot(2);
+   buzzobj_t s1 = create(a, 1);
+   create(a, 2);
+   buzzobj_t s3 = create(a, 500);
+   call(a, s1, "join", 0);
+   call(a, s3, "join", 0);
+   err |= check("in", call(a, s1, "in", 0)->i.value == 1 &&
+                call(a, s3, "in", 0)->i.value == 1);
+   buzzdarray_t mine = buzzswarm_members_mine(a->swarmmembers);
+   err |= check("swarm list", buzzdarray_size(mine) == 2 &&
+                buzzdarray_get(mine, 0, uint16_t) == 1 &&
+                buzzdarray_get(mine, 1, uint16_t) == 500);
+   buzzdarray_destroy(&mine);
+   deliver(a, b);
+   err |= check("neighbor knows the swarms", buzzswarm_members_isrobotin(b->swarmmembers, 1, 1) &&
+                !buzzswarm_members_isrobotin(b->swarmmembers, 1, 2) &&
+                buzzswarm_members_isrobotin(b->swarmmembers, 1, 500));
+   err |= check("digest matches the neighbor's", buzzswarm_members_hash(b->swarmmembers, 1) ==
+                buzzswarm_members_hash(a->swarmmembers, -1));
+   call(a, s1, "leave", 0);
+   deliver(a, b);
+   err |= check("neighbor sees the leave", !buzzswarm_members_isrobotin(b->swarmmembers, 1, 1));
+   buzzvm_destroy(&a);
+   buzzvm_destroy(&b);
+   /*
+    * Heartbeat
+    */
+   a = robot(1);
+   buzzswarm_members_period(a->swarmmembers, 2, 16);
+   s1 = create(a, 1);
+   call(a, s1, "join", 0);
+   struct buzzswarm_stats_s st;
+   /* Digests at steps 2, 6, 14, 30, 46, 62, 78, 94 */
+   for(i = 0; i < 100; ++i) drop(a);
+   buzzswarm_members_stats(a->swarmmembers, &st);
+   err |= check("heartbeat backs off", st.digests == 8 && st.period == 16);
+   /* The full list still goes out for the robots that ignore the digests */
+   err |= check("list for older robots", st.lists == 100 / BUZZSWARM_LIST_PERIOD);
+   call(a, s1, "leave", 0);
+   drop(a);
+   buzzswarm_members_stats(a->swarmmembers, &st);
+   err |= check("a change resets the heartbeat", st.period == 2);
+   buzzvm_destroy(&a);
+   /*
+    * A new neighbor gets the full list, a missed leave is repaired
+    */
+   a = robot(1);
+   b = robot(2);
+   buzzswarm_members_period(a->swarmmembers, 1, 1);
+   s1 = create(a, 1);
+   s3 = create(a, 500);
+   call(a, s1, "join", 0);
+   call(a, s3, "join", 0);
+   /* The joins are lost */
+   drop(a);
+   create(b, 7);
+   /* b hears the digest of a and requests the list */
+   deliver(a, b);
+   buzzswarm_members_stats(b->swarmmembers, &st);
+   err |= check("unknown digest requests the list", st.robots == 1 && st.requests == 1);
+   deliver(b, a);
+   /* a answers with the full list */
+   deliver(a, b);
+   err |= check("new neighbor gets the list", buzzswarm_members_isrobotin(b->swarmmembers, 1, 1) &&
+                buzzswarm_members_isrobotin(b->swarmmembers, 1, 500));
+   /* The leave is lost */
+   call(a, s3, "leave", 0);
+   drop(a);
+   deliver(a, b);
+   deliver(b, a);
+   deliver(a, b);
+   err |= check("missed leave repaired", buzzswarm_members_isrobotin(b->swarmmembers, 1, 1) &&
+                !buzzswarm_members_isrobotin(b->swarmmembers, 1, 500));
+   buzzswarm_members_stats(b->swarmmembers, &st);
+   err |= check("staleness", st.robots == 1 && st.maxage <= 1 && st.requests == 2);
+   buzzvm_destroy(&a);
+   buzzvm_destroy(&b);
+   return err;
+}
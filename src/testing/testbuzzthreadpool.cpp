@@ -0,0 +1,63 @@
+#include "testbuzzutil.h"
+#include <buzz/argos/buzz_thread_pool.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+/* Runs a job and returns 1 if every index was visited exactly once */
+bool once(CBuzzThreadPool& c_pool, size_t un_count) {
+   std::vector<std::atomic<int> > vecHits(un_count);
+   for(size_t i = 0; i < un_count; ++i) vecHits[i] = 0;
+   c_pool.ParallelFor(un_count, [&vecHits](size_t i) { ++vecHits[i]; });
+   for(size_t i = 0; i < un_count; ++i)
+      if(vecHits[i] != 1) return false;
+   return true;
+}
+
+int main() {
+   int err = 0;
+   /* Shutdown of a pool that never worked */
+   {
+      CBuzzThreadPool cIdle(4);
+      err |= check("threads", cIdle.GetNumThreads() == 4);
+   }
+   err |= check("idle shutdown", true);
+   CBuzzThreadPool cPool(4);
+   err |= check("empty job", once(cPool, 0));
+   err |= check("single task", once(cPool, 1));
+   err |= check("each task once", once(cPool, 10007));
+   /* Uneven tasks: the slow ones all end up in the queue of one worker */
+   std::atomic<size_t> unThreads(0);
+   std::vector<std::atomic<bool> > vecSeen(64);
+   auto tStart = std::chrono::steady_clock::now();
+   cPool.ParallelFor(64, [&](size_t i) {
+         if(i < 8) std::this_thread::sleep_for(std::chrono::milliseconds(20));
+         ++unThreads;
+      });
+   double fElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+   err |= check("uneven tasks", unThreads == 64 && fElapsed < 8 * 0.020);
+   /* Many short jobs in a row */
+   bool bOK = true;
+   for(int j = 0; j < 1000 && bOK; ++j) bOK = once(cPool, 13);
+   err |= check("repeated jobs", bOK);
+   /* Exceptions are rethrown once all the tasks are done */
+   std::atomic<size_t> unDone(0);
+   bool bThrown = false;
+   try {
+      cPool.ParallelFor(100, [&unDone](size_t i) {
+            if(i == 42) throw std::runtime_error("task 42");
+            ++unDone;
+         });
+   }
+   catch(std::runtime_error& ex) {
+      bThrown = true;
+   }
+   err |= check("exception", bThrown && unDone == 99);
+   err |= check("after exception", once(cPool, 500));
+   /* A pool with a single thread runs the tasks in the calling thread */
+   CBuzzThreadPool cSerial(1);
+   err |= check("serial", cSerial.GetNumThreads() == 1 && once(cSerial, 100));
+   return err;
+}
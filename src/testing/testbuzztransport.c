@@ -0,0 +1,83 @@
+#include "testbuzzutil.h"
+#include <buzz/buzzbus.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#define ROBOTS 3
+
+/* Returns the number of neighbors of a robot */
+int64_t neighbor_count(buzzvm_t vm) {
+   return vm->neighbors->size;
+}
+
+int main() {
+   int err = 0;
+   uint16_t id = 1;
+   int i, s;
+   /* A line of robots, where each robot can talk only to the closest ones */
+   buzzbus_t bus = buzzbus_new(1.5f);
+   buzzvm_t vm[ROBOTS];
+   buzztransport_t t[ROBOTS];
+   for(i = 0; i < ROBOTS; ++i) {
+      vm[i] = vstig_robot(i + 1, id);
+      t[i] = buzzbus_transport_new(bus, i + 1, 64);
+      buzzbus_set_position(t[i], i, 0, 0, 0);
+   }
+   fprintf(stdout, "duplicate id rejected: %s\n",
+           buzzbus_transport_new(bus, 1, 64) ? "NO" : "YES");
+   /* The first robot puts a large table in the virtual stigmergy */
+   buzzobj_t k;
+   buzzvm_pushs(vm[0], buzzvm_string_register(vm[0], "map", 1));
+   k = buzzvm_stack_at(vm[0], 1);
+   buzzvm_pusht(vm[0]);
+   buzzobj_t v = buzzvm_stack_at(vm[0], 1);
+   for(i = 0; i < 40; ++i) {
+      buzzvm_push(vm[0], v);
+      buzzvm_pushi(vm[0], i);
+      buzzvm_pushi(vm[0], i * i);
+      buzzvm_tput(vm[0]);
+   }
+   buzzvstig_elem_t e = buzzvstig_elem_new(v, 1, vm[0]->robot);
+   buzzvstig_store(vstig(vm[0], id), &k, &e);
+   buzzoutmsg_queue_append_vstig(vm[0], BUZZMSG_VSTIG_PUT, id, k, e);
+   buzzvm_pop(vm[0]);
+   buzzvm_pop(vm[0]);
+   /* Run the swarm until the table has gone through the line */
+   for(s = 0; s < 100; ++s) {
+      for(i = 0; i < ROBOTS; ++i) buzztransport_process_inmsgs(t[i], vm[i]);
+      for(i = 0; i < ROBOTS; ++i) buzztransport_process_outmsgs(t[i], vm[i]);
+      buzzbus_tick(bus);
+   }
+   /* Check the neighbors */
+   for(i = 0; i < ROBOTS; ++i) {
+      int64_t n = neighbor_count(vm[i]);
+      fprintf(stdout, "robot %d: %" PRId64 " neighbors, %" PRIu64 " packets sent, %" PRIu64 " received\n",
+              i + 1, n, t[i]->sent, t[i]->received);
+      err |= n != (i == 1 ? 2 : 1);
+   }
+   /* Check that the table reached the last robot */
+   buzzvm_pushs(vm[ROBOTS-1], buzzvm_string_register(vm[ROBOTS-1], "map", 1));
+   k = buzzvm_stack_at(vm[ROBOTS-1], 1);
+   const buzzvstig_elem_t* l = buzzvstig_fetch(vstig(vm[ROBOTS-1], id), &k);
+   int ok = l &&
+      (*l)->data->o.type == BUZZTYPE_TABLE &&
+      buzzdict_size((*l)->data->t.value) == 40;
+   fprintf(stdout, "table received by robot %d: %s\n", ROBOTS, ok ? "OK" : "MISSING");
+   err |= !ok;
+   /* The packets received while waiting are kept for the next step */
+   for(i = 0; i < ROBOTS; ++i) buzztransport_process_outmsgs(t[i], vm[i]);
+   buzzbus_tick(bus);
+   for(i = 0; i < ROBOTS; ++i) buzztransport_wait(t[i], 10);
+   ok = buzzdarray_size(t[1]->pending) == 2;
+   for(i = 0; i < ROBOTS; ++i) buzztransport_process_inmsgs(t[i], vm[i]);
+   err |= check("packets kept while waiting",
+                ok && buzzdarray_isempty(t[1]->pending) &&
+                neighbor_count(vm[0]) == 1 && neighbor_count(vm[1]) == 2);
+   /* Cleanup */
+   for(i = 0; i < ROBOTS; ++i) {
+      buzztransport_destroy(&t[i]);
+      buzzvm_destroy(&vm[i]);
+   }
+   buzzbus_destroy(&bus);
+   return err;
+}
@@ -0,0 +1,214 @@
+#include "testbuzzutil.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* An empty script: no strings, no functions */
+static const uint8_t BCODE[] = { 0, 0, BUZZVM_INSTR_NOP, BUZZVM_INSTR_DONE };
+
+/****************************************/
+/****************************************/
+
+buzzvm_t robot(uint16_t id) {
+   buzzvm_t vm = buzzvm_new(id);
+   buzzvm_set_bcode(vm, BCODE, sizeof(BCODE));
+   return vm;
+}
+
+/****************************************/
+/****************************************/
+
+buzzvm_t vstig_robot(uint16_t id, uint16_t vsid) {
+   buzzvm_t vm = robot(id);
+   vstig(vm, vsid);
+   return vm;
+}
+
+/****************************************/
+/****************************************/
+
+buzzobj_t global(buzzvm_t vm, const char* name) {
+   buzzvm_pushs(vm, buzzvm_string_register(vm, name, 1));
+   buzzvm_gload(vm);
+   buzzobj_t o = buzzvm_stack_at(vm, 1);
+   buzzvm_pop(vm);
+   return o;
+}
+
+/****************************************/
+/****************************************/
+
+buzzobj_t integer(buzzvm_t vm, int32_t v) {
+   buzzobj_t o = buzzheap_newobj(vm, BUZZTYPE_INT);
+   o->i.value = v;
+   return o;
+}
+
+/****************************************/
+/****************************************/
+
+buzzobj_t number(buzzvm_t vm, float v) {
+   buzzobj_t o = buzzheap_newobj(vm, BUZZTYPE_FLOAT);
+   o->f.value = v;
+   return o;
+}
+
+/****************************************/
+/****************************************/
+
+int32_t intof(buzzobj_t o) {
+   return o->o.type == BUZZTYPE_INT ? o->i.value : -1;
+}
+
+/****************************************/
+/****************************************/
+
+float floatof(buzzobj_t o) {
+   return o->o.type == BUZZTYPE_FLOAT ? o->f.value : -1;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Calls a method with the arguments already on the stack.
+ */
+static buzzobj_t callv(buzzvm_t vm, int argc) {
+   buzzvm_pushi(vm, argc);
+   buzzvm_callc(vm);
+   buzzobj_t r = buzzvm_stack_at(vm, 1);
+   buzzvm_pop(vm);
+   return r;
+}
+
+/*
+ * Pushes the self table and the method.
+ */
+static void callm(buzzvm_t vm, buzzobj_t t, const char* method) {
+   /* The table is the self table and the place to look up the method */
+   buzzvm_push(vm, t);
+   buzzvm_push(vm, t);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, method, 1));
+   buzzvm_tget(vm);
+}
+
+buzzobj_t call(buzzvm_t vm,
+               buzzobj_t t,
+               const char* method,
+               int argc, ...) {
+   va_list ap;
+   int i;
+   callm(vm, t, method);
+   va_start(ap, argc);
+   for(i = 0; i < argc; ++i) buzzvm_push(vm, va_arg(ap, buzzobj_t));
+   va_end(ap);
+   return callv(vm, argc);
+}
+
+buzzobj_t calli(buzzvm_t vm,
+                buzzobj_t t,
+                const char* method,
+                int argc, ...) {
+   va_list ap;
+   int i;
+   callm(vm, t, method);
+   va_start(ap, argc);
+   for(i = 0; i < argc; ++i) buzzvm_pushi(vm, va_arg(ap, int32_t));
+   va_end(ap);
+   return callv(vm, argc);
+}
+
+buzzobj_t callf(buzzvm_t vm,
+                buzzobj_t t,
+                const char* method,
+                int argc, ...) {
+   va_list ap;
+   int i;
+   callm(vm, t, method);
+   va_start(ap, argc);
+   for(i = 0; i < argc; ++i) buzzvm_pushf(vm, va_arg(ap, double));
+   va_end(ap);
+   return callv(vm, argc);
+}
+
+/****************************************/
+/****************************************/
+
+buzzvstig_t vstig(buzzvm_t vm, uint16_t id) {
+   const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+   if(vs) return *vs;
+   buzzvstig_t nvs = buzzvstig_new();
+   buzzdict_set(vm->vstigs, &id, &nvs);
+   return nvs;
+}
+
+/****************************************/
+/****************************************/
+
+int deliver(buzzvm_t src, buzzvm_t dst) {
+   int n = 0;
+   buzzvm_process_outmsgs(src);
+   while(!buzzoutmsg_queue_isempty(src)) {
+      buzzinmsg_queue_append(dst, src->robot, buzzoutmsg_queue_first(src));
+      buzzoutmsg_queue_next(src);
+      ++n;
+   }
+   buzzvm_process_inmsgs(dst);
+   return n;
+}
+
+/****************************************/
+/****************************************/
+
+int drop(buzzvm_t vm) {
+   int n = 0;
+   buzzvm_process_outmsgs(vm);
+   while(!buzzoutmsg_queue_isempty(vm)) {
+      buzzoutmsg_queue_next(vm);
+      ++n;
+   }
+   return n;
+}
+
+/****************************************/
+/****************************************/
+
+void step_line(buzzvm_t* vms, int n) {
+   int i;
+   for(i = 0; i < n; ++i) {
+      buzzvm_process_outmsgs(vms[i]);
+      while(!buzzoutmsg_queue_isempty(vms[i])) {
+         if(i > 0)
+            buzzinmsg_queue_append(vms[i-1], vms[i]->robot, buzzoutmsg_queue_first(vms[i]));
+         if(i < n - 1)
+            buzzinmsg_queue_append(vms[i+1], vms[i]->robot, buzzoutmsg_queue_first(vms[i]));
+         buzzoutmsg_queue_next(vms[i]);
+      }
+   }
+   for(i = 0; i < n; ++i)
+      buzzvm_process_inmsgs(vms[i]);
+}
+
+/****************************************/
+/****************************************/
+
+int tmpfile_write(char* fname, const char* str) {
+   int fd = mkstemp(fname);
+   if(fd < 0) return 1;
+   ssize_t n = write(fd, str, strlen(str));
+   close(fd);
+   return n < (ssize_t)strlen(str);
+}
+
+/****************************************/
+/****************************************/
+
+int check(const char* what, int ok) {
+   fprintf(stdout, "%s: %s\n", what, ok ? "OK" : "FAILED");
+   return !ok;
+}
+
+/****************************************/
+/****************************************/
@@ -0,0 +1,148 @@
+#ifndef TESTBUZZUTIL_H
+#define TESTBUZZUTIL_H
+
+#include <buzz/buzzvm.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /*
+    * Helpers shared by the test programs.
+    */
+
+   /*
+    * Creates a robot that runs an empty script.
+    * @param id The robot id.
+    * @return A new VM.
+    */
+   extern buzzvm_t robot(uint16_t id);
+
+   /*
+    * Creates a robot that runs an empty script and has an empty virtual
+    * stigmergy.
+    * @param id The robot id.
+    * @param vsid The virtual stigmergy id.
+    * @return A new VM.
+    */
+   extern buzzvm_t vstig_robot(uint16_t id, uint16_t vsid);
+
+   /*
+    * Returns the value of a global symbol.
+    * @param vm The VM data.
+    * @param name The symbol name.
+    * @return The value, or nil if the symbol does not exist.
+    */
+   extern buzzobj_t global(buzzvm_t vm, const char* name);
+
+   /*
+    * Returns a new int object.
+    * @param vm The VM data.
+    * @param v The value.
+    * @return The object.
+    */
+   extern buzzobj_t integer(buzzvm_t vm, int32_t v);
+
+   /*
+    * Returns a new float object.
+    * @param vm The VM data.
+    * @param v The value.
+    * @return The object.
+    */
+   extern buzzobj_t number(buzzvm_t vm, float v);
+
+   /*
+    * Returns the value of an int object.
+    * @param o The object.
+    * @return The value, or -1 if the object is not an int.
+    */
+   extern int32_t intof(buzzobj_t o);
+
+   /*
+    * Returns the value of a float object.
+    * @param o The object.
+    * @return The value, or -1 if the object is not a float.
+    */
+   extern float floatof(buzzobj_t o);
+
+   /*
+    * Calls a method of a table, with the table as self, and returns the result.
+    * @param vm The VM data.
+    * @param t The table.
+    * @param method The method name.
+    * @param argc The number of arguments, passed as buzzobj_t after argc.
+    * @return The value returned by the method.
+    */
+   extern buzzobj_t call(buzzvm_t vm,
+                         buzzobj_t t,
+                         const char* method,
+                         int argc, ...);
+
+   /*
+    * Like call(), with int32_t arguments.
+    */
+   extern buzzobj_t calli(buzzvm_t vm,
+                          buzzobj_t t,
+                          const char* method,
+                          int argc, ...);
+
+   /*
+    * Like call(), with float arguments.
+    */
+   extern buzzobj_t callf(buzzvm_t vm,
+                          buzzobj_t t,
+                          const char* method,
+                          int argc, ...);
+
+   /*
+    * Returns a virtual stigmergy of a robot, creating it if needed.
+    * @param vm The VM data.
+    * @param id The virtual stigmergy id.
+    * @return The virtual stigmergy.
+    */
+   extern buzzvstig_t vstig(buzzvm_t vm, uint16_t id);
+
+   /*
+    * Sends the messages of a robot to another and processes them.
+    * @param src The sending robot.
+    * @param dst The receiving robot.
+    * @return The number of messages sent.
+    */
+   extern int deliver(buzzvm_t src, buzzvm_t dst);
+
+   /*
+    * Throws the messages of a robot away, as if nobody heard them.
+    * @param vm The VM data.
+    * @return The number of messages thrown away.
+    */
+   extern int drop(buzzvm_t vm);
+
+   /*
+    * Runs a step in which robots in a line hear the previous and the next.
+    * @param vms The robots, in order.
+    * @param n The number of robots.
+    */
+   extern void step_line(buzzvm_t* vms, int n);
+
+   /*
+    * Writes a string into a new temporary file.
+    * @param fname The file name template, as for mkstemp(). On return,
+    *              the name of the file.
+    * @param str The string to write.
+    * @return 0 on success, 1 on error.
+    */
+   extern int tmpfile_write(char* fname, const char* str);
+
+   /*
+    * Prints the outcome of a check.
+    * @param what The name of the check.
+    * @param ok Whether the check passed.
+    * @return 0 if the check passed, 1 otherwise.
+    */
+   extern int check(const char* what, int ok);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,107 @@
+#include "testbuzzutil.h"
+#include <stdio.h>
+#include <time.h>
+
+#define ENTRIES 10000
+
+/* Returns a new virtual stigmergy, created the way stigmergy.create(id) does */
+buzzobj_t create(buzzvm_t vm, uint16_t id, buzzvstig_t* vs) {
+   buzzobj_t s = calli(vm, global(vm, "stigmergy"), "create", 1, id);
+   *vs = vstig(vm, id);
+   return s;
+}
+
+/* Stores an entry */
+void store(buzzvm_t vm, buzzvstig_t vs, buzzobj_t k, buzzobj_t v) {
+   buzzvstig_elem_t e = buzzvstig_elem_new(v, 1, vm->robot);
+   buzzvstig_store(vs, &k, &e);
+}
+
+/* Returns a table { .x = x } */
+buzzobj_t point(buzzvm_t vm, int32_t x) {
+   buzzobj_t t = buzzheap_newobj(vm, BUZZTYPE_TABLE);
+   buzzobj_t k = buzzheap_newobj(vm, BUZZTYPE_STRING);
+   k->s.value.sid = buzzvm_string_register(vm, "x", 1);
+   k->s.value.str = buzzvm_string_get(vm, k->s.value.sid);
+   buzzobj_t v = integer(vm, x);
+   buzzdict_set(t->t.value, &k, &v);
+   return t;
+}
+
+/* A native function that adds the value to the accumulator, for reduce() */
+int add(buzzvm_t vm) {
+   buzzvm_lload(vm, 2);
+   buzzvm_lload(vm, 4);
+   buzzvm_add(vm);
+   return buzzvm_ret1(vm);
+}
+
+/* Returns the time in ms */
+double now() {
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec * 1000.0 + t.tv_nsec / 1e6;
+}
+
+int main() {
+   int err = 0;
+   int i;
+   buzzvm_t vm = robot(1);
+   buzzvstig_t vs;
+   create(vm, 1, &vs);
+   /*
+    * Aggregates over plain values
+    */
+   store(vm, vs, integer(vm, 0), integer(vm, 4));
+   store(vm, vs, integer(vm, 1), integer(vm, -2));
+   store(vm, vs, integer(vm, 2), integer(vm, 7));
+   store(vm, vs, integer(vm, 3), buzzheap_newobj(vm, BUZZTYPE_NIL));
+   buzzobj_t r = buzzvstig_aggregate_elems(vm, vs, BUZZVSTIG_AGG_SUM, NULL);
+   err |= check("sum", r->o.type == BUZZTYPE_INT && r->i.value == 9);
+   r = buzzvstig_aggregate_elems(vm, vs, BUZZVSTIG_AGG_COUNT, NULL);
+   err |= check("count skips nil", r->i.value == 3);
+   r = buzzvstig_aggregate_elems(vm, vs, BUZZVSTIG_AGG_MIN, NULL);
+   err |= check("min", r->i.value == -2);
+   r = buzzvstig_aggregate_elems(vm, vs, BUZZVSTIG_AGG_ARGMAX, NULL);
+   err |= check("argmax", r->o.type == BUZZTYPE_INT && r->i.value == 2);
+   buzzobj_t f = buzzheap_newobj(vm, BUZZTYPE_FLOAT);
+   f->f.value = 0.5f;
+   store(vm, vs, integer(vm, 4), f);
+   r = buzzvstig_aggregate_elems(vm, vs, BUZZVSTIG_AGG_SUM, NULL);
+   err |= check("sum with floats", r->o.type == BUZZTYPE_FLOAT && r->f.value == 9.5f);
+   /*
+    * Aggregates over a field
+    */
+   create(vm, 2, &vs);
+   for(i = 0; i < ENTRIES; ++i) store(vm, vs, integer(vm, i), point(vm, i % 100));
+   buzzobj_t x = buzzheap_newobj(vm, BUZZTYPE_STRING);
+   x->s.value.sid = buzzvm_string_register(vm, "x", 1);
+   x->s.value.str = buzzvm_string_get(vm, x->s.value.sid);
+   r = buzzvstig_aggregate_elems(vm, vs, BUZZVSTIG_AGG_SUM, x);
+   err |= check("sum of a field", r->i.value == 49500 * (ENTRIES / 1000));
+   r = buzzvstig_aggregate_elems(vm, vs, BUZZVSTIG_AGG_MAX, x);
+   err |= check("max of a field", r->i.value == 99);
+   r = buzzvstig_aggregate_elems(vm, vs, BUZZVSTIG_AGG_ARGMIN, NULL);
+   err |= check("argmin of non-numeric values", r->o.type == BUZZTYPE_NIL);
+   /*
+    * Native aggregate versus reduce() with a closure, over plain values
+    */
+   buzzobj_t s = create(vm, 3, &vs);
+   for(i = 0; i < ENTRIES; ++i) store(vm, vs, integer(vm, i), integer(vm, 1));
+   double t0 = now();
+   r = buzzvstig_aggregate_elems(vm, vs, BUZZVSTIG_AGG_SUM, NULL);
+   double t1 = now();
+   err |= check("native sum", r->i.value == ENTRIES);
+   /* s.reduce(add, 0) */
+   buzzvm_pushcc(vm, buzzvm_function_register(vm, add));
+   buzzobj_t fn = buzzvm_stack_at(vm, 1);
+   buzzobj_t zero = integer(vm, 0);
+   double t2 = now();
+   r = call(vm, s, "reduce", 2, fn, zero);
+   double t3 = now();
+   buzzvm_pop(vm);
+   err |= check("reduce sum", r->i.value == ENTRIES);
+   fprintf(stdout, "%d entries: native %.3f ms, reduce %.3f ms\n", ENTRIES, t1 - t0, t3 - t2);
+   buzzvm_destroy(&vm);
+   return err;
+}
@@ -0,0 +1,119 @@
+#include "testbuzzutil.h"
+#include <stdio.h>
+#include <inttypes.h>
+
+#define ENTRIES 100
+
+static const uint16_t ID = 1;
+
+/* Writes an entry the way vs.put(key, value) or vs.putmany(table) do */
+void put(buzzvm_t vm, int32_t key, int32_t value, uint64_t ts, int batch) {
+   buzzvm_pushi(vm, key);
+   buzzobj_t k = buzzvm_stack_at(vm, 1);
+   buzzvm_pushi(vm, value);
+   buzzobj_t v = buzzvm_stack_at(vm, 1);
+   buzzvstig_elem_t e = buzzvstig_elem_new(v, ts, vm->robot);
+   buzzvstig_store(vstig(vm, ID), &k, &e);
+   if(batch) buzzoutmsg_queue_append_vstig_batch(vm, ID, k, e);
+   else buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, ID, k, e);
+   buzzvm_pop(vm);
+   buzzvm_pop(vm);
+}
+
+/*
+ * Moves the queued messages of a robot to another and returns their number.
+ * If type is not NULL, it is set to the type of the last message.
+ */
+int transfer(buzzvm_t src, buzzvm_t dst, uint8_t* type) {
+   int n = 0;
+   while(!buzzoutmsg_queue_isempty(src)) {
+      buzzmsg_payload_t m = buzzoutmsg_queue_first(src);
+      if(type) *type = buzzmsg_payload_type(m);
+      buzzinmsg_queue_append(dst, src->robot, m);
+      buzzoutmsg_queue_next(src);
+      ++n;
+   }
+   buzzvm_process_inmsgs(dst);
+   return n;
+}
+
+int test(int batch, int expected) {
+   buzzvm_t a = vstig_robot(1, ID);
+   buzzvm_t b = vstig_robot(2, ID);
+   buzzvm_t c = vstig_robot(3, ID);
+   int i;
+   for(i = 0; i < ENTRIES; ++i) put(a, i, i, 1, batch);
+   /* Send to b, then let b relay to c */
+   uint8_t t1, t2;
+   int n1 = transfer(a, b, &t1);
+   int n2 = transfer(b, c, &t2);
+   /* Older VMs ignore batches, instead of reading only their first entry */
+   uint8_t type = batch ? BUZZMSG_VSTIG_PUTMANY : BUZZMSG_VSTIG_PUT;
+   int ok =
+      n1 == expected && n2 == expected &&
+      t1 == type && t2 == type &&
+      buzzdict_size(vstig(b, ID)->data) == ENTRIES &&
+      buzzdict_size(vstig(c, ID)->data) == ENTRIES;
+   fprintf(stdout, "%s: %d messages, %d relayed: %s\n",
+           batch ? "putmany" : "put", n1, n2, ok ? "OK" : "FAILED");
+   buzzvm_destroy(&a);
+   buzzvm_destroy(&b);
+   buzzvm_destroy(&c);
+   return !ok;
+}
+
+int replace() {
+   buzzvm_t a = vstig_robot(1, ID);
+   buzzvm_t b = vstig_robot(2, ID);
+   int i;
+   for(i = 0; i < ENTRIES; ++i) put(a, i, i, 1, 0);
+   /* Newer writes replace the queued messages, older ones are dropped */
+   put(a, 0, 1000, 2, 0);
+   put(a, 1, 1001, 0, 0);
+   int ok = buzzoutmsg_queue_vstig_size(a) == ENTRIES;
+   /* The replaced message keeps its place at the head of the queue */
+   buzzinmsg_queue_append(b, a->robot, buzzoutmsg_queue_first(a));
+   buzzoutmsg_queue_next(a);
+   buzzvm_process_inmsgs(b);
+   buzzvm_pushi(b, 0);
+   buzzobj_t k = buzzvm_stack_at(b, 1);
+   const buzzvstig_elem_t* x = buzzvstig_fetch(vstig(b, ID), &k);
+   buzzvm_pop(b);
+   ok = ok &&
+      buzzdict_size(vstig(b, ID)->data) == 1 &&
+      x && (*x)->data->i.value == 1000;
+   /* The rest of the queue is intact */
+   int n = transfer(a, b, NULL);
+   ok = ok &&
+      n == ENTRIES - 1 &&
+      buzzdict_size(vstig(b, ID)->data) == ENTRIES;
+   fprintf(stdout, "replace: %s\n", ok ? "OK" : "FAILED");
+   buzzvm_destroy(&a);
+   buzzvm_destroy(&b);
+   return !ok;
+}
+
+/* A batch of one entry is an ordinary PUT */
+int single() {
+   buzzvm_t a = vstig_robot(1, ID);
+   buzzvm_t b = vstig_robot(2, ID);
+   put(a, 0, 5, 1, 1);
+   uint8_t type;
+   int n = transfer(a, b, &type);
+   int ok =
+      n == 1 && type == BUZZMSG_VSTIG_PUT &&
+      buzzdict_size(vstig(b, ID)->data) == 1;
+   fprintf(stdout, "single putmany: %s\n", ok ? "OK" : "FAILED");
+   buzzvm_destroy(&a);
+   buzzvm_destroy(&b);
+   return !ok;
+}
+
+int main() {
+   int err = 0;
+   err |= test(0, ENTRIES);
+   err |= test(1, (ENTRIES + BUZZOUTMSG_VSTIG_BATCH_MAX - 1) / BUZZOUTMSG_VSTIG_BATCH_MAX);
+   err |= replace();
+   err |= single();
+   return err;
+}
@@ -0,0 +1,151 @@
+#include "testbuzzutil.h"
+#include <stdio.h>
+#include <inttypes.h>
+
+static const uint16_t ID = 1;
+
+/* Writes an entry with the given timestamp, or with the VM clock if 0 */
+uint64_t put(buzzvm_t vm, int32_t key, int32_t value, uint64_t ts) {
+   buzzvm_pushi(vm, key);
+   buzzobj_t k = buzzvm_stack_at(vm, 1);
+   buzzvm_pushi(vm, value);
+   buzzobj_t v = buzzvm_stack_at(vm, 1);
+   const buzzvstig_elem_t* x = buzzvstig_fetch(vstig(vm, ID), &k);
+   if(!ts) ts = buzzvstig_clock_tick(vm, x ? (*x)->timestamp : 0);
+   buzzvstig_elem_t e = buzzvstig_elem_new(v, ts, vm->robot);
+   buzzvstig_store(vstig(vm, ID), &k, &e);
+   buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, ID, k, e);
+   buzzvm_pop(vm);
+   buzzvm_pop(vm);
+   return ts;
+}
+
+/* Returns the entry for a key, or NULL if not found */
+const buzzvstig_elem_t* get(buzzvm_t vm, int32_t key) {
+   buzzvm_pushi(vm, key);
+   buzzobj_t k = buzzvm_stack_at(vm, 1);
+   const buzzvstig_elem_t* x = buzzvstig_fetch(vstig(vm, ID), &k);
+   buzzvm_pop(vm);
+   return x;
+}
+
+/* Moves the queued messages of a robot to another, returning the type of the first one */
+uint8_t transfer(buzzvm_t src, buzzvm_t dst) {
+   uint8_t type = 0xFF;
+   while(!buzzoutmsg_queue_isempty(src)) {
+      buzzmsg_payload_t m = buzzoutmsg_queue_first(src);
+      if(type == 0xFF) type = buzzmsg_payload_get(m, 0) & ~BUZZMSG_FLAG_COMPRESSED;
+      buzzinmsg_queue_append(dst, src->robot, m);
+      buzzoutmsg_queue_next(src);
+   }
+   buzzvm_process_inmsgs(dst);
+   return type;
+}
+
+/* The fields of the entries seen by the conflict manager */
+static int32_t seen_hi[2], seen_lo[2];
+static float seen_ts[2];
+
+/* Returns a field of a table */
+buzzobj_t field(buzzvm_t vm, buzzobj_t t, const char* name) {
+   buzzvm_push(vm, t);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, name, 1));
+   buzzvm_tget(vm);
+   buzzobj_t o = buzzvm_stack_at(vm, 1);
+   buzzvm_pop(vm);
+   return o;
+}
+
+/* Conflict manager: records the timestamps and keeps the local entry */
+int onconflict(buzzvm_t vm) {
+   int i;
+   for(i = 0; i < 2; ++i) {
+      buzzvm_lload(vm, i + 2);
+      buzzobj_t t = buzzvm_stack_at(vm, 1);
+      buzzvm_pop(vm);
+      buzzobj_t ts = field(vm, t, "timestamp");
+      seen_ts[i] = ts->o.type == BUZZTYPE_FLOAT ? ts->f.value : -1;
+      seen_hi[i] = field(vm, t, "timestamp_hi")->i.value;
+      seen_lo[i] = field(vm, t, "timestamp_lo")->i.value;
+   }
+   buzzvm_lload(vm, 2);
+   return buzzvm_ret1(vm);
+}
+
+int main() {
+   int err = 0;
+   /*
+    * Lamport clock across the 16-bit boundary
+    */
+   buzzvm_t a = vstig_robot(1, ID);
+   buzzvm_t b = vstig_robot(2, ID);
+   put(a, 0, 10, 65530);
+   uint8_t type = transfer(a, b);
+   err |= check("small timestamp uses the 16-bit format", type == BUZZMSG_VSTIG_PUT);
+   err |= check("small timestamp received", get(b, 0) && (*get(b, 0))->timestamp == 65530);
+   /* Write until the timestamp no longer fits in 16 bits */
+   int i;
+   for(i = 0; i < 10; ++i) put(a, 0, 11 + i, 0);
+   type = transfer(a, b);
+   err |= check("large timestamp uses the 64-bit format", type == (BUZZMSG_VSTIG_PUT | BUZZMSG_FLAG_WIDE));
+   err |= check("large timestamp received",
+                get(b, 0) &&
+                (*get(b, 0))->timestamp == 65540 &&
+                (*get(b, 0))->data->i.value == 20);
+   /* An older write must not win after the wrap-around */
+   put(a, 0, 99, 65535);
+   transfer(a, b);
+   err |= check("older write discarded", (*get(b, 0))->data->i.value == 20);
+   buzzvm_destroy(&a);
+   buzzvm_destroy(&b);
+   /*
+    * Extension of the 16-bit timestamps sent by older robots
+    */
+   err |= check("16-bit extension forward", buzzvstig_ts_extend(65635, 0x70) == 65648);
+   err |= check("16-bit extension backward", buzzvstig_ts_extend(65540, 65530) == 65530);
+   err |= check("16-bit timestamps as they are", buzzvstig_ts_extend(3, 65530) == 65530);
+   /*
+    * Hybrid logical clock
+    */
+   a = vstig_robot(1, ID);
+   b = vstig_robot(2, ID);
+   a->vstigtime = 1000;
+   b->vstigtime = 500;
+   uint64_t t1 = put(a, 0, 1, 0);
+   uint64_t t2 = put(a, 1, 1, 0);
+   err |= check("physical time in the upper bits", t1 == (1000ull << 16));
+   err |= check("counter breaks ties", t2 == t1 + 1);
+   transfer(a, b);
+   /* b is behind in physical time, but its writes must still win */
+   uint64_t t3 = put(b, 0, 2, 0);
+   err |= check("clock catches up with received timestamps", buzzvstig_ts_newer(t3, t2));
+   transfer(b, a);
+   err |= check("later write wins", (*get(a, 0))->data->i.value == 2);
+   /* Physical time going backwards does not make the clock go backwards */
+   a->vstigtime = 10;
+   uint64_t t4 = put(a, 2, 1, 0);
+   err |= check("clock is monotonic", buzzvstig_ts_newer(t4, t3));
+   buzzvm_destroy(&a);
+   buzzvm_destroy(&b);
+   /*
+    * Conflict managers see the whole hybrid logical clock timestamp
+    */
+   a = vstig_robot(1, ID);
+   b = vstig_robot(2, ID);
+   buzzvm_pushcc(b, buzzvm_function_register(b, onconflict));
+   vstig(b, ID)->onconflict = buzzheap_clone(b, buzzvm_stack_at(b, 1));
+   buzzvm_pop(b);
+   uint64_t wide = (1700000000000ull << 16) | 5;
+   put(a, 0, 1, wide);
+   put(b, 0, 2, wide);
+   transfer(a, b);
+   err |= check("conflict timestamp exact",
+                ((uint64_t)seen_hi[0] << 31 | seen_lo[0]) == wide &&
+                ((uint64_t)seen_hi[1] << 31 | seen_lo[1]) == wide &&
+                seen_hi[0] > 0 && seen_lo[0] >= 0);
+   err |= check("conflict timestamp approximate",
+                seen_ts[0] == (float)wide && seen_ts[1] == (float)wide);
+   buzzvm_destroy(&a);
+   buzzvm_destroy(&b);
+   return err;
+}
@@ -0,0 +1,135 @@
+#include "testbuzzutil.h"
+#include <stdio.h>
+#include <inttypes.h>
+
+static const uint16_t ID = 1;
+
+/* Writes an entry the way vs.put(key, value) does */
+void put(buzzvm_t vm, int32_t key, int32_t value) {
+   buzzvm_pushi(vm, key);
+   buzzobj_t k = buzzvm_stack_at(vm, 1);
+   buzzvm_pushi(vm, value);
+   buzzobj_t v = buzzvm_stack_at(vm, 1);
+   const buzzvstig_elem_t* x = buzzvstig_fetch(vstig(vm, ID), &k);
+   buzzvstig_elem_t e = buzzvstig_elem_new(v, x ? (*x)->timestamp + 1 : 1, vm->robot);
+   buzzvstig_store(vstig(vm, ID), &k, &e);
+   buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, ID, k, e);
+   buzzvm_pop(vm);
+   buzzvm_pop(vm);
+}
+
+/* Returns the entry for a key and marks it as used, or NULL if not found */
+const buzzvstig_elem_t* get(buzzvm_t vm, int32_t key) {
+   buzzvm_pushi(vm, key);
+   buzzobj_t k = buzzvm_stack_at(vm, 1);
+   const buzzvstig_elem_t* x = buzzvstig_fetch(vstig(vm, ID), &k);
+   if(x) (*x)->used = vstig(vm, ID)->step;
+   buzzvm_pop(vm);
+   return x;
+}
+
+/* Queues a QUERY for an entry, the way vs.get(key) does on a robot that has it */
+void query(buzzvm_t vm, int32_t key) {
+   buzzvm_pushi(vm, key);
+   buzzobj_t k = buzzvm_stack_at(vm, 1);
+   const buzzvstig_elem_t* x = buzzvstig_fetch(vstig(vm, ID), &k);
+   buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_QUERY, ID, k, *x);
+   buzzvm_pop(vm);
+}
+
+int main() {
+   int err = 0;
+   int i;
+   /*
+    * Time to live
+    */
+   buzzvm_t a = vstig_robot(1, ID);
+   buzzvm_t b = vstig_robot(2, ID);
+   vstig(a, ID)->ttl = 5;
+   put(a, 0, 10);
+   put(a, 1, 11);
+   for(i = 0; i < 3; ++i) drop(a);
+   put(a, 1, 12);
+   drop(a);
+   err |= check("entry alive before the ttl", get(a, 0) != NULL);
+   drop(a);
+   err |= check("entry removed after the ttl", get(a, 0) == NULL);
+   err |= check("updated entry alive", get(a, 1) != NULL);
+   /* A neighbor with the old entry must not bring it back */
+   put(b, 0, 10);
+   drop(b);
+   query(b, 0);
+   deliver(b, a);
+   err |= check("expired entry not stored again", get(a, 0) == NULL);
+   err |= check("expired entry not flooded again", buzzoutmsg_queue_isempty(a));
+   /* A newer write is accepted */
+   put(b, 0, 20);
+   deliver(b, a);
+   err |= check("newer entry accepted", get(a, 0) && (*get(a, 0))->data->i.value == 20);
+   buzzvm_destroy(&a);
+   buzzvm_destroy(&b);
+   /*
+    * Capacity with LRU eviction
+    */
+   a = vstig_robot(1, ID);
+   for(i = 0; i < 5; ++i) {
+      put(a, i, i);
+      drop(a);
+   }
+   /* Entries 0, 1 and 2 are the oldest, but 0 was used recently */
+   get(a, 0);
+   drop(a);
+   vstig(a, ID)->capacity = 3;
+   drop(a);
+   err |= check("lru: capacity respected", buzzdict_size(vstig(a, ID)->data) == 3);
+   err |= check("lru: recently used entry kept", get(a, 0) != NULL);
+   err |= check("lru: least recently used entries evicted", get(a, 1) == NULL && get(a, 2) == NULL);
+   buzzvm_destroy(&a);
+   /*
+    * Capacity with eviction of the oldest updates
+    */
+   a = vstig_robot(1, ID);
+   vstig(a, ID)->capacity = 3;
+   vstig(a, ID)->evict = BUZZVSTIG_EVICT_OLDEST;
+   for(i = 0; i < 5; ++i) {
+      put(a, i, i);
+      get(a, 0);
+      drop(a);
+   }
+   err |= check("oldest: capacity respected", buzzdict_size(vstig(a, ID)->data) == 3);
+   err |= check("oldest: oldest entries evicted", get(a, 0) == NULL && get(a, 1) == NULL);
+   buzzvm_destroy(&a);
+   /*
+    * Tombstones
+    */
+   a = vstig_robot(1, ID);
+   b = vstig_robot(2, ID);
+   vstig(a, ID)->ttl = 2;
+   vstig(a, ID)->tombstones = 1;
+   put(a, 0, 10);
+   deliver(a, b);
+   buzzvm_process_outmsgs(a);
+   buzzvm_process_outmsgs(a);
+   deliver(a, b);
+   err |= check("tombstone: entry removed", get(a, 0) == NULL);
+   err |= check("tombstone: entry deleted on the neighbor",
+                get(b, 0) && (*get(b, 0))->data->o.type == BUZZTYPE_NIL);
+   buzzvm_destroy(&a);
+   buzzvm_destroy(&b);
+   /*
+    * The int 3 and the float 3.5 have the same hash: only the expired one
+    * is rejected, and the record survives the garbage collector
+    */
+   a = vstig_robot(1, ID);
+   vstig(a, ID)->ttl = 1;
+   put(a, 3, 10);
+   drop(a);
+   drop(a);
+   buzzheap_gc(a);
+   buzzobj_t k3 = integer(a, 3);
+   buzzobj_t k35 = number(a, 3.5);
+   err |= check("same hash: expired key rejected", buzzvstig_isexpired(vstig(a, ID), k3, 1));
+   err |= check("same hash: other key accepted", !buzzvstig_isexpired(vstig(a, ID), k35, 1));
+   buzzvm_destroy(&a);
+   return err;
+}
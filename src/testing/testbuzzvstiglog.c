@@ -0,0 +1,137 @@
+#include "testbuzzutil.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* Creates a virtual stigmergy the way stigmergy.create(id) does */
+buzzobj_t create(buzzvm_t vm, int32_t id) {
+   return calli(vm, global(vm, "stigmergy"), "create", 1, id);
+}
+
+/* Writes an entry */
+void put(buzzvm_t vm, buzzobj_t s, int32_t k, int32_t v) {
+   calli(vm, s, "put", 2, k, v);
+}
+
+/* Deletes an entry */
+void del(buzzvm_t vm, buzzobj_t s, int32_t k) {
+   call(vm, s, "put", 2, integer(vm, k), buzzheap_newobj(vm, BUZZTYPE_NIL));
+}
+
+/* Reads an entry, or -1 if not found */
+int32_t get(buzzvm_t vm, buzzobj_t s, int32_t k) {
+   return intof(calli(vm, s, "get", 1, k));
+}
+
+/* Returns the number of entries */
+int32_t size(buzzvm_t vm, buzzobj_t s) {
+   return call(vm, s, "size", 0)->i.value;
+}
+
+/* Returns the size of a file */
+long fsize(const char* path) {
+   struct stat st;
+   return stat(path, &st) < 0 ? -1 : st.st_size;
+}
+
+int main() {
+   int err = 0;
+   int i;
+   char path[64];
+   snprintf(path, sizeof(path), "/tmp/testbuzzvstiglog-%d.log", getpid());
+   unlink(path);
+   /*
+    * Without a log, nothing is written
+    */
+   buzzvm_t vm = robot(1);
+   buzzobj_t s = create(vm, 1);
+   put(vm, s, 1, 10);
+   err |= check("in memory by default", vstig(vm, 1)->log == NULL && fsize(path) < 0);
+   buzzvm_destroy(&vm);
+   /*
+    * The entries survive a reboot
+    */
+   vm = robot(1);
+   err |= check("attach", buzzvstiglog_attach(vm, 1, path) == 0);
+   s = create(vm, 1);
+   put(vm, s, 1, 10);
+   put(vm, s, 2, 20);
+   put(vm, s, 3, 30);
+   put(vm, s, 2, 21);
+   del(vm, s, 3);
+   buzzobj_t k = buzzheap_newobj(vm, BUZZTYPE_INT);
+   k->i.value = 2;
+   uint64_t ts = (*buzzvstig_fetch(vstig(vm, 1), &k))->timestamp;
+   buzzvm_process_outmsgs(vm);
+   buzzvm_destroy(&vm);
+   vm = robot(1);
+   buzzvstiglog_attach(vm, 1, path);
+   s = create(vm, 1);
+   err |= check("entries restored", size(vm, s) == 2 && get(vm, s, 1) == 10 && get(vm, s, 2) == 21);
+   err |= check("deleted entry stays deleted", get(vm, s, 3) == -1);
+   put(vm, s, 2, 22);
+   k = buzzheap_newobj(vm, BUZZTYPE_INT);
+   k->i.value = 2;
+   err |= check("timestamps restored", (*buzzvstig_fetch(vstig(vm, 1), &k))->timestamp == ts + 1);
+   /*
+    * Rewriting the same entry triggers the compaction
+    */
+   for(i = 0; i < 3 * BUZZVSTIGLOG_COMPACT_MIN; ++i) put(vm, s, 4, i);
+   long before = fsize(path);
+   buzzvm_process_outmsgs(vm);
+   err |= check("log compacted", vstig(vm, 1)->log->records == 3);
+   buzzvm_destroy(&vm);
+   err |= check("log file shrunk", fsize(path) < before && fsize(path) < 1024);
+   vm = robot(1);
+   buzzvstiglog_attach(vm, 1, path);
+   s = create(vm, 1);
+   err |= check("compacted log restored", size(vm, s) == 3 && get(vm, s, 2) == 22 &&
+                get(vm, s, 4) == 3 * BUZZVSTIGLOG_COMPACT_MIN - 1);
+   buzzvm_destroy(&vm);
+   /*
+    * A corrupted record and the ones after it are discarded
+    */
+   vm = robot(1);
+   buzzvstiglog_attach(vm, 1, path);
+   s = create(vm, 1);
+   put(vm, s, 5, 50);
+   buzzvstiglog_t log = vstig(vm, 1)->log;
+   uint64_t last = log->tail;
+   put(vm, s, 6, 60);
+   /* Replace the operation of the last record */
+   log->map[last + sizeof(uint32_t)] = 0xff;
+   buzzvm_destroy(&vm);
+   vm = robot(1);
+   buzzvstiglog_attach(vm, 1, path);
+   s = create(vm, 1);
+   err |= check("corrupted record discarded", get(vm, s, 5) == 50 && get(vm, s, 6) == -1);
+   buzzvm_destroy(&vm);
+   unlink(path);
+   /*
+    * Attaching a log to an existing virtual stigmergy saves its entries
+    */
+   vm = robot(1);
+   s = create(vm, 1);
+   put(vm, s, 7, 70);
+   err |= check("attach to an existing stigmergy", buzzvstiglog_attach(vm, 1, path) == 0);
+   buzzvm_destroy(&vm);
+   vm = robot(1);
+   buzzvstiglog_attach(vm, 1, path);
+   s = create(vm, 1);
+   err |= check("existing entries saved", get(vm, s, 7) == 70);
+   buzzvm_destroy(&vm);
+   /*
+    * A file that is not a log is left alone
+    */
+   FILE* f = fopen(path, "w");
+   fputs("not a log, but long enough", f);
+   fclose(f);
+   vm = robot(1);
+   err |= check("reject a file that is not a log", buzzvstiglog_attach(vm, 1, path) == 0);
+   s = create(vm, 1);
+   err |= check("fall back to memory", vstig(vm, 1)->log == NULL && fsize(path) == 26);
+   buzzvm_destroy(&vm);
+   unlink(path);
+   return err;
+}
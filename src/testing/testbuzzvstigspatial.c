@@ -0,0 +1,83 @@
+#include "testbuzzutil.h"
+#include <stdio.h>
+
+/* Creates a spatial stigmergy the way stigmergy.spatial(id, cell) does */
+buzzobj_t spatial(buzzvm_t vm, uint16_t id, float cell) {
+   return call(vm, global(vm, "stigmergy"), "spatial", 2, integer(vm, id), number(vm, cell));
+}
+
+/* Writes a value at a 2D position */
+void putat(buzzvm_t vm, buzzobj_t s, float x, float y, float v) {
+   callf(vm, s, "putat", 3, x, y, v);
+}
+
+/* Reads the value at a 2D position, or -1 if not found */
+float getat(buzzvm_t vm, buzzobj_t s, float x, float y) {
+   return floatof(callf(vm, s, "getat", 2, x, y));
+}
+
+/* Returns the number of cells within a radius */
+int64_t near(buzzvm_t vm, buzzobj_t s, float x, float y, float r) {
+   buzzobj_t t = callf(vm, s, "near", 3, x, y, r);
+   return t->o.type == BUZZTYPE_TABLE ? buzzdict_size(t->t.value) : -1;
+}
+
+int main() {
+   int err = 0;
+   int x, y;
+   /*
+    * Cell keys
+    */
+   buzzvstig_t vs = buzzvstig_spatial_new(0.5f);
+   int32_t k;
+   float c[3];
+   int ok = buzzvstig_cell_key(vs, -3.1f, 7.2f, -0.6f, &k);
+   buzzvstig_cell_center(vs, k, c);
+   err |= check("cell center", ok && c[0] == -3.0f && c[1] == 7.0f && c[2] == -0.5f);
+   err |= check("cell bounds", !buzzvstig_cell_key(vs, 1e6f, 0.0f, 0.0f, &k));
+   buzzvstig_destroy(&vs);
+   /*
+    * Writes and queries
+    */
+   buzzvm_t a = robot(1);
+   buzzobj_t sa = spatial(a, 1, 1.0f);
+   /* A 50x50 map centered on the origin */
+   for(y = -25; y < 25; ++y)
+      for(x = -25; x < 25; ++x)
+         putat(a, sa, x, y, x * 100 + y);
+   drop(a);
+   err |= check("read a cell", getat(a, sa, 3.2f, -4.4f) == 296.0f);
+   err |= check("read an empty cell", getat(a, sa, 40.0f, 0.0f) == -1.0f);
+   /* Brute-force count of the cells within radius 3 of (10,10) */
+   int64_t n = 0;
+   for(y = -25; y < 25; ++y)
+      for(x = -25; x < 25; ++x)
+         if((x - 10) * (x - 10) + (y - 10) * (y - 10) <= 9) ++n;
+   err |= check("radius query", near(a, sa, 10.0f, 10.0f, 3.0f) == n);
+   err |= check("radius query over the whole map", near(a, sa, 0.0f, 0.0f, 1000.0f) == 2500);
+   err |= check("radius query outside the map", near(a, sa, 100.0f, 100.0f, 5.0f) == 0);
+   buzzobj_t t = callf(a, sa, "box", 4, -2.0f, -1.0f, 2.0f, 1.0f);
+   err |= check("box query", t->o.type == BUZZTYPE_TABLE && buzzdict_size(t->t.value) == 15);
+   buzzvm_destroy(&a);
+   /*
+    * Propagation range: b is at (0,0) and relays only the cells within 5
+    */
+   a = robot(1);
+   buzzvm_t r = robot(2);
+   buzzvm_t d = robot(3);
+   sa = spatial(a, 1, 1.0f);
+   buzzobj_t sr = spatial(r, 1, 1.0f);
+   spatial(d, 1, 1.0f);
+   callf(r, sr, "setposition", 2, 0.0f, 0.0f);
+   callf(r, sr, "setrange", 1, 5.0f);
+   putat(a, sa, 1.0f, 2.0f, 1.0f);
+   putat(a, sa, 20.0f, 0.0f, 2.0f);
+   deliver(a, r);
+   deliver(r, d);
+   err |= check("relay stores all the cells", getat(r, sr, 1.0f, 2.0f) == 1.0f && getat(r, sr, 20.0f, 0.0f) == 2.0f);
+   err |= check("only the cells in range are relayed", buzzdict_size(vstig(d, 1)->data) == 1);
+   buzzvm_destroy(&a);
+   buzzvm_destroy(&r);
+   buzzvm_destroy(&d);
+   return err;
+}
@@ -0,0 +1,180 @@
+#include "testbuzzutil.h"
+#include <buzz/buzzbus.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#define ROBOTS 5
+#define ENTRIES 100
+
+static const uint16_t ID = 1;
+
+/* Writes an entry the way vs.put(key, value) does */
+void put(buzzvm_t vm, int32_t key, int32_t value) {
+   buzzvm_pushi(vm, key);
+   buzzobj_t k = buzzvm_stack_at(vm, 1);
+   buzzvm_pushi(vm, value);
+   buzzobj_t v = buzzvm_stack_at(vm, 1);
+   const buzzvstig_elem_t* x = buzzvstig_fetch(vstig(vm, ID), &k);
+   buzzvstig_elem_t e = buzzvstig_elem_new(v, x ? (*x)->timestamp + 1 : 1, vm->robot);
+   buzzvstig_store(vstig(vm, ID), &k, &e);
+   buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, ID, k, e);
+   buzzvm_pop(vm);
+   buzzvm_pop(vm);
+}
+
+/* Returns the value of an entry, or -1 if not found */
+int32_t get(buzzvm_t vm, int32_t key) {
+   buzzvm_pushi(vm, key);
+   buzzobj_t k = buzzvm_stack_at(vm, 1);
+   const buzzvstig_elem_t* x = buzzvstig_fetch(vstig(vm, ID), &k);
+   buzzvm_pop(vm);
+   if(!x || (*x)->data->o.type != BUZZTYPE_INT) return -1;
+   return (*x)->data->i.value;
+}
+
+/* Runs the swarm and returns the number of messages sent */
+uint64_t run(buzzbus_t bus, buzzvm_t* vm, buzztransport_t* t, int steps) {
+   uint64_t sent = 0;
+   int i, s;
+   for(i = 0; i < ROBOTS; ++i) sent -= t[i]->msgsent;
+   for(s = 0; s < steps; ++s) {
+      for(i = 0; i < ROBOTS; ++i) buzztransport_process_inmsgs(t[i], vm[i]);
+      for(i = 0; i < ROBOTS; ++i) buzztransport_process_outmsgs(t[i], vm[i]);
+      buzzbus_tick(bus);
+   }
+   for(i = 0; i < ROBOTS; ++i) sent += t[i]->msgsent;
+   return sent;
+}
+
+/* Checks that every robot has the given value for every key */
+int agree(buzzvm_t* vm, int32_t base) {
+   int i, k;
+   for(i = 0; i < ROBOTS; ++i)
+      for(k = 0; k < ENTRIES; ++k)
+         if(get(vm[i], k) != base + k) return 0;
+   return 1;
+}
+
+int test(uint8_t mode, const char* name) {
+   int err = 0;
+   int i, k;
+   /* A line of robots, where each robot can talk only to the closest ones */
+   buzzbus_t bus = buzzbus_new(1.5f);
+   buzzvm_t vm[ROBOTS];
+   buzztransport_t t[ROBOTS];
+   for(i = 0; i < ROBOTS; ++i) {
+      vm[i] = vstig_robot(i + 1, ID);
+      vstig(vm[i], ID)->mode = mode;
+      t[i] = buzzbus_transport_new(bus, i + 1, 100);
+      buzzbus_set_position(t[i], i, 0, 0, 0);
+   }
+   /* The first robot fills the virtual stigmergy */
+   for(k = 0; k < ENTRIES; ++k) put(vm[0], k, k);
+   uint64_t n = run(bus, vm, t, 100);
+   int ok = agree(vm, 0);
+   fprintf(stdout, "%s: initial fill: %s, %" PRIu64 " messages\n", name, ok ? "OK" : "FAILED", n);
+   err |= !ok;
+   /* The last robot updates every entry */
+   for(k = 0; k < ENTRIES; ++k) put(vm[ROBOTS-1], k, 1000 + k);
+   n = run(bus, vm, t, 100);
+   ok = agree(vm, 1000);
+   fprintf(stdout, "%s: update: %s, %" PRIu64 " messages\n", name, ok ? "OK" : "FAILED", n);
+   err |= !ok;
+   /* Nothing changes */
+   n = run(bus, vm, t, 100);
+   fprintf(stdout, "%s: idle: %" PRIu64 " messages\n", name, n);
+   /* The middle robot updates every entry over a lossy channel */
+   bus->loss = 0.2f;
+   for(k = 0; k < ENTRIES; ++k) put(vm[ROBOTS/2], k, 2000 + k);
+   n = run(bus, vm, t, 200);
+   bus->loss = 0.0f;
+   ok = agree(vm, 2000);
+   fprintf(stdout, "%s: lossy update: %s, %" PRIu64 " messages\n", name, ok ? "OK" : "MISSING DATA", n);
+   /* A robot joins late and catches up */
+   buzzvm_t late = vstig_robot(ROBOTS + 1, ID);
+   vstig(late, ID)->mode = mode;
+   buzztransport_t tl = buzzbus_transport_new(bus, ROBOTS + 1, 100);
+   buzzbus_set_position(tl, 2, 1, 0, 0);
+   for(i = 0; i < 100; ++i) {
+      buzztransport_process_inmsgs(tl, late);
+      buzztransport_process_outmsgs(tl, late);
+      run(bus, vm, t, 1);
+   }
+   ok = buzzdict_size(vstig(late, ID)->data) == ENTRIES;
+   for(k = 0; ok && k < ENTRIES; ++k) ok = get(late, k) == 2000 + k;
+   fprintf(stdout, "%s: late robot: %s\n", name, ok ? "OK" : "MISSING DATA");
+   /* Only the anti-entropy mode repairs lost updates and late robots */
+   if(mode == BUZZVSTIG_MODE_ANTIENTROPY) err |= !ok || !agree(vm, 2000);
+   /* Cleanup */
+   buzztransport_destroy(&tl);
+   buzzvm_destroy(&late);
+   for(i = 0; i < ROBOTS; ++i) {
+      buzztransport_destroy(&t[i]);
+      buzzvm_destroy(&vm[i]);
+   }
+   buzzbus_destroy(&bus);
+   return err;
+}
+
+/* Stores an entry without telling the neighbors */
+void store(buzzvm_t vm, buzzobj_t k, int32_t value, uint64_t ts, uint16_t robot) {
+   buzzvm_pushi(vm, value);
+   buzzvstig_elem_t e = buzzvstig_elem_new(buzzvm_stack_at(vm, 1), ts, robot);
+   buzzvstig_store(vstig(vm, ID), &k, &e);
+   buzzvm_pop(vm);
+}
+
+/*
+ * The int 3 and the float 3.5 are different keys with the same
+ * fingerprint. The first robot has an old 3 and the only 3.5; the
+ * second has a newer 3. Matching the entries by fingerprint alone, the
+ * first robot would take the 3 of its neighbor for its 3.5 and never
+ * send it.
+ */
+int test_collision() {
+   int i;
+   buzzbus_t bus = buzzbus_new(1.5f);
+   buzzvm_t vm[2];
+   buzztransport_t t[2];
+   buzzobj_t k3[2], k35[2];
+   for(i = 0; i < 2; ++i) {
+      vm[i] = vstig_robot(i + 1, ID);
+      vstig(vm[i], ID)->mode = BUZZVSTIG_MODE_ANTIENTROPY;
+      t[i] = buzzbus_transport_new(bus, i + 1, 100);
+      buzzbus_set_position(t[i], i, 0, 0, 0);
+      k3[i] = integer(vm[i], 3);
+      k35[i] = number(vm[i], 3.5);
+      buzzvm_push(vm[i], k3[i]);
+      buzzvm_push(vm[i], k35[i]);
+   }
+   store(vm[0], k3[0], 1, 1, 1);
+   store(vm[0], k35[0], 2, 5, 1);
+   store(vm[1], k3[1], 7, 9, 2);
+   int s;
+   for(s = 0; s < 100; ++s) {
+      for(i = 0; i < 2; ++i) buzztransport_process_inmsgs(t[i], vm[i]);
+      for(i = 0; i < 2; ++i) buzztransport_process_outmsgs(t[i], vm[i]);
+      buzzbus_tick(bus);
+   }
+   int ok = 1;
+   for(i = 0; i < 2; ++i) {
+      const buzzvstig_elem_t* e3 = buzzvstig_fetch(vstig(vm[i], ID), &k3[i]);
+      const buzzvstig_elem_t* e35 = buzzvstig_fetch(vstig(vm[i], ID), &k35[i]);
+      ok &= e3 && (*e3)->data->i.value == 7 && e35 && (*e35)->data->i.value == 2;
+   }
+   fprintf(stdout, "anti-entropy: fingerprint collision: %s\n", ok ? "OK" : "MISSING DATA");
+   for(i = 0; i < 2; ++i) {
+      buzztransport_destroy(&t[i]);
+      buzzvm_destroy(&vm[i]);
+   }
+   buzzbus_destroy(&bus);
+   return !ok;
+}
+
+int main() {
+   int err = 0;
+   err |= test(BUZZVSTIG_MODE_FLOOD, "flood");
+   err |= test(BUZZVSTIG_MODE_ANTIENTROPY, "anti-entropy");
+   err |= test_collision();
+   return err;
+}